@@ -4,56 +4,31 @@
 #include <GLFW/glfw3.h>
 
 #include <common/shader.hpp>
+#include <common/window.hpp>
 
 // Function prototypes
 void keyboardInput(GLFWwindow *window);
 
-int main( void )
+int main(int argc, char *argv[])
 {
     // =========================================================================
     // Window creation - you shouldn't need to change this code
     // -------------------------------------------------------------------------
-    // Initialise GLFW
-    if( !glfwInit() )
+    // Open a window and create its OpenGL context (run with --headless to
+    // render offscreen instead)
+    Window window(argc, argv, "Lab02 Basic Shapes");
+    if (!window.isOpen())
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
         getchar();
         return -1;
     }
-
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_RESIZABLE,GL_FALSE);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    // Open a window and create its OpenGL context
-    GLFWwindow* window;
-    window = glfwCreateWindow(1024, 768, "Lab02 Basic Shapes", NULL, NULL);
-    
-    if( window == NULL ){
-        fprintf(stderr, "Failed to open GLFW window.\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
-    glfwMakeContextCurrent(window);
-
-    // Initialize GLEW
-    glewExperimental = true; // Needed for core profile
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
     // -------------------------------------------------------------------------
     // End of window creation
     // =========================================================================
     
-	// Ensure we can capture keyboard inputs
-	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+    // Ensure we can capture keyboard inputs (there are none when headless)
+    if (!window.headless)
+        glfwSetInputMode(window.window, GLFW_STICKY_KEYS, GL_TRUE);
     
     // Define vertices
     static const float vertices[] = {
@@ -191,10 +166,11 @@ int main( void )
     glUseProgram(shaderID);
     
     // Render loop
-	while (!glfwWindowShouldClose(window))
+	while (!window.shouldClose())
     {
         // Get inputs
-        keyboardInput(window);
+        if (!window.headless)
+            keyboardInput(window.window);
         
         // Clear the window
         glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
@@ -221,8 +197,7 @@ int main( void )
         glDisableVertexAttribArray(0);
         
 		// Swap buffers
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		window.swapBuffers();
 	}
     
     // Cleanup
@@ -231,7 +206,7 @@ int main( void )
     glDeleteProgram(shaderID);
     
 	// Close OpenGL window and terminate GLFW
-	glfwTerminate();
+	window.close();
 	return 0;
 }
 
@@ -4,57 +4,32 @@
 #include <GLFW/glfw3.h>
 
 #include <common/shader.hpp>
+#include <common/window.hpp>
 #include <common/texture.hpp>
 
 // Function prototypes
 void keyboardInput(GLFWwindow *window);
 
-int main( void )
+int main(int argc, char *argv[])
 {
     // =========================================================================
     // Window creation - you shouldn't need to change this code
     // -------------------------------------------------------------------------
-	// Initialise GLFW
-	if( !glfwInit() )
-	{
-		fprintf( stderr, "Failed to initialize GLFW\n" );
-		getchar();
-		return -1;
-	}
-
-	glfwWindowHint(GLFW_SAMPLES, 4);
-	glfwWindowHint(GLFW_RESIZABLE,GL_FALSE);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-	// Open a window and create its OpenGL context
-    GLFWwindow* window;
-    window = glfwCreateWindow(1024, 768, "Lab03 Textures", NULL, NULL);
-    
-	if( window == NULL ){
-		fprintf(stderr, "Failed to open GLFW window.\n");
-		getchar();
-		glfwTerminate();
-		return -1;
-	}
-	glfwMakeContextCurrent(window);
-
-	// Initialize GLEW
-    glewExperimental = true; // Needed for core profile
-	if (glewInit() != GLEW_OK) {
-		fprintf(stderr, "Failed to initialize GLEW\n");
-		getchar();
-		glfwTerminate();
-		return -1;
-	}    
+    // Open a window and create its OpenGL context (run with --headless to
+    // render offscreen instead)
+    Window window(argc, argv, "Lab03 Textures");
+    if (!window.isOpen())
+    {
+        getchar();
+        return -1;
+    }
     // -------------------------------------------------------------------------
     // End of window creation
     // =========================================================================
     
-	// Ensure we can capture keyboard inputs
-	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+    // Ensure we can capture keyboard inputs (there are none when headless)
+    if (!window.headless)
+        glfwSetInputMode(window.window, GLFW_STICKY_KEYS, GL_TRUE);
     
 //    // Define vertex positions
 //    static const float vertices[] = {
@@ -191,10 +166,11 @@ int main( void )
     glBindTexture(GL_TEXTURE_2D, texture3);
     
     // Render loop
-	while (!glfwWindowShouldClose(window))
+	while (!window.shouldClose())
     {
         // Get inputs
-        keyboardInput(window);
+        if (!window.headless)
+            keyboardInput(window.window);
         
         // Clear the window
         glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
@@ -218,8 +194,7 @@ int main( void )
         glDisableVertexAttribArray(1);
         
 		// Swap buffers
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		window.swapBuffers();
 	}
     
     // Cleanup
@@ -230,7 +205,7 @@ int main( void )
     glDeleteProgram(shaderID);
     
 	// Close OpenGL window and terminate GLFW
-	glfwTerminate();
+	window.close();
 	return 0;
 }
 
@@ -4,6 +4,7 @@
 #include <GLFW/glfw3.h>
 
 #include <common/shader.hpp>
+#include <common/window.hpp>
 #include <common/texture.hpp>
 #include <common/maths.hpp>
 
@@ -14,52 +15,26 @@ void keyboardInput(GLFWwindow *window);
 glm::vec3 pos = glm::vec3(0.0f, 0.0f, 0.0f);
 glm::vec3 vel = glm::vec3(0.01f, 0.005f, 0.0f);
 
-int main( void )
+int main(int argc, char *argv[])
 {
     // =========================================================================
     // Window creation - you shouldn't need to change this code
     // -------------------------------------------------------------------------
-    // Initialise GLFW
-    if( !glfwInit() )
+    // Open a window and create its OpenGL context (run with --headless to
+    // render offscreen instead)
+    Window window(argc, argv, "Lab05 Transformations");
+    if (!window.isOpen())
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
         getchar();
         return -1;
     }
-
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_RESIZABLE,GL_FALSE);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    // Open a window and create its OpenGL context
-    GLFWwindow* window;
-    window = glfwCreateWindow(1024, 768, "Lab05 Transformations", NULL, NULL);
-    
-    if( window == NULL ){
-        fprintf(stderr, "Failed to open GLFW window.\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
-    glfwMakeContextCurrent(window);
-
-    // Initialize GLEW
-    glewExperimental = true; // Needed for core profile
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
     // -------------------------------------------------------------------------
     // End of window creation
     // =========================================================================
     
-    // Ensure we can capture keyboard inputs
-    glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+    // Ensure we can capture keyboard inputs (there are none when headless)
+    if (!window.headless)
+        glfwSetInputMode(window.window, GLFW_STICKY_KEYS, GL_TRUE);
     
     // Define vertex positions
     static const float vertices[] = {
@@ -124,10 +99,11 @@ int main( void )
     glUniform1i(textureID, 0);
     
     // Render loop
-    while (!glfwWindowShouldClose(window))
+    while (!window.shouldClose())
     {
         // Get inputs
-        keyboardInput(window);
+        if (!window.headless)
+            keyboardInput(window.window);
         
         // Clear the window
         glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
@@ -161,13 +137,13 @@ int main( void )
 //        glm::mat4 rotate = Maths::rotate(angle, glm::vec3(0.0f, 0.0f, 1.0f));
         
         // Animate rectangle
-        float angle = Maths::radians(glfwGetTime() * 360.0f / 3.0f);
+        float angle = Maths::radians(window.getTime() * 360.0f / 3.0f);
         glm::mat4 translate = Maths::translate(glm::vec3(0.4f, 0.3f, 0.0f));
         glm::mat4 scale     = Maths::scale(glm::vec3(0.4f, 0.3f, 0.0f));
         glm::mat4 rotate    = Maths::rotate(angle, glm::vec3(0.0f, 0.0f, 1.0f));
         
 //        // Exercise 1
-//        float angle = 2.0f * 3.1416f * glfwGetTime() / 5.0f;
+//        float angle = 2.0f * 3.1416f * window.getTime() / 5.0f;
 //        float x = 0.5f * cos(angle);
 //        float y = 0.5f * sin(angle);
 //        glm::mat4 translate = Maths::translate(glm::vec3(x, y, 0.0f));
@@ -175,11 +151,11 @@ int main( void )
 //        glm::mat4 rotate;
 //        
 //        // Exercise 2
-//        angle = -2.0f * 3.1416f * glfwGetTime() / 2.5f;
+//        angle = -2.0f * 3.1416f * window.getTime() / 2.5f;
 //        rotate = Maths::rotate(angle, glm::vec3(0.0f, 0.0f, 1.0f));
 //
 //        // Exercise 3
-//        angle   = 2.0f * 3.1416f * glfwGetTime() / 2.0f;
+//        angle   = 2.0f * 3.1416f * window.getTime() / 2.0f;
 //        float s = 0.5f + 0.25 * sin(angle);
 //        scale   = Maths::scale(glm::vec3(s, s, s));
         
@@ -208,8 +184,7 @@ int main( void )
         glDisableVertexAttribArray(1);
         
         // Swap buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        window.swapBuffers();
     }
     
     // Cleanup
@@ -220,7 +195,7 @@ int main( void )
     glDeleteProgram(shaderID);
     
     // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    window.close();
     return 0;
 }
 
@@ -4,6 +4,7 @@
 #include <GLFW/glfw3.h>
 
 #include <common/shader.hpp>
+#include <common/window.hpp>
 #include <common/texture.hpp>
 #include <common/maths.hpp>
 #include <common/camera.hpp>
@@ -15,46 +16,19 @@ void keyboardInput(GLFWwindow *window);
 //Camera camera(glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(0.0f, 0.0f, -2.0f));
 Camera camera(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.0f, 0.0f));
 
-int main( void )
+int main(int argc, char *argv[])
 {
     // =========================================================================
     // Window creation - you shouldn't need to change this code
     // -------------------------------------------------------------------------
-    // Initialise GLFW
-    if( !glfwInit() )
+    // Open a window and create its OpenGL context (run with --headless to
+    // render offscreen instead)
+    Window window(argc, argv, "Lab06 3D Worlds");
+    if (!window.isOpen())
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
         getchar();
         return -1;
     }
-
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_RESIZABLE,GL_FALSE);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    // Open a window and create its OpenGL context
-    GLFWwindow* window;
-    window = glfwCreateWindow(1024, 768, "Lab06 3D Worlds", NULL, NULL);
-    
-    if( window == NULL ){
-        fprintf(stderr, "Failed to open GLFW window.\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
-    glfwMakeContextCurrent(window);
-
-    // Initialize GLEW
-    glewExperimental = true; // Needed for core profile
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
     // -------------------------------------------------------------------------
     // End of window creation
     // =========================================================================
@@ -62,8 +36,9 @@ int main( void )
     // Enable depth test
     glEnable(GL_DEPTH_TEST);
     
-    // Ensure we can capture keyboard inputs
-    glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+    // Ensure we can capture keyboard inputs (there are none when headless)
+    if (!window.headless)
+        glfwSetInputMode(window.window, GLFW_STICKY_KEYS, GL_TRUE);
     
     // Define cube object
     // Define vertices
@@ -226,10 +201,11 @@ int main( void )
         cubeAngles[i] = Maths::radians(20.0f * i);
     
     // Render loop
-    while (!glfwWindowShouldClose(window))
+    while (!window.shouldClose())
     {
         // Get inputs
-        keyboardInput(window);
+        if (!window.headless)
+            keyboardInput(window.window);
         
         // Clear the window
         glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
@@ -246,7 +222,7 @@ int main( void )
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
         
         // Calculate the model matrix
-        float angle         = Maths::radians(glfwGetTime() * 360.0f / 3.0f);
+        float angle         = Maths::radians(window.getTime() * 360.0f / 3.0f);
         glm::mat4 translate = Maths::translate(glm::vec3(0.0f, 0.0f, -2.0f));
         glm::mat4 scale     = Maths::scale(glm::vec3(0.5f, 0.5f, 0.5f));
         glm::mat4 rotate    = Maths::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f));
@@ -311,7 +287,7 @@ int main( void )
         
         
 //        // Exercise 1 - orbit the camera
-//        float angle = Maths::radians(glfwGetTime() * 360.0f / 5.0f);
+//        float angle = Maths::radians(window.getTime() * 360.0f / 5.0f);
 //        camera.eye = glm::vec3(10 * cos(angle), 0.0f, 10 * sin(angle));
 //        camera.target = cubePositions[0];
 //        camera.calculateMatrices();
@@ -328,7 +304,7 @@ int main( void )
 //            // Exericse 2
 //            if (i % 2 == 1)
 //            {
-//                float angle = Maths::radians(glfwGetTime() * 360.0f / 2.0f);
+//                float angle = Maths::radians(window.getTime() * 360.0f / 2.0f);
 //                rotate = Maths::rotate(angle, glm::vec3(1.0f, 1.0f, 1.0f));
 //            }
             
@@ -351,8 +327,7 @@ int main( void )
         glDisableVertexAttribArray(1);
 
         // Swap buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        window.swapBuffers();
     }
     
     // Cleanup
@@ -363,7 +338,7 @@ int main( void )
     glDeleteProgram(shaderID);
     
     // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    window.close();
     return 0;
 }
 
@@ -1,12 +1,19 @@
 #include <iostream>
+#include <algorithm>
+#include <functional>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include <common/shader.hpp>
+#include <common/window.hpp>
 #include <common/texture.hpp>
 #include <common/maths.hpp>
 #include <common/camera.hpp>
+#include <common/camerapath.hpp>
+#include <common/options.hpp>
+#include <common/scene.hpp>
+#include <common/rayquery.hpp>
 
 // Function prototypes
 void keyboardInput(GLFWwindow *window);
@@ -19,44 +26,26 @@ float deltaTime    = 0.0f;  // time elapsed since the previous frame
 // Create camera object
 Camera camera(glm::vec3(0.0f, 0.0f, 5.0f), glm::vec3(0.0f, 0.0f, 0.0f));
 
-int main( void )
+// Camera path recorder and player
+CameraPath cameraPath;
+
+// Ray queries for picking objects with the left mouse button, built the
+// first time something is picked
+RayQuery rayQuery;
+std::function<void()> buildRayQuery;
+bool leftButtonDown = false;
+
+int main(int argc, char *argv[])
 {
     // =========================================================================
     // Window creation - you shouldn't need to change this code
     // -------------------------------------------------------------------------
-    // Initialise GLFW
-    if( !glfwInit() )
+    // Open a window and create its OpenGL context (run with --headless to
+    // render offscreen instead)
+    Window window(argc, argv, "Lab07 Moving the Camera");
+    if (!window.isOpen())
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
-        getchar();
-        return -1;
-    }
-
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_RESIZABLE,GL_FALSE);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    // Open a window and create its OpenGL context
-    GLFWwindow* window;
-    window = glfwCreateWindow(1024, 768, "Lab07 Moving the Camera", NULL, NULL);
-    
-    if( window == NULL ){
-        fprintf(stderr, "Failed to open GLFW window.\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
-    glfwMakeContextCurrent(window);
-
-    // Initialize GLEW
-    glewExperimental = true; // Needed for core profile
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
         getchar();
-        glfwTerminate();
         return -1;
     }
     // -------------------------------------------------------------------------
@@ -69,13 +58,21 @@ int main( void )
     // Use back face culling
     glEnable(GL_CULL_FACE);
     
-    // Ensure we can capture keyboard inputs
-    glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+    // Capture keyboard and mouse inputs (there are none when headless)
+    if (!window.headless)
+    {
+        glfwSetInputMode(window.window, GLFW_STICKY_KEYS, GL_TRUE);
+        glfwSetInputMode(window.window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwPollEvents();
+        glfwSetCursorPos(window.window, 1024 / 2, 768 / 2);
+    }
     
-    // Capture mouse inputs
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwPollEvents();
-    glfwSetCursorPos(window, 1024 / 2, 768 / 2);
+    // Record or replay a camera path (run with --record FILE or --replay FILE)
+    if (!cameraPath.start(window))
+    {
+        window.close();
+        return -1;
+    }
     
     // Define cube object
     // Define vertices
@@ -218,36 +215,62 @@ int main( void )
     textureID = glGetUniformLocation(shaderID, "texture");
     glUniform1i(textureID, 0);
     
-    // Cube positions
-    glm::vec3 cubePositions[] = {
-        glm::vec3( 0.0f,  0.0f,  0.0f),
-        glm::vec3( 2.0f,  5.0f, -10.0f),
-        glm::vec3(-3.0f, -2.0f, -3.0f),
-        glm::vec3(-4.0f, -2.0f, -8.0f),
-        glm::vec3( 2.0f,  2.0f, -6.0f),
-        glm::vec3(-4.0f,  3.0f, -8.0f),
-        glm::vec3( 0.0f, -2.0f, -5.0f),
-        glm::vec3( 4.0f,  2.0f, -4.0f),
-        glm::vec3( 2.0f,  0.0f, -2.0f),
-        glm::vec3(-1.0f,  1.0f, -2.0f)
+    // Cube instances. Larger scenes can be generated for benchmarking, e.g.
+    // --instances 10000 --layout random --seed 2
+    Scene scene(Options::getInt("seed", 1));
+    if (Options::has("instances"))
+    {
+        scene.addInstances(Options::getInt("instances", 100),
+                           Scene::layoutFromName(Options::get("layout", "grid")));
+        camera.far = std::max(camera.far, 2.0f * scene.radius);
+    }
+    else
+    {
+        glm::vec3 cubePositions[] = {
+            glm::vec3( 0.0f,  0.0f,  0.0f),
+            glm::vec3( 2.0f,  5.0f, -10.0f),
+            glm::vec3(-3.0f, -2.0f, -3.0f),
+            glm::vec3(-4.0f, -2.0f, -8.0f),
+            glm::vec3( 2.0f,  2.0f, -6.0f),
+            glm::vec3(-4.0f,  3.0f, -8.0f),
+            glm::vec3( 0.0f, -2.0f, -5.0f),
+            glm::vec3( 4.0f,  2.0f, -4.0f),
+            glm::vec3( 2.0f,  0.0f, -2.0f),
+            glm::vec3(-1.0f,  1.0f, -2.0f)
+        };
+        for (unsigned int i = 0 ; i < 10 ; i++)
+            scene.addInstance(cubePositions[i], glm::vec3(1.0f, 1.0f, 1.0f),
+                              Maths::radians(20.0f * i), 0.5f);
+    }
+    
+    // Put the cubes' triangles into the ray queries the first time one is
+    // picked
+    buildRayQuery = [&]()
+    {
+        unsigned int cubeMesh = rayQuery.addMesh(reinterpret_cast<const glm::vec3 *>(vertices),
+                                                 sizeof(vertices) / (9 * sizeof(float)));
+        for (unsigned int i = 0; i < scene.instances.size(); i++)
+            rayQuery.addInstance(cubeMesh, scene.modelMatrix(i));
+        rayQuery.build();
     };
-
-    // Cube rotation angles
-    float cubeAngles[10];
-    for (unsigned int i = 0 ; i < 10 ; i++)
-        cubeAngles[i] = Maths::radians(20.0f * i);
     
     // Render loop
-    while (!glfwWindowShouldClose(window))
+    while (!window.shouldClose() && !cameraPath.finished())
     {
         // Update timer
-        float time   = glfwGetTime();
+        float time   = window.getTime();
         deltaTime    = time - previousTime;
         previousTime = time;
         
         // Get inputs
-        keyboardInput(window);
-        mouseInput(window);
+        if (!window.headless && !cameraPath.replaying())
+        {
+            keyboardInput(window.window);
+            mouseInput(window.window);
+        }
+        
+        // Record the camera, or move it along the replayed path
+        cameraPath.update(camera, deltaTime);
         
         // Clear the window
         glClearColor(0.2f, 0.2f, 0.2f, 0.0f);
@@ -268,14 +291,10 @@ int main( void )
         camera.calculateMatrices();
         
         // Loop through cubes and draw each one
-        for (int i = 0; i < 10; i++)
+        for (unsigned int i = 0; i < scene.instances.size(); i++)
         {
             // Calculate the model matrix
-            glm::mat4 translate = Maths::translate(cubePositions[i]);
-            glm::mat4 scale     = Maths::scale(glm::vec3(0.5f, 0.5f, 0.5f));
-            glm::mat4 rotate    = Maths::rotate(cubeAngles[i],
-                                                glm::vec3(1.0f, 1.0f, 1.0f));
-            glm::mat4 model     = translate * rotate * scale;
+            glm::mat4 model = scene.modelMatrix(i);
 
             // Calculate the MVP matrix
             glm::mat4 mvp = camera.projection * camera.view * model;
@@ -294,8 +313,7 @@ int main( void )
         glDisableVertexAttribArray(1);
         
         // Swap buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        window.swapBuffers();
     }
     
     // Cleanup
@@ -305,8 +323,11 @@ int main( void )
     glDeleteBuffers(1, &uvBuffer);
     glDeleteProgram(shaderID);
     
+    // Write the recorded camera path or report the replay frame times
+    cameraPath.stop(window);
+    
     // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    window.close();
     return 0;
 }
 
@@ -315,6 +336,9 @@ void keyboardInput(GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
     
+    // Start a new camera path segment using the return key
+    cameraPath.segmentKey(glfwGetKey(window, GLFW_KEY_ENTER) == GLFW_PRESS);
+    
     // Move the camera using WSAD keys
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.eye += 5.0f * deltaTime * camera.front;
@@ -345,4 +369,26 @@ void mouseInput(GLFWwindow *window)
     
     // Calculate camera vectors from the yaw and pitch angles
     camera.calculateCameraVectors();
+    
+    // Pick the object in the centre of the window using the left mouse button
+    bool leftButton = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    if (leftButton && !leftButtonDown)
+    {
+        if (rayQuery.numInstances() == 0)
+            buildRayQuery();
+        
+        double start = glfwGetTime();
+        int width, height;
+        glfwGetWindowSize(window, &width, &height);
+        Ray ray = RayQuery::cursorRay(width / 2, height / 2, width, height, camera.view,
+                                      camera.projection);
+        RayQuery::Hit hit;
+        bool picked = rayQuery.intersect(ray, hit);
+        double time = 1.0e6 * (glfwGetTime() - start);
+        if (picked)
+            printf("Picked cube %u at a distance of %.2f (%.1f us)\n", hit.instance, hit.t, time);
+        else
+            printf("Nothing picked (%.1f us)\n", time);
+    }
+    leftButtonDown = leftButton;
 }
@@ -1,14 +1,21 @@
 #include <iostream>
 #include <cmath>
+#include <functional>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include <common/shader.hpp>
+#include <common/window.hpp>
 #include <common/texture.hpp>
 #include <common/maths.hpp>
 #include <common/camera.hpp>
+#include <common/camerapath.hpp>
 #include <common/model.hpp>
+#include <common/rayquery.hpp>
+#include <common/staticbatch.hpp>
+#include <common/options.hpp>
+#include <common/jobs.hpp>
 
 // Function prototypes
 void keyboardInput(GLFWwindow *window);
@@ -21,6 +28,15 @@ float deltaTime    = 0.0f;  // time elapsed since the previous frame
 // Create camera object
 Camera camera(glm::vec3(0.0f, 0.0f, 4.0f), glm::vec3(0.0f, 0.0f, 0.0f));
 
+// Camera path recorder and player
+CameraPath cameraPath;
+
+// Ray queries for picking objects with the left mouse button, built the
+// first time something is picked
+RayQuery rayQuery;
+std::function<void()> buildRayQuery;
+bool leftButtonDown = false;
+
 // Light struct
 struct Light
 {
@@ -34,46 +50,19 @@ struct Light
     unsigned int type;
 };
 
-int main( void )
+int main(int argc, char *argv[])
 {
     // =========================================================================
     // Window creation - you shouldn't need to change this code
     // -------------------------------------------------------------------------
-    // Initialise GLFW
-    if( !glfwInit() )
+    // Open a window and create its OpenGL context (run with --headless to
+    // render offscreen instead)
+    Window window(argc, argv, "Lab08 Lighting");
+    if (!window.isOpen())
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
         getchar();
         return -1;
     }
-
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_RESIZABLE,GL_FALSE);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    // Open a window and create its OpenGL context
-    GLFWwindow* window;
-    window = glfwCreateWindow(1024, 768, "Lab08 Lighting", NULL, NULL);
-    
-    if( window == NULL ){
-        fprintf(stderr, "Failed to open GLFW window.\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
-    glfwMakeContextCurrent(window);
-
-    // Initialize GLEW
-    glewExperimental = true; // Needed for core profile
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
     // -------------------------------------------------------------------------
     // End of window creation
     // =========================================================================
@@ -84,18 +73,27 @@ int main( void )
     // Use back face culling
     glEnable(GL_CULL_FACE);
     
-    // Ensure we can capture keyboard inputs
-    glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+    // Capture keyboard and mouse inputs (there are none when headless)
+    if (!window.headless)
+    {
+        glfwSetInputMode(window.window, GLFW_STICKY_KEYS, GL_TRUE);
+        glfwSetInputMode(window.window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwPollEvents();
+        glfwSetCursorPos(window.window, 1024 / 2, 768 / 2);
+    }
     
-    // Capture mouse inputs
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwPollEvents();
-    glfwSetCursorPos(window, 1024 / 2, 768 / 2);
+    // Record or replay a camera path (run with --record FILE or --replay FILE)
+    if (!cameraPath.start(window))
+    {
+        window.close();
+        return -1;
+    }
     
     // Compile shader program
     unsigned int shaderID, lightShaderID;
 //    shaderID      = LoadShaders("vertexShader.glsl", "fragmentShader.glsl");
-    shaderID      = LoadShaders("vertexShader.glsl", "multipleLightsFragmentShader.glsl");
+    shaderID      = LoadShaders("vertexShader.glsl", "multipleLightsFragmentShader.glsl",
+                                { "../common/lightingFragmentShader.glsl" });
     lightShaderID = LoadShaders("lightVertexShader.glsl", "lightFragmentShader.glsl");
     
     // Activate shader
@@ -182,17 +180,53 @@ int main( void )
     for (unsigned int i = 0 ; i < 10 ; i++)
         teapotAngles[i] = Maths::radians(20.0f * i);
     
+    // Put the teapots' triangles into the ray queries the first time one is
+    // picked
+    buildRayQuery = [&]()
+    {
+        unsigned int teapotMesh = rayQuery.addMesh(teapot);
+        for (unsigned int i = 0; i < 10; i++)
+            rayQuery.addInstance(teapotMesh, Maths::translate(teapotPositions[i]) *
+                                             Maths::rotate(teapotAngles[i], glm::vec3(1.0f)) *
+                                             Maths::scale(glm::vec3(0.75f)));
+        rayQuery.build();
+    };
+    
+    // The teapots don't move, so they can be baked into a static batch and
+    // drawn with one draw call instead of one each (run with --static-batch)
+    bool staticBatching = Options::has("static-batch");
+    StaticBatch staticBatch;
+    if (staticBatching)
+    {
+        Jobs::start();
+        for (unsigned int i = 0; i < 10; i++)
+            staticBatch.add(teapot, Maths::translate(teapotPositions[i]) *
+                                    Maths::rotate(teapotAngles[i], glm::vec3(1.0f)) *
+                                    Maths::scale(glm::vec3(0.75f)));
+        staticBatch.build();
+        printf("Static batch: %u objects in %u batches of %u chunks, %u vertices (%.1f MB) built in %.1f ms\n",
+               staticBatch.stats.objects, staticBatch.stats.batches, staticBatch.stats.chunks,
+               staticBatch.stats.vertices, staticBatch.stats.bytes / 1048576.0,
+               staticBatch.stats.buildTime);
+    }
+    
     // Render loop
-    while (!glfwWindowShouldClose(window))
+    while (!window.shouldClose() && !cameraPath.finished())
     {
         // Update timer
-        float time   = glfwGetTime();
+        float time   = window.getTime();
         deltaTime    = time - previousTime;
         previousTime = time;
         
         // Get inputs
-        keyboardInput(window);
-        mouseInput(window);
+        if (!window.headless && !cameraPath.replaying())
+        {
+            keyboardInput(window.window);
+            mouseInput(window.window);
+        }
+        
+        // Record the camera, or move it along the replayed path
+        cameraPath.update(camera, deltaTime);
         
         // Clear the window
         glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
@@ -258,8 +292,17 @@ int main( void )
         // Draw teapot
 //        teapot.draw(shaderID);
         
+        // Draw the static batch (its vertices are already in world space)
+        if (staticBatching)
+        {
+            glm::mat4 MVP = camera.projection * camera.view;
+            glUniformMatrix4fv(glGetUniformLocation(shaderID, "MVP"), 1, GL_FALSE, &MVP[0][0]);
+            glUniformMatrix4fv(glGetUniformLocation(shaderID, "MV"), 1, GL_FALSE, &camera.view[0][0]);
+            staticBatch.draw(shaderID, MVP);
+        }
+        
         // Loop through objects
-        for (unsigned int i = 0; i < 10; i++)
+        for (unsigned int i = 0; i < 10 && !staticBatching; i++)
         {
             // Calculate model matrix
             glm::mat4 translate = Maths::translate(teapotPositions[i]);
@@ -317,16 +360,21 @@ int main( void )
         // ---------------------------------------------------------------------
         
         // Swap buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        window.swapBuffers();
     }
     
     // Cleanup
+    staticBatch.deleteBuffers();
     teapot.deleteBuffers();
+    Jobs::stop();
     glDeleteProgram(shaderID);
+    DeleteShaderCache();
+    
+    // Write the recorded camera path or report the replay frame times
+    cameraPath.stop(window);
     
     // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    window.close();
     return 0;
 }
 
@@ -335,6 +383,9 @@ void keyboardInput(GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
     
+    // Start a new camera path segment using the return key
+    cameraPath.segmentKey(glfwGetKey(window, GLFW_KEY_ENTER) == GLFW_PRESS);
+    
     // Move the camera using WSAD keys
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.eye += 5.0f * deltaTime * camera.front;
@@ -362,5 +413,27 @@ void mouseInput(GLFWwindow *window)
     
     // Calculate camera vectors from the yaw and pitch angles
     camera.calculateCameraVectors();
+    
+    // Pick the object in the centre of the window using the left mouse button
+    bool leftButton = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    if (leftButton && !leftButtonDown)
+    {
+        if (rayQuery.numInstances() == 0)
+            buildRayQuery();
+        
+        double start = glfwGetTime();
+        int width, height;
+        glfwGetWindowSize(window, &width, &height);
+        Ray ray = RayQuery::cursorRay(width / 2, height / 2, width, height, camera.view,
+                                      camera.projection);
+        RayQuery::Hit hit;
+        bool picked = rayQuery.intersect(ray, hit);
+        double time = 1.0e6 * (glfwGetTime() - start);
+        if (picked)
+            printf("Picked teapot %u at a distance of %.2f (%.1f us)\n", hit.instance, hit.t, time);
+        else
+            printf("Nothing picked (%.1f us)\n", time);
+    }
+    leftButtonDown = leftButton;
 }
 
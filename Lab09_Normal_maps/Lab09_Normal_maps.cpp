@@ -1,19 +1,35 @@
 #include <iostream>
 #include <cmath>
+#include <algorithm>
+#include <functional>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include <common/shader.hpp>
+#include <common/window.hpp>
 #include <common/texture.hpp>
 #include <common/maths.hpp>
 #include <common/camera.hpp>
+#include <common/camerapath.hpp>
 #include <common/model.hpp>
 #include <common/light.hpp>
+#include <common/profiler.hpp>
+#include <common/options.hpp>
+#include <common/scene.hpp>
+#include <common/jobs.hpp>
+#include <common/transform.hpp>
+#include <common/matrixbatch.hpp>
+#include <common/rasterizer.hpp>
+#include <common/pathtracer.hpp>
+#include <common/rayquery.hpp>
+#include <common/staticbatch.hpp>
 
 // Function prototypes
 void keyboardInput(GLFWwindow *window);
 void mouseInput(GLFWwindow *window);
+void keyCallback(GLFWwindow *window, int key, int scancode, int action,
+                 int mods);
 
 // Frame timers
 float previousTime = 0.0f;  // time of previous iteration of the loop
@@ -22,46 +38,35 @@ float deltaTime    = 0.0f;  // time elapsed since the previous frame
 // Create camera object
 Camera camera(glm::vec3(0.0f, 0.0f, 4.0f), glm::vec3(0.0f, 0.0f, 0.0f));
 
-int main( void )
+// Camera path recorder and player
+CameraPath cameraPath;
+
+// Ray queries for picking objects with the left mouse button, built the
+// first time something is picked
+RayQuery rayQuery;
+std::function<void()> buildRayQuery;
+bool leftButtonDown = false;
+
+// Create light sources object
+Light lightSources;
+
+// Normal mapping pipeline (run with --pipeline vertex or tbn, press T to
+// switch)
+bool perFragmentTBN = true;
+
+int main(int argc, char *argv[])
 {
     // =========================================================================
     // Window creation - you shouldn't need to change this code
     // -------------------------------------------------------------------------
-    // Initialise GLFW
-    if( !glfwInit() )
+    // Open a window and create its OpenGL context (run with --headless to
+    // render offscreen instead)
+    Window window(argc, argv, "Lab09 Normal Maps");
+    if (!window.isOpen())
     {
-        fprintf( stderr, "Failed to initialize GLFW\n" );
         getchar();
         return -1;
     }
-
-    glfwWindowHint(GLFW_SAMPLES, 4);
-    glfwWindowHint(GLFW_RESIZABLE,GL_FALSE);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-    // Open a window and create its OpenGL context
-    GLFWwindow* window;
-    window = glfwCreateWindow(1024, 768, "Lab09 Normal Maps", NULL, NULL);
-    
-    if( window == NULL ){
-        fprintf(stderr, "Failed to open GLFW window.\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
-    glfwMakeContextCurrent(window);
-
-    // Initialize GLEW
-    glewExperimental = true; // Needed for core profile
-    if (glewInit() != GLEW_OK) {
-        fprintf(stderr, "Failed to initialize GLEW\n");
-        getchar();
-        glfwTerminate();
-        return -1;
-    }
     // -------------------------------------------------------------------------
     // End of window creation
     // =========================================================================
@@ -72,22 +77,43 @@ int main( void )
     // Use back face culling
     glEnable(GL_CULL_FACE);
     
-    // Ensure we can capture keyboard inputs
-    glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
+    // Capture keyboard and mouse inputs (there are none when headless)
+    if (!window.headless)
+    {
+        glfwSetInputMode(window.window, GLFW_STICKY_KEYS, GL_TRUE);
+        glfwSetInputMode(window.window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwPollEvents();
+        glfwSetCursorPos(window.window, 1024 / 2, 768 / 2);
+        
+        // Switch pipelines and add or remove lights using key presses
+        glfwSetKeyCallback(window.window, keyCallback);
+    }
     
-    // Capture mouse inputs
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwPollEvents();
-    glfwSetCursorPos(window, 1024 / 2, 768 / 2);
+    // Record or replay a camera path (run with --record FILE or --replay FILE)
+    if (!cameraPath.start(window))
+    {
+        window.close();
+        return -1;
+    }
     
-    // Compile shader program
-    unsigned int shaderID, lightShaderID;
-    shaderID      = LoadShaders("vertexShader.glsl", "fragmentShader.glsl");
+    // Compile shader programs. The per-vertex program transforms every light
+    // into tangent space in the vertex shader, the per-fragment program
+    // passes the TBN matrix to the fragment shader and lights in view space.
+    unsigned int shaderID, tbnShaderID, lightShaderID;
+    shaderID      = LoadShaders("vertexShader.glsl", "fragmentShader.glsl",
+                                { "../common/lightingFragmentShader.glsl" });
+    tbnShaderID   = LoadShaders("tbnVertexShader.glsl", "tbnFragmentShader.glsl",
+                                { "../common/lightingFragmentShader.glsl" });
     lightShaderID = LoadShaders("lightVertexShader.glsl", "lightFragmentShader.glsl");
+    perFragmentTBN = Options::get("pipeline", "tbn") != "vertex";
     
     // Activate shader
     glUseProgram(shaderID);
     
+    // Start the job system used to calculate the models' tangents and to
+    // update the objects' matrices
+    Jobs::start();
+    
     // Load models
     Model teapot("../assets/teapot.obj");
     Model sphere("../assets/sphere.obj");
@@ -104,7 +130,6 @@ int main( void )
     teapot.Ns = 20.0f;
     
     // Add light sources
-    Light lightSources;
     lightSources.addPointLight(glm::vec3(2.0f, 2.0f, 2.0f),         // position
                                glm::vec3(1.0f, 1.0f, 1.0f),         // colour
                                1.0f, 0.1f, 0.02f);                  // attenuation
@@ -122,88 +147,304 @@ int main( void )
     lightSources.addDirectionalLight(glm::vec3(1.0f, -1.0f, 0.0f),  // direction
                                      glm::vec3(1.0f, 0.0f, 0.0f));  // colour
     
-    // Teapot positions
-    glm::vec3 teapotPositions[] = {
-        glm::vec3( 0.0f,  0.0f,  0.0f),
-        glm::vec3( 2.0f,  5.0f, -10.0f),
-        glm::vec3(-3.0f, -2.0f, -3.0f),
-        glm::vec3(-4.0f, -2.0f, -8.0f),
-        glm::vec3( 2.0f,  2.0f, -6.0f),
-        glm::vec3(-4.0f,  3.0f, -8.0f),
-        glm::vec3( 0.0f, -2.0f, -5.0f),
-        glm::vec3( 4.0f,  2.0f, -4.0f),
-        glm::vec3( 2.0f,  0.0f, -2.0f),
-        glm::vec3(-1.0f,  1.0f, -2.0f)
+    // Teapot instances. Larger scenes can be generated for benchmarking, e.g.
+    // --instances 10000 --layout clustered --lights 8 --seed 2
+    Scene scene(Options::getInt("seed", 1));
+    if (Options::has("instances"))
+    {
+        scene.addInstances(Options::getInt("instances", 100),
+                           Scene::layoutFromName(Options::get("layout", "grid")));
+        camera.far = std::max(camera.far, 2.0f * scene.radius);
+    }
+    else
+    {
+        glm::vec3 teapotPositions[] = {
+            glm::vec3( 0.0f,  0.0f,  0.0f),
+            glm::vec3( 2.0f,  5.0f, -10.0f),
+            glm::vec3(-3.0f, -2.0f, -3.0f),
+            glm::vec3(-4.0f, -2.0f, -8.0f),
+            glm::vec3( 2.0f,  2.0f, -6.0f),
+            glm::vec3(-4.0f,  3.0f, -8.0f),
+            glm::vec3( 0.0f, -2.0f, -5.0f),
+            glm::vec3( 4.0f,  2.0f, -4.0f),
+            glm::vec3( 2.0f,  0.0f, -2.0f),
+            glm::vec3(-1.0f,  1.0f, -2.0f)
+        };
+        for (unsigned int i = 0 ; i < 10 ; i++)
+            scene.addInstance(teapotPositions[i], glm::vec3(1.0f),
+                              Maths::radians(20.0f * i), 0.75f);
+    }
+    
+    // Transform hierarchy holding the teapots' model matrices. The teapots
+    // don't move so their matrices are only calculated in the first frame.
+    TransformHierarchy transforms;
+    for (unsigned int i = 0; i < scene.instances.size(); i++)
+        transforms.add(scene.instances[i].position, scene.instances[i].axis,
+                       scene.instances[i].angle, glm::vec3(scene.instances[i].scale));
+    
+    // Replace the light sources with generated ones (the shaders use the
+    // first 10)
+    if (Options::has("lights"))
+    {
+        lightSources.lightSources.clear();
+        scene.addLights(lightSources, Options::getInt("lights", 4));
+    }
+    
+    // Draw the frames with the CPU rasterizer instead of OpenGL (run with
+    // --renderer cpu). It always uses per-fragment TBN normal mapping.
+    bool cpuRenderer = Options::get("renderer") == "cpu";
+    Rasterizer rasterizer;
+    if (cpuRenderer)
+        rasterizer.resize(window.width, window.height);
+    double rasterTime = 0.0;
+    double rasterTriangles = 0.0;
+    unsigned int rasterFrames = 0;
+    
+    // Or path trace them (run with --renderer path). Each frame adds a
+    // sample to every pixel, so the image gets less noisy while the camera
+    // stays still. The light sources themselves aren't drawn.
+    bool pathRenderer = Options::get("renderer") == "path";
+    PathTracer pathTracer;
+    size_t pathLights = 0;
+    double pathTime = 0.0;
+    double pathRays = 0.0;
+    
+    // Start the profiler if a trace file is given in the PROFILE environment
+    // variable, e.g. PROFILE=trace.json ./Lab09_Normal_maps
+    Profiler::start(getenv("PROFILE"), 300);
+    
+    // Put the teapots' triangles into the ray queries the first time one is
+    // picked
+    buildRayQuery = [&]()
+    {
+        unsigned int teapotMesh = rayQuery.addMesh(teapot);
+        for (unsigned int i = 0; i < scene.instances.size(); i++)
+            rayQuery.addInstance(teapotMesh, scene.modelMatrix(i));
+        rayQuery.build();
     };
-
-    // Teapot rotation angles
-    float teapotAngles[10];
-    for (unsigned int i = 0 ; i < 10 ; i++)
-        teapotAngles[i] = Maths::radians(20.0f * i);
+    
+    // Put the teapots into the path tracer's BVH (they don't move)
+    if (pathRenderer)
+    {
+        std::vector<glm::mat4> teapotModels(scene.instances.size());
+        for (unsigned int i = 0; i < scene.instances.size(); i++)
+            teapotModels[i] = scene.modelMatrix(i);
+        pathTracer.resize(window.width, window.height);
+        pathTracer.add(teapot, &teapotModels[0], static_cast<unsigned int>(teapotModels.size()));
+        pathTracer.build();
+        printf("Path tracer: BVH of %u triangles built in %.1f ms on %u threads\n",
+               pathTracer.stats.triangles, pathTracer.stats.buildTime, Jobs::numThreads());
+    }
+    
+    // Model matrices stored as a structure of arrays for the SIMD matrix
+    // kernel, and the model view matrices sent to the shaders as 48 byte
+    // affine transforms in an instance buffer (the shaders apply the
+    // projection themselves)
+    MatrixArray models;
+    models.resize(scene.instances.size());
+    std::vector<Affine> modelViews(scene.instances.size());
+    unsigned int instanceBuffer;
+    glGenBuffers(1, &instanceBuffer);
+    teapot.setInstanceBuffer(instanceBuffer, 5);
+    
+    // Or bake the teapots into a static batch (run with --static-batch). Its
+    // vertices are in world space, so its one instance's model view matrix
+    // is the view matrix.
+    bool staticBatching = Options::has("static-batch");
+    StaticBatch staticBatch;
+    unsigned int batchInstanceBuffer;
+    glGenBuffers(1, &batchInstanceBuffer);
+    if (staticBatching)
+    {
+        for (unsigned int i = 0; i < scene.instances.size(); i++)
+            staticBatch.add(teapot, scene.modelMatrix(i));
+        staticBatch.build();
+        staticBatch.setInstanceBuffer(batchInstanceBuffer, 5);
+        printf("Static batch: %u objects in %u batches of %u chunks, %u vertices (%.1f MB) built in %.1f ms\n",
+               staticBatch.stats.objects, staticBatch.stats.batches, staticBatch.stats.chunks,
+               staticBatch.stats.vertices, staticBatch.stats.bytes / 1048576.0,
+               staticBatch.stats.buildTime);
+    }
     
     // Render loop
-    while (!glfwWindowShouldClose(window))
+    while (!window.shouldClose() && !cameraPath.finished())
     {
         // Update timer
-        float time   = glfwGetTime();
+        float time   = window.getTime();
         deltaTime    = time - previousTime;
         previousTime = time;
+        Profiler::beginFrame();
         
         // Get inputs
-        keyboardInput(window);
-        mouseInput(window);
+        {
+            PROFILE_SCOPE("Input");
+            if (!window.headless && !cameraPath.replaying())
+            {
+                keyboardInput(window.window);
+                mouseInput(window.window);
+            }
+            
+            // Record the camera, or move it along the replayed path
+            cameraPath.update(camera, deltaTime);
+        }
         
         // Clear the window
         glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         
         // Calculate view and projection matrices
-        camera.target = camera.eye + camera.front;
-        camera.calculateMatrices();
+        {
+            PROFILE_SCOPE("Camera matrices");
+            camera.calculateOrientationMatrices();
+        }
         
-        // Activate shader
-        glUseProgram(shaderID);
+        // Activate shader for the current normal mapping pipeline
+        unsigned int programID = perFragmentTBN ? tbnShaderID : shaderID;
+        glUseProgram(programID);
         
         // Send light source properties to the shader
-        lightSources.toShader(shaderID, camera.view);
+        lightSources.toShader(programID, camera.view);
         
-        // Send view matrix to the shader
-        glUniformMatrix4fv(glGetUniformLocation(shaderID, "V"), 1, GL_FALSE, &camera.view[0][0]);
+        // Send view and projection matrices to the shader
+        glUniformMatrix4fv(glGetUniformLocation(programID, "V"), 1, GL_FALSE, &camera.view[0][0]);
+        glUniformMatrix4fv(glGetUniformLocation(programID, "P"), 1, GL_FALSE, &camera.projection[0][0]);
         
-        // Loop through objects
-        for (unsigned int i = 0; i < 10; i++)
+        // Update the model matrices of objects that have moved
         {
-            // Calculate model matrix
-            glm::mat4 translate = Maths::translate(teapotPositions[i]);
-            glm::mat4 scale     = Maths::scale(glm::vec3(0.75f));
-            glm::mat4 rotate    = Maths::rotate(teapotAngles[i], glm::vec3(1.0f));
-            glm::mat4 model     = translate * rotate * scale;
+            PROFILE_SCOPE("Transform update");
+            if (transforms.update() > 0)
+            {
+                for (unsigned int i = 0; i < scene.instances.size(); i++)
+                    models.set(i, transforms.world(i));
+            }
+        }
+        
+        // Calculate the model view matrices of all objects in parallel
+        {
+            PROFILE_SCOPE("Matrix update");
+            Jobs::parallelFor(0, models.size(), 256,
+                              [&](unsigned int begin, unsigned int end)
+            {
+                computeModelViews(models, camera.view, &modelViews[0], begin, end);
+            });
+        }
+        
+        if (cpuRenderer)
+        {
+            // Draw the teapots and light sources on the CPU and copy the
+            // frame into the window
+            PROFILE_SCOPE("CPU rasterizer");
+            rasterizer.begin(camera.view, camera.projection, lightSources);
+            rasterizer.draw(teapot, &modelViews[0], static_cast<unsigned int>(modelViews.size()));
+            rasterizer.drawLights(lightSources, sphere);
+            rasterizer.end();
+            rasterizer.present();
+            rasterTime      += rasterizer.stats.setupTime + rasterizer.stats.rasterTime;
+            rasterTriangles += rasterizer.stats.triangles;
+            rasterFrames++;
+        }
+        else if (pathRenderer)
+        {
+            // Add a sample to every pixel, starting again if the camera or
+            // the lights have changed
+            PROFILE_SCOPE("Path tracer");
+            if (lightSources.lightSources.size() != pathLights)
+            {
+                pathTracer.setLights(lightSources);
+                pathLights = lightSources.lightSources.size();
+            }
+            pathTracer.setCamera(camera.view, camera.projection);
+            double startTime  = pathTracer.stats.renderTime;
+            uint64_t startRays = pathTracer.stats.rays;
+            pathTracer.render();
+            pathTracer.present();
+            pathTime += pathTracer.stats.renderTime - startTime;
+            pathRays += static_cast<double>(pathTracer.stats.rays - startRays);
+        }
+        else if (staticBatching)
+        {
+            // Draw the chunks of the batch inside the view frustum
+            Affine view(camera.view);
+            glBindBuffer(GL_ARRAY_BUFFER, batchInstanceBuffer);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(Affine), &view, GL_STREAM_DRAW);
+            Profiler::beginGpuScope("GPU teapots");
+            staticBatch.draw(programID, camera.projection * camera.view);
+            Profiler::endGpuScope();
             
-            // Send the MVP and MV matrices to the vertex shader
-            glm::mat4 MV  = camera.view * model;
-            glm::mat4 MVP = camera.projection * MV;
-            glUniformMatrix4fv(glGetUniformLocation(shaderID, "MVP"), 1, GL_FALSE, &MVP[0][0]);
-            glUniformMatrix4fv(glGetUniformLocation(shaderID, "MV"), 1, GL_FALSE, &MV[0][0]);
+            // Draw light sources
+            Profiler::beginGpuScope("GPU lights");
+            glUseProgram(lightShaderID);
+            lightSources.draw(camera.view, camera.projection, sphere);
+            Profiler::endGpuScope();
+        }
+        else
+        {
+            // Upload the model view matrices to the instance buffer
+            {
+                PROFILE_SCOPE("Matrix upload");
+                glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+                glBufferData(GL_ARRAY_BUFFER, modelViews.size() * sizeof(Affine),
+                             &modelViews[0], GL_STREAM_DRAW);
+            }
             
-            // Draw the model
-            teapot.draw(shaderID);
+            // Draw all of the teapots in one draw call
+            Profiler::beginGpuScope("GPU teapots");
+            teapot.draw(programID, static_cast<unsigned int>(modelViews.size()));
+            Profiler::endGpuScope();
+            
+            // Draw light sources
+            Profiler::beginGpuScope("GPU lights");
+            glUseProgram(lightShaderID);
+            lightSources.draw(camera.view, camera.projection, sphere);
+            Profiler::endGpuScope();
         }
         
-        // Draw light sources
-        glUseProgram(lightShaderID);
-        lightSources.draw(camera.view, camera.projection, sphere);
-        
         // Swap buffers
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        {
+            PROFILE_SCOPE("Swap buffers");
+            window.swapBuffers();
+        }
+        Profiler::endFrame();
     }
     
+    // Report the CPU rasterizer's throughput
+    if (cpuRenderer && rasterTime > 0.0)
+        printf("CPU rasterizer: %.1f Mtri/s, %.3f ms/frame on %u threads\n",
+               rasterTriangles / (1000.0 * rasterTime), rasterTime / rasterFrames,
+               Jobs::numThreads());
+    
+    // Report the path tracer's throughput
+    if (pathRenderer && pathTime > 0.0)
+        printf("Path tracer: %.2f Mrays/s, %u samples per pixel in the last image\n",
+               pathRays / (1000.0 * pathTime), pathTracer.stats.samples);
+    
+    // Write the profiler trace and stop the worker threads
+    Profiler::stop();
+    Jobs::stop();
+    
+    // Report the matrix data sent to the GPU each frame compared with the
+    // MVP, MV and normal matrices the shaders used to take per object
+    printf("Matrix upload: %.1f KB per frame for %u objects (%.1f KB as MVP, MV and normal matrices)\n",
+           modelViews.size() * sizeof(Affine) / 1024.0f,
+           static_cast<unsigned int>(modelViews.size()),
+           modelViews.size() * sizeof(ObjectMatrices) / 1024.0f);
+    
     // Cleanup
+    glDeleteBuffers(1, &instanceBuffer);
+    glDeleteBuffers(1, &batchInstanceBuffer);
+    staticBatch.deleteBuffers();
+    rasterizer.deleteBuffers();
+    pathTracer.deleteBuffers();
     teapot.deleteBuffers();
     glDeleteProgram(shaderID);
+    glDeleteProgram(tbnShaderID);
+    DeleteShaderCache();
+    
+    // Write the recorded camera path or report the replay frame times
+    cameraPath.stop(window);
     
     // Close OpenGL window and terminate GLFW
-    glfwTerminate();
+    window.close();
     return 0;
 }
 
@@ -212,6 +453,9 @@ void keyboardInput(GLFWwindow *window)
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
     
+    // Start a new camera path segment using the return key
+    cameraPath.segmentKey(glfwGetKey(window, GLFW_KEY_ENTER) == GLFW_PRESS);
+    
     // Move the camera using WSAD keys
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.eye += 5.0f * deltaTime * camera.front;
@@ -239,5 +483,49 @@ void mouseInput(GLFWwindow *window)
     
     // Calculate camera vectors from the yaw and pitch angles
     camera.calculateCameraVectors();
+    
+    // Pick the object in the centre of the window using the left mouse button
+    bool leftButton = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    if (leftButton && !leftButtonDown)
+    {
+        if (rayQuery.numInstances() == 0)
+            buildRayQuery();
+        
+        double start = glfwGetTime();
+        int width, height;
+        glfwGetWindowSize(window, &width, &height);
+        Ray ray = RayQuery::cursorRay(width / 2, height / 2, width, height, camera.view,
+                                      camera.projection);
+        RayQuery::Hit hit;
+        bool picked = rayQuery.intersect(ray, hit);
+        double time = 1.0e6 * (glfwGetTime() - start);
+        if (picked)
+            printf("Picked teapot %u at a distance of %.2f (%.1f us)\n", hit.instance, hit.t, time);
+        else
+            printf("Nothing picked (%.1f us)\n", time);
+    }
+    leftButtonDown = leftButton;
 }
 
+void keyCallback(GLFWwindow *, int key, int, int action, int)
+{
+    if (action != GLFW_PRESS)
+        return;
+    
+    // Switch between the per-vertex and per-fragment TBN pipelines
+    if (key == GLFW_KEY_T)
+        perFragmentTBN = !perFragmentTBN;
+    
+    // Add a point light (up to the 10 supported by the shaders)
+    if (key == GLFW_KEY_L && lightSources.lightSources.size() < 10)
+    {
+        float angle = Maths::radians(36.0f * lightSources.lightSources.size());
+        lightSources.addPointLight(glm::vec3(5.0f * cos(angle), 2.0f, -5.0f + 5.0f * sin(angle)),
+                                   glm::vec3(1.0f, 1.0f, 1.0f),
+                                   1.0f, 0.1f, 0.02f);
+    }
+    
+    // Remove the most recently added light
+    if (key == GLFW_KEY_K && lightSources.lightSources.size() > 0)
+        lightSources.lightSources.pop_back();
+}
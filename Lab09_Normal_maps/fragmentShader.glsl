@@ -1,6 +1,6 @@
 #version 330 core
 
-# define maxLights 10
+#include "../common/lighting.glsl"
 
 // Inputs
 in vec2 UV;
@@ -11,159 +11,30 @@ in vec3 tangentSpaceLightDirection[maxLights];
 // Outputs
 out vec3 fragmentColour;
 
-// Light struct
-struct Light
-{
-    vec3 position;
-    vec3 colour;
-    vec3 direction;
-    float constant;
-    float linear;
-    float quadratic;
-    float cosPhi;
-    int type;
-};
-
 // Uniforms
 uniform sampler2D diffuseMap;
 uniform sampler2D normalMap;
-uniform float ka;
-uniform float kd;
-uniform float ks;
-uniform float Ns;
+uniform bool normalMapXY;
+uniform int numLights;
 uniform Light lightSources[maxLights];
 
-// Function prototypes
-vec3 pointLight(vec3 lightPosition, vec3 lightColour,
-                float constant, float linear, float quadratic);
-
-vec3 spotLight(vec3 lightPosition, vec3 direction, vec3 lightColour,
-               float cosPhi, float constant, float linear, float quadratic);
-
-vec3 directionalLight(vec3 lightDirection, vec3 lightColour);
-
-// Get the normal vector from the normal map
-vec3 Normal = normalize(2.0 * vec3(texture(normalMap, UV)) - 1.0);
-
 void main ()
 {
+    // Object colour and the normal vector from the normal map (a BC5
+    // compressed map only holds x and y, so z is calculated from them)
+    vec3 objectColour = vec3(texture(diffuseMap, UV));
+    vec3 normal       = 2.0 * vec3(texture(normalMap, UV)) - 1.0;
+    if (normalMapXY)
+        normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+    normal            = normalize(normal);
+    
     fragmentColour = vec3(0.0, 0.0, 0.0);
-    for (int i = 0; i < maxLights; i++)
+    for (int i = 0; i < numLights; i++)
     {
-        // Determine light properties for current light source
-        vec3 lightPosition  = tangentSpaceLightPosition[i];
-        vec3 lightColour    = lightSources[i].colour;
-        vec3 lightDirection = tangentSpaceLightDirection[i];
-        float constant      = lightSources[i].constant;
-        float linear        = lightSources[i].linear;
-        float quadratic     = lightSources[i].quadratic;
-        float cosPhi        = lightSources[i].cosPhi;
-        
-        // Calculate point light
-        if (lightSources[i].type == 1)
-            fragmentColour += pointLight(lightPosition, lightColour,
-                                         constant, linear, quadratic);
-        
-        // Calculate spotlight
-        if (lightSources[i].type == 2)
-            fragmentColour += spotLight(lightPosition, lightDirection, lightColour,
-                                        cosPhi, constant, linear, quadratic);
-           
-        // Calculate directional light
-        if (lightSources[i].type == 3)
-            fragmentColour += directionalLight(lightDirection, lightColour);
+        fragmentColour += calculateLight(lightSources[i],
+                                         tangentSpaceLightPosition[i],
+                                         tangentSpaceLightDirection[i],
+                                         objectColour, normal,
+                                         fragmentPosition);
     }
 }
-
-// Calculate point light
-vec3 pointLight(vec3 lightPosition, vec3 lightColour,
-                float constant, float linear, float quadratic)
-{
-    // Object colour
-    vec3 objectColour = vec3(texture(diffuseMap, UV));
-    
-    // Ambient reflection
-    vec3 ambient = ka * objectColour;
-    
-    // Diffuse reflection
-    vec3 light      = normalize(lightPosition - fragmentPosition);
-    vec3 normal     = normalize(Normal);
-    float cosTheta  = max(dot(normal, light), 0);
-    vec3 diffuse    = kd * lightColour * objectColour * cosTheta;
-    
-    // Specular reflection
-    vec3 reflection = - light + 2 * dot(light, normal) * normal;
-    vec3 camera     = normalize(-fragmentPosition);
-    float cosAlpha  = max(dot(camera, reflection), 0);
-    vec3 specular   = ks * lightColour * pow(cosAlpha, Ns);
-    
-    // Attenuation
-    float distance    = length(lightPosition - fragmentPosition);
-    float attenuation = 1.0 / (constant + linear * distance +
-                               quadratic * distance * distance);
-    
-    // Fragment colour
-    return (ambient + diffuse + specular) * attenuation;
-}
-
-// Calculate spotlight
-vec3 spotLight(vec3 lightPosition, vec3 lightDirection, vec3 lightColour,
-               float cosPhi, float constant, float linear, float quadratic)
-{
-    // Object colour
-    vec3 objectColour = vec3(texture(diffuseMap, UV));
-    
-    // Ambient reflection
-    vec3 ambient = ka * objectColour;
-    
-    // Diffuse reflection
-    vec3 light     = normalize(lightPosition - fragmentPosition);
-    vec3 normal    = normalize(Normal);
-    float cosTheta = max(dot(normal, light), 0);
-    vec3 diffuse   = kd * lightColour * objectColour * cosTheta;
-    
-    // Specular reflection
-    vec3 reflection = - light + 2 * dot(light, normal) * normal;
-    vec3 camera     = normalize(-fragmentPosition);
-    float cosAlpha  = max(dot(camera, reflection), 0);
-    vec3 specular   = ks * lightColour * pow(cosAlpha, Ns);
-    
-    // Attenuation
-    float distance    = length(lightPosition - fragmentPosition);
-    float attenuation = 1.0 / (constant + linear * distance +
-                               quadratic * distance * distance);
-    
-    // Directional light intensity
-    vec3 direction  = normalize(lightDirection);
-    cosTheta        = dot(-light, direction);
-    float delta     = radians(2.0);
-    float intensity = clamp((cosTheta - cosPhi) / delta, 0.0, 1.0);
-    
-    // Return fragment colour
-    return (ambient + diffuse + specular) * attenuation * intensity;
-}
-
-// Calculate directional light
-vec3 directionalLight(vec3 lightDirection, vec3 lightColour)
-{
-    // Object colour
-    vec3 objectColour = vec3(texture(diffuseMap, UV));
-    
-    // Ambient reflection
-    vec3 ambient = ka * objectColour;
-    
-    // Diffuse reflection
-    vec3 light     = normalize(-lightDirection);
-    vec3 normal    = normalize(Normal);
-    float cosTheta = max(dot(normal, light), 0);
-    vec3 diffuse   = kd * lightColour * objectColour * cosTheta;
-    
-    // Specular reflection
-    vec3 reflection = - light + 2 * dot(light, normal) * normal;
-    vec3 camera     = normalize(-fragmentPosition);
-    float cosAlpha  = max(dot(camera, reflection), 0);
-    vec3 specular   = ks * lightColour * pow(cosAlpha, Ns);
-    
-    // Return fragment colour
-    return ambient + diffuse + specular;
-}
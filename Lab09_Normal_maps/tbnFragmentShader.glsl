@@ -0,0 +1,41 @@
+#version 330 core
+
+#include "../common/lighting.glsl"
+
+// Inputs
+in vec2 UV;
+in vec3 fragmentPosition;
+in mat3 TBN;
+
+// Outputs
+out vec3 fragmentColour;
+
+// Uniforms
+uniform sampler2D diffuseMap;
+uniform sampler2D normalMap;
+uniform bool normalMapXY;
+uniform int numLights;
+uniform Light lightSources[maxLights];
+
+void main ()
+{
+    // Object colour and the view space normal vector from the normal map (a BC5
+    // compressed map only holds x and y, so z is calculated from them)
+    vec3 objectColour = vec3(texture(diffuseMap, UV));
+    vec3 normal       = 2.0 * vec3(texture(normalMap, UV)) - 1.0;
+    if (normalMapXY)
+        normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+    normal            = normalize(normal);
+    normal            = normalize(TBN * normal);
+    
+    // Calculate lighting in view space for the active light sources only
+    fragmentColour = vec3(0.0, 0.0, 0.0);
+    for (int i = 0; i < numLights; i++)
+    {
+        fragmentColour += calculateLight(lightSources[i],
+                                         lightSources[i].position,
+                                         lightSources[i].direction,
+                                         objectColour, normal,
+                                         fragmentPosition);
+    }
+}
@@ -0,0 +1,39 @@
+#version 330 core
+
+// Inputs
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec2 uv;
+layout(location = 2) in vec3 normal;
+layout(location = 3) in vec4 tangent;    // handedness in w
+layout(location = 5) in mat3x4 MV;      // rows of the instance's model view matrix
+
+// Outputs
+out vec2 UV;
+out vec3 fragmentPosition;
+out mat3 TBN;
+
+// Uniforms
+uniform mat4 P;
+
+void main()
+{
+    // Output view space fragment position and vertex position (the model
+    // view matrix is affine, so only its top three rows are sent)
+    fragmentPosition = vec4(position, 1.0) * MV;
+    gl_Position      = P * vec4(fragmentPosition, 1.0);
+    
+    // Output texture co-ordinates
+    UV = uv;
+    
+    // Output the TBN matrix that transforms tangent space to view space. The
+    // columns of the normal matrix b x c, c x a and a x b (where a, b and c
+    // are the columns of the model view 3x3) are the inverse transpose
+    // multiplied by the determinant, which normalising removes.
+    mat3 A = transpose(mat3(MV));
+    mat3 normalMatrix = mat3(cross(A[1], A[2]), cross(A[2], A[0]), cross(A[0], A[1]));
+    vec3 n = normalize(normalMatrix * normal);
+    vec3 t = normalize(normalMatrix * tangent.xyz);
+    t      = normalize(t - dot(t, n) * n);
+    vec3 b = tangent.w * cross(n, t);
+    TBN    = mat3(t, b, n);
+}
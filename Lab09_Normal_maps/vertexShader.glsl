@@ -1,13 +1,13 @@
 #version 330 core
 
-# define maxLights 10
+#include "../common/lighting.glsl"
 
 // Inputs
 layout(location = 0) in vec3 position;
 layout(location = 1) in vec2 uv;
 layout(location = 2) in vec3 normal;
-layout(location = 3) in vec3 tangent;
-layout(location = 4) in vec3 bitangent;
+layout(location = 3) in vec4 tangent;    // handedness in w
+layout(location = 5) in mat3x4 MV;      // rows of the instance's model view matrix
 
 // Outputs
 out vec2 UV;
@@ -16,43 +16,31 @@ out vec3 fragmentPosition;
 out vec3 tangentSpaceLightPosition[maxLights];
 out vec3 tangentSpaceLightDirection[maxLights];
 
-// Light struct
-struct Light
-{
-    vec3 position;
-    vec3 colour;
-    vec3 direction;
-    float constant;
-    float linear;
-    float quadratic;
-    float cosPhi;
-    int type;
-};
-
 // Uniforms
-uniform mat4 MVP;
-uniform mat4 MV;
+uniform mat4 P;
 uniform Light lightSources[maxLights];
 
 void main()
 {
-    // Output vertex position
-    gl_Position = MVP * vec4(position, 1.0);
+    // Output vertex position (the model view matrix is affine, so only its
+    // top three rows are sent)
+    vec3 viewPosition = vec4(position, 1.0) * MV;
+    gl_Position       = P * vec4(viewPosition, 1.0);
     
     // Output texture co-ordinates
     UV = uv;
     
     // Calculate the TBN matrix that transforms view space to tangent space
-    mat3 invMV = transpose(inverse(mat3(MV)));
-    vec3 t     = normalize(invMV * tangent);
-    //vec3 b     = normalize(invMV * bitangent);
+    mat3 A     = transpose(mat3(MV));
+    mat3 invMV = mat3(cross(A[1], A[2]), cross(A[2], A[0]), cross(A[0], A[1]));
+    vec3 t     = normalize(invMV * tangent.xyz);
     vec3 n     = normalize(invMV * normal);
     t = normalize(t - dot(t, n) * n);
-    vec3 b     = cross(n, t);
+    vec3 b     = tangent.w * cross(n, t);
     mat3 TBN   = transpose(mat3(t, b, n));
     
     // Output tangent space fragment position, light positions and directions
-    fragmentPosition = TBN * vec3(MV * vec4(position, 1.0));
+    fragmentPosition = TBN * viewPosition;
     // Normal           = TBN * mat3(transpose(inverse(MV))) * normal;
     for (int i = 0; i < maxLights; i++)
     {
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Result of one benchmark (times are nanoseconds per iteration)
+struct BenchmarkResult
+{
+    std::string  name;
+    unsigned int iterations = 0;    // iterations per sample
+    unsigned int samples    = 0;
+    double median = 0.0;
+    double mean   = 0.0;
+    double min    = 0.0;
+    double max    = 0.0;
+};
+
+// Benchmark class. A self-contained header-only harness: each benchmark
+// function is run in samples of enough iterations to take sampleTime
+// milliseconds, until minTime milliseconds have passed. The results can be
+// written to a JSON file and compared with the results in an earlier one,
+// where benchmarks slower than the baseline by more than a tolerance are
+// flagged as regressions.
+class Benchmark
+{
+public:
+    // Settings
+    static double      &minTime()    { static double time = 200.0; return time; }
+    static double      &sampleTime() { static double time = 2.0;   return time; }
+    static std::string &filter()     { static std::string name;    return name; }
+
+    // Results of every benchmark run so far
+    static std::vector<BenchmarkResult> &results()
+    {
+        static std::vector<BenchmarkResult> list;
+        return list;
+    }
+
+    // Wall clock time in milliseconds
+    static double now()
+    {
+        std::chrono::duration<double, std::milli> time =
+            std::chrono::steady_clock::now().time_since_epoch();
+        return time.count();
+    }
+
+    // Stop the compiler optimising away a value that is never used
+    template <typename T>
+    static void keep(const T &value)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r"(&value) : "memory");
+#else
+        static const void *volatile sink;
+        sink = &value;
+#endif
+    }
+
+    // Whether a benchmark is selected by the filter (part of its name)
+    static bool selected(const std::string &name)
+    {
+        return name.find(filter()) != std::string::npos;
+    }
+
+    // Time a function. Benchmarks not selected by the filter are skipped (and
+    // return false).
+    template <typename Function>
+    static bool run(const std::string &name, Function function)
+    {
+        if (!selected(name))
+            return false;
+
+        // Anything the function prints is discarded while it is timed
+        silence(true);
+
+        // Double the number of iterations until a sample takes long enough
+        unsigned int iterations = 1;
+        while (iterations < (1u << 30))
+        {
+            double start = now();
+            for (unsigned int i = 0; i < iterations; i++)
+                function();
+            if (now() - start >= sampleTime())
+                break;
+            iterations *= 2;
+        }
+
+        // Time samples until the minimum time has passed
+        std::vector<double> samples;
+        double total = 0.0;
+        while (samples.size() < 5 || (total < minTime() && samples.size() < 1000))
+        {
+            double start = now();
+            for (unsigned int i = 0; i < iterations; i++)
+                function();
+            double time = now() - start;
+            samples.push_back(1.0e6 * time / iterations);
+            total += time;
+        }
+        silence(false);
+
+        // Calculate the statistics
+        std::sort(samples.begin(), samples.end());
+        BenchmarkResult result;
+        result.name       = name;
+        result.iterations = iterations;
+        result.samples    = static_cast<unsigned int>(samples.size());
+        result.min        = samples.front();
+        result.max        = samples.back();
+        result.median     = samples[samples.size() / 2];
+        for (double sample : samples)
+            result.mean += sample / samples.size();
+        results().push_back(result);
+
+        printf("%-56s %12s %12s %10u x %u\n", name.c_str(), format(result.median).c_str(),
+               format(result.min).c_str(), result.samples, result.iterations);
+        return true;
+    }
+
+    // Print the column headings
+    static void printHeader()
+    {
+        printf("%-56s %12s %12s %14s\n", "benchmark", "median", "min", "samples");
+    }
+
+    // Time in ns, us or ms
+    static std::string format(const double ns)
+    {
+        char text[32];
+        if (ns < 1.0e3)
+            snprintf(text, sizeof(text), "%.1f ns", ns);
+        else if (ns < 1.0e6)
+            snprintf(text, sizeof(text), "%.2f us", ns / 1.0e3);
+        else
+            snprintf(text, sizeof(text), "%.2f ms", ns / 1.0e6);
+        return text;
+    }
+
+    // Write the results to a JSON file
+    static bool writeJSON(const char *path,
+                          const std::vector<std::pair<std::string, std::string> > &context)
+    {
+        FILE *file = fopen(path, "w");
+        if (!file)
+        {
+            printf("Could not write %s\n", path);
+            return false;
+        }
+
+        fprintf(file, "{\n  \"context\": {");
+        for (size_t i = 0; i < context.size(); i++)
+            fprintf(file, "%s\n    \"%s\": \"%s\"", i > 0 ? "," : "",
+                    escape(context[i].first).c_str(), escape(context[i].second).c_str());
+        fprintf(file, "\n  },\n  \"benchmarks\": [");
+        const std::vector<BenchmarkResult> &list = results();
+        for (size_t i = 0; i < list.size(); i++)
+        {
+            const BenchmarkResult &r = list[i];
+            fprintf(file, "%s\n    { \"name\": \"%s\", \"iterations\": %u, \"samples\": %u, "
+                    "\"median_ns\": %.3f, \"mean_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f }",
+                    i > 0 ? "," : "", escape(r.name).c_str(), r.iterations, r.samples,
+                    r.median, r.mean, r.min, r.max);
+        }
+        fprintf(file, "\n  ]\n}\n");
+        fclose(file);
+        printf("Results written to %s\n", path);
+        return true;
+    }
+
+    // Read the results from a JSON file written by writeJSON
+    static bool readJSON(const char *path, std::vector<BenchmarkResult> &list)
+    {
+        std::ifstream stream(path, std::ios::in);
+        if (!stream.is_open())
+        {
+            printf("Could not open %s\n", path);
+            return false;
+        }
+        std::stringstream buffer;
+        buffer << stream.rdbuf();
+        std::string text = buffer.str();
+
+        size_t pos = text.find("\"benchmarks\"");
+        if (pos == std::string::npos)
+        {
+            printf("%s has no benchmarks\n", path);
+            return false;
+        }
+
+        // Each benchmark is an object of "key": value pairs
+        while ((pos = text.find('{', pos)) != std::string::npos)
+        {
+            size_t end = text.find('}', pos);
+            if (end == std::string::npos)
+                break;
+            std::string object = text.substr(pos + 1, end - pos - 1);
+
+            BenchmarkResult r;
+            r.name       = readString(object, "name");
+            r.iterations = static_cast<unsigned int>(readNumber(object, "iterations"));
+            r.samples    = static_cast<unsigned int>(readNumber(object, "samples"));
+            r.median     = readNumber(object, "median_ns");
+            r.mean       = readNumber(object, "mean_ns");
+            r.min        = readNumber(object, "min_ns");
+            r.max        = readNumber(object, "max_ns");
+            if (!r.name.empty())
+                list.push_back(r);
+            pos = end + 1;
+        }
+        return true;
+    }
+
+    // Compare the median times with a baseline. Benchmarks more than
+    // tolerance (e.g. 0.1 for 10%) slower are regressions; the number of
+    // regressions is returned.
+    static unsigned int compare(const std::vector<BenchmarkResult> &baseline,
+                                const double tolerance)
+    {
+        printf("\n%-56s %12s %12s %8s\n", "benchmark", "baseline", "now", "change");
+        unsigned int regressions = 0;
+        for (const BenchmarkResult &r : results())
+        {
+            const BenchmarkResult *old = nullptr;
+            for (const BenchmarkResult &b : baseline)
+                if (b.name == r.name)
+                    old = &b;
+
+            if (!old || old->median <= 0.0)
+            {
+                printf("%-56s %12s %12s %8s\n", r.name.c_str(), "-",
+                       format(r.median).c_str(), "new");
+                continue;
+            }
+
+            double ratio = r.median / old->median;
+            const char *flag = "";
+            if (ratio > 1.0 + tolerance)
+            {
+                flag = "  REGRESSION";
+                regressions++;
+            }
+            else if (ratio < 1.0 / (1.0 + tolerance))
+                flag = "  faster";
+            printf("%-56s %12s %12s %+7.1f%%%s\n", r.name.c_str(), format(old->median).c_str(),
+                   format(r.median).c_str(), 100.0 * (ratio - 1.0), flag);
+        }
+
+        printf("\n%u regression%s (tolerance %.0f%%)\n", regressions,
+               regressions == 1 ? "" : "s", 100.0 * tolerance);
+        return regressions;
+    }
+
+    // JSON helpers (enough to read the files written here)
+
+    // Escape quotes and backslashes in a JSON string
+    static std::string escape(const std::string &text)
+    {
+        std::string output;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                output += '\\';
+            output += c;
+        }
+        return output;
+    }
+
+    // Find the value of "key" in a JSON object
+    static size_t findValue(const std::string &object, const std::string &key)
+    {
+        size_t pos = object.find("\"" + key + "\"");
+        if (pos == std::string::npos)
+            return pos;
+        pos = object.find(':', pos + key.size() + 2);
+        if (pos == std::string::npos)
+            return pos;
+        return object.find_first_not_of(" \t\r\n", pos + 1);
+    }
+
+    static std::string readString(const std::string &object, const std::string &key)
+    {
+        size_t pos = findValue(object, key);
+        std::string value;
+        if (pos == std::string::npos || object[pos] != '"')
+            return value;
+        for (pos++; pos < object.size() && object[pos] != '"'; pos++)
+        {
+            if (object[pos] == '\\' && pos + 1 < object.size())
+                pos++;
+            value += object[pos];
+        }
+        return value;
+    }
+
+    static double readNumber(const std::string &object, const std::string &key)
+    {
+        size_t pos = findValue(object, key);
+        if (pos == std::string::npos)
+            return 0.0;
+        return atof(object.c_str() + pos);
+    }
+
+private:
+    // Send stdout to the null device (or back again)
+    static void silence(const bool on)
+    {
+        static int saved = -1;
+        fflush(stdout);
+#ifdef _WIN32
+        if (on && saved < 0)
+        {
+            saved = _dup(_fileno(stdout));
+            int null = _open("NUL", _O_WRONLY);
+            _dup2(null, _fileno(stdout));
+            _close(null);
+        }
+        else if (!on && saved >= 0)
+        {
+            _dup2(saved, _fileno(stdout));
+            _close(saved);
+            saved = -1;
+        }
+#else
+        if (on && saved < 0)
+        {
+            saved = dup(fileno(stdout));
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, fileno(stdout));
+            close(null);
+        }
+        else if (!on && saved >= 0)
+        {
+            dup2(saved, fileno(stdout));
+            close(saved);
+            saved = -1;
+        }
+#endif
+    }
+};
@@ -0,0 +1,968 @@
+// Microbenchmarks of the common code: loading and calculating the tangents
+// of the .obj models, the Maths functions against glm (and glm's SSE
+// simdMat4), spawning jobs and parallelFor with each number of threads and
+// grain size, calculating the matrices of 100000 objects with glm and with
+// the SIMD kernels, uploading them into an instance buffer in each format,
+// loading each image in assets/ with stbi_load, loading Lab09's
+// textures one at a time, in parallel, from KTX files and streamed over
+// several frames, building their mipmaps with each filter, block
+// compressing the images (and the PSNR of the results), the CPU cost of
+// Light::toShader, the time to compile and link each lab's shaders and the
+// latency of ray queries against a million triangles.
+//
+//     ./benchmarks --headless [--filter maths] [--min-time 200]
+//                  [--json results.json] [--compare baseline.json]
+//                  [--tolerance 0.1] [--root path/to/repository]
+//
+// With --compare the results are checked against an earlier --json file and
+// the exit code is 1 if any benchmark is slower by more than the tolerance.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#if (GLM_ARCH & GLM_ARCH_SSE2)
+#include <glm/gtx/simd_mat4.hpp>
+#endif
+
+#include <common/window.hpp>
+#include <common/options.hpp>
+#include <common/shader.hpp>
+#include <common/texture.hpp>
+#include <common/mipmaps.hpp>
+#include <common/ktx.hpp>
+#include <common/blockcompression.hpp>
+#include <common/stb_image.hpp>
+#include <common/maths.hpp>
+#include <common/matrixbatch.hpp>
+#include <common/model.hpp>
+#include <common/light.hpp>
+#include <common/camera.hpp>
+#include <common/scene.hpp>
+#include <common/jobs.hpp>
+#include <common/rayquery.hpp>
+
+#include "benchmark.hpp"
+
+#ifndef LABS_SOURCE_DIR
+#define LABS_SOURCE_DIR ".."
+#endif
+
+// Files in a directory with one of the given extensions, sorted by name
+static std::vector<std::string> listFiles(const std::string &directory,
+                                          const std::vector<std::string> &extensions)
+{
+    std::vector<std::string> names;
+#ifdef _WIN32
+    _finddata_t data;
+    intptr_t handle = _findfirst((directory + "/*").c_str(), &data);
+    if (handle != -1)
+    {
+        do
+            names.push_back(data.name);
+        while (_findnext(handle, &data) == 0);
+        _findclose(handle);
+    }
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (dir)
+    {
+        while (dirent *entry = readdir(dir))
+            names.push_back(entry->d_name);
+        closedir(dir);
+    }
+#endif
+
+    std::vector<std::string> files;
+    for (const std::string &name : names)
+    {
+        size_t dot = name.rfind('.');
+        if (dot == std::string::npos)
+            continue;
+        std::string extension = name.substr(dot + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        if (std::find(extensions.begin(), extensions.end(), extension) != extensions.end())
+            files.push_back(name);
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Model::loadObj and Model::calculateTangents for each .obj file in assets/
+static void modelBenchmarks(const std::string &assets)
+{
+    std::vector<std::string> files = listFiles(assets, { "obj" });
+    if (files.empty())
+        printf("No .obj files in %s\n", assets.c_str());
+
+    for (const std::string &file : files)
+    {
+        if (!Benchmark::selected("Model::loadObj/" + file) &&
+            !Benchmark::selected("Model::calculateTangents/" + file))
+            continue;
+
+        std::string path = assets + "/" + file;
+        Model model(path.c_str());
+
+        Benchmark::run("Model::loadObj/" + file, [&]()
+        {
+            std::vector<glm::vec3> vertices, normals;
+            std::vector<glm::vec2> uvs;
+            model.loadObj(path.c_str(), vertices, uvs, normals);
+            Benchmark::keep(vertices);
+        });
+
+        Benchmark::run("Model::calculateTangents/" + file, [&]()
+        {
+            model.tangents.clear();
+            model.calculateTangents();
+            Benchmark::keep(model.tangents);
+        });
+
+        model.deleteBuffers();
+    }
+}
+
+// Results of the Maths functions with a SIMD level, as floats
+static std::vector<float> mathsResults(const Maths::SimdLevel level,
+                                       const std::vector<glm::mat4> &a,
+                                       const std::vector<glm::mat4> &b,
+                                       const std::vector<glm::mat4> &affine,
+                                       const std::vector<glm::vec3> &points,
+                                       const std::vector<Quaternion> &quaternions)
+{
+    Maths::setSimdLevel(level);
+    std::vector<float> results;
+    auto add = [&](const glm::mat4 &m) { results.insert(results.end(), &m[0][0], &m[0][0] + 16); };
+    for (unsigned int i = 0; i < a.size(); i++)
+    {
+        add(Maths::multiply(a[i], b[i]));
+        add(Maths::inverse(a[i]));
+        add(Maths::transpose(a[i]));
+        add(Maths::affineInverse(affine[i]));
+    }
+
+    std::vector<glm::vec3> output(points.size());
+    Maths::transformPoints(a[0], &points[0], &output[0], static_cast<unsigned int>(points.size()));
+    results.insert(results.end(), &output[0].x, &output[0].x + 3 * output.size());
+    Maths::transformNormals(affine[0], &points[0], &output[0],
+                            static_cast<unsigned int>(points.size()));
+    results.insert(results.end(), &output[0].x, &output[0].x + 3 * output.size());
+
+    std::vector<glm::mat4> matrices(quaternions.size());
+    Maths::quaternionMatrices(&quaternions[0], &matrices[0],
+                              static_cast<unsigned int>(quaternions.size()));
+    for (const glm::mat4 &m : matrices)
+        add(m);
+    return results;
+}
+
+// Maths functions against glm. Each iteration uses the next of a set of
+// random inputs so nothing can be calculated at compile time.
+static void mathsBenchmarks()
+{
+    static const unsigned int n = 256;
+    std::vector<glm::mat4> a(n), b(n);
+    std::vector<glm::vec3> vectors(n), points(1024), output(1024);
+    std::vector<float> angles(n);
+    std::vector<Quaternion> quaternions(n);
+    std::vector<glm::quat> glmQuaternions(n);
+    srand(1);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        for (unsigned int k = 0; k < 16; k++)
+        {
+            a[i][k / 4][k % 4] = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+            b[i][k / 4][k % 4] = static_cast<float>(rand()) / RAND_MAX - 0.5f;
+        }
+        vectors[i] = glm::normalize(glm::vec3(rand() + 1.0f, rand() + 1.0f, rand() + 1.0f));
+        angles[i]  = 6.28f * rand() / RAND_MAX;
+        quaternions[i]    = Quaternion(angles[i], vectors[i]);
+        glmQuaternions[i] = glm::angleAxis(angles[i], vectors[i]);
+    }
+    for (glm::vec3 &point : points)
+        point = glm::vec3(rand(), rand(), rand()) / static_cast<float>(RAND_MAX);
+    std::vector<glm::mat4> affine(n);
+    for (unsigned int i = 0; i < n; i++)
+        affine[i] = Maths::translate(points[i]) * Maths::rotate(angles[i], vectors[i]) *
+                    Maths::scale(0.5f + vectors[i]);
+
+    unsigned int i = 0;
+    glm::mat4 m;
+    const char *simd = Maths::simdName(Maths::simdLevel());
+
+    Benchmark::run(std::string("maths/multiply/Maths (") + simd + ")", [&]()
+    {
+        m = Maths::multiply(a[i], b[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/multiply/glm", [&]()
+    {
+        m = a[i] * b[i]; i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run(std::string("maths/inverse/Maths (") + simd + ")", [&]()
+    {
+        m = Maths::inverse(a[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/inverse/glm", [&]()
+    {
+        m = glm::inverse(a[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run(std::string("maths/transpose/Maths (") + simd + ")", [&]()
+    {
+        m = Maths::transpose(a[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/transpose/glm", [&]()
+    {
+        m = glm::transpose(a[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+
+#if (GLM_ARCH & GLM_ARCH_SSE2)
+    // glm's experimental SSE matrices (its inverse is called directly as
+    // glm::inverse(simdMat4) is declared but not defined in glm 0.9.7)
+    std::vector<glm::simdMat4> simdA(a.begin(), a.end()), simdB(b.begin(), b.end());
+    glm::simdMat4 s;
+    Benchmark::run("maths/multiply/glm simdMat4", [&]()
+    {
+        s = simdA[i] * simdB[i]; i = (i + 1) % n; Benchmark::keep(s);
+    });
+    Benchmark::run("maths/inverse/glm simdMat4", [&]()
+    {
+        glm::detail::sse_inverse_ps(&simdA[i][0].Data, &s[0].Data); i = (i + 1) % n;
+        Benchmark::keep(s);
+    });
+    Benchmark::run("maths/transpose/glm simdMat4", [&]()
+    {
+        s = glm::transpose(simdA[i]); i = (i + 1) % n; Benchmark::keep(s);
+    });
+#endif
+
+    Benchmark::run("maths/translate/Maths", [&]()
+    {
+        m = Maths::translate(vectors[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/translate/glm", [&]()
+    {
+        m = glm::translate(glm::mat4(1.0f), vectors[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/scale/Maths", [&]()
+    {
+        m = Maths::scale(vectors[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/scale/glm", [&]()
+    {
+        m = glm::scale(glm::mat4(1.0f), vectors[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/rotate/Maths", [&]()
+    {
+        m = Maths::rotate(angles[i], vectors[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/rotate/glm", [&]()
+    {
+        m = glm::rotate(glm::mat4(1.0f), angles[i], vectors[i]); i = (i + 1) % n;
+        Benchmark::keep(m);
+    });
+    Benchmark::run("maths/lookAt/Maths", [&]()
+    {
+        m = Maths::lookAt(vectors[i], glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/lookAt/glm", [&]()
+    {
+        m = glm::lookAt(vectors[i], glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/perspective/Maths", [&]()
+    {
+        m = Maths::perspective(angles[i], 1.5f, 0.2f, 100.0f); i = (i + 1) % n;
+        Benchmark::keep(m);
+    });
+    Benchmark::run("maths/perspective/glm", [&]()
+    {
+        m = glm::perspective(angles[i], 1.5f, 0.2f, 100.0f); i = (i + 1) % n;
+        Benchmark::keep(m);
+    });
+    Benchmark::run("maths/quaternion matrix/Maths", [&]()
+    {
+        m = quaternions[i].matrix(); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/quaternion matrix/glm", [&]()
+    {
+        m = glm::mat4_cast(glmQuaternions[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run(std::string("maths/transformPoints x1024/Maths (") + simd + ")", [&]()
+    {
+        Maths::transformPoints(a[i], &points[0], &output[0], 1024); i = (i + 1) % n;
+        Benchmark::keep(output);
+    });
+    Benchmark::run("maths/transformPoints x1024/glm", [&]()
+    {
+        for (unsigned int k = 0; k < 1024; k++)
+            output[k] = glm::vec3(a[i] * glm::vec4(points[k], 1.0f));
+        i = (i + 1) % n; Benchmark::keep(output);
+    });
+    Benchmark::run(std::string("maths/transformNormals x1024/Maths (") + simd + ")", [&]()
+    {
+        Maths::transformNormals(affine[i], &points[0], &output[0], 1024); i = (i + 1) % n;
+        Benchmark::keep(output);
+    });
+    Benchmark::run("maths/transformNormals x1024/glm", [&]()
+    {
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(affine[i])));
+        for (unsigned int k = 0; k < 1024; k++)
+            output[k] = glm::normalize(normalMatrix * points[k]);
+        i = (i + 1) % n; Benchmark::keep(output);
+    });
+    Benchmark::run(std::string("maths/affineInverse/Maths (") + simd + ")", [&]()
+    {
+        m = Maths::affineInverse(affine[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    Benchmark::run("maths/affineInverse/glm", [&]()
+    {
+        m = glm::inverse(affine[i]); i = (i + 1) % n; Benchmark::keep(m);
+    });
+    std::vector<glm::mat4> rotations(n);
+    Benchmark::run(std::string("maths/quaternionMatrices x256/Maths (") + simd + ")", [&]()
+    {
+        Maths::quaternionMatrices(&quaternions[0], &rotations[0], n);
+        Benchmark::keep(rotations);
+    });
+    Benchmark::run("maths/quaternionMatrices x256/glm", [&]()
+    {
+        for (unsigned int k = 0; k < n; k++)
+            rotations[k] = glm::mat4_cast(glmQuaternions[k]);
+        Benchmark::keep(rotations);
+    });
+
+    // The SSE and AVX versions do the same operations in the same order as
+    // the scalar ones, so their results should be the same bits
+    if (Benchmark::selected("maths/"))
+    {
+        Maths::SimdLevel current = Maths::simdLevel();
+        std::vector<float> scalar = mathsResults(Maths::Scalar, a, b, affine, points, quaternions);
+        for (int level = Maths::SSE; level <= Maths::cpuSimdLevel(); level++)
+        {
+            Maths::SimdLevel simdLevel = static_cast<Maths::SimdLevel>(level);
+            bool same = mathsResults(simdLevel, a, b, affine, points, quaternions) == scalar;
+            printf("%-56s %12s\n", (std::string("maths/") + Maths::simdName(simdLevel) +
+                                    " results the same as scalar").c_str(), same ? "yes" : "NO");
+        }
+        Maths::setSimdLevel(current);
+    }
+}
+
+// Spawning empty jobs, and parallelFor over the labs' per object matrix
+// updates with each number of threads (in grains of 1024 objects) and, with
+// all of them, each grain size
+static void jobsBenchmarks()
+{
+    if (!Benchmark::selected("Jobs::"))
+        return;
+
+    std::vector<glm::vec3> positions(1000000);
+    std::vector<glm::mat4> mvp(positions.size());
+    for (unsigned int i = 0; i < positions.size(); i++)
+        positions[i] = glm::vec3(i % 100, (i / 100) % 100, i / 10000);
+    glm::mat4 viewProjection = Maths::perspective(1.0f, 1.33f, 0.1f, 100.0f);
+    auto updateMatrices = [&](const unsigned int grainSize)
+    {
+        Jobs::parallelFor(0, static_cast<unsigned int>(positions.size()), grainSize,
+            [&](unsigned int begin, unsigned int end)
+            {
+                for (unsigned int i = begin; i < end; i++)
+                    mvp[i] = viewProjection * Maths::translate(positions[i]) *
+                             Maths::rotate(0.01f * i, glm::vec3(1.0f)) *
+                             Maths::scale(glm::vec3(0.75f));
+            });
+        Benchmark::keep(mvp);
+    };
+
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= cores; threads *= 2)
+    {
+        Jobs::start(threads - 1);
+        std::string suffix = "/" + std::to_string(threads) + " threads";
+        Benchmark::run("Jobs::run/1000 empty jobs" + suffix, [&]()
+        {
+            JobHandle root = Jobs::create(std::function<void()>());
+            for (unsigned int i = 0; i < 1000; i++)
+                Jobs::run([]() {}, root);
+            Jobs::submit(root);
+            Jobs::wait(root);
+        });
+        Benchmark::run("Jobs::parallelFor/1000000 matrices" + suffix, [&]()
+        {
+            updateMatrices(1024);
+        });
+        Jobs::stop();
+    }
+
+    Jobs::start();
+    std::string suffix = "/" + std::to_string(Jobs::numThreads()) + " threads";
+    for (unsigned int grain = 16; grain <= 65536; grain *= 4)
+        Benchmark::run("Jobs::parallelFor/1000000 matrices/grain " + std::to_string(grain) +
+                       suffix, [&]() { updateMatrices(grain); });
+    Jobs::stop();
+}
+
+// The MV, MVP and normal matrices of 100000 objects one at a time with glm
+// (as the labs did) and with the SIMD kernel in common/matrixbatch.cpp, and
+// only the 48 byte affine model view matrices
+static void matrixBenchmarks()
+{
+    if (!Benchmark::selected("matrices/"))
+        return;
+
+    const unsigned int numObjects = 100000;
+    std::vector<glm::mat4> models(numObjects);
+    MatrixArray modelArray;
+    modelArray.resize(numObjects);
+    srand(1);
+    for (unsigned int i = 0; i < numObjects; i++)
+    {
+        glm::vec3 position(rand() % 100, rand() % 100, rand() % 100);
+        glm::vec3 axis(rand() % 10 + 1, rand() % 10, rand() % 10);
+        glm::vec3 scale(0.5f + 0.1f * (rand() % 10));
+        models[i] = Maths::translate(position) * Maths::rotate(0.01f * i, axis) *
+                    Maths::scale(scale);
+        modelArray.set(i, models[i]);
+    }
+    glm::mat4 view       = Maths::lookAt(glm::vec3(50.0f, 50.0f, 150.0f),
+                                         glm::vec3(50.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = Maths::perspective(Maths::radians(45.0f), 1024.0f / 768.0f,
+                                              0.2f, 500.0f);
+
+    std::vector<ObjectMatrices> output(numObjects);
+    std::vector<Affine> modelViews(numObjects);
+    const char *simd = Maths::simdName(Maths::simdLevel());
+    Benchmark::run("matrices/100000 objects/glm", [&]()
+    {
+        for (unsigned int i = 0; i < numObjects; i++)
+        {
+            output[i].MV  = view * models[i];
+            output[i].MVP = projection * output[i].MV;
+            output[i].normalMatrix = glm::transpose(glm::inverse(glm::mat3(output[i].MV)));
+        }
+        Benchmark::keep(output);
+    });
+    Benchmark::run("matrices/100000 objects/computeObjectMatricesScalar", [&]()
+    {
+        computeObjectMatricesScalar(modelArray, view, projection, &output[0], 0, numObjects);
+        Benchmark::keep(output);
+    });
+    Benchmark::run(std::string("matrices/100000 objects/computeObjectMatrices (") + simd + ")",
+                   [&]()
+    {
+        computeObjectMatrices(modelArray, view, projection, &output[0], 0, numObjects);
+        Benchmark::keep(output);
+    });
+    Benchmark::run(std::string("matrices/100000 objects/computeModelViews (") + simd + ")", [&]()
+    {
+        computeModelViews(modelArray, view, &modelViews[0], 0, numObjects);
+        Benchmark::keep(modelViews);
+    });
+}
+
+// Uploading the matrices of each number of objects into an instance buffer
+// (as Lab09 does) as 48 byte affine model view matrices, as 64 byte mat4s
+// and as the 164 byte MVP, MV and normal matrices the shaders used to take,
+// waiting for the GL to finish with the data each time
+static void uploadBenchmarks()
+{
+    if (!Benchmark::selected("glBufferData/"))
+        return;
+
+    const unsigned int counts[] = { 1000, 10000, 100000 };
+    const char *formats[] = { "Affine", "mat4", "MVP, MV and normal" };
+    const size_t sizes[] = { sizeof(Affine), sizeof(glm::mat4), sizeof(ObjectMatrices) };
+
+    unsigned int buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    for (unsigned int count : counts)
+        for (unsigned int f = 0; f < 3; f++)
+        {
+            std::vector<unsigned char> data(count * sizes[f], 1);
+            Benchmark::run("glBufferData/" + std::to_string(count) + " objects/" + formats[f],
+                           [&]()
+            {
+                glBufferData(GL_ARRAY_BUFFER, data.size(), &data[0], GL_STREAM_DRAW);
+                glFinish();
+            });
+        }
+    glDeleteBuffers(1, &buffer);
+}
+
+// stbi_load for each image in assets/
+static void imageBenchmarks(const std::string &assets)
+{
+    stbi_set_flip_vertically_on_load(true);
+    std::vector<std::string> files = listFiles(assets, { "bmp", "jpg", "jpeg", "png", "tga" });
+    for (const std::string &file : files)
+    {
+        std::string path = assets + "/" + file;
+        Benchmark::run("stbi_load/" + file, [&]()
+        {
+            int width, height, nChannels;
+            unsigned char *data = stbi_load(path.c_str(), &width, &height, &nChannels, 0);
+            Benchmark::keep(data);
+            stbi_image_free(data);
+        });
+    }
+}
+
+// Startup cost of Lab09's textures, the 788 KB blue.bmp and the 2 MB
+// diamond_normal.png: decoded and uploaded one after the other, requested
+// together so they decode in parallel on the job system, mapped from the
+// KTX files of the mipmap cache, and streamed in over several frames
+static void textureBenchmarks(const std::string &assets)
+{
+    if (!Benchmark::selected("Textures::"))
+        return;
+
+    // Make the mipmaps every time, then map the ones made the last time
+    std::string paths[] = { assets + "/blue.bmp", assets + "/diamond_normal.png" };
+    Textures::setMipmapCache("");
+    Benchmark::run("Textures::load/blue.bmp + diamond_normal.png", [&]()
+    {
+        Textures::clear();
+        for (const std::string &path : paths)
+            Textures::load(path.c_str());
+        glFinish();
+    });
+
+    Jobs::start();
+    std::string threads = std::to_string(Jobs::numThreads()) + " threads";
+    Benchmark::run("Textures::request/blue.bmp + diamond_normal.png/" + threads, [&]()
+    {
+        Textures::clear();
+        for (const std::string &path : paths)
+            Textures::request(path.c_str());
+        Textures::finish();
+        glFinish();
+    });
+    Jobs::stop();
+
+    Textures::setMipmapCache(NULL);
+    Textures::clear();
+    for (const std::string &path : paths)
+        Textures::load(path.c_str());
+    Benchmark::run("Textures::load/blue.bmp + diamond_normal.png/KTX cache", [&]()
+    {
+        Textures::clear();
+        for (const std::string &path : paths)
+            Textures::load(path.c_str());
+        glFinish();
+    });
+
+    // Streamed a frame's budget at a time, and the longest a frame waits for
+    // it (against the whole load above)
+    double longest = 0.0;
+    Textures::setStreaming(true);
+    bool streamed = Benchmark::run("Textures::stream/blue.bmp + diamond_normal.png/KTX cache",
+                                   [&]()
+    {
+        Textures::clear();
+        for (const std::string &path : paths)
+            Textures::request(path.c_str());
+        Textures::finish();
+        for (bool streaming = true; streaming;)
+        {
+            double start = Benchmark::now();
+            streaming = Textures::stream();
+            glFinish();
+            longest = std::max(longest, Benchmark::now() - start);
+        }
+    });
+    Textures::setStreaming(false);
+    if (streamed)
+        printf("%-56s %9.2f ms\n", "Textures::stream/longest frame", longest);
+
+    // Asking again for a texture already loaded
+    Benchmark::run("Textures::request/cached", [&]()
+    {
+        unsigned int id = Textures::request(paths[1].c_str());
+        Benchmark::keep(id);
+    });
+    Textures::clear();
+}
+
+// Loading diamond_normal.png's mipmaps from a KTX file: mapping the file
+// and uploading its levels, against reading the file into memory (what
+// loading it can't be faster than)
+static void ktxBenchmarks(const std::string &assets)
+{
+    if (!Benchmark::selected("KTX::"))
+        return;
+
+    int width, height, numComponents;
+    unsigned char *pixels = stbi_load((assets + "/diamond_normal.png").c_str(), &width, &height,
+                                      &numComponents, 0);
+    if (pixels == NULL)
+        return;
+    Mipmaps mipmaps;
+    Mipmaps::Settings settings;
+    settings.normalMap = true;
+    mipmaps.build(pixels, width, height, numComponents, settings);
+    stbi_image_free(pixels);
+    std::string path = "benchmarks.ktx";
+    if (!KTX::write(path, mipmaps))
+        return;
+
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    Benchmark::run("KTX::open + upload/diamond_normal.png", [&]()
+    {
+        KTX ktx;
+        ktx.open(path);
+        ktx.upload();
+        glFinish();
+    });
+    glDeleteTextures(1, &texture);
+
+    std::vector<unsigned char> file(mipmaps.size() + 4096);
+    Benchmark::run("KTX::open + upload/diamond_normal.png/fread only", [&]()
+    {
+        FILE *stream = fopen(path.c_str(), "rb");
+        Benchmark::keep(fread(&file[0], 1, file.size(), stream));
+        fclose(stream);
+    });
+    remove(path.c_str());
+}
+
+// Mipmaps of the 2048 x 2048 diamond_normal.png with each filter, on one
+// thread and on the job system, and of blue.bmp in sRGB and linear
+static void mipmapBenchmarks(const std::string &assets)
+{
+    if (!Benchmark::selected("Mipmaps::build/"))
+        return;
+
+    struct Image
+    {
+        std::string name;
+        int width = 0, height = 0, numComponents = 0;
+        unsigned char *pixels = NULL;
+    };
+    Image images[2];
+    images[0].name = "diamond_normal.png";
+    images[1].name = "blue.bmp";
+    for (Image &image : images)
+        image.pixels = stbi_load((assets + "/" + image.name).c_str(), &image.width,
+                                 &image.height, &image.numComponents, 0);
+
+    const char *filterNames[] = { "box", "kaiser", "lanczos" };
+    Mipmaps mipmaps;
+    Mipmaps::Settings settings;
+    for (int threads = 0; threads < 2; threads++)
+    {
+        if (threads == 1)
+            Jobs::start();
+        std::string suffix = threads == 0 ? "/serial"
+                                          : "/" + std::to_string(Jobs::numThreads()) + " threads";
+        settings.normalMap = true;
+        for (int filter = Mipmaps::Box; filter <= Mipmaps::Lanczos; filter++)
+        {
+            settings.filter = static_cast<Mipmaps::Filter>(filter);
+            Benchmark::run("Mipmaps::build/diamond_normal.png/" +
+                           std::string(filterNames[filter]) + suffix, [&]()
+            {
+                mipmaps.build(images[0].pixels, images[0].width, images[0].height,
+                              images[0].numComponents, settings);
+                Benchmark::keep(mipmaps.levels.back().pixels);
+            });
+        }
+    }
+
+    settings.normalMap = false;
+    settings.filter = Mipmaps::Kaiser;
+    for (int sRGB = 1; sRGB >= 0; sRGB--)
+    {
+        settings.sRGB = sRGB == 1;
+        Benchmark::run("Mipmaps::build/blue.bmp/" + settings.name(), [&]()
+        {
+            mipmaps.build(images[1].pixels, images[1].width, images[1].height,
+                          images[1].numComponents, settings);
+            Benchmark::keep(mipmaps.levels.back().pixels);
+        });
+    }
+    Jobs::stop();
+
+    for (Image &image : images)
+        stbi_image_free(image.pixels);
+}
+
+// Encoding each image in assets/ in the block compressed format Textures
+// uses for it, and diamond_normal.png as BC1 as well as BC5, with the PSNR
+// of the decoded image (of the channels the format keeps)
+static void compressionBenchmarks(const std::string &assets)
+{
+    if (!Benchmark::selected("BlockCompression::encode/"))
+        return;
+
+    const char *formatNames[] = { "BC1", "BC3", "BC4", "BC5" };
+    const unsigned int formatChannels[] = { 3, 4, 1, 2 };
+    stbi_set_flip_vertically_on_load(false);
+    std::vector<std::string> files = listFiles(assets, { "bmp", "jpg", "jpeg", "png", "tga" });
+    for (const std::string &file : files)
+    {
+        int width, height, numComponents;
+        unsigned char *pixels = stbi_load((assets + "/" + file).c_str(), &width, &height,
+                                          &numComponents, 0);
+        if (pixels == NULL)
+            continue;
+
+        bool normalMap = file.find("normal") != std::string::npos;
+        std::vector<BlockCompression::Format> formats;
+        formats.push_back(BlockCompression::format(numComponents, normalMap));
+        if (normalMap)
+            formats.push_back(BlockCompression::format(numComponents, false));
+
+        for (BlockCompression::Format format : formats)
+        {
+            std::vector<unsigned char> blocks(BlockCompression::size(format, width, height));
+            std::string name = "BlockCompression::encode/" + file + "/" + formatNames[format];
+            if (!Benchmark::run(name, [&]()
+            {
+                BlockCompression::encode(pixels, width, height, numComponents, format, &blocks[0]);
+                Benchmark::keep(blocks);
+            }))
+                continue;
+
+            // Calculate the peak signal to noise ratio
+            std::vector<unsigned char> decoded(4 * static_cast<size_t>(width) * height);
+            BlockCompression::decode(&blocks[0], width, height, format, &decoded[0]);
+            unsigned int channels = std::min(formatChannels[format],
+                                             static_cast<unsigned int>(numComponents));
+            double squaredError = 0.0;
+            for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+                for (unsigned int c = 0; c < channels; c++)
+                {
+                    double error = pixels[numComponents * i + c] - decoded[4 * i + c];
+                    squaredError += error * error;
+                }
+            double meanError = squaredError / (static_cast<double>(width) * height * channels);
+            double psnr = meanError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanError) : 99.0;
+            double ratio = static_cast<double>(width) * height * numComponents / blocks.size();
+            printf("%-56s %9.2f dB %9.1f:1\n", (name + " PSNR").c_str(), psnr, ratio);
+        }
+        stbi_image_free(pixels);
+    }
+}
+
+// Light::toShader with the lights of Lab09 and with the most the shaders use
+static void lightBenchmarks(const std::string &root)
+{
+    if (!Benchmark::selected("Light::toShader/"))
+        return;
+
+    std::string lab = root + "/Lab09_Normal_maps/";
+    unsigned int shaderID = LoadShaders((lab + "vertexShader.glsl").c_str(),
+                                        (lab + "fragmentShader.glsl").c_str(),
+                                        { root + "/common/lightingFragmentShader.glsl" });
+    if (shaderID == 0)
+        return;
+    glUseProgram(shaderID);
+
+    Light light;
+    light.addPointLight(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(1.0f), 1.0f, 0.1f, 0.02f);
+    light.addPointLight(glm::vec3(1.0f, 1.0f, -8.0f), glm::vec3(1.0f), 1.0f, 0.1f, 0.02f);
+    light.addSpotLight(glm::vec3(0.0f, 3.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+                       glm::vec3(1.0f, 1.0f, 0.0f), 1.0f, 0.1f, 0.02f, std::cos(Maths::radians(45.0f)));
+    light.addDirectionalLight(glm::vec3(1.0f, -1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    glm::mat4 view = Maths::lookAt(glm::vec3(0.0f, 2.0f, 5.0f), glm::vec3(0.0f),
+                                   glm::vec3(0.0f, 1.0f, 0.0f));
+
+    Benchmark::run("Light::toShader/4 lights", [&]()
+    {
+        light.toShader(shaderID, view);
+    });
+    while (light.lightSources.size() < maxShaderLights)
+        light.addPointLight(glm::vec3(0.0f), glm::vec3(1.0f), 1.0f, 0.1f, 0.02f);
+    Benchmark::run("Light::toShader/" + std::to_string(maxShaderLights) + " lights", [&]()
+    {
+        light.toShader(shaderID, view);
+    });
+
+    glFinish();
+    glDeleteProgram(shaderID);
+    DeleteShaderCache();
+}
+
+// Compile and link each lab's shaders. The shader cache is emptied each time
+// so every shader is compiled (the driver may still cache its own results).
+static void shaderBenchmarks(const std::string &root)
+{
+    struct Program
+    {
+        const char *lab, *vertex, *fragment;
+        bool lighting;
+    };
+    const Program programs[] =
+    {
+        { "Lab02_Basic_shapes",      "vertexShader.glsl",      "fragmentShader.glsl",               false },
+        { "Lab03_Textures",          "vertexShader.glsl",      "fragmentShader.glsl",               false },
+        { "Lab05_Transformations",   "vertexShader.glsl",      "fragmentShader.glsl",               false },
+        { "Lab06_3D_worlds",         "vertexShader.glsl",      "fragmentShader.glsl",               false },
+        { "Lab07_Moving_the_camera", "vertexShader.glsl",      "fragmentShader.glsl",               false },
+        { "Lab08_Lighting",          "vertexShader.glsl",      "multipleLightsFragmentShader.glsl", true  },
+        { "Lab08_Lighting",          "lightVertexShader.glsl", "lightFragmentShader.glsl",          false },
+        { "Lab09_Normal_maps",       "vertexShader.glsl",      "fragmentShader.glsl",               true  },
+        { "Lab09_Normal_maps",       "tbnVertexShader.glsl",   "tbnFragmentShader.glsl",            true  },
+    };
+
+    for (const Program &program : programs)
+    {
+        std::string name = std::string("LoadShaders/") + program.lab + "/" + program.vertex;
+        if (!Benchmark::selected(name))
+            continue;
+
+        std::string directory = root + "/" + program.lab + "/";
+        std::string vertex    = directory + program.vertex;
+        std::string fragment  = directory + program.fragment;
+        std::vector<std::string> modules;
+        if (program.lighting)
+            modules.push_back(root + "/common/lightingFragmentShader.glsl");
+
+        // Check the shaders build before timing them
+        unsigned int shaderID = LoadShaders(vertex.c_str(), fragment.c_str(), modules);
+        DeleteShaderCache();
+        if (shaderID == 0)
+            continue;
+        glDeleteProgram(shaderID);
+
+        Benchmark::run(name, [&]()
+        {
+            unsigned int id = LoadShaders(vertex.c_str(), fragment.c_str(), modules);
+            glDeleteProgram(id);
+            DeleteShaderCache();
+        });
+    }
+}
+
+// RayQuery closest and any hit queries, one ray at a time and in batches,
+// against a grid of 110 teapots (about a million triangles) seen from
+// outside. Each iteration uses the next of 1024 rays spread over the view.
+static void rayQueryBenchmarks(const std::string &assets)
+{
+    if (!Benchmark::selected("RayQuery::"))
+        return;
+
+    Model teapot((assets + "/teapot.obj").c_str());
+    Scene scene;
+    scene.addInstances(110, Scene::Grid);
+    RayQuery query;
+    unsigned int mesh = query.addMesh(teapot);
+    for (unsigned int i = 0; i < scene.instances.size(); i++)
+        query.addInstance(mesh, scene.modelMatrix(i));
+    query.build();
+    std::string triangles = std::to_string((query.numTriangles() + 500) / 1000) + "K triangles";
+
+    Camera camera(glm::vec3(0.0f), glm::vec3(0.0f));
+    float distance = 1.5f * scene.radius + 4.0f;
+    camera.eye = distance * glm::normalize(glm::vec3(0.6f, 0.4f, 1.0f));
+    camera.far = std::max(camera.far, 2.0f * distance);
+    camera.calculateMatrices();
+
+    static const unsigned int n = 1024;
+    std::vector<Ray> rays(n);
+    for (unsigned int i = 0; i < n; i++)
+        rays[i] = RayQuery::cursorRay(32.0 * (i % 32) + 16.0, 24.0 * (i / 32) + 12.0, 1024, 768,
+                                      camera.view, camera.projection);
+
+    unsigned int next = 0;
+    Benchmark::run("RayQuery::intersect/" + triangles, [&]()
+    {
+        RayQuery::Hit hit;
+        query.intersect(rays[next++ % n], hit);
+        Benchmark::keep(hit);
+    });
+    Benchmark::run("RayQuery::occluded/" + triangles, [&]()
+    {
+        bool occluded = query.occluded(rays[next++ % n]);
+        Benchmark::keep(occluded);
+    });
+
+    std::vector<RayQuery::Hit> hits(n);
+    std::vector<unsigned char> occluded(n);
+    Jobs::start();
+    Benchmark::run("RayQuery::intersect/1024 rays/" + triangles, [&]()
+    {
+        query.intersect(&rays[0], &hits[0], n);
+        Benchmark::keep(hits);
+    });
+    Benchmark::run("RayQuery::occluded/1024 rays/" + triangles, [&]()
+    {
+        query.occluded(&rays[0], &occluded[0], n);
+        Benchmark::keep(occluded);
+    });
+    Jobs::stop();
+
+    teapot.deleteBuffers();
+}
+
+int main(int argc, char *argv[])
+{
+    // The model, light and shader benchmarks need an OpenGL context
+    Window window(argc, argv, "Benchmarks", 64, 64);
+    if (!window.isOpen())
+        return -1;
+
+    std::string root     = Options::get("root", LABS_SOURCE_DIR);
+    std::string assets   = root + "/assets";
+    std::string json     = Options::get("json");
+    std::string baseline = Options::get("compare");
+    Benchmark::filter()  = Options::get("filter");
+    Benchmark::minTime() = Options::getFloat("min-time", 200.0f);
+
+    // Read the baseline first so a missing file is found straight away
+    std::vector<BenchmarkResult> baselineResults;
+    if (!baseline.empty() && !Benchmark::readJSON(baseline.c_str(), baselineResults))
+        return -1;
+
+    Benchmark::printHeader();
+    modelBenchmarks(assets);
+    mathsBenchmarks();
+    jobsBenchmarks();
+    matrixBenchmarks();
+    uploadBenchmarks();
+    imageBenchmarks(assets);
+    textureBenchmarks(assets);
+    ktxBenchmarks(assets);
+    mipmapBenchmarks(assets);
+    compressionBenchmarks(assets);
+    lightBenchmarks(root);
+    shaderBenchmarks(root);
+    rayQueryBenchmarks(assets);
+
+    if (!json.empty())
+    {
+        std::vector<std::pair<std::string, std::string> > context;
+        context.push_back(std::make_pair("renderer",
+            std::string(reinterpret_cast<const char *>(glGetString(GL_RENDERER)))));
+        context.push_back(std::make_pair("simd", std::string(Maths::simdName(Maths::simdLevel()))));
+        Benchmark::writeJSON(json.c_str(), context);
+    }
+
+    unsigned int regressions = 0;
+    if (!baseline.empty())
+        regressions = Benchmark::compare(baselineResults,
+                                         Options::getFloat("tolerance", 0.1f));
+
+    window.close();
+    return regressions > 0 ? 1 : 0;
+}
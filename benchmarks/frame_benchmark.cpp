@@ -0,0 +1,335 @@
+// Frame time regression gate: runs each of the windowed labs (Lab02 to Lab09;
+// Lab04 only prints to the console) headless along the built-in scripted
+// camera path for a fixed number of frames, reads the frame time, GPU time
+// and GL call statistics each lab writes with --stats and compares them with
+// a checked-in baseline. A lab fails if a time is more than the tolerance
+// (plus a small slack in ms) slower, or a GL call count more than the call
+// tolerance higher, than in the baseline, so a change that doubles the GL
+// calls per frame always fails. Lab09 is also run with each normal mapping
+// pipeline (--pipeline vertex or tbn) at 1, 4 and 10 light sources.
+//
+//     ./frame_benchmark [--frames 120] [--runs 3] [--labs Lab09]
+//                       [--tolerance 0.25] [--slack 0.5] [--call-tolerance 0.1]
+//                       [--baseline file.json] [--update]
+//                       [--root path/to/repository]
+//
+// The labs are run from their own directories, where the build copies them.
+// Each lab is run several times and the lowest of each time is kept.
+// --update writes the results as the new baseline, keeping the baseline's
+// entries for the runs left out by --labs (the checked-in times are only
+// meaningful on the machine they were measured on; the GL calls are the same
+// everywhere).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <common/options.hpp>
+
+#include "benchmark.hpp"
+
+#ifndef LABS_SOURCE_DIR
+#define LABS_SOURCE_DIR ".."
+#endif
+
+// Run of a lab with extra command line arguments, named lab/suffix in the
+// baseline
+struct LabRun
+{
+    const char *lab;
+    const char *suffix;
+    const char *arguments;
+};
+
+static const LabRun labRuns[] =
+{
+    { "Lab02_Basic_shapes",      "", "" },
+    { "Lab03_Textures",          "", "" },
+    { "Lab05_Transformations",   "", "" },
+    { "Lab06_3D_worlds",         "", "" },
+    { "Lab07_Moving_the_camera", "", "" },
+    { "Lab08_Lighting",          "", "" },
+    { "Lab09_Normal_maps",       "", "" },
+    { "Lab09_Normal_maps", "vertex/1 lights",  "--pipeline vertex --lights 1" },
+    { "Lab09_Normal_maps", "vertex/4 lights",  "--pipeline vertex --lights 4" },
+    { "Lab09_Normal_maps", "vertex/10 lights", "--pipeline vertex --lights 10" },
+    { "Lab09_Normal_maps", "tbn/1 lights",     "--pipeline tbn --lights 1" },
+    { "Lab09_Normal_maps", "tbn/4 lights",     "--pipeline tbn --lights 4" },
+    { "Lab09_Normal_maps", "tbn/10 lights",    "--pipeline tbn --lights 10" },
+};
+
+// Statistics compared with the baseline
+struct Metric
+{
+    const char *key;
+    bool time;                  // times use the time tolerance, calls the call tolerance
+};
+
+static const unsigned int numMetrics = 8;
+static const Metric metrics[numMetrics] =
+{
+    { "mean_ms",       true  },
+    { "p95_ms",        true  },
+    { "p99_ms",        true  },
+    { "gpu_mean_ms",   true  },
+    { "draw_calls",    false },
+    { "uniform_calls", false },
+    { "other_calls",   false },
+    { "gl_calls",      false },
+};
+
+struct LabResult
+{
+    std::string name;
+    std::string renderer;
+    double values[numMetrics];
+};
+
+// Name of a run in the baseline
+static std::string runName(const LabRun &labRun)
+{
+    std::string name = labRun.lab;
+    if (labRun.suffix[0] != '\0')
+        name += std::string("/") + labRun.suffix;
+    return name;
+}
+
+// Result of a run (NULL if there is none)
+static const LabResult *findResult(const std::vector<LabResult> &results,
+                                   const std::string &name)
+{
+    for (const LabResult &result : results)
+        if (result.name == name)
+            return &result;
+    return NULL;
+}
+
+// Read a whole file into a string
+static bool readFile(const std::string &path, std::string &text)
+{
+    std::ifstream stream(path.c_str(), std::ios::in);
+    if (!stream.is_open())
+        return false;
+    std::stringstream buffer;
+    buffer << stream.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+// Run a lab headless from its own directory and read its statistics
+static bool runLab(const std::string &root, const LabRun &labRun,
+                   const unsigned int frames, const unsigned int runs, LabResult &result)
+{
+    std::string lab  = labRun.lab;
+    std::string name = runName(labRun);
+    std::string directory = root + "/" + lab;
+    std::string statsPath = directory + "/frame_stats.json";
+    std::string logPath   = directory + "/frame_benchmark.log";
+    remove(statsPath.c_str());
+
+#ifdef _WIN32
+    std::string command = "cd /d \"" + directory + "\" && \"" + lab + ".exe\"";
+#else
+    std::string command = "cd \"" + directory + "\" && \"./" + lab + "\"";
+#endif
+    command += " --headless --scripted-path --frames " + std::to_string(frames) +
+               " --stats frame_stats.json " + labRun.arguments + " > frame_benchmark.log 2>&1";
+
+    double start = Benchmark::now();
+    for (unsigned int run = 0; run < runs; run++)
+    {
+        std::string text;
+        int status = system(command.c_str());
+        if (status != 0 || !readFile(statsPath, text))
+        {
+            printf("%-34s failed (exit status %d), see %s\n", name.c_str(), status,
+                   logPath.c_str());
+            return false;
+        }
+        remove(statsPath.c_str());
+        remove(logPath.c_str());
+
+        // Keep the lowest of each time (the GL calls are the same every run)
+        result.name     = name;
+        result.renderer = Benchmark::readString(text, "renderer");
+        for (unsigned int i = 0; i < numMetrics; i++)
+        {
+            double value = Benchmark::readNumber(text, metrics[i].key);
+            if (run == 0 || (metrics[i].time && value < result.values[i]))
+                result.values[i] = value;
+        }
+    }
+
+    printf("%-34s %u x %u frames in %.1f s\n", name.c_str(), runs, frames,
+           (Benchmark::now() - start) / 1000.0);
+    return true;
+}
+
+// Read a baseline written by writeBaseline
+static bool readBaseline(const std::string &path, std::vector<LabResult> &results,
+                         unsigned int &frames, std::string &renderer)
+{
+    std::string text;
+    if (!readFile(path, text))
+    {
+        printf("Could not open %s\n", path.c_str());
+        return false;
+    }
+
+    size_t pos = text.find("\"labs\"");
+    if (pos == std::string::npos)
+    {
+        printf("%s has no labs\n", path.c_str());
+        return false;
+    }
+    frames   = static_cast<unsigned int>(Benchmark::readNumber(text.substr(0, pos), "frames"));
+    renderer = Benchmark::readString(text.substr(0, pos), "renderer");
+
+    // Each lab is an object of "key": value pairs
+    while ((pos = text.find('{', pos)) != std::string::npos)
+    {
+        size_t end = text.find('}', pos);
+        if (end == std::string::npos)
+            break;
+        std::string object = text.substr(pos + 1, end - pos - 1);
+
+        LabResult result;
+        result.name     = Benchmark::readString(object, "name");
+        result.renderer = renderer;
+        for (unsigned int i = 0; i < numMetrics; i++)
+            result.values[i] = Benchmark::readNumber(object, metrics[i].key);
+        if (!result.name.empty())
+            results.push_back(result);
+        pos = end + 1;
+    }
+    return true;
+}
+
+static bool writeBaseline(const std::string &path, const std::vector<LabResult> &results,
+                          const unsigned int frames)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file)
+    {
+        printf("Could not write %s\n", path.c_str());
+        return false;
+    }
+
+    fprintf(file, "{\n  \"renderer\": \"%s\",\n  \"frames\": %u,\n  \"labs\": [",
+            results.empty() ? "" : Benchmark::escape(results[0].renderer).c_str(), frames);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        fprintf(file, "%s\n    { \"name\": \"%s\"", i > 0 ? "," : "",
+                Benchmark::escape(results[i].name).c_str());
+        for (unsigned int k = 0; k < numMetrics; k++)
+            fprintf(file, ", \"%s\": %.3f", metrics[k].key, results[i].values[k]);
+        fprintf(file, " }");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    fclose(file);
+    printf("Baseline written to %s\n", path.c_str());
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Options::parse(argc, argv);
+    std::string root         = Options::get("root", LABS_SOURCE_DIR);
+    std::string baselinePath = Options::get("baseline", root + "/benchmarks/frame_baseline.json");
+    std::string filter       = Options::get("labs");
+    unsigned int frames      = std::max(Options::getInt("frames", 120), 2);
+    unsigned int runs        = std::max(Options::getInt("runs", 3), 1);
+    double tolerance         = Options::getFloat("tolerance", 0.25f);
+    double slack             = Options::getFloat("slack", 0.5f);
+    double callTolerance     = Options::getFloat("call-tolerance", 0.1f);
+    bool update              = Options::has("update");
+
+    // Run the labs
+    std::vector<LabResult> results;
+    unsigned int failures = 0;
+    for (const LabRun &labRun : labRuns)
+    {
+        if (runName(labRun).find(filter) == std::string::npos)
+            continue;
+
+        LabResult result;
+        if (runLab(root, labRun, frames, runs, result))
+            results.push_back(result);
+        else
+            failures++;
+    }
+
+    std::vector<LabResult> baseline;
+    unsigned int baselineFrames = 0;
+    std::string baselineRenderer;
+    if (update)
+    {
+        if (failures > 0)
+            return 1;
+
+        // Keep the baseline's other runs, in the order of the runs
+        if (!filter.empty() && readBaseline(baselinePath, baseline, baselineFrames,
+                                            baselineRenderer))
+        {
+            std::vector<LabResult> merged;
+            for (const LabRun &labRun : labRuns)
+            {
+                const LabResult *result = findResult(results, runName(labRun));
+                if (!result)
+                    result = findResult(baseline, runName(labRun));
+                if (result)
+                    merged.push_back(*result);
+            }
+            results.swap(merged);
+        }
+        return writeBaseline(baselinePath, results, frames) ? 0 : 1;
+    }
+
+    if (!readBaseline(baselinePath, baseline, baselineFrames, baselineRenderer))
+        return 1;
+    if (!results.empty() && results[0].renderer != baselineRenderer)
+        printf("Warning: the baseline times were measured with %s, not %s\n",
+               baselineRenderer.c_str(), results[0].renderer.c_str());
+    if (baselineFrames != frames)
+        printf("Warning: the baseline was measured over %u frames, not %u\n",
+               baselineFrames, frames);
+
+    // Compare each statistic with the baseline
+    printf("\n%-34s %-14s %12s %12s %9s\n", "lab", "", "baseline", "now", "change");
+    for (const LabResult &result : results)
+    {
+        const LabResult *old = findResult(baseline, result.name);
+
+        for (unsigned int i = 0; i < numMetrics; i++)
+        {
+            const char *name = i == 0 ? result.name.c_str() : "";
+            double now = result.values[i];
+            if (!old)
+            {
+                printf("%-34s %-14s %12s %12.3f %9s\n", name, metrics[i].key, "-", now, "new");
+                continue;
+            }
+
+            double before = old->values[i];
+            double limit  = metrics[i].time ? before * (1.0 + tolerance) + slack
+                                            : before * (1.0 + callTolerance);
+            bool failed = now > limit;
+            failures += failed ? 1 : 0;
+
+            char change[32] = "";
+            if (before > 0.0)
+                snprintf(change, sizeof(change), "%+.1f%%", 100.0 * (now / before - 1.0));
+            printf("%-34s %-14s %12.3f %12.3f %9s%s\n", name, metrics[i].key, before, now,
+                   change, failed ? "  FAIL" : "");
+        }
+    }
+
+    printf("\n%u failure%s (time tolerance %.0f%% + %.2f ms, call tolerance %.0f%%)\n",
+           failures, failures == 1 ? "" : "s", 100.0 * tolerance, slack,
+           100.0 * callTolerance);
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+// Path tracer benchmark: builds the BVH of scenes from one teapot up to
+// millions of triangles (grids of teapots made by the scene generator, lit
+// by the light sources of Lab09) on 1, 2, 4, ... threads and path traces
+// them, reporting the build time, the quality of the hierarchy and the
+// millions of rays traced per second. Each iteration of a render benchmark
+// traces one sample per pixel.
+//
+//     ./pathtracer_benchmark --headless [--instances 1,10,100,300]
+//                            [--width 320] [--height 240] [--bounces 4]
+//                            [--threads 8] [--filter BVH] [--min-time 200]
+//                            [--json results.json] [--compare baseline.json]
+//                            [--tolerance 0.1] [--output DIR] [--samples 4]
+//                            [--root path/to/repository]
+//
+// With --compare the results are checked against an earlier --json file and
+// the exit code is 1 if any benchmark is slower by more than the tolerance.
+// --output writes the image of each scene, rendered with --samples samples
+// per pixel, to DIR/pathtracer_N.png, so many samples make a reference
+// image, e.g. --instances 10 --samples 1024 --width 1024 --height 768
+// --output .
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <thread>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+#include <common/window.hpp>
+#include <common/options.hpp>
+#include <common/texture.hpp>
+#include <common/maths.hpp>
+#include <common/camera.hpp>
+#include <common/model.hpp>
+#include <common/light.hpp>
+#include <common/scene.hpp>
+#include <common/jobs.hpp>
+#include <common/pathtracer.hpp>
+
+#include "benchmark.hpp"
+
+#ifndef LABS_SOURCE_DIR
+#define LABS_SOURCE_DIR ".."
+#endif
+
+// Comma separated list of numbers
+static std::vector<unsigned int> readList(const std::string &text)
+{
+    std::vector<unsigned int> list;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (atoi(item.c_str()) > 0)
+            list.push_back(atoi(item.c_str()));
+    return list;
+}
+
+int main(int argc, char *argv[])
+{
+    // The window is only used for the models' OpenGL buffers
+    Window window(argc, argv, "Path tracer benchmark");
+    if (!window.isOpen())
+        return -1;
+
+    std::string root     = Options::get("root", LABS_SOURCE_DIR);
+    std::string output   = Options::get("output");
+    std::string json     = Options::get("json");
+    std::string baseline = Options::get("compare");
+    Benchmark::filter()  = Options::get("filter");
+    Benchmark::minTime() = Options::getFloat("min-time", 200.0f);
+    unsigned int width   = std::max(Options::getInt("width", 320), 1);
+    unsigned int height  = std::max(Options::getInt("height", 240), 1);
+    unsigned int samples = std::max(Options::getInt("samples", 4), 1);
+    unsigned int cores   = std::max(std::thread::hardware_concurrency(), 1u);
+    unsigned int maxThreads = std::max(Options::getInt("threads", static_cast<int>(cores)), 1);
+    std::vector<unsigned int> sizes = readList(Options::get("instances", "1,10,100,300"));
+
+    // Read the baseline first so a missing file is found straight away
+    std::vector<BenchmarkResult> baselineResults;
+    if (!baseline.empty() && !Benchmark::readJSON(baseline.c_str(), baselineResults))
+        return -1;
+
+    // Teapot of Lab09 and its light sources
+    Model teapot((root + "/assets/teapot.obj").c_str());
+    teapot.addTexture((root + "/assets/blue.bmp").c_str(), "diffuse");
+    teapot.addTexture((root + "/assets/diamond_normal.png").c_str(), "normal");
+    teapot.ka = 0.2f;
+    teapot.kd = 0.7f;
+    teapot.ks = 1.0f;
+    teapot.Ns = 20.0f;
+
+    Light lights;
+    lights.addPointLight(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(1.0f), 1.0f, 0.1f, 0.02f);
+    lights.addPointLight(glm::vec3(1.0f, 1.0f, -8.0f), glm::vec3(1.0f), 1.0f, 0.1f, 0.02f);
+    lights.addSpotLight(glm::vec3(0.0f, 3.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+                        glm::vec3(1.0f, 1.0f, 0.0f), 1.0f, 0.1f, 0.02f,
+                        std::cos(Maths::radians(45.0f)));
+    lights.addDirectionalLight(glm::vec3(1.0f, -1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    PathTracer pathTracer(width, height);
+    pathTracer.maxBounces = std::max(Options::getInt("bounces", 4), 0);
+    pathTracer.setLights(lights);
+    printf("%u x %u pixels, up to %u bounces\n\n", width, height, pathTracer.maxBounces);
+    Benchmark::printHeader();
+
+    for (unsigned int size : sizes)
+    {
+        // Grid of teapots with the camera looking at it from outside
+        Scene scene;
+        scene.addInstances(size, Scene::Grid);
+        std::vector<glm::mat4> models(size);
+        for (unsigned int i = 0; i < size; i++)
+            models[i] = scene.modelMatrix(i);
+
+        Camera camera(glm::vec3(0.0f), glm::vec3(0.0f));
+        float distance = 1.5f * scene.radius + 4.0f;
+        camera.eye = distance * glm::normalize(glm::vec3(0.6f, 0.4f, 1.0f));
+        camera.far = std::max(camera.far, 2.0f * distance);
+        camera.calculateMatrices();
+
+        pathTracer.clear();
+        pathTracer.add(teapot, &models[0], size);
+        std::string triangles = std::to_string(size * (teapot.vertices.size() / 3)) + " triangles";
+        for (unsigned int threads : threadCounts)
+        {
+            Jobs::start(threads - 1);
+            std::string suffix = "/" + triangles + "/" + std::to_string(threads) + " threads";
+            if (Benchmark::run("BVH::build" + suffix, [&]() { pathTracer.build(); }))
+            {
+                const BVH &bvh = pathTracer.getBVH();
+                printf("%-56s %9u nodes, depth %u, SAH %.1f\n", ("BVH::build" + suffix).c_str(),
+                       pathTracer.stats.nodes, bvh.depth, bvh.cost());
+            }
+
+            // The path tracer needs a hierarchy even when its build isn't timed
+            if (Benchmark::selected("PathTracer::render" + suffix))
+            {
+                if (pathTracer.getBVH().nodes.empty())
+                    pathTracer.build();
+                pathTracer.setCamera(camera.view, camera.projection);
+                pathTracer.reset();
+                Benchmark::run("PathTracer::render" + suffix, [&]() { pathTracer.render(); });
+                const PathTracer::Stats &stats = pathTracer.stats;
+                printf("%-56s %9.2f Mrays/s\n", ("PathTracer::render" + suffix).c_str(),
+                       stats.rays / (1000.0 * stats.renderTime));
+            }
+            Jobs::stop();
+        }
+
+        if (!output.empty())
+        {
+            if (pathTracer.getBVH().nodes.empty())
+                pathTracer.build();
+            pathTracer.setCamera(camera.view, camera.projection);
+            pathTracer.reset();
+            for (unsigned int s = 0; s < samples; s++)
+                pathTracer.render();
+            pathTracer.writePNG((output + "/pathtracer_" + std::to_string(size) + ".png").c_str());
+        }
+    }
+
+    if (!json.empty())
+    {
+        std::vector<std::pair<std::string, std::string> > context;
+        context.push_back(std::make_pair("simd", std::string(Maths::simdName(Maths::simdLevel()))));
+        context.push_back(std::make_pair("size", std::to_string(width) + " x " +
+                                                 std::to_string(height)));
+        context.push_back(std::make_pair("bounces", std::to_string(pathTracer.maxBounces)));
+        Benchmark::writeJSON(json.c_str(), context);
+    }
+
+    unsigned int regressions = 0;
+    if (!baseline.empty())
+        regressions = Benchmark::compare(baselineResults,
+                                         Options::getFloat("tolerance", 0.1f));
+
+    teapot.deleteBuffers();
+    window.close();
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,299 @@
+// CPU rasterizer benchmark: renders the Lab09 scene (normal mapped teapots
+// lit by four lights, and the light sources) on a camera orbit with OpenGL
+// (llvmpipe on machines without a GPU) and with the CPU Rasterizer on 1, 2,
+// 4, ... threads, and reports the frame times and millions of triangles
+// drawn per second. Each iteration of a benchmark draws the next frame of
+// the orbit. The first frame of each renderer is compared to check they
+// draw the same picture. Larger scenes are generated as in the labs.
+//
+//     ./raster_benchmark --headless [--frames 60] [--threads 8]
+//                        [--instances 1000] [--layout grid] [--seed 1]
+//                        [--filter Rasterizer] [--min-time 200]
+//                        [--json results.json] [--compare baseline.json]
+//                        [--tolerance 0.1] [--images DIR]
+//                        [--root path/to/repository]
+//
+// With --compare the results are checked against an earlier --json file and
+// the exit code is 1 if any benchmark is slower by more than the tolerance.
+// --images writes the first frame of each renderer to DIR/opengl.png and
+// DIR/rasterizer.png. llvmpipe's own threads are set with LP_NUM_THREADS.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <thread>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <common/window.hpp>
+#include <common/options.hpp>
+#include <common/shader.hpp>
+#include <common/texture.hpp>
+#include <common/maths.hpp>
+#include <common/camera.hpp>
+#include <common/model.hpp>
+#include <common/light.hpp>
+#include <common/scene.hpp>
+#include <common/jobs.hpp>
+#include <common/rasterizer.hpp>
+
+#include "benchmark.hpp"
+
+#ifndef LABS_SOURCE_DIR
+#define LABS_SOURCE_DIR ".."
+#endif
+
+// Millions of triangles drawn per second by the last benchmark run, and its
+// speed-up over a reference time in ns (0 for none)
+static void printThroughput(const double triangles, const double reference,
+                            const char *breakdown = "")
+{
+    const BenchmarkResult &result = Benchmark::results().back();
+    printf("%-56s %9.1f Mtri/s", (result.name + " throughput").c_str(),
+           1000.0 * triangles / result.median);
+    if (reference > 0.0)
+        printf(" %8.2fx", reference / result.median);
+    printf(" %s\n", breakdown);
+}
+
+int main(int argc, char *argv[])
+{
+    Window window(argc, argv, "Rasterizer benchmark");
+    if (!window.isOpen())
+        return -1;
+
+    std::string root     = Options::get("root", LABS_SOURCE_DIR);
+    std::string images   = Options::get("images");
+    std::string json     = Options::get("json");
+    std::string baseline = Options::get("compare");
+    Benchmark::filter()  = Options::get("filter");
+    Benchmark::minTime() = Options::getFloat("min-time", 200.0f);
+    unsigned int frames  = std::max(Options::getInt("frames", 60), 1);
+    unsigned int cores   = std::max(std::thread::hardware_concurrency(), 1u);
+    unsigned int maxThreads = std::max(Options::getInt("threads", static_cast<int>(cores)), 1);
+
+    // Shaders and models of Lab09 (the paths are relative to the repository
+    // so the benchmark runs from anywhere)
+    std::string lab = root + "/Lab09_Normal_maps/";
+    unsigned int shaderID = LoadShaders((lab + "tbnVertexShader.glsl").c_str(),
+                                        (lab + "tbnFragmentShader.glsl").c_str(),
+                                        { root + "/common/lightingFragmentShader.glsl" });
+    unsigned int lightShaderID = LoadShaders((lab + "lightVertexShader.glsl").c_str(),
+                                             (lab + "lightFragmentShader.glsl").c_str());
+    if (shaderID == 0 || lightShaderID == 0)
+        return -1;
+
+    Model teapot((root + "/assets/teapot.obj").c_str());
+    Model sphere((root + "/assets/sphere.obj").c_str());
+    teapot.addTexture((root + "/assets/blue.bmp").c_str(), "diffuse");
+    teapot.addTexture((root + "/assets/diamond_normal.png").c_str(), "normal");
+    teapot.ka = 0.2f;
+    teapot.kd = 0.7f;
+    teapot.ks = 1.0f;
+    teapot.Ns = 20.0f;
+
+    // The light sources of Lab09
+    Light lights;
+    lights.lightShaderID = lightShaderID;
+    lights.addPointLight(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(1.0f), 1.0f, 0.1f, 0.02f);
+    lights.addPointLight(glm::vec3(1.0f, 1.0f, -8.0f), glm::vec3(1.0f), 1.0f, 0.1f, 0.02f);
+    lights.addSpotLight(glm::vec3(0.0f, 3.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+                        glm::vec3(1.0f, 1.0f, 0.0f), 1.0f, 0.1f, 0.02f,
+                        std::cos(Maths::radians(45.0f)));
+    lights.addDirectionalLight(glm::vec3(1.0f, -1.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+
+    // Teapots placed as in Lab09, or a generated scene
+    Scene scene(Options::getInt("seed", 1));
+    if (Options::has("instances"))
+    {
+        scene.addInstances(Options::getInt("instances", 100),
+                           Scene::layoutFromName(Options::get("layout", "grid")));
+    }
+    else
+    {
+        glm::vec3 teapotPositions[] = {
+            glm::vec3( 0.0f,  0.0f,  0.0f), glm::vec3( 2.0f,  5.0f, -10.0f),
+            glm::vec3(-3.0f, -2.0f, -3.0f), glm::vec3(-4.0f, -2.0f, -8.0f),
+            glm::vec3( 2.0f,  2.0f, -6.0f), glm::vec3(-4.0f,  3.0f, -8.0f),
+            glm::vec3( 0.0f, -2.0f, -5.0f), glm::vec3( 4.0f,  2.0f, -4.0f),
+            glm::vec3( 2.0f,  0.0f, -2.0f), glm::vec3(-1.0f,  1.0f, -2.0f)
+        };
+        for (unsigned int i = 0; i < 10; i++)
+            scene.addInstance(teapotPositions[i], glm::vec3(1.0f),
+                              Maths::radians(20.0f * i), 0.75f);
+    }
+    unsigned int numInstances = static_cast<unsigned int>(scene.instances.size());
+    double triangles = numInstances * (teapot.vertices.size() / 3.0) +
+                       lights.lightSources.size() * (sphere.vertices.size() / 3.0);
+
+    // Camera orbiting the scene
+    Camera camera(glm::vec3(0.0f, 0.0f, 4.0f), glm::vec3(0.0f));
+    float orbit = std::max(5.0f, 0.75f * scene.radius);
+    camera.far  = std::max(camera.far, 4.0f * scene.radius);
+    std::vector<std::vector<Affine> > modelViews(frames, std::vector<Affine>(numInstances));
+    std::vector<glm::mat4> views(frames);
+    for (unsigned int f = 0; f < frames; f++)
+    {
+        float angle = 2.0f * 3.14159265f * f / frames;
+        camera.eye  = glm::vec3(orbit * std::sin(angle), 0.5f, orbit * std::cos(angle));
+        camera.calculateMatrices();
+        views[f] = camera.view;
+        for (unsigned int i = 0; i < numInstances; i++)
+            modelViews[f][i] = Affine(camera.view * scene.modelMatrix(i));
+    }
+
+    printf("%u teapots and %u lights, %.0f triangles per frame, %u x %u pixels, %u frames\n",
+           numInstances, static_cast<unsigned int>(lights.lightSources.size()), triangles,
+           window.width, window.height, frames);
+
+    // Read the baseline first so a missing file is found straight away
+    std::vector<BenchmarkResult> baselineResults;
+    if (!baseline.empty() && !Benchmark::readJSON(baseline.c_str(), baselineResults))
+        return -1;
+
+    // Render with OpenGL, waiting for each frame to finish
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+    unsigned int instanceBuffer;
+    glGenBuffers(1, &instanceBuffer);
+    teapot.setInstanceBuffer(instanceBuffer, 5);
+    auto drawOpenGL = [&](const unsigned int frame)
+    {
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glUseProgram(shaderID);
+        lights.toShader(shaderID, views[frame]);
+        glUniformMatrix4fv(glGetUniformLocation(shaderID, "P"), 1, GL_FALSE, &camera.projection[0][0]);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, numInstances * sizeof(Affine), &modelViews[frame][0],
+                     GL_STREAM_DRAW);
+        teapot.draw(shaderID, numInstances);
+        lights.draw(views[frame], camera.projection, sphere);
+        glFinish();
+    };
+
+    // Keep the first frame (with its first row at the top), which also
+    // loads the textures and compiles the shaders before anything is timed
+    drawOpenGL(0);
+    std::vector<unsigned char> glPixels(4 * window.width * window.height);
+    {
+        std::vector<unsigned char> pixels(glPixels.size());
+        glReadPixels(0, 0, window.width, window.height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+        unsigned int rowSize = 4 * window.width;
+        for (unsigned int y = 0; y < window.height; y++)
+            memcpy(&glPixels[y * rowSize], &pixels[(window.height - 1 - y) * rowSize], rowSize);
+    }
+
+    Benchmark::printHeader();
+    std::string sceneName = std::to_string(numInstances) + " teapots";
+    unsigned int frame = 0;
+    double glTime = 0.0;
+    if (Benchmark::run("OpenGL/" + sceneName, [&]()
+    {
+        drawOpenGL(frame);
+        frame = (frame + 1) % frames;
+    }))
+    {
+        glTime = Benchmark::results().back().median;
+        printThroughput(triangles, glTime);
+    }
+
+    // Render with the CPU rasterizer on increasing numbers of threads
+    Rasterizer rasterizer(window.width, window.height);
+    auto drawRasterizer = [&](const unsigned int frame)
+    {
+        rasterizer.begin(views[frame], camera.projection, lights);
+        rasterizer.draw(teapot, &modelViews[frame][0], numInstances);
+        rasterizer.drawLights(lights, sphere);
+        rasterizer.end();
+    };
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    for (unsigned int threads : threadCounts)
+    {
+        Jobs::start(threads - 1);
+        double setupTime = 0.0, rasterTime = 0.0;
+        unsigned int numFrames = 0;
+        frame = 0;
+        bool ran = Benchmark::run("Rasterizer/" + sceneName + "/" + std::to_string(threads) +
+                                  " threads", [&]()
+        {
+            drawRasterizer(frame);
+            frame = (frame + 1) % frames;
+            setupTime  += rasterizer.stats.setupTime;
+            rasterTime += rasterizer.stats.rasterTime;
+            numFrames++;
+        });
+        Jobs::stop();
+
+        if (ran)
+        {
+            char breakdown[64];
+            snprintf(breakdown, sizeof(breakdown), "(set up %.2f ms, rasterize and shade %.2f ms)",
+                     setupTime / numFrames, rasterTime / numFrames);
+            printThroughput(triangles, glTime, breakdown);
+        }
+    }
+
+    // First frame statistics
+    drawRasterizer(0);
+    const Rasterizer::Stats &stats = rasterizer.stats;
+    printf("\nFirst frame: %u triangles set up, %u binned into tiles, %u tiles and blocks "
+           "skipped by the depth test, %u pixels shaded\n", stats.setup, stats.binned,
+           stats.hizCulled, stats.fragments);
+
+    // Compare the first frames
+    const unsigned char *cpuPixels = rasterizer.pixels();
+    double difference = 0.0;
+    unsigned int differentPixels = 0;
+    for (unsigned int i = 0; i < window.width * window.height; i++)
+    {
+        int largest = 0;
+        for (unsigned int c = 0; c < 3; c++)
+        {
+            int d = std::abs(cpuPixels[4 * i + c] - glPixels[4 * i + c]);
+            difference += d;
+            largest = std::max(largest, d);
+        }
+        differentPixels += largest > 16 ? 1 : 0;
+    }
+    printf("First frame difference: mean %.2f / 255, %.2f%% of pixels differ by more than 16 / 255\n",
+           difference / (3.0 * window.width * window.height),
+           100.0 * differentPixels / (window.width * window.height));
+
+    if (!images.empty())
+    {
+        writePNG((images + "/opengl.png").c_str(), &glPixels[0], window.width, window.height, 4);
+        rasterizer.writePNG((images + "/rasterizer.png").c_str());
+    }
+
+    if (!json.empty())
+    {
+        std::vector<std::pair<std::string, std::string> > context;
+        context.push_back(std::make_pair("renderer",
+            std::string(reinterpret_cast<const char *>(glGetString(GL_RENDERER)))));
+        context.push_back(std::make_pair("simd", std::string(Maths::simdName(Maths::simdLevel()))));
+        context.push_back(std::make_pair("size", std::to_string(window.width) + " x " +
+                                                 std::to_string(window.height)));
+        Benchmark::writeJSON(json.c_str(), context);
+    }
+
+    unsigned int regressions = 0;
+    if (!baseline.empty())
+        regressions = Benchmark::compare(baselineResults,
+                                         Options::getFloat("tolerance", 0.1f));
+
+    glDeleteBuffers(1, &instanceBuffer);
+    teapot.deleteBuffers();
+    sphere.deleteBuffers();
+    glDeleteProgram(shaderID);
+    glDeleteProgram(lightShaderID);
+    DeleteShaderCache();
+    window.close();
+    return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,524 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+#include <common/blockcompression.hpp>
+#include <common/jobs.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCKCOMPRESSION_SSE
+#include <immintrin.h>
+#endif
+
+// =============================================================================
+// BC1 colour blocks
+
+// Colour as 5:6:5 bits and back (the 5 and 6 bit values are widened to 8
+// bits by repeating their top bits, as the GPU does)
+static uint16_t to565(const float r, const float g, const float b)
+{
+    int R = std::min(std::max(static_cast<int>(r * (31.0f / 255.0f) + 0.5f), 0), 31);
+    int G = std::min(std::max(static_cast<int>(g * (63.0f / 255.0f) + 0.5f), 0), 63);
+    int B = std::min(std::max(static_cast<int>(b * (31.0f / 255.0f) + 0.5f), 0), 31);
+    return static_cast<uint16_t>(R << 11 | G << 5 | B);
+}
+
+static void from565(const uint16_t colour, int rgb[3])
+{
+    int R = colour >> 11, G = colour >> 5 & 63, B = colour & 31;
+    rgb[0] = R << 3 | R >> 2;
+    rgb[1] = G << 2 | G >> 4;
+    rgb[2] = B << 3 | B >> 2;
+}
+
+// Choose the nearest of the four colours between two 5:6:5 colours for each
+// pixel and return the squared error
+static float chooseIndices(const float *r, const float *g, const float *b, const uint16_t c0,
+                           const uint16_t c1, uint32_t &indices)
+{
+    int a[3], z[3];
+    from565(c0, a);
+    from565(c1, z);
+    float palette[4][3];
+    for (unsigned int c = 0; c < 3; c++)
+    {
+        palette[0][c] = static_cast<float>(a[c]);
+        palette[1][c] = static_cast<float>(z[c]);
+        palette[2][c] = static_cast<float>((2 * a[c] + z[c]) / 3);
+        palette[3][c] = static_cast<float>((a[c] + 2 * z[c]) / 3);
+    }
+
+    indices = 0;
+    float error = 0.0f;
+#ifdef BLOCKCOMPRESSION_SSE
+    __m128 total = _mm_setzero_ps();
+    for (unsigned int i = 0; i < 16; i += 4)
+    {
+        __m128 R = _mm_loadu_ps(r + i), G = _mm_loadu_ps(g + i), B = _mm_loadu_ps(b + i);
+        __m128 best = _mm_set1_ps(1e30f);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int k = 0; k < 4; k++)
+        {
+            __m128 dR = _mm_sub_ps(R, _mm_set1_ps(palette[k][0]));
+            __m128 dG = _mm_sub_ps(G, _mm_set1_ps(palette[k][1]));
+            __m128 dB = _mm_sub_ps(B, _mm_set1_ps(palette[k][2]));
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dR, dR), _mm_mul_ps(dG, dG)),
+                                         _mm_mul_ps(dB, dB));
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(best, distance);
+            bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex),
+                                     _mm_and_si128(closer, _mm_set1_epi32(k)));
+        }
+        total = _mm_add_ps(total, best);
+
+        int chosen[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(chosen), bestIndex);
+        for (unsigned int j = 0; j < 4; j++)
+            indices |= static_cast<uint32_t>(chosen[j]) << (2 * (i + j));
+    }
+    float sums[4];
+    _mm_storeu_ps(sums, total);
+    error = sums[0] + sums[1] + sums[2] + sums[3];
+#else
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        float best = 1e30f;
+        uint32_t bestIndex = 0;
+        for (uint32_t k = 0; k < 4; k++)
+        {
+            float dR = r[i] - palette[k][0], dG = g[i] - palette[k][1], dB = b[i] - palette[k][2];
+            float distance = dR * dR + dG * dG + dB * dB;
+            if (distance < best)
+            {
+                best = distance;
+                bestIndex = k;
+            }
+        }
+        error += best;
+        indices |= bestIndex << (2 * i);
+    }
+#endif
+    return error;
+}
+
+// Fit the two colours to the pixels by least squares, given the index of
+// each pixel (returns false if the indices don't separate the colours)
+static bool fitColours(const float *r, const float *g, const float *b, const uint32_t indices,
+                       float colour0[3], float colour1[3])
+{
+    static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ap[3] = { 0.0f, 0.0f, 0.0f }, bp[3] = { 0.0f, 0.0f, 0.0f };
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        float wa = weights[indices >> (2 * i) & 3], wb = 1.0f - wa;
+        aa += wa * wa;
+        ab += wa * wb;
+        bb += wb * wb;
+        ap[0] += wa * r[i]; ap[1] += wa * g[i]; ap[2] += wa * b[i];
+        bp[0] += wb * r[i]; bp[1] += wb * g[i]; bp[2] += wb * b[i];
+    }
+
+    float det = aa * bb - ab * ab;
+    if (fabsf(det) < 1e-6f)
+        return false;
+    for (unsigned int c = 0; c < 3; c++)
+    {
+        colour0[c] = (bb * ap[c] - ab * bp[c]) / det;
+        colour1[c] = (aa * bp[c] - ab * ap[c]) / det;
+    }
+    return true;
+}
+
+// Encode a block of 16 colours (0 to 255) into 8 bytes
+static void encodeColourBlock(const float *r, const float *g, const float *b,
+                              unsigned char *block)
+{
+    // Calculate the mean and covariance of the colours
+    float mean[3], covariance[6];
+#ifdef BLOCKCOMPRESSION_SSE
+    __m128 sumR = _mm_setzero_ps(), sumG = _mm_setzero_ps(), sumB = _mm_setzero_ps();
+    for (unsigned int i = 0; i < 16; i += 4)
+    {
+        sumR = _mm_add_ps(sumR, _mm_loadu_ps(r + i));
+        sumG = _mm_add_ps(sumG, _mm_loadu_ps(g + i));
+        sumB = _mm_add_ps(sumB, _mm_loadu_ps(b + i));
+    }
+    float sums[3][4];
+    _mm_storeu_ps(sums[0], sumR);
+    _mm_storeu_ps(sums[1], sumG);
+    _mm_storeu_ps(sums[2], sumB);
+    for (unsigned int c = 0; c < 3; c++)
+        mean[c] = (sums[c][0] + sums[c][1] + sums[c][2] + sums[c][3]) / 16.0f;
+
+    __m128 products[6];
+    for (unsigned int k = 0; k < 6; k++)
+        products[k] = _mm_setzero_ps();
+    for (unsigned int i = 0; i < 16; i += 4)
+    {
+        __m128 R = _mm_sub_ps(_mm_loadu_ps(r + i), _mm_set1_ps(mean[0]));
+        __m128 G = _mm_sub_ps(_mm_loadu_ps(g + i), _mm_set1_ps(mean[1]));
+        __m128 B = _mm_sub_ps(_mm_loadu_ps(b + i), _mm_set1_ps(mean[2]));
+        products[0] = _mm_add_ps(products[0], _mm_mul_ps(R, R));
+        products[1] = _mm_add_ps(products[1], _mm_mul_ps(R, G));
+        products[2] = _mm_add_ps(products[2], _mm_mul_ps(R, B));
+        products[3] = _mm_add_ps(products[3], _mm_mul_ps(G, G));
+        products[4] = _mm_add_ps(products[4], _mm_mul_ps(G, B));
+        products[5] = _mm_add_ps(products[5], _mm_mul_ps(B, B));
+    }
+    for (unsigned int k = 0; k < 6; k++)
+    {
+        float sum[4];
+        _mm_storeu_ps(sum, products[k]);
+        covariance[k] = sum[0] + sum[1] + sum[2] + sum[3];
+    }
+#else
+    mean[0] = mean[1] = mean[2] = 0.0f;
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        mean[0] += r[i] / 16.0f;
+        mean[1] += g[i] / 16.0f;
+        mean[2] += b[i] / 16.0f;
+    }
+    for (unsigned int k = 0; k < 6; k++)
+        covariance[k] = 0.0f;
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        float R = r[i] - mean[0], G = g[i] - mean[1], B = b[i] - mean[2];
+        covariance[0] += R * R; covariance[1] += R * G; covariance[2] += R * B;
+        covariance[3] += G * G; covariance[4] += G * B; covariance[5] += B * B;
+    }
+#endif
+
+    // Find the principal axis by power iteration, starting from the column of
+    // the channel that varies most
+    static const unsigned int element[3][3] = { { 0, 1, 2 }, { 1, 3, 4 }, { 2, 4, 5 } };
+    unsigned int widest = 0;
+    for (unsigned int c = 1; c < 3; c++)
+        if (covariance[element[c][c]] > covariance[element[widest][widest]])
+            widest = c;
+    float axis[3];
+    for (unsigned int c = 0; c < 3; c++)
+        axis[c] = covariance[element[widest][c]];
+    for (unsigned int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3], largest = 0.0f;
+        for (unsigned int c = 0; c < 3; c++)
+        {
+            next[c] = covariance[element[c][0]] * axis[0] + covariance[element[c][1]] * axis[1] +
+                      covariance[element[c][2]] * axis[2];
+            largest = std::max(largest, fabsf(next[c]));
+        }
+        if (largest < 1e-6f)
+            break;
+        for (unsigned int c = 0; c < 3; c++)
+            axis[c] = next[c] / largest;
+    }
+
+    // Start with the colours at the ends of the axis
+    unsigned int first = 0, last = 0;
+    float lowest = 1e30f, highest = -1e30f;
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        float t = r[i] * axis[0] + g[i] * axis[1] + b[i] * axis[2];
+        if (t < lowest)  { lowest = t;  first = i; }
+        if (t > highest) { highest = t; last = i; }
+    }
+    float colour0[3] = { r[last], g[last], b[last] };
+    float colour1[3] = { r[first], g[first], b[first] };
+
+    // Fit the colours to the pixels the indices give them and keep the best
+    uint16_t best0 = to565(colour0[0], colour0[1], colour0[2]);
+    uint16_t best1 = to565(colour1[0], colour1[1], colour1[2]);
+    uint32_t bestIndices;
+    float bestError = chooseIndices(r, g, b, best0, best1, bestIndices);
+    uint32_t indices = bestIndices;
+    for (unsigned int iteration = 0; iteration < 2 && bestError > 0.0f; iteration++)
+    {
+        if (!fitColours(r, g, b, indices, colour0, colour1))
+            break;
+        uint16_t c0 = to565(colour0[0], colour0[1], colour0[2]);
+        uint16_t c1 = to565(colour1[0], colour1[1], colour1[2]);
+        float error = chooseIndices(r, g, b, c0, c1, indices);
+        if (error >= bestError)
+            break;
+        best0 = c0;
+        best1 = c1;
+        bestError = error;
+        bestIndices = indices;
+    }
+
+    // The first colour must be the larger for four colours (with equal
+    // colours every pixel is the first)
+    if (best0 < best1)
+    {
+        std::swap(best0, best1);
+        bestIndices ^= 0x55555555;
+    }
+    else if (best0 == best1)
+        bestIndices = 0;
+
+    block[0] = best0 & 255; block[1] = best0 >> 8;
+    block[2] = best1 & 255; block[3] = best1 >> 8;
+    for (unsigned int k = 0; k < 4; k++)
+        block[4 + k] = bestIndices >> (8 * k) & 255;
+}
+
+// =============================================================================
+// BC4 single channel blocks
+
+// Encode a block of 16 values (0 to 255) into 8 bytes: the largest and
+// smallest values and eight steps between them
+static void encodeValueBlock(const float *values, unsigned char *block)
+{
+    float lowest = values[0], highest = values[0];
+    for (unsigned int i = 1; i < 16; i++)
+    {
+        lowest  = std::min(lowest, values[i]);
+        highest = std::max(highest, values[i]);
+    }
+    int e0 = static_cast<int>(highest + 0.5f), e1 = static_cast<int>(lowest + 0.5f);
+    block[0] = static_cast<unsigned char>(e0);
+    block[1] = static_cast<unsigned char>(e1);
+
+    // Step of each value from the smallest (step 0 has index 1, step 7 index
+    // 0 and step s index 8 - s)
+    int steps[16];
+    if (e0 == e1)
+        memset(steps, 0, sizeof(steps));
+    else
+    {
+        float scale = 7.0f / (e0 - e1);
+#ifdef BLOCKCOMPRESSION_SSE
+        for (unsigned int i = 0; i < 16; i += 4)
+        {
+            __m128 t = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(values + i),
+                                             _mm_set1_ps(static_cast<float>(e1))),
+                                  _mm_set1_ps(scale));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(steps + i), _mm_cvtps_epi32(t));
+        }
+#else
+        for (unsigned int i = 0; i < 16; i++)
+            steps[i] = static_cast<int>(floorf((values[i] - e1) * scale + 0.5f));
+#endif
+    }
+
+    uint64_t indices = 0;
+    for (unsigned int i = 0; i < 16; i++)
+    {
+        int step = std::min(std::max(steps[i], 0), 7);
+        uint64_t index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+        indices |= index << (3 * i);
+    }
+    for (unsigned int k = 0; k < 6; k++)
+        block[2 + k] = indices >> (8 * k) & 255;
+}
+
+// =============================================================================
+// BlockCompression
+
+unsigned int BlockCompression::blockSize(const Format format)
+{
+    return format == BC1 || format == BC4 ? 8 : 16;
+}
+
+size_t BlockCompression::size(const Format format, const unsigned int width,
+                              const unsigned int height)
+{
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * blockSize(format);
+}
+
+unsigned int BlockCompression::components(const Format format)
+{
+    if (format == BC4)
+        return 1;
+    if (format == BC5)
+        return 2;
+    return format == BC3 ? 4 : 3;
+}
+
+BlockCompression::Format BlockCompression::format(const unsigned int components,
+                                                  const bool normalMap)
+{
+    if (normalMap || components == 2)
+        return BC5;
+    if (components == 1)
+        return BC4;
+    return components == 4 ? BC3 : BC1;
+}
+
+void BlockCompression::encode(const unsigned char *pixels, const unsigned int width,
+                              const unsigned int height, const unsigned int components,
+                              const Format format, unsigned char *blocks)
+{
+    unsigned int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    unsigned int size = blockSize(format);
+    unsigned int grainSize = std::max(1u, 256 / blocksWide);
+    Jobs::parallelFor(0, blocksHigh, grainSize, [&](unsigned int begin, unsigned int end)
+    {
+        float channels[4][16];
+        for (unsigned int by = begin; by < end; by++)
+            for (unsigned int bx = 0; bx < blocksWide; bx++)
+            {
+                // Copy the block's pixels (repeating the last row and column
+                // past the edges)
+                for (unsigned int i = 0; i < 16; i++)
+                {
+                    unsigned int x = std::min(4 * bx + i % 4, width - 1);
+                    unsigned int y = std::min(4 * by + i / 4, height - 1);
+                    const unsigned char *pixel = pixels + (static_cast<size_t>(y) * width + x) *
+                                                          components;
+                    for (unsigned int c = 0; c < 4; c++)
+                        channels[c][i] = c < components ? pixel[c] : 0.0f;
+                }
+
+                unsigned char *block = blocks + (static_cast<size_t>(by) * blocksWide + bx) * size;
+                switch (format)
+                {
+                    case BC1:
+                        encodeColourBlock(channels[0], channels[1], channels[2], block);
+                        break;
+                    case BC3:
+                        encodeValueBlock(channels[3], block);
+                        encodeColourBlock(channels[0], channels[1], channels[2], block + 8);
+                        break;
+                    case BC4:
+                        encodeValueBlock(channels[0], block);
+                        break;
+                    case BC5:
+                        encodeValueBlock(channels[0], block);
+                        encodeValueBlock(channels[1], block + 8);
+                        break;
+                }
+            }
+    });
+}
+
+// Decode the colours of a BC1 block (with three colours and transparent
+// black when the first colour isn't the larger, unless it is part of BC3)
+static void decodeColourBlock(const unsigned char *block, const bool alwaysFour,
+                              unsigned char rgba[16][4])
+{
+    uint16_t c0 = static_cast<uint16_t>(block[0] | block[1] << 8);
+    uint16_t c1 = static_cast<uint16_t>(block[2] | block[3] << 8);
+    int a[3], z[3], palette[4][4];
+    from565(c0, a);
+    from565(c1, z);
+    for (unsigned int c = 0; c < 3; c++)
+    {
+        palette[0][c] = a[c];
+        palette[1][c] = z[c];
+        if (c0 > c1 || alwaysFour)
+        {
+            palette[2][c] = (2 * a[c] + z[c]) / 3;
+            palette[3][c] = (a[c] + 2 * z[c]) / 3;
+        }
+        else
+        {
+            palette[2][c] = (a[c] + z[c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+    palette[3][3] = c0 > c1 || alwaysFour ? 255 : 0;
+
+    uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 |
+                       static_cast<uint32_t>(block[7]) << 24;
+    for (unsigned int i = 0; i < 16; i++)
+        for (unsigned int c = 0; c < 4; c++)
+            rgba[i][c] = static_cast<unsigned char>(palette[indices >> (2 * i) & 3][c]);
+}
+
+// Decode the values of a BC4 block into one channel
+static void decodeValueBlock(const unsigned char *block, unsigned char rgba[16][4],
+                             const unsigned int channel)
+{
+    int e0 = block[0], e1 = block[1], palette[8] = { e0, e1 };
+    for (int k = 2; k < 8; k++)
+    {
+        if (e0 > e1)
+            palette[k] = ((8 - k) * e0 + (k - 1) * e1) / 7;
+        else
+            palette[k] = k < 6 ? ((6 - k) * e0 + (k - 1) * e1) / 5 : k == 6 ? 0 : 255;
+    }
+
+    uint64_t indices = 0;
+    for (unsigned int k = 0; k < 6; k++)
+        indices |= static_cast<uint64_t>(block[2 + k]) << (8 * k);
+    for (unsigned int i = 0; i < 16; i++)
+        rgba[i][channel] = static_cast<unsigned char>(palette[indices >> (3 * i) & 7]);
+}
+
+void BlockCompression::decode(const unsigned char *blocks, const unsigned int width,
+                              const unsigned int height, const Format format,
+                              unsigned char *pixels)
+{
+    unsigned int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    unsigned int size = blockSize(format);
+    for (unsigned int by = 0; by < blocksHigh; by++)
+        for (unsigned int bx = 0; bx < blocksWide; bx++)
+        {
+            size_t first = static_cast<size_t>(by) * blocksWide + bx;
+            const unsigned char *block = blocks + first * size;
+            unsigned char rgba[16][4];
+            memset(rgba, 0, sizeof(rgba));
+            for (unsigned int i = 0; i < 16; i++)
+                rgba[i][3] = 255;
+            switch (format)
+            {
+                case BC1:
+                    decodeColourBlock(block, false, rgba);
+                    break;
+                case BC3:
+                    decodeColourBlock(block + 8, true, rgba);
+                    decodeValueBlock(block, rgba, 3);
+                    break;
+                case BC4:
+                    decodeValueBlock(block, rgba, 0);
+                    break;
+                case BC5:
+                    decodeValueBlock(block, rgba, 0);
+                    decodeValueBlock(block + 8, rgba, 1);
+                    break;
+            }
+
+            // Copy the pixels inside the image
+            for (unsigned int i = 0; i < 16; i++)
+            {
+                unsigned int x = 4 * bx + i % 4, y = 4 * by + i / 4;
+                if (x < width && y < height)
+                    memcpy(pixels + 4 * (static_cast<size_t>(y) * width + x), rgba[i], 4);
+            }
+        }
+}
+
+GLenum BlockCompression::internalFormat(const Format format)
+{
+    switch (format)
+    {
+        case BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BC4: return GL_COMPRESSED_RED_RGTC1;
+        case BC5: return GL_COMPRESSED_RG_RGTC2;
+    }
+    return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+bool BlockCompression::supported()
+{
+    if (!GLEW_VERSION_3_0)
+        return false;
+
+    // GLEW 1.13 reads the extensions with glGetString, which core profiles
+    // don't allow, so look for S3TC in the list of extensions
+    GLint numExtensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+    for (GLint i = 0; i < numExtensions; i++)
+    {
+        const char *extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+        if (extension != NULL && strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <GL/glew.h>
+
+// BlockCompression class. Encodes 8 bit images into the block compressed
+// formats GPUs sample without decompressing them first. Each 4x4 block of
+// pixels is stored in 8 or 16 bytes:
+//
+//     BC1  RGB   8 bytes   two 5:6:5 colours and 2 bit indices between them
+//     BC3  RGBA  16 bytes  a BC4 block of alphas then a BC1 block of colours
+//     BC4  R     8 bytes   two 8 bit values and 3 bit indices between them
+//     BC5  RG    16 bytes  two BC4 blocks, e.g. the x and y of normal maps
+//
+// so an RGB texture takes a sixth of the memory and an RGBA one a quarter.
+// The colours of a BC1 block are found along the principal axis of the
+// block's colours and fitted to the pixels by least squares. The pixels of
+// a block are processed four at a time with SSE and the rows of blocks are
+// shared between the threads of the job system:
+//
+//     BlockCompression::Format format = BlockCompression::BC1;
+//     std::vector<unsigned char> blocks(BlockCompression::size(format, w, h));
+//     BlockCompression::encode(pixels, w, h, 3, format, &blocks[0]);
+//     glCompressedTexImage2D(GL_TEXTURE_2D, 0, BlockCompression::internalFormat(format),
+//                            w, h, 0, blocks.size(), &blocks[0]);
+//
+// Normal maps are stored as BC5, so the shaders calculate z from x and y.
+class BlockCompression
+{
+public:
+    enum Format { BC1, BC3, BC4, BC5 };
+
+    // Bytes in a block and in an image
+    static unsigned int blockSize(const Format format);
+    static size_t size(const Format format, const unsigned int width, const unsigned int height);
+
+    // Components a format holds
+    static unsigned int components(const Format format);
+
+    // Format for an image with a number of components (BC5 for normal maps)
+    static Format format(const unsigned int components, const bool normalMap);
+
+    // Encode an image (the pixels past its edges are copies of the edges')
+    static void encode(const unsigned char *pixels, const unsigned int width,
+                       const unsigned int height, const unsigned int components,
+                       const Format format, unsigned char *blocks);
+
+    // Decode an image into RGBA pixels (as the GPU does, to measure the error)
+    static void decode(const unsigned char *blocks, const unsigned int width,
+                       const unsigned int height, const Format format, unsigned char *pixels);
+
+    // OpenGL format and whether the formats can be used (BC1 and BC3 need
+    // EXT_texture_compression_s3tc, BC4 and BC5 are part of OpenGL 3.0)
+    static GLenum internalFormat(const Format format);
+    static bool supported();
+};
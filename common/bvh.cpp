@@ -0,0 +1,745 @@
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#include <common/bvh.hpp>
+#include <common/jobs.hpp>
+#include <common/profiler.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE
+#include <immintrin.h>
+#endif
+
+// Number of bins the SAH is evaluated at along each axis
+static const unsigned int numBins = 16;
+
+// Leaves hold at most 8 triangles (two blocks)
+static const unsigned int maxLeafSize = 8;
+
+// Cost of stepping to a node relative to the cost of a triangle test
+static const float traversalCost = 1.0f;
+
+// Nodes with more triangles than this bin them in parallel, and subtrees
+// with more than this are built as separate jobs
+static const unsigned int parallelBinSize   = 65536;
+static const unsigned int parallelBuildSize = 4096;
+
+// Longest path from the root to a leaf that can be traversed. Below the
+// median split level nodes are split in half, so no tree is deeper than it.
+static const unsigned int maxStackSize = 64;
+static const unsigned int medianSplitLevel = maxStackSize - 33;
+
+// Wall clock time in milliseconds
+static double now()
+{
+    std::chrono::duration<double, std::milli> time =
+        std::chrono::steady_clock::now().time_since_epoch();
+    return time.count();
+}
+
+// =============================================================================
+// Build
+
+namespace
+{
+    // Bounding box
+    struct Box
+    {
+        glm::vec3 min = glm::vec3(1.0e30f);
+        glm::vec3 max = glm::vec3(-1.0e30f);
+
+        void grow(const glm::vec3 &point)
+        {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+        void grow(const Box &box)
+        {
+            min = glm::min(min, box.min);
+            max = glm::max(max, box.max);
+        }
+        float area() const
+        {
+            glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+            return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+        }
+    };
+
+    // Triangle's (or box's) bounding box and centre (twice the centre of
+    // the box)
+    struct Reference
+    {
+        Box box;
+        glm::vec3 centre;
+        uint32_t primitive;
+    };
+
+    // Triangles and their bounds counted into one bin
+    struct Bin
+    {
+        Box box;
+        unsigned int count = 0;
+    };
+
+    // Bounds of the triangles in a node and of their centres, and the bins
+    // of each axis
+    struct Binning
+    {
+        Box box;
+        Box centres;
+        Bin bins[3][numBins];
+    };
+
+    // State shared by the jobs building a hierarchy
+    struct Builder
+    {
+        std::vector<Reference> references;
+        std::vector<BVH::Node> &nodes;
+        std::atomic<uint32_t> nodeCount;
+        std::atomic<unsigned int> numLeaves;
+        std::atomic<unsigned int> depth;
+
+        Builder(std::vector<BVH::Node> &nodes) : nodes(nodes), nodeCount(1), numLeaves(0),
+                                                 depth(0) {}
+    };
+}
+
+// Calculate the bounds of references [first, last)
+static void calculateBounds(const Reference *references, const uint32_t first,
+                            const uint32_t last, Box &box, Box &centres)
+{
+    for (uint32_t i = first; i < last; i++)
+    {
+        box.grow(references[i].box);
+        centres.grow(references[i].centre);
+    }
+}
+
+// Bin index of a centre along an axis
+static inline unsigned int binIndex(const float centre, const float min, const float scale)
+{
+    int bin = static_cast<int>((centre - min) * scale);
+    return static_cast<unsigned int>(std::min(std::max(bin, 0), static_cast<int>(numBins) - 1));
+}
+
+// Count references [first, last) into the bins of each axis
+static void binReferences(const Reference *references, const uint32_t first,
+                          const uint32_t last, const Box &centres, const glm::vec3 &scale,
+                          Bin bins[3][numBins])
+{
+    for (uint32_t i = first; i < last; i++)
+    {
+        const Reference &reference = references[i];
+        for (unsigned int axis = 0; axis < 3; axis++)
+        {
+            Bin &bin = bins[axis][binIndex(reference.centre[axis], centres.min[axis], scale[axis])];
+            bin.box.grow(reference.box);
+            bin.count++;
+        }
+    }
+}
+
+// Calculate the bounds and bins of references [first, first + count), in
+// parallel when there are many of them
+static void binNode(const Reference *references, const uint32_t first, const uint32_t count,
+                    Binning &binning, glm::vec3 &scale)
+{
+    uint32_t last = first + count;
+    std::mutex mutex;
+    if (count > parallelBinSize)
+    {
+        Jobs::parallelFor(first, last, parallelBinSize / 4, [&](unsigned int begin,
+                                                                unsigned int end)
+        {
+            Box box, centres;
+            calculateBounds(references, begin, end, box, centres);
+            std::lock_guard<std::mutex> lock(mutex);
+            binning.box.grow(box);
+            binning.centres.grow(centres);
+        });
+    }
+    else
+        calculateBounds(references, first, last, binning.box, binning.centres);
+
+    // Bins are spread evenly between the smallest and largest centres
+    glm::vec3 extent = binning.centres.max - binning.centres.min;
+    for (unsigned int axis = 0; axis < 3; axis++)
+        scale[axis] = extent[axis] > 0.0f ? numBins * (1.0f - 1.0e-6f) / extent[axis] : 0.0f;
+
+    if (count > parallelBinSize)
+    {
+        Jobs::parallelFor(first, last, parallelBinSize / 4, [&](unsigned int begin,
+                                                                unsigned int end)
+        {
+            Bin bins[3][numBins];
+            binReferences(references, begin, end, binning.centres, scale, bins);
+            std::lock_guard<std::mutex> lock(mutex);
+            for (unsigned int axis = 0; axis < 3; axis++)
+                for (unsigned int b = 0; b < numBins; b++)
+                {
+                    binning.bins[axis][b].box.grow(bins[axis][b].box);
+                    binning.bins[axis][b].count += bins[axis][b].count;
+                }
+        });
+    }
+    else
+        binReferences(references, first, last, binning.centres, scale, binning.bins);
+}
+
+static void buildNode(Builder &builder, const uint32_t index, const uint32_t first,
+                      const uint32_t count, const unsigned int level)
+{
+    Reference *references = &builder.references[0];
+    Binning binning;
+    glm::vec3 scale;
+    binNode(references, first, count, binning, scale);
+
+    BVH::Node &node = builder.nodes[index];
+    node.min = binning.box.min;
+    node.max = binning.box.max;
+
+    // Find the cheapest split between bins along any axis by sweeping the
+    // bins from the right and then from the left
+    float leafCost  = static_cast<float>(count);
+    float bestCost  = 1.0e30f;
+    unsigned int bestAxis = 0, bestSplit = 0;
+    float nodeArea  = binning.box.area();
+    for (unsigned int axis = 0; axis < 3 && nodeArea > 0.0f; axis++)
+    {
+        if (scale[axis] == 0.0f)
+            continue;
+
+        const Bin *bins = binning.bins[axis];
+        float rightCost[numBins];
+        Box box;
+        unsigned int rightCount = 0;
+        for (unsigned int b = numBins - 1; b > 0; b--)
+        {
+            box.grow(bins[b].box);
+            rightCount += bins[b].count;
+            rightCost[b] = rightCount > 0 ? box.area() * rightCount : 0.0f;
+        }
+
+        box = Box();
+        unsigned int leftCount = 0;
+        for (unsigned int split = 1; split < numBins; split++)
+        {
+            box.grow(bins[split - 1].box);
+            leftCount += bins[split - 1].count;
+            if (leftCount == 0 || leftCount == count)
+                continue;
+            float cost = traversalCost + (box.area() * leftCount + rightCost[split]) / nodeArea;
+            if (cost < bestCost)
+            {
+                bestCost  = cost;
+                bestAxis  = axis;
+                bestSplit = split;
+            }
+        }
+    }
+
+    // Make a leaf if splitting doesn't pay, or there is no split between
+    // the bins (or the tree is getting too deep) and few enough triangles
+    bool noSplit = bestCost == 1.0e30f;
+    bool median  = noSplit || level >= medianSplitLevel;
+    if ((count <= maxLeafSize && (leafCost <= bestCost || median)) || count == 1)
+    {
+        node.index = first;
+        node.count = count;
+        builder.numLeaves++;
+        unsigned int depth = builder.depth;
+        while (level > depth && !builder.depth.compare_exchange_weak(depth, level)) {}
+        return;
+    }
+
+    // Move the references on the left of the split to the front, or split
+    // the references in half along the longest axis of their centres when
+    // the centres are all in the same place or the tree is getting too deep
+    // (halving them needs at most 32 more levels)
+    uint32_t middle;
+    if (median)
+    {
+        middle = first + count / 2;
+        glm::vec3 extent = binning.centres.max - binning.centres.min;
+        unsigned int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                                : (extent.y > extent.z ? 1 : 2);
+        std::nth_element(references + first, references + middle, references + first + count,
+                         [axis](const Reference &a, const Reference &b)
+        {
+            return a.centre[axis] < b.centre[axis];
+        });
+    }
+    else
+    {
+        float min = binning.centres.min[bestAxis];
+        float axisScale = scale[bestAxis];
+        Reference *split = std::partition(references + first, references + first + count,
+                                          [&](const Reference &reference)
+        {
+            return binIndex(reference.centre[bestAxis], min, axisScale) < bestSplit;
+        });
+        middle = static_cast<uint32_t>(split - references);
+    }
+
+    // Build the children, the left one as a separate job if both are large
+    uint32_t left = builder.nodeCount.fetch_add(2);
+    node.index = left;
+    node.count = 0;
+    uint32_t leftCount  = middle - first;
+    uint32_t rightCount = count - leftCount;
+    if (leftCount > parallelBuildSize && rightCount > parallelBuildSize)
+    {
+        JobHandle job = Jobs::run([&]()
+        {
+            buildNode(builder, left, first, leftCount, level + 1);
+        });
+        buildNode(builder, left + 1, middle, rightCount, level + 1);
+        Jobs::wait(job);
+    }
+    else
+    {
+        buildNode(builder, left, first, leftCount, level + 1);
+        buildNode(builder, left + 1, middle, rightCount, level + 1);
+    }
+}
+
+// Build the nodes over the references (a tree with one reference in each
+// leaf has 2n - 1 nodes)
+static void buildHierarchy(Builder &builder, const unsigned int count,
+                           std::vector<BVH::Node> &nodes, unsigned int &numLeaves,
+                           unsigned int &depth)
+{
+    nodes.resize(2 * count);
+    buildNode(builder, 0, 0, count, 1);
+    nodes.resize(builder.nodeCount);
+    nodes.shrink_to_fit();
+    numLeaves = builder.numLeaves;
+    depth     = builder.depth;
+}
+
+void BVH::build(const glm::vec3 *positions, const unsigned int numTriangles)
+{
+    PROFILE_SCOPE("BVH::build");
+    double start = now();
+    clear();
+    this->numTriangles = numTriangles;
+    if (numTriangles == 0)
+        return;
+
+    // Bounds of each triangle
+    Builder builder(nodes);
+    builder.references.resize(numTriangles);
+    Jobs::parallelFor(0, numTriangles, 16384, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            Reference &reference = builder.references[i];
+            reference.box = Box();
+            reference.box.grow(positions[3 * i]);
+            reference.box.grow(positions[3 * i + 1]);
+            reference.box.grow(positions[3 * i + 2]);
+            reference.centre    = reference.box.min + reference.box.max;
+            reference.primitive = i;
+        }
+    });
+    buildHierarchy(builder, numTriangles, nodes, numLeaves, depth);
+
+    // Give each leaf its blocks
+    std::vector<uint32_t> leaves;
+    leaves.reserve(numLeaves);
+    uint32_t numBlocks = 0;
+    for (uint32_t i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i].count == 0)
+            continue;
+        leaves.push_back(i);
+        numBlocks += (nodes[i].count + 3) / 4;
+    }
+
+    // Copy the triangles into the blocks in the order of their references
+    blocks.resize(numBlocks);
+    std::vector<uint32_t> firstBlock(leaves.size());
+    for (uint32_t i = 0, block = 0; i < leaves.size(); i++)
+    {
+        firstBlock[i] = block;
+        block += (nodes[leaves[i]].count + 3) / 4;
+    }
+    Jobs::parallelFor(0, static_cast<unsigned int>(leaves.size()), 1024,
+                      [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            Node &leaf = nodes[leaves[i]];
+            for (uint32_t k = 0; k < (leaf.count + 3) / 4 * 4; k++)
+            {
+                Block &block = blocks[firstBlock[i] + k / 4];
+                unsigned int lane = k % 4;
+                glm::vec3 v0(0.0f), e1(0.0f), e2(0.0f);
+                uint32_t triangle = 0xffffffff;
+                if (k < leaf.count)
+                {
+                    triangle = builder.references[leaf.index + k].primitive;
+                    v0 = positions[3 * triangle];
+                    e1 = positions[3 * triangle + 1] - v0;
+                    e2 = positions[3 * triangle + 2] - v0;
+                }
+                for (unsigned int axis = 0; axis < 3; axis++)
+                {
+                    block.v0[axis][lane] = v0[axis];
+                    block.e1[axis][lane] = e1[axis];
+                    block.e2[axis][lane] = e2[axis];
+                }
+                block.triangle[lane] = triangle;
+            }
+            leaf.index = firstBlock[i];
+        }
+    });
+
+    buildTime = now() - start;
+}
+
+void BVH::buildBoxes(const glm::vec3 *boxMin, const glm::vec3 *boxMax, const unsigned int count)
+{
+    clear();
+    if (count == 0)
+        return;
+
+    Builder builder(nodes);
+    builder.references.resize(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        Reference &reference = builder.references[i];
+        reference.box.min   = boxMin[i];
+        reference.box.max   = boxMax[i];
+        reference.centre    = boxMin[i] + boxMax[i];
+        reference.primitive = i;
+    }
+    buildHierarchy(builder, count, nodes, numLeaves, depth);
+
+    // The leaves' boxes are in the order of their references
+    primitives.resize(count);
+    for (unsigned int i = 0; i < count; i++)
+        primitives[i] = builder.references[i].primitive;
+}
+
+void BVH::clear()
+{
+    nodes.clear();
+    blocks.clear();
+    primitives.clear();
+    numTriangles = 0;
+    numLeaves    = 0;
+    depth        = 0;
+    buildTime    = 0.0;
+}
+
+float BVH::cost() const
+{
+    if (nodes.empty())
+        return 0.0f;
+
+    // Sum the node areas relative to the root's area
+    Box root;
+    root.min = nodes[0].min;
+    root.max = nodes[0].max;
+    float rootArea = std::max(root.area(), 1.0e-30f);
+    float total = 0.0f;
+    for (const Node &node : nodes)
+    {
+        Box box;
+        box.min = node.min;
+        box.max = node.max;
+        total += box.area() / rootArea * (node.count > 0 ? node.count : traversalCost);
+    }
+    return total;
+}
+
+// =============================================================================
+// Traversal
+
+bool BVH::intersect(const Ray &ray, RayHit &hit) const
+{
+    return intersectTriangles<false>(ray, hit);
+}
+
+bool BVH::occluded(const Ray &ray) const
+{
+    RayHit hit;
+    return intersectTriangles<true>(ray, hit);
+}
+
+// Reciprocal of a direction, avoiding infinities that would give NaNs in
+// the slab tests
+static glm::vec3 safeInverse(const glm::vec3 &direction)
+{
+    glm::vec3 inverse;
+    for (unsigned int axis = 0; axis < 3; axis++)
+    {
+        float d = direction[axis];
+        if (fabsf(d) < 1.0e-20f)
+            d = d < 0.0f ? -1.0e-20f : 1.0e-20f;
+        inverse[axis] = 1.0f / d;
+    }
+    return inverse;
+}
+
+#ifdef BVH_SSE
+
+// Distance along the ray to where it enters a node's box, or 1e30 if it
+// misses the box between tMin and tMax. The three axes are tested at once.
+static inline float enterBox(const BVH::Node &node, const __m128 origin, const __m128 inverse,
+                             const float tMin, const float tMax)
+{
+    // Loads the index and count too; their lanes are replaced by z
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.min.x), origin), inverse);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&node.max.x), origin), inverse);
+    __m128 tNear = _mm_min_ps(t0, t1);
+    __m128 tFar  = _mm_max_ps(t0, t1);
+    tNear = _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 2, 1, 0));
+    tFar  = _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 2, 1, 0));
+    tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+    tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+    tFar  = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+    tFar  = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+    float enter = std::max(_mm_cvtss_f32(tNear), tMin);
+    float exit  = std::min(_mm_cvtss_f32(tFar), tMax);
+    return enter <= exit ? enter : 1.0e30f;
+}
+
+// Moller-Trumbore test of a ray against the 4 triangles of a block. Returns
+// a mask of the lanes hit nearer than tMax, with their distances and
+// barycentric co-ordinates.
+static inline int intersectBlock(const BVH::Block &block, const __m128 origin[3],
+                                 const __m128 direction[3], const float tMin, const float tMax,
+                                 __m128 &t, __m128 &u, __m128 &v)
+{
+    __m128 e1x = _mm_loadu_ps(block.e1[0]);
+    __m128 e1y = _mm_loadu_ps(block.e1[1]);
+    __m128 e1z = _mm_loadu_ps(block.e1[2]);
+    __m128 e2x = _mm_loadu_ps(block.e2[0]);
+    __m128 e2y = _mm_loadu_ps(block.e2[1]);
+    __m128 e2z = _mm_loadu_ps(block.e2[2]);
+
+    // p = direction x e2
+    __m128 px = _mm_sub_ps(_mm_mul_ps(direction[1], e2z), _mm_mul_ps(direction[2], e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(direction[2], e2x), _mm_mul_ps(direction[0], e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(direction[0], e2y), _mm_mul_ps(direction[1], e2x));
+    __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)),
+                            _mm_mul_ps(e1z, pz));
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    // s = origin - v0, u = (s . p) / det
+    __m128 sx = _mm_sub_ps(origin[0], _mm_loadu_ps(block.v0[0]));
+    __m128 sy = _mm_sub_ps(origin[1], _mm_loadu_ps(block.v0[1]));
+    __m128 sz = _mm_sub_ps(origin[2], _mm_loadu_ps(block.v0[2]));
+    u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)),
+                              _mm_mul_ps(sz, pz)), invDet);
+
+    // q = s x e1, v = (direction . q) / det, t = (e2 . q) / det
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+    v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(direction[0], qx),
+                                         _mm_mul_ps(direction[1], qy)),
+                              _mm_mul_ps(direction[2], qz)), invDet);
+    t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)),
+                              _mm_mul_ps(e2z, qz)), invDet);
+
+    // Degenerate lanes have det = 0 and fail every test
+    __m128 zero = _mm_setzero_ps();
+    __m128 mask = _mm_cmpneq_ps(det, zero);
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(u, zero));
+    mask = _mm_and_ps(mask, _mm_cmpge_ps(v, zero));
+    mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, _mm_set1_ps(tMin)));
+    mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(tMax)));
+    return _mm_movemask_ps(mask);
+}
+
+#else
+
+static inline float enterBox(const BVH::Node &node, const glm::vec3 &origin,
+                             const glm::vec3 &inverse, const float tMin, const float tMax)
+{
+    glm::vec3 t0 = (node.min - origin) * inverse;
+    glm::vec3 t1 = (node.max - origin) * inverse;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar  = glm::max(t0, t1);
+    float enter = std::max(std::max(std::max(tNear.x, tNear.y), tNear.z), tMin);
+    float exit  = std::min(std::min(std::min(tFar.x, tFar.y), tFar.z), tMax);
+    return enter <= exit ? enter : 1.0e30f;
+}
+
+static inline int intersectBlock(const BVH::Block &block, const glm::vec3 &origin,
+                                 const glm::vec3 &direction, const float tMin, const float tMax,
+                                 float t[4], float u[4], float v[4])
+{
+    int mask = 0;
+    for (unsigned int lane = 0; lane < 4; lane++)
+    {
+        glm::vec3 v0(block.v0[0][lane], block.v0[1][lane], block.v0[2][lane]);
+        glm::vec3 e1(block.e1[0][lane], block.e1[1][lane], block.e1[2][lane]);
+        glm::vec3 e2(block.e2[0][lane], block.e2[1][lane], block.e2[2][lane]);
+        glm::vec3 p = glm::cross(direction, e2);
+        float det   = glm::dot(e1, p);
+        if (det == 0.0f)
+            continue;
+        float invDet = 1.0f / det;
+        glm::vec3 s  = origin - v0;
+        glm::vec3 q  = glm::cross(s, e1);
+        u[lane] = glm::dot(s, p) * invDet;
+        v[lane] = glm::dot(direction, q) * invDet;
+        t[lane] = glm::dot(e2, q) * invDet;
+        if (u[lane] >= 0.0f && v[lane] >= 0.0f && u[lane] + v[lane] <= 1.0f &&
+            t[lane] > tMin && t[lane] < tMax)
+            mask |= 1 << lane;
+    }
+    return mask;
+}
+
+#endif
+
+// Walk down the nodes a ray passes through, nearest first, calling
+// visitLeaf(leaf, tMax) at each leaf it reaches. visitLeaf may shorten tMax
+// to skip the nodes further away, and returns true to stop the walk.
+template <typename VisitLeaf>
+static void walk(const std::vector<BVH::Node> &nodes, const Ray &ray, float tMax,
+                 VisitLeaf visitLeaf)
+{
+    if (nodes.empty())
+        return;
+
+#ifdef BVH_SSE
+    glm::vec3 inv = safeInverse(ray.direction);
+    __m128 origin  = _mm_setr_ps(ray.origin.x, ray.origin.y, ray.origin.z, 0.0f);
+    __m128 inverse = _mm_setr_ps(inv.x, inv.y, inv.z, 0.0f);
+#else
+    const glm::vec3 &origin = ray.origin;
+    glm::vec3 inverse = safeInverse(ray.direction);
+#endif
+
+    if (enterBox(nodes[0], origin, inverse, ray.tMin, tMax) == 1.0e30f)
+        return;
+
+    // Nodes still to visit and where the ray enters them
+    uint32_t stack[maxStackSize];
+    float stackEnter[maxStackSize];
+    unsigned int stackSize = 0;
+    uint32_t index = 0;
+    while (true)
+    {
+        const BVH::Node &node = nodes[index];
+        if (node.count > 0)
+        {
+            if (visitLeaf(node, tMax))
+                return;
+        }
+        else
+        {
+            // Visit the nearer child first
+            float enterLeft  = enterBox(nodes[node.index], origin, inverse, ray.tMin, tMax);
+            float enterRight = enterBox(nodes[node.index + 1], origin, inverse, ray.tMin, tMax);
+            uint32_t near = node.index, far = node.index + 1;
+            if (enterRight < enterLeft)
+            {
+                std::swap(enterLeft, enterRight);
+                std::swap(near, far);
+            }
+            if (enterLeft != 1.0e30f)
+            {
+                if (enterRight != 1.0e30f)
+                {
+                    assert(stackSize < maxStackSize);
+                    stack[stackSize]      = far;
+                    stackEnter[stackSize] = enterRight;
+                    stackSize++;
+                }
+                index = near;
+                continue;
+            }
+        }
+
+        // Go back to the nearest node left that is still nearer than the
+        // closest hit
+        do
+        {
+            if (stackSize == 0)
+                return;
+            stackSize--;
+        } while (stackEnter[stackSize] > tMax);
+        index = stack[stackSize];
+    }
+}
+
+template <bool anyHit>
+bool BVH::intersectTriangles(const Ray &ray, RayHit &hit) const
+{
+#ifdef BVH_SSE
+    __m128 origins[3] = { _mm_set1_ps(ray.origin.x), _mm_set1_ps(ray.origin.y),
+                          _mm_set1_ps(ray.origin.z) };
+    __m128 directions[3] = { _mm_set1_ps(ray.direction.x), _mm_set1_ps(ray.direction.y),
+                             _mm_set1_ps(ray.direction.z) };
+    __m128 t, u, v;
+#else
+    const glm::vec3 &origins = ray.origin;
+    const glm::vec3 &directions = ray.direction;
+    float t[4], u[4], v[4];
+#endif
+
+    bool found = false;
+    walk(nodes, ray, std::min(ray.tMax, hit.t), [&](const Node &node, float &tMax)
+    {
+        // Test the leaf's triangles 4 at a time
+        for (uint32_t b = 0; b < (node.count + 3) / 4; b++)
+        {
+            const Block &block = blocks[node.index + b];
+            int mask = intersectBlock(block, origins, directions, ray.tMin, tMax, t, u, v);
+            if (mask == 0)
+                continue;
+            if (anyHit)
+            {
+                found = true;
+                return true;
+            }
+
+#ifdef BVH_SSE
+            float ts[4], us[4], vs[4];
+            _mm_storeu_ps(ts, t);
+            _mm_storeu_ps(us, u);
+            _mm_storeu_ps(vs, v);
+#else
+            const float *ts = t, *us = u, *vs = v;
+#endif
+            for (unsigned int lane = 0; lane < 4; lane++)
+            {
+                if ((mask & (1 << lane)) && ts[lane] < tMax)
+                {
+                    tMax         = ts[lane];
+                    hit.t        = ts[lane];
+                    hit.u        = us[lane];
+                    hit.v        = vs[lane];
+                    hit.triangle = block.triangle[lane];
+                    found        = true;
+                }
+            }
+        }
+        return false;
+    });
+    return found;
+}
+
+void BVH::traverse(const Ray &ray, const std::function<bool(uint32_t, float &)> &visit) const
+{
+    walk(nodes, ray, ray.tMax, [&](const Node &node, float &tMax)
+    {
+        for (uint32_t i = node.index; i < node.index + node.count; i++)
+            if (visit(primitives[i], tMax))
+                return true;
+        return false;
+    });
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <stdint.h>
+
+#include <common/maths.hpp>
+
+// Ray from origin along direction, between distances tMin and tMax
+struct Ray
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float tMin = 0.0f;
+    float tMax = 1.0e30f;
+};
+
+// Closest intersection of a ray with the triangles of a BVH
+struct RayHit
+{
+    float t = 1.0e30f;
+    float u = 0.0f, v = 0.0f;           // barycentric co-ordinates of vertices 1 and 2
+    uint32_t triangle = 0xffffffff;     // index of the triangle given to build
+};
+
+// BVH class. Bounding volume hierarchy over a triangle soup for ray tracing.
+// The hierarchy is built top down with the surface area heuristic (SAH)
+// evaluated at 16 bins along each axis. The top levels bin their triangles
+// in parallel and the subtrees below them are built as jobs on the job
+// system. The leaves hold up to 8 triangles in blocks of 4 stored as a
+// structure of arrays, and a ray is tested against the 4 triangles of a
+// block at once with SSE.
+//
+//     BVH bvh;
+//     bvh.build(&positions[0], numTriangles);    // 3 vertices per triangle
+//     RayHit hit;
+//     if (bvh.intersect(ray, hit))
+//         ...                                     // hit.triangle, hit.t
+//
+// A BVH keeps its own copy of the triangles, so the positions can be freed
+// after it is built.
+//
+// A BVH can also be built over boxes (e.g. the bounds of other BVHs), when
+// traverse calls back with each box whose node the ray reaches:
+//
+//     bvh.buildBoxes(&boxMin[0], &boxMax[0], count);
+//     bvh.traverse(ray, [&](uint32_t box, float &tMax)
+//     {
+//         ...                                     // shorten tMax on a hit
+//         return false;                           // true stops the traversal
+//     });
+class BVH
+{
+public:
+    // Node of the hierarchy (32 bytes). The children of an inner node are
+    // next to each other at index and index + 1; a leaf's triangles are in
+    // the blocks from index, or its boxes in primitives from index.
+    struct Node
+    {
+        glm::vec3 min;
+        uint32_t index;
+        glm::vec3 max;
+        uint32_t count;                 // number of triangles or boxes (0 for inner nodes)
+    };
+
+    // Four triangles as a vertex and two edges (unused lanes are degenerate)
+    struct Block
+    {
+        float v0[3][4];
+        float e1[3][4];
+        float e2[3][4];
+        uint32_t triangle[4];
+    };
+
+    std::vector<Node>  nodes;
+    std::vector<Block> blocks;
+    std::vector<uint32_t> primitives;   // boxes in the order of the leaves
+
+    // Statistics of the last build
+    unsigned int numTriangles = 0;
+    unsigned int numLeaves = 0;
+    unsigned int depth = 0;
+    double buildTime = 0.0;             // milliseconds
+
+    // Build the hierarchy
+    void build(const glm::vec3 *positions, const unsigned int numTriangles);
+    void buildBoxes(const glm::vec3 *boxMin, const glm::vec3 *boxMax, const unsigned int count);
+    void clear();
+
+    // Closest hit along a ray (true if there is one)
+    bool intersect(const Ray &ray, RayHit &hit) const;
+
+    // Whether anything is hit along a ray (stops at the first hit found)
+    bool occluded(const Ray &ray) const;
+
+    // Call visit with each box of a hierarchy built by buildBoxes that the
+    // ray reaches, nearest node first
+    void traverse(const Ray &ray,
+                  const std::function<bool(uint32_t box, float &tMax)> &visit) const;
+
+    // Bounding box of everything
+    glm::vec3 boundsMin() const { return nodes.empty() ? glm::vec3(0.0f) : nodes[0].min; }
+    glm::vec3 boundsMax() const { return nodes.empty() ? glm::vec3(0.0f) : nodes[0].max; }
+
+    // SAH cost of the hierarchy (traversal steps plus triangle tests per ray
+    // for rays uniformly distributed over the root box)
+    float cost() const;
+
+private:
+    template <bool anyHit>
+    bool intersectTriangles(const Ray &ray, RayHit &hit) const;
+};
@@ -15,10 +15,26 @@ void Camera::calculateMatrices()
     projection = Maths::perspective(fov, aspect, near, far);
 }
 
+void Camera::calculateOrientationMatrices()
+{
+    // Calculate the view matrix from the eye and orientation (the inverse
+    // rotation followed by a translation by -eye) instead of a target
+    view    = orientation.conjugate().matrix();
+    view[3] = view * glm::vec4(-eye, 1.0f);
+
+    // Calculate the projection matrix
+    projection = Maths::perspective(fov, aspect, near, far);
+}
+
 void Camera::calculateCameraVectors()
 {
-    front = glm::vec3(cos(yaw) * cos(pitch), sin(pitch), sin(yaw) * cos(pitch));
-    front = glm::normalize(front);
-    right = glm::normalize(glm::cross(front, worldUp));
-    up    = glm::cross(right, front);
+    // Calculate the orientation: yaw about the world up vector (a yaw of
+    // -90 degrees looks down the -z axis) then pitch about the right vector
+    orientation = Quaternion(-yaw - Maths::radians(90.0f), worldUp) *
+                  Quaternion(pitch, glm::vec3(1.0f, 0.0f, 0.0f));
+
+    // Rotate the camera's axes
+    front = orientation.rotate(glm::vec3(0.0f, 0.0f, -1.0f));
+    right = orientation.rotate(glm::vec3(1.0f, 0.0f, 0.0f));
+    up    = orientation.rotate(glm::vec3(0.0f, 1.0f, 0.0f));
 }
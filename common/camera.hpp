@@ -25,6 +25,9 @@ public:
     float pitch = 0.0f;
     float roll  = 0.0f;
     
+    // Orientation (calculated from the yaw and pitch angles)
+    Quaternion orientation;
+    
     // Transformation matrices
     glm::mat4 view;
     glm::mat4 projection;
@@ -34,5 +37,6 @@ public:
     
     // Methods
     void calculateMatrices();
+    void calculateOrientationMatrices();
     void calculateCameraVectors();
 };
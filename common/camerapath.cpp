@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+#include <cmath>
+#include <algorithm>
+
+#include <common/camerapath.hpp>
+#include <common/options.hpp>
+
+// File header: magic number, version and number of frames
+static const char     pathMagic[4] = { 'C', 'P', 'T', 'H' };
+static const uint32_t pathVersion  = 1;
+
+const float CameraPath::timeStep = 1.0f / 60.0f;
+
+bool CameraPath::start(Window &window)
+{
+    if (Options::has("replay"))
+    {
+        path = Options::get("replay");
+        if (!load(path.c_str()))
+            return false;
+
+        isReplaying = true;
+        if (window.headless && !Options::has("frames"))
+            window.setFrames(static_cast<unsigned int>(frames.size()));
+        printf("Replaying %u frames from %s\n",
+               static_cast<unsigned int>(frames.size()), path.c_str());
+    }
+    else if (Options::has("scripted-path"))
+    {
+        script(std::max(Options::getInt("frames", 300), 1));
+        isReplaying = true;
+        if (window.headless)
+            window.setFrames(static_cast<unsigned int>(frames.size()));
+        printf("Replaying the %u frame scripted camera path\n",
+               static_cast<unsigned int>(frames.size()));
+    }
+    else if (Options::has("record"))
+    {
+        path = Options::get("record");
+        isRecording = true;
+        printf("Recording the camera path to %s (press return to start a new "
+               "segment)\n", path.c_str());
+    }
+
+    return true;
+}
+
+void CameraPath::update(Camera &camera, float &deltaTime)
+{
+    if (isRecording)
+    {
+        Frame state;
+        state.eye[0]    = camera.eye.x;
+        state.eye[1]    = camera.eye.y;
+        state.eye[2]    = camera.eye.z;
+        state.yaw       = camera.yaw;
+        state.pitch     = camera.pitch;
+        state.deltaTime = deltaTime;
+        state.segment   = segment;
+        frames.push_back(state);
+    }
+
+    if (isReplaying && frame < frames.size())
+    {
+        const Frame &state = frames[frame++];
+        camera.eye   = glm::vec3(state.eye[0], state.eye[1], state.eye[2]);
+        camera.yaw   = state.yaw;
+        camera.pitch = state.pitch;
+        camera.calculateCameraVectors();
+        deltaTime = timeStep;
+    }
+}
+
+void CameraPath::segmentKey(const bool pressed)
+{
+    // Only start one segment per key press, and not before the current
+    // segment has any frames
+    if (isRecording && pressed && !keyDown && !frames.empty() &&
+        frames.back().segment == segment)
+    {
+        segment++;
+        printf("Camera path segment %u\n", segment);
+    }
+    keyDown = pressed;
+}
+
+void CameraPath::stop(const Window &window)
+{
+    if (isRecording)
+    {
+        isRecording = false;
+        if (save(path.c_str()))
+            printf("Recorded %u frames (%u segments) to %s\n",
+                   static_cast<unsigned int>(frames.size()), segment + 1,
+                   path.c_str());
+    }
+
+    if (isReplaying)
+    {
+        isReplaying = false;
+        printReport(window.frameTimes);
+    }
+}
+
+void CameraPath::script(const unsigned int count)
+{
+    frames.resize(count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        // Distance from and height above the origin
+        float t      = static_cast<float>(i) / count;
+        float s      = std::max(2.0f * t - 1.0f, 0.0f);
+        float angle  = Maths::radians(360.0f) * t;
+        float radius = 5.0f - 2.0f * s;
+        float height = 0.5f + 2.5f * s;
+
+        // Look at the origin (a yaw of -90 degrees looks down the -z axis)
+        glm::vec3 eye(radius * std::sin(angle), height, radius * std::cos(angle));
+        glm::vec3 front = glm::normalize(-eye);
+
+        Frame &state    = frames[i];
+        state.eye[0]    = eye.x;
+        state.eye[1]    = eye.y;
+        state.eye[2]    = eye.z;
+        state.yaw       = std::atan2(front.z, front.x);
+        state.pitch     = std::asin(front.y);
+        state.deltaTime = timeStep;
+        state.segment   = 2 * i < count ? 0 : 1;
+    }
+    frame = 0;
+}
+
+bool CameraPath::load(const char *filePath)
+{
+    FILE *file = fopen(filePath, "rb");
+    if (file == NULL)
+    {
+        printf("Impossible to open %s. Are you in the right directory ?\n",
+               filePath);
+        return false;
+    }
+
+    // Read and check the header
+    char magic[4];
+    uint32_t version = 0, count = 0;
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, pathMagic, 4) != 0 ||
+        fread(&version, sizeof(version), 1, file) != 1 ||
+        version != pathVersion || fread(&count, sizeof(count), 1, file) != 1)
+    {
+        printf("%s is not a camera path file.\n", filePath);
+        fclose(file);
+        return false;
+    }
+
+    // Read the frames
+    frames.resize(count);
+    if (count > 0 && fread(&frames[0], sizeof(Frame), count, file) != count)
+    {
+        printf("%s is truncated.\n", filePath);
+        frames.clear();
+        fclose(file);
+        return false;
+    }
+
+    fclose(file);
+    frame = 0;
+    return true;
+}
+
+bool CameraPath::save(const char *filePath)
+{
+    FILE *file = fopen(filePath, "wb");
+    if (file == NULL)
+    {
+        printf("Impossible to open %s for writing.\n", filePath);
+        return false;
+    }
+
+    uint32_t count = static_cast<uint32_t>(frames.size());
+    fwrite(pathMagic, 1, 4, file);
+    fwrite(&pathVersion, sizeof(pathVersion), 1, file);
+    fwrite(&count, sizeof(count), 1, file);
+    if (count > 0)
+        fwrite(&frames[0], sizeof(Frame), count, file);
+
+    fclose(file);
+    return true;
+}
+
+// Return the p-th percentile of a sorted set of samples
+static double percentile(const std::vector<double> &sorted, const double p)
+{
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5)];
+}
+
+void CameraPath::printReport(const std::vector<double> &frameTimes)
+{
+    // Group the frame times by segment (frame i of the window is frame i of
+    // the path)
+    std::vector<std::vector<double> > segments;
+    size_t count = std::min(frameTimes.size(), frames.size());
+    for (size_t i = 0; i < count; i++)
+    {
+        if (frames[i].segment >= segments.size())
+            segments.resize(frames[i].segment + 1);
+        segments[frames[i].segment].push_back(frameTimes[i]);
+    }
+
+    printf("\n%-10s %8s %10s %10s %10s %10s\n", "Segment", "frames",
+           "mean (ms)", "p50", "p95", "p99");
+    for (unsigned int i = 0; i < segments.size(); i++)
+    {
+        std::vector<double> &times = segments[i];
+        if (times.empty())
+            continue;
+
+        std::sort(times.begin(), times.end());
+        double total = 0.0;
+        for (unsigned int j = 0; j < times.size(); j++)
+            total += times[j];
+
+        printf("%-10u %8u %10.3f %10.3f %10.3f %10.3f\n", i,
+               static_cast<unsigned int>(times.size()), total / times.size(),
+               percentile(times, 0.50), percentile(times, 0.95),
+               percentile(times, 0.99));
+    }
+}
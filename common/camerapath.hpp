@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include <common/camera.hpp>
+#include <common/window.hpp>
+
+// CameraPath class. Records the camera state of every frame to a compact
+// binary file (--record FILE) and replays it (--replay FILE) so benchmark
+// runs are repeatable. Replays restore the exact recorded eye, yaw and pitch
+// values and use a fixed time step, so two replays of the same path render
+// identical frames. A recording can be split into segments (e.g. "walk down
+// the corridor", "look at the teapots") and the replay reports frame times
+// for each segment. The --scripted-path option replays a built-in path
+// instead of a recorded one so the labs can be benchmarked without a file.
+class CameraPath
+{
+public:
+    // Camera state for one frame (28 bytes in the file)
+    struct Frame
+    {
+        float eye[3];
+        float yaw;
+        float pitch;
+        float deltaTime;        // time step used when the frame was recorded
+        uint32_t segment;
+    };
+
+    // Time step used when replaying
+    static const float timeStep;
+
+    std::vector<Frame> frames;
+
+    // Read the --record and --replay options. When replaying headless the
+    // window renders the whole path unless --frames is given.
+    bool start(Window &window);
+
+    // Record the camera state for this frame, or set the camera and time step
+    // from the path when replaying
+    void update(Camera &camera, float &deltaTime);
+
+    // Start a new segment when the segment key is pressed while recording
+    void segmentKey(const bool pressed);
+
+    bool recording() { return isRecording; }
+    bool replaying() { return isReplaying; }
+    bool finished()  { return isReplaying && frame >= frames.size(); }
+
+    // Write the recorded path or print the per-segment frame time report
+    void stop(const Window &window);
+
+    // Generate the built-in path: half an orbit of the origin at eye height
+    // then half an orbit closing in and rising to look down on the scene (one
+    // segment each)
+    void script(const unsigned int count);
+
+    // File input/output
+    bool load(const char *path);
+    bool save(const char *path);
+
+private:
+    bool isRecording = false;
+    bool isReplaying = false;
+    bool keyDown     = false;
+    unsigned int frame   = 0;
+    uint32_t     segment = 0;
+    std::string  path;
+
+    void printReport(const std::vector<double> &frameTimes);
+};
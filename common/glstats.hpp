@@ -0,0 +1,113 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// GLStats class. Counts the draw calls, uniform calls and other per frame GL
+// calls (state changes, buffer uploads and uniform location queries) so the
+// headless frame statistics can show code that makes more GL calls than it
+// used to. The counting is done by the macros below, which wrap the GL
+// functions in any code that includes this header (the labs get it through
+// window.hpp and the common code through model.hpp). Defining
+// DISABLE_GL_STATS removes the macros altogether.
+class GLStats
+{
+public:
+    struct Counts
+    {
+        unsigned int draws    = 0;
+        unsigned int uniforms = 0;
+        unsigned int others   = 0;
+
+        unsigned int total() const { return draws + uniforms + others; }
+    };
+
+    // Calls made since the last reset
+    static Counts &counts()
+    {
+        static Counts calls;
+        return calls;
+    }
+
+    // Return the calls made since the last reset and start counting again
+    static Counts reset()
+    {
+        Counts calls = counts();
+        counts() = Counts();
+        return calls;
+    }
+};
+
+#ifndef DISABLE_GL_STATS
+
+#define GLSTATS_COUNT(type, call) (GLStats::counts().type++, call)
+
+// Draw calls
+#define glDrawArrays(...)   GLSTATS_COUNT(draws, glDrawArrays(__VA_ARGS__))
+#define glDrawElements(...) GLSTATS_COUNT(draws, glDrawElements(__VA_ARGS__))
+#undef  glDrawArraysInstanced
+#define glDrawArraysInstanced(...) GLSTATS_COUNT(draws, GLEW_GET_FUN(__glewDrawArraysInstanced)(__VA_ARGS__))
+#undef  glDrawElementsInstanced
+#define glDrawElementsInstanced(...) GLSTATS_COUNT(draws, GLEW_GET_FUN(__glewDrawElementsInstanced)(__VA_ARGS__))
+#undef  glMultiDrawElements
+#define glMultiDrawElements(...) GLSTATS_COUNT(draws, GLEW_GET_FUN(__glewMultiDrawElements)(__VA_ARGS__))
+
+// Uniform calls
+#undef  glUniform1f
+#define glUniform1f(...)  GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform1f)(__VA_ARGS__))
+#undef  glUniform2f
+#define glUniform2f(...)  GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform2f)(__VA_ARGS__))
+#undef  glUniform3f
+#define glUniform3f(...)  GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform3f)(__VA_ARGS__))
+#undef  glUniform4f
+#define glUniform4f(...)  GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform4f)(__VA_ARGS__))
+#undef  glUniform1i
+#define glUniform1i(...)  GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform1i)(__VA_ARGS__))
+#undef  glUniform2i
+#define glUniform2i(...)  GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform2i)(__VA_ARGS__))
+#undef  glUniform3i
+#define glUniform3i(...)  GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform3i)(__VA_ARGS__))
+#undef  glUniform4i
+#define glUniform4i(...)  GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform4i)(__VA_ARGS__))
+#undef  glUniform1fv
+#define glUniform1fv(...) GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform1fv)(__VA_ARGS__))
+#undef  glUniform2fv
+#define glUniform2fv(...) GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform2fv)(__VA_ARGS__))
+#undef  glUniform3fv
+#define glUniform3fv(...) GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform3fv)(__VA_ARGS__))
+#undef  glUniform4fv
+#define glUniform4fv(...) GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform4fv)(__VA_ARGS__))
+#undef  glUniform1iv
+#define glUniform1iv(...) GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniform1iv)(__VA_ARGS__))
+#undef  glUniformMatrix3fv
+#define glUniformMatrix3fv(...) GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniformMatrix3fv)(__VA_ARGS__))
+#undef  glUniformMatrix4fv
+#define glUniformMatrix4fv(...) GLSTATS_COUNT(uniforms, GLEW_GET_FUN(__glewUniformMatrix4fv)(__VA_ARGS__))
+
+// Other per frame calls
+#define glClear(...)       GLSTATS_COUNT(others, glClear(__VA_ARGS__))
+#define glEnable(...)      GLSTATS_COUNT(others, glEnable(__VA_ARGS__))
+#define glDisable(...)     GLSTATS_COUNT(others, glDisable(__VA_ARGS__))
+#define glBindTexture(...) GLSTATS_COUNT(others, glBindTexture(__VA_ARGS__))
+#define glPolygonMode(...) GLSTATS_COUNT(others, glPolygonMode(__VA_ARGS__))
+#undef  glActiveTexture
+#define glActiveTexture(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewActiveTexture)(__VA_ARGS__))
+#undef  glUseProgram
+#define glUseProgram(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewUseProgram)(__VA_ARGS__))
+#undef  glBindVertexArray
+#define glBindVertexArray(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewBindVertexArray)(__VA_ARGS__))
+#undef  glBindBuffer
+#define glBindBuffer(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewBindBuffer)(__VA_ARGS__))
+#undef  glBufferData
+#define glBufferData(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewBufferData)(__VA_ARGS__))
+#undef  glBufferSubData
+#define glBufferSubData(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewBufferSubData)(__VA_ARGS__))
+#undef  glGetUniformLocation
+#define glGetUniformLocation(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewGetUniformLocation)(__VA_ARGS__))
+#undef  glVertexAttribPointer
+#define glVertexAttribPointer(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewVertexAttribPointer)(__VA_ARGS__))
+#undef  glEnableVertexAttribArray
+#define glEnableVertexAttribArray(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewEnableVertexAttribArray)(__VA_ARGS__))
+#undef  glDisableVertexAttribArray
+#define glDisableVertexAttribArray(...) GLSTATS_COUNT(others, GLEW_GET_FUN(__glewDisableVertexAttribArray)(__VA_ARGS__))
+
+#endif
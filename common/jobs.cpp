@@ -0,0 +1,302 @@
+#include <deque>
+#include <thread>
+#include <condition_variable>
+
+#include <common/jobs.hpp>
+
+// Queue of jobs belonging to one thread. The owner adds and takes jobs at
+// the back, other threads steal from the front.
+struct WorkQueue
+{
+    std::mutex mutex;
+    std::deque<JobHandle> jobs;
+};
+
+static std::vector<std::unique_ptr<WorkQueue> > queues;
+static std::vector<std::thread> workers;
+static std::atomic<bool> running(false);
+
+// Idle workers sleep until jobs are queued
+static std::atomic<int> queuedJobs(0);
+static std::atomic<int> sleepingWorkers(0);
+static std::mutex sleepMutex;
+static std::condition_variable wakeUp;
+
+// Queue index of the calling thread (-1 for threads outside the scheduler,
+// which add jobs to the main thread's queue)
+static thread_local int threadIndex = -1;
+
+// Choose a queue to steal from (xorshift random numbers)
+static unsigned int randomQueue()
+{
+    static thread_local unsigned int state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state % queues.size();
+}
+
+void Jobs::start(const int numWorkers)
+{
+    if (running)
+        return;
+
+    // Use one thread per core
+    unsigned int count;
+    if (numWorkers < 0)
+    {
+        unsigned int cores = std::thread::hardware_concurrency();
+        count = cores > 1 ? cores - 1 : 0;
+    }
+    else
+    {
+        count = static_cast<unsigned int>(numWorkers);
+    }
+
+    for (unsigned int i = 0; i <= count; i++)
+        queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue));
+
+    threadIndex = 0;
+    running     = true;
+    for (unsigned int i = 1; i <= count; i++)
+        workers.push_back(std::thread(workerLoop, i));
+}
+
+void Jobs::stop()
+{
+    if (!running)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        running = false;
+    }
+    wakeUp.notify_all();
+    for (unsigned int i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    // Run the jobs still queued on this thread so waiting for them doesn't
+    // spin forever (any jobs they add run straight away)
+    std::vector<JobHandle> remaining;
+    for (unsigned int i = 0; i < queues.size(); i++)
+        remaining.insert(remaining.end(), queues[i]->jobs.begin(), queues[i]->jobs.end());
+
+    workers.clear();
+    queues.clear();
+    queuedJobs  = 0;
+    threadIndex = -1;
+    for (unsigned int i = 0; i < remaining.size(); i++)
+        execute(remaining[i]);
+}
+
+unsigned int Jobs::numThreads()
+{
+    return queues.empty() ? 1 : static_cast<unsigned int>(queues.size());
+}
+
+JobHandle Jobs::create(const std::function<void()> &function,
+                       const JobHandle &parent)
+{
+    JobHandle job = std::make_shared<Job>();
+    job->function     = function;
+    job->parent       = parent;
+    job->unfinished   = 1;
+    job->dependencies = 1;
+    if (parent)
+        parent->unfinished++;
+
+    return job;
+}
+
+void Jobs::depend(const JobHandle &job, const JobHandle &dependency)
+{
+    std::lock_guard<std::mutex> lock(dependency->mutex);
+    if (!dependency->finished)
+    {
+        job->dependencies++;
+        dependency->dependents.push_back(job);
+    }
+}
+
+void Jobs::submit(const JobHandle &job)
+{
+    if (--job->dependencies == 0)
+        push(job);
+}
+
+JobHandle Jobs::run(const std::function<void()> &function,
+                    const JobHandle &parent)
+{
+    JobHandle job = create(function, parent);
+    submit(job);
+    return job;
+}
+
+void Jobs::wait(const JobHandle &job)
+{
+    while (job->unfinished > 0)
+    {
+        JobHandle next = pop();
+        if (next)
+            execute(next);
+        else
+            std::this_thread::yield();
+    }
+}
+
+bool Jobs::done(const JobHandle &job)
+{
+    return job->unfinished == 0;
+}
+
+void Jobs::parallelFor(const unsigned int begin, const unsigned int end,
+                       const unsigned int grainSize,
+                       const std::function<void(unsigned int, unsigned int)> &body)
+{
+    if (begin >= end)
+        return;
+
+    // The calling thread works through the first piece of the range while
+    // the other pieces are stolen
+    JobHandle root = create(std::function<void()>());
+    splitRange(begin, end, grainSize > 0 ? grainSize : 1, body, root);
+    submit(root);
+    wait(root);
+}
+
+void Jobs::splitRange(const unsigned int begin, unsigned int end,
+                      const unsigned int grainSize,
+                      const std::function<void(unsigned int, unsigned int)> &body,
+                      const JobHandle &parent)
+{
+    // Hand out the upper half of the range until what is left is small enough
+    while (end - begin > grainSize)
+    {
+        unsigned int middle = begin + (end - begin) / 2;
+        const std::function<void(unsigned int, unsigned int)> *bodyPointer = &body;
+        run([=]() { splitRange(middle, end, grainSize, *bodyPointer, parent); },
+            parent);
+        end = middle;
+    }
+
+    body(begin, end);
+}
+
+void Jobs::execute(const JobHandle &job)
+{
+    if (job->function)
+        job->function();
+
+    finish(job);
+}
+
+void Jobs::finish(const JobHandle &job)
+{
+    if (--job->unfinished > 0)
+        return;
+
+    if (job->parent)
+        finish(job->parent);
+
+    // Queue the jobs that were waiting for this one
+    std::vector<JobHandle> ready;
+    {
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->finished = true;
+        ready.swap(job->dependents);
+    }
+    for (unsigned int i = 0; i < ready.size(); i++)
+        submit(ready[i]);
+}
+
+void Jobs::push(const JobHandle &job)
+{
+    // Without worker threads jobs run straight away
+    if (!running)
+    {
+        execute(job);
+        return;
+    }
+
+    WorkQueue &queue = *queues[threadIndex >= 0 ? threadIndex : 0];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(job);
+    }
+    queuedJobs++;
+
+    if (sleepingWorkers > 0)
+        wakeUp.notify_one();
+}
+
+JobHandle Jobs::pop()
+{
+    if (!running || queuedJobs == 0)
+        return JobHandle();
+
+    // Take the newest job from this thread's own queue
+    int index = threadIndex >= 0 ? threadIndex : 0;
+    {
+        WorkQueue &queue = *queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty())
+        {
+            JobHandle job = queue.jobs.back();
+            queue.jobs.pop_back();
+            queuedJobs--;
+            return job;
+        }
+    }
+
+    // Otherwise steal the oldest job from another queue, starting at a
+    // random queue so thieves spread out
+    unsigned int first = randomQueue();
+    for (unsigned int i = 0; i < queues.size(); i++)
+    {
+        unsigned int victim = (first + i) % queues.size();
+        if (static_cast<int>(victim) == index)
+            continue;
+
+        WorkQueue &queue = *queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty())
+        {
+            JobHandle job = queue.jobs.front();
+            queue.jobs.pop_front();
+            queuedJobs--;
+            return job;
+        }
+    }
+
+    return JobHandle();
+}
+
+void Jobs::workerLoop(const unsigned int index)
+{
+    threadIndex = static_cast<int>(index);
+    unsigned int idle = 0;
+    while (running)
+    {
+        JobHandle job = pop();
+        if (job)
+        {
+            execute(job);
+            idle = 0;
+            continue;
+        }
+
+        // Spin for a while before going to sleep as new jobs usually arrive
+        // soon after the last ones finish
+        if (++idle < 64)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepingWorkers++;
+        wakeUp.wait_for(lock, std::chrono::milliseconds(1),
+                        []() { return queuedJobs > 0 || !running; });
+        sleepingWorkers--;
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+
+// A job is a function run on one of the worker threads
+struct Job
+{
+    std::function<void()> function;
+    std::shared_ptr<Job> parent;
+
+    // This job plus its unfinished children
+    std::atomic<int> unfinished;
+
+    // Jobs that must finish before this one can run (plus one until the job
+    // is submitted)
+    std::atomic<int> dependencies;
+
+    // Jobs waiting for this one
+    std::mutex mutex;
+    bool finished = false;
+    std::vector<std::shared_ptr<Job> > dependents;
+};
+
+typedef std::shared_ptr<Job> JobHandle;
+
+// Jobs class. Work-stealing job scheduler. Each thread has its own queue of
+// jobs: a thread takes the most recently added job from its own queue and,
+// when that is empty, steals the oldest job from another thread's queue.
+// The thread that starts the scheduler (normally the main thread, which owns
+// the OpenGL context) joins in while it waits for jobs to finish.
+//
+//     JobHandle a = Jobs::create(updateTransforms);
+//     JobHandle b = Jobs::create(cullObjects);
+//     Jobs::depend(b, a);                     // b runs after a
+//     Jobs::submit(a);
+//     Jobs::submit(b);
+//     Jobs::wait(b);
+//
+// Before the scheduler is started jobs run as soon as they are submitted.
+class Jobs
+{
+public:
+    // Start worker threads (by default one per core less the calling thread)
+    // and stop them (running the jobs still queued)
+    static void start(const int numWorkers = -1);
+    static void stop();
+    static unsigned int numThreads();
+
+    // Create a job. A job with a parent counts as unfinished until all of
+    // its children have finished.
+    static JobHandle create(const std::function<void()> &function,
+                            const JobHandle &parent = JobHandle());
+
+    // Make a job wait for another (call before submitting the job)
+    static void depend(const JobHandle &job, const JobHandle &dependency);
+
+    // Queue a job once its dependencies have finished
+    static void submit(const JobHandle &job);
+
+    // Create and submit a job
+    static JobHandle run(const std::function<void()> &function,
+                         const JobHandle &parent = JobHandle());
+
+    // Run jobs on the calling thread until a job and its children finish
+    static void wait(const JobHandle &job);
+
+    // Whether a job and its children have finished (without waiting)
+    static bool done(const JobHandle &job);
+
+    // Call body(first, last) for ranges of at most grainSize indices in
+    // [begin, end) in parallel and wait for them to finish. The range is
+    // split in halves so idle threads steal large pieces of work.
+    static void parallelFor(const unsigned int begin, const unsigned int end,
+                            const unsigned int grainSize,
+                            const std::function<void(unsigned int, unsigned int)> &body);
+
+private:
+    static void execute(const JobHandle &job);
+    static void finish(const JobHandle &job);
+    static void push(const JobHandle &job);
+    static JobHandle pop();
+    static void workerLoop(const unsigned int index);
+    static void splitRange(const unsigned int begin, unsigned int end,
+                           const unsigned int grainSize,
+                           const std::function<void(unsigned int, unsigned int)> &body,
+                           const JobHandle &parent);
+};
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <common/ktx.hpp>
+
+// Header of a KTX 1.1 file
+struct KTXHeader
+{
+    unsigned char identifier[12];
+    uint32_t endianness;
+    uint32_t glType, glTypeSize, glFormat, glInternalFormat, glBaseInternalFormat;
+    uint32_t pixelWidth, pixelHeight, pixelDepth;
+    uint32_t numberOfArrayElements, numberOfFaces, numberOfMipmapLevels;
+    uint32_t bytesOfKeyValueData;
+};
+
+static const unsigned char ktxIdentifier[12] = {
+    0xAB, 0x4B, 0x54, 0x58, 0x20, 0x31, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A
+};
+static const uint32_t ktxEndianness = 0x04030201;
+
+// Sizes in a KTX file are padded to 4 bytes (the rows of uncompressed levels
+// too, which is OpenGL's default GL_UNPACK_ALIGNMENT)
+static size_t pad4(const size_t size)
+{
+    return (size + 3) & ~static_cast<size_t>(3);
+}
+
+// Sized format of a chain's pixels
+static GLenum sizedFormat(const unsigned int components)
+{
+    if (components == 1)
+        return GL_R8;
+    if (components == 2)
+        return GL_RG8;
+    if (components == 3)
+        return GL_RGB8;
+    return GL_RGBA8;
+}
+
+// Bytes in a level, or 0 for a format we don't upload
+static size_t levelSize(const GLenum type, const GLenum format, const GLenum internalFormat,
+                        const unsigned int width, const unsigned int height)
+{
+    if (type == 0)
+    {
+        for (int i = BlockCompression::BC1; i <= BlockCompression::BC5; i++)
+        {
+            BlockCompression::Format blockFormat = static_cast<BlockCompression::Format>(i);
+            if (BlockCompression::internalFormat(blockFormat) == internalFormat)
+                return BlockCompression::size(blockFormat, width, height);
+        }
+        return 0;
+    }
+    if (type != GL_UNSIGNED_BYTE)
+        return 0;
+
+    for (unsigned int components = 1; components <= 4; components++)
+        if (format == Mipmaps::pixelFormat(components))
+            return pad4(static_cast<size_t>(width) * components) * height;
+    return 0;
+}
+
+// Replace a file with the temporary file just written, so another program
+// never reads half a file
+static bool replaceFile(const std::string &temporary, const std::string &path,
+                        const bool written)
+{
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+KTX::~KTX()
+{
+    close();
+}
+
+bool KTX::open(const std::string &path)
+{
+    close();
+
+    // Map the file
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        file = NULL;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+        fileMapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (fileMapping != NULL)
+        mapping = MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+    if (mapping == NULL)
+    {
+        close();
+        return false;
+    }
+    mappingSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+        return false;
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+    {
+        mapping = mmap(NULL, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE,
+                       descriptor, 0);
+        mappingSize = static_cast<size_t>(status.st_size);
+    }
+    ::close(descriptor);
+    if (mapping == MAP_FAILED || mapping == NULL)
+    {
+        mapping = NULL;
+        return false;
+    }
+#endif
+
+    // Check the header describes a 2D texture with its levels down to 1x1
+    // in the byte order of this computer
+    KTXHeader header;
+    const unsigned char *bytes = static_cast<const unsigned char *>(mapping);
+    bool valid = mappingSize >= sizeof(header);
+    if (valid)
+        memcpy(&header, bytes, sizeof(header));
+    valid = valid && memcmp(header.identifier, ktxIdentifier, 12) == 0 &&
+            header.endianness == ktxEndianness &&
+            header.pixelWidth > 0 && header.pixelHeight > 0 && header.pixelDepth == 0 &&
+            header.numberOfArrayElements == 0 && header.numberOfFaces == 1 &&
+            header.numberOfMipmapLevels > 0 && header.numberOfMipmapLevels <= 32;
+
+    // Find the levels, each after its size
+    size_t offset = sizeof(header) + (valid ? header.bytesOfKeyValueData : 0);
+    unsigned int w = valid ? header.pixelWidth : 0, h = valid ? header.pixelHeight : 0;
+    for (unsigned int i = 0; valid && i < header.numberOfMipmapLevels; i++)
+    {
+        Level level;
+        level.width  = w;
+        level.height = h;
+        level.size   = levelSize(header.glType, header.glFormat, header.glInternalFormat, w, h);
+        uint32_t imageSize = 0;
+        valid = level.size > 0 && offset + 4 <= mappingSize;
+        if (valid)
+            memcpy(&imageSize, bytes + offset, 4);
+        valid = valid && imageSize == level.size && offset + 4 + level.size <= mappingSize;
+        level.data = bytes + offset + 4;
+        levels.push_back(level);
+        offset += 4 + pad4(level.size);
+        w = std::max(1u, w / 2);
+        h = std::max(1u, h / 2);
+    }
+    valid = valid && levels.back().width == 1 && levels.back().height == 1;
+
+    if (!valid)
+    {
+        close();
+        return false;
+    }
+    type           = header.glType;
+    format         = header.glFormat;
+    internalFormat = header.glInternalFormat;
+    return true;
+}
+
+void KTX::close()
+{
+#ifdef _WIN32
+    if (mapping != NULL)
+        UnmapViewOfFile(mapping);
+    if (fileMapping != NULL)
+        CloseHandle(fileMapping);
+    if (file != NULL)
+        CloseHandle(file);
+    file = NULL;
+    fileMapping = NULL;
+#else
+    if (mapping != NULL)
+        munmap(mapping, mappingSize);
+#endif
+    mapping = NULL;
+    mappingSize = 0;
+    levels.clear();
+}
+
+void KTX::prefetch() const
+{
+    if (mapping == NULL)
+        return;
+
+#ifndef _WIN32
+    madvise(mapping, mappingSize, MADV_WILLNEED);
+#endif
+
+    // Touch a byte of each page so they are read now and not while uploading
+    const volatile unsigned char *bytes = static_cast<const unsigned char *>(mapping);
+    unsigned char sum = 0;
+    for (size_t i = 0; i < mappingSize; i += 4096)
+        sum += bytes[i];
+    (void)sum;
+}
+
+size_t KTX::size() const
+{
+    size_t size = 0;
+    for (const Level &level : levels)
+        size += level.size;
+    return size;
+}
+
+unsigned int KTX::components() const
+{
+    if (type == 0)
+    {
+        for (int i = BlockCompression::BC1; i <= BlockCompression::BC5; i++)
+        {
+            BlockCompression::Format blockFormat = static_cast<BlockCompression::Format>(i);
+            if (BlockCompression::internalFormat(blockFormat) == internalFormat)
+                return BlockCompression::components(blockFormat);
+        }
+        return 0;
+    }
+
+    for (unsigned int components = 1; components <= 4; components++)
+        if (format == Mipmaps::pixelFormat(components))
+            return components;
+    return 0;
+}
+
+void KTX::upload() const
+{
+    // The rows are padded to 4 bytes, OpenGL's default GL_UNPACK_ALIGNMENT
+    for (unsigned int i = 0; i < levels.size(); i++)
+    {
+        if (type == 0)
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat,
+                                   levels[i].width, levels[i].height, 0,
+                                   static_cast<GLsizei>(levels[i].size), levels[i].data);
+        else
+            glTexImage2D(GL_TEXTURE_2D, i, internalFormat, levels[i].width, levels[i].height, 0,
+                         format, type, levels[i].data);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<int>(levels.size()) - 1);
+}
+
+bool KTX::write(const std::string &path, const Mipmaps &mipmaps)
+{
+    if (mipmaps.levels.empty())
+        return false;
+
+    std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == NULL)
+        return false;
+
+    KTXHeader header;
+    memcpy(header.identifier, ktxIdentifier, 12);
+    header.endianness            = ktxEndianness;
+    header.glType                = mipmaps.compressed ? 0 : GL_UNSIGNED_BYTE;
+    header.glTypeSize            = 1;
+    header.glFormat              = mipmaps.compressed ? 0
+                                                      : Mipmaps::pixelFormat(mipmaps.components);
+    header.glInternalFormat      = mipmaps.compressed
+                                   ? BlockCompression::internalFormat(mipmaps.format)
+                                   : sizedFormat(mipmaps.components);
+    header.glBaseInternalFormat  = Mipmaps::pixelFormat(mipmaps.components);
+    header.pixelWidth            = mipmaps.levels[0].width;
+    header.pixelHeight           = mipmaps.levels[0].height;
+    header.pixelDepth            = 0;
+    header.numberOfArrayElements = 0;
+    header.numberOfFaces         = 1;
+    header.numberOfMipmapLevels  = static_cast<uint32_t>(mipmaps.levels.size());
+    header.bytesOfKeyValueData   = 0;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    // Write each level after its size, with the rows of uncompressed levels
+    // padded to 4 bytes
+    const unsigned char padding[4] = { 0, 0, 0, 0 };
+    for (const Mipmaps::Level &level : mipmaps.levels)
+    {
+        size_t rowSize = mipmaps.compressed ? level.pixels.size()
+                                            : static_cast<size_t>(level.width) * mipmaps.components;
+        unsigned int numRows = mipmaps.compressed ? 1 : level.height;
+        uint32_t imageSize = static_cast<uint32_t>(pad4(rowSize) * numRows);
+        written = written && fwrite(&imageSize, 4, 1, file) == 1;
+        for (unsigned int y = 0; y < numRows; y++)
+            written = written &&
+                      fwrite(&level.pixels[y * rowSize], 1, rowSize, file) == rowSize &&
+                      fwrite(padding, 1, pad4(rowSize) - rowSize, file) == pad4(rowSize) - rowSize;
+    }
+    written = fclose(file) == 0 && written;
+    return replaceFile(temporary, path, written);
+}
+
+bool KTX::copy(const std::string &path) const
+{
+    if (mapping == NULL)
+        return false;
+
+    std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == NULL)
+        return false;
+    bool written = fwrite(mapping, 1, mappingSize, file) == mappingSize;
+    written = fclose(file) == 0 && written;
+    return replaceFile(temporary, path, written);
+}
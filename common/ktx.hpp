@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <GL/glew.h>
+
+#include <common/mipmaps.hpp>
+
+// KTX class. Reads and writes mipmap chains in KTX 1.1 files, the Khronos
+// container for OpenGL textures. The header holds the OpenGL type and
+// formats, and the levels are stored in the format they are uploaded in,
+// block compressed or not, each after its size in bytes:
+//
+//     KTX::write("diamond_normal.ktx", mipmaps);
+//     ...
+//     KTX ktx;
+//     if (ktx.open("diamond_normal.ktx"))     // map the file into memory
+//     {
+//         glBindTexture(GL_TEXTURE_2D, texture);
+//         ktx.upload();                       // straight from the mapping
+//     }
+//
+// The file is mapped instead of read so the levels are not copied or
+// decoded before they are uploaded, and loading a texture takes as long as
+// reading its file. The pages can be read in on a worker thread first with
+// prefetch, so uploading them doesn't wait for the disk.
+class KTX
+{
+public:
+    // Level in the mapping
+    struct Level
+    {
+        unsigned int width  = 0;
+        unsigned int height = 0;
+        const unsigned char *data = NULL;
+        size_t size = 0;
+    };
+
+    std::vector<Level> levels;
+    GLenum type = 0;                        // 0 for compressed levels
+    GLenum format = 0;
+    GLenum internalFormat = 0;
+
+    KTX() {}
+    ~KTX();
+    KTX(const KTX &) = delete;
+    KTX &operator=(const KTX &) = delete;
+
+    // Map a file and find its levels (false if it isn't a 2D texture in a
+    // format we upload)
+    bool open(const std::string &path);
+    void close();
+    bool isOpen() const { return mapping != NULL; }
+
+    // Read the mapped pages into memory
+    void prefetch() const;
+
+    // Bytes in the levels and components in their pixels
+    size_t size() const;
+    unsigned int components() const;
+
+    // Upload the levels into the bound GL_TEXTURE_2D
+    void upload() const;
+
+    // Write a chain to a file, or the mapped file to another one
+    static bool write(const std::string &path, const Mipmaps &mipmaps);
+    bool copy(const std::string &path) const;
+
+private:
+    void *mapping = NULL;
+    size_t mappingSize = 0;
+#ifdef _WIN32
+    void *file = NULL;
+    void *fileMapping = NULL;
+#endif
+};
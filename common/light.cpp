@@ -1,4 +1,7 @@
+#include <algorithm>
+
 #include <common/light.hpp>
+#include <common/profiler.hpp>
 
 void Light::addPointLight(const glm::vec3 position,  const glm::vec3 colour,
                    const float constant,      const float linear,
@@ -42,7 +45,11 @@ void Light::addDirectionalLight(const glm::vec3 direction, const glm::vec3 colou
 
 void Light::toShader(unsigned int shaderID, glm::mat4 view)
 {
-    unsigned int numLights = static_cast<unsigned int>(lightSources.size());
+    PROFILE_SCOPE("Light::toShader");
+    
+    // Lights beyond the size of the shader's light array are not used
+    unsigned int numLights = std::min(static_cast<unsigned int>(lightSources.size()),
+                                      maxShaderLights);
     glUniform1i(glGetUniformLocation(shaderID, "numLights"), numLights);
     
     for (unsigned int i = 0; i < numLights; i++)
@@ -61,7 +68,7 @@ void Light::toShader(unsigned int shaderID, glm::mat4 view)
     }
 }
 
-void Light::draw(glm::mat4 view, glm::mat4 projection, Model lightModel)
+void Light::draw(glm::mat4 view, glm::mat4 projection, Model &lightModel)
 {
     glUseProgram(lightShaderID);
     for (unsigned int i = 0; i < static_cast<unsigned int>(lightSources.size()); i++)
@@ -3,6 +3,9 @@
 #include <common/maths.hpp>
 #include <common/model.hpp>
 
+// Maximum number of lights used by the shaders (maxLights in lighting.glsl)
+static const unsigned int maxShaderLights = 10;
+
 struct LightSource
 {
     glm::vec3 position;
@@ -35,5 +38,5 @@ public:
     void toShader(unsigned int shaderID, glm::mat4 view);
     
     // Draw light source
-    void draw(glm::mat4 view, glm::mat4 projection, Model lightModel);
+    void draw(glm::mat4 view, glm::mat4 projection, Model &lightModel);
 };
@@ -0,0 +1,33 @@
+// Shared light source definitions. Include this file in a shader and link
+// the program with lightingFragmentShader.glsl which implements the functions.
+
+# define maxLights 10
+
+// Light struct
+struct Light
+{
+    vec3 position;
+    vec3 colour;
+    vec3 direction;
+    float constant;
+    float linear;
+    float quadratic;
+    float cosPhi;
+    int type;
+};
+
+// Function prototypes
+vec3 pointLight(vec3 lightPosition, vec3 lightColour,
+                float constant, float linear, float quadratic,
+                vec3 objectColour, vec3 normal, vec3 fragmentPosition);
+
+vec3 spotLight(vec3 lightPosition, vec3 lightDirection, vec3 lightColour,
+               float cosPhi, float constant, float linear, float quadratic,
+               vec3 objectColour, vec3 normal, vec3 fragmentPosition);
+
+vec3 directionalLight(vec3 lightDirection, vec3 lightColour,
+                      vec3 objectColour, vec3 normal, vec3 fragmentPosition);
+
+// Calculate the contribution of a light source of any type
+vec3 calculateLight(Light light, vec3 lightPosition, vec3 lightDirection,
+                    vec3 objectColour, vec3 normal, vec3 fragmentPosition);
@@ -0,0 +1,118 @@
+#version 330 core
+
+#include "lighting.glsl"
+
+// Uniforms
+uniform float ka;
+uniform float kd;
+uniform float ks;
+uniform float Ns;
+
+// Calculate the contribution of a light source of any type
+vec3 calculateLight(Light light, vec3 lightPosition, vec3 lightDirection,
+                    vec3 objectColour, vec3 normal, vec3 fragmentPosition)
+{
+    // Calculate point light
+    if (light.type == 1)
+        return pointLight(lightPosition, light.colour,
+                          light.constant, light.linear, light.quadratic,
+                          objectColour, normal, fragmentPosition);
+
+    // Calculate spotlight
+    if (light.type == 2)
+        return spotLight(lightPosition, lightDirection, light.colour,
+                         light.cosPhi, light.constant, light.linear,
+                         light.quadratic, objectColour, normal,
+                         fragmentPosition);
+
+    // Calculate directional light
+    if (light.type == 3)
+        return directionalLight(lightDirection, light.colour,
+                                objectColour, normal, fragmentPosition);
+
+    return vec3(0.0, 0.0, 0.0);
+}
+
+// Calculate point light
+vec3 pointLight(vec3 lightPosition, vec3 lightColour,
+                float constant, float linear, float quadratic,
+                vec3 objectColour, vec3 normal, vec3 fragmentPosition)
+{
+    // Ambient reflection
+    vec3 ambient = ka * objectColour;
+    
+    // Diffuse reflection
+    vec3 light      = normalize(lightPosition - fragmentPosition);
+    float cosTheta  = max(dot(normal, light), 0);
+    vec3 diffuse    = kd * lightColour * objectColour * cosTheta;
+    
+    // Specular reflection
+    vec3 reflection = - light + 2 * dot(light, normal) * normal;
+    vec3 camera     = normalize(-fragmentPosition);
+    float cosAlpha  = max(dot(camera, reflection), 0);
+    vec3 specular   = ks * lightColour * pow(cosAlpha, Ns);
+    
+    // Attenuation
+    float distance    = length(lightPosition - fragmentPosition);
+    float attenuation = 1.0 / (constant + linear * distance +
+                               quadratic * distance * distance);
+    
+    // Fragment colour
+    return (ambient + diffuse + specular) * attenuation;
+}
+
+// Calculate spotlight
+vec3 spotLight(vec3 lightPosition, vec3 lightDirection, vec3 lightColour,
+               float cosPhi, float constant, float linear, float quadratic,
+               vec3 objectColour, vec3 normal, vec3 fragmentPosition)
+{
+    // Ambient reflection
+    vec3 ambient = ka * objectColour;
+    
+    // Diffuse reflection
+    vec3 light     = normalize(lightPosition - fragmentPosition);
+    float cosTheta = max(dot(normal, light), 0);
+    vec3 diffuse   = kd * lightColour * objectColour * cosTheta;
+    
+    // Specular reflection
+    vec3 reflection = - light + 2 * dot(light, normal) * normal;
+    vec3 camera     = normalize(-fragmentPosition);
+    float cosAlpha  = max(dot(camera, reflection), 0);
+    vec3 specular   = ks * lightColour * pow(cosAlpha, Ns);
+    
+    // Attenuation
+    float distance    = length(lightPosition - fragmentPosition);
+    float attenuation = 1.0 / (constant + linear * distance +
+                               quadratic * distance * distance);
+    
+    // Directional light intensity
+    vec3 direction  = normalize(lightDirection);
+    cosTheta        = dot(-light, direction);
+    float delta     = radians(2.0);
+    float intensity = clamp((cosTheta - cosPhi) / delta, 0.0, 1.0);
+    
+    // Return fragment colour
+    return (ambient + diffuse + specular) * attenuation * intensity;
+}
+
+// Calculate directional light
+vec3 directionalLight(vec3 lightDirection, vec3 lightColour,
+                      vec3 objectColour, vec3 normal, vec3 fragmentPosition)
+{
+    // Ambient reflection
+    vec3 ambient = ka * objectColour;
+    
+    // Diffuse reflection
+    vec3 light     = normalize(-lightDirection);
+    float cosTheta = max(dot(normal, light), 0);
+    vec3 diffuse   = kd * lightColour * objectColour * cosTheta;
+    
+    // Specular reflection
+    vec3 reflection = - light + 2 * dot(light, normal) * normal;
+    vec3 camera     = normalize(-fragmentPosition);
+    float cosAlpha  = max(dot(camera, reflection), 0);
+    vec3 specular   = ks * lightColour * pow(cosAlpha, Ns);
+    
+    // Return fragment colour
+    return ambient + diffuse + specular;
+}
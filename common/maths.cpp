@@ -91,48 +91,144 @@ glm::mat4 Maths::perspective(const float fov,  const float aspect,
 }
 
 // =============================================================================
-// Quaternion class methods
-
-//Quaternion::Quaternion() {}
-//
-//Quaternion::Quaternion(const float w, const float x, const float y,
-//                       const float z)
-//{
-//    this->w = w;
-//    this->x = x;
-//    this->y = y;
-//    this->z = z;
-//}
-//
-//glm::mat4 Quaternion::matrix()
-//{
-//    float x2 = 2.0f * x,  y2 = 2.0f * y,  z2 = 2.0f * z;
-//    float xx = x * x2, xy = x * y2, xz = x * z2, xw = w * x2;
-//    float yy = y * y2, yz = y * z2, yw = w * y2;
-//    float zz = z * z2, zw = w * z2;
-//    
-//    glm::mat4 R(1.0f);
-//    R[0][0] = 1.0f - yy - zz, R[] = xy - zw,        R[8]  = xz + yw;
-//    R[1] = xy + zw,        R[5] = 1.0f - xx - zz, R[9]  = yz - xw;
-//    R[2] = xz - yw,        R[6] = xw + yz,        R[10] = 1.0f - xx - yy;
-//    
-//    return R;
-//}
-//
-//void Quaternion::eulerToQuat(const float yaw, const float pitch,
-//                             const float roll)
-//{
-//    float cp = cos(0.5f * pitch), sp = sin(0.5f * pitch);
-//    float cy = cos(0.5f * yaw),   sy = sin(0.5f * yaw);
-//    float cr = cos(0.5f * roll),  sr = sin(0.5f * roll);
-//
-////    w = cy * cp * cr - cy * sp * sr;
-////    x = cy * cp * cr + cy * sp * sr;
-////    y = cy * cp * sp - cy * cp * sr;
-////    z = cy * cp * sr + cy * sp * cr;
-//    
-//    w = cr * cp * cy + sr * sp * sy;
-//    x = sr * cp * cy - cr * sp * sy;
-//    y = cr * sp * cy + sr * cp * sy;
-//    z = cr * cp * sy - sr * sp * cy;
-//}
+// Quaternion class methods (matrix() is in mathssimd.cpp with the batched
+// version so the two give the same results)
+
+Quaternion::Quaternion() : w(1.0f), x(0.0f), y(0.0f), z(0.0f) {}
+
+Quaternion::Quaternion(const float w, const float x, const float y,
+                       const float z)
+{
+    this->w = w;
+    this->x = x;
+    this->y = y;
+    this->z = z;
+}
+
+Quaternion::Quaternion(const float angle, const glm::vec3 axis)
+{
+    glm::vec3 v = glm::normalize(axis);
+    float s = sin(0.5f * angle);
+    w = cos(0.5f * angle);
+    x = s * v.x;
+    y = s * v.y;
+    z = s * v.z;
+}
+
+void Quaternion::eulerToQuat(const float yaw, const float pitch,
+                             const float roll)
+{
+    float cp = cos(0.5f * pitch), sp = sin(0.5f * pitch);
+    float cy = cos(0.5f * yaw),   sy = sin(0.5f * yaw);
+    float cr = cos(0.5f * roll),  sr = sin(0.5f * roll);
+
+    w = cr * cp * cy + sr * sp * sy;
+    x = sr * cp * cy - cr * sp * sy;
+    y = cr * sp * cy + sr * cp * sy;
+    z = cr * cp * sy - sr * sp * cy;
+}
+
+Quaternion Quaternion::operator*(const Quaternion &q) const
+{
+    return Quaternion(w * q.w - x * q.x - y * q.y - z * q.z,
+                      w * q.x + x * q.w + y * q.z - z * q.y,
+                      w * q.y - x * q.z + y * q.w + z * q.x,
+                      w * q.z + x * q.y - y * q.x + z * q.w);
+}
+
+Quaternion Quaternion::conjugate() const
+{
+    return Quaternion(w, -x, -y, -z);
+}
+
+float Quaternion::length() const
+{
+    return sqrt(w * w + x * x + y * y + z * z);
+}
+
+Quaternion Quaternion::normalise() const
+{
+    float s = 1.0f / length();
+    return Quaternion(s * w, s * x, s * y, s * z);
+}
+
+glm::vec3 Quaternion::rotate(const glm::vec3 &v) const
+{
+    // v' = v + w t + q x t where t = 2 q x v
+    glm::vec3 q(x, y, z);
+    glm::vec3 t = 2.0f * glm::cross(q, v);
+    return v + w * t + glm::cross(q, t);
+}
+
+Quaternion Quaternion::nlerp(const Quaternion &q1, const Quaternion &q2,
+                             const float t)
+{
+    // Take the shortest path (q and -q are the same rotation)
+    float sign = q1.w * q2.w + q1.x * q2.x + q1.y * q2.y + q1.z * q2.z < 0.0f ? -1.0f : 1.0f;
+    float a = 1.0f - t, b = sign * t;
+    return Quaternion(a * q1.w + b * q2.w, a * q1.x + b * q2.x,
+                      a * q1.y + b * q2.y, a * q1.z + b * q2.z).normalise();
+}
+
+Quaternion Quaternion::slerp(const Quaternion &q1, const Quaternion &q2,
+                             const float t)
+{
+    float cosTheta = q1.w * q2.w + q1.x * q2.x + q1.y * q2.y + q1.z * q2.z;
+    float sign     = cosTheta < 0.0f ? -1.0f : 1.0f;
+    cosTheta      *= sign;
+
+    // Nearly the same rotation, where sin(theta) is too small to divide by
+    if (cosTheta > 0.9995f)
+        return nlerp(q1, q2, t);
+
+    float theta = acos(cosTheta);
+    float a = sin((1.0f - t) * theta) / sin(theta);
+    float b = sign * sin(t * theta) / sin(theta);
+    return Quaternion(a * q1.w + b * q2.w, a * q1.x + b * q2.x,
+                      a * q1.y + b * q2.y, a * q1.z + b * q2.z);
+}
+
+// =============================================================================
+// Affine class methods (operator* and inverse() are in mathssimd.cpp)
+
+Affine::Affine()
+{
+    rows[0] = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+    rows[1] = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+    rows[2] = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+}
+
+Affine::Affine(const glm::mat4 &m)
+{
+    for (unsigned int r = 0; r < 3; r++)
+        rows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+}
+
+glm::mat4 Affine::matrix() const
+{
+    glm::mat4 m(1.0f);
+    for (unsigned int r = 0; r < 3; r++)
+        for (unsigned int c = 0; c < 4; c++)
+            m[c][r] = rows[r][c];
+
+    return m;
+}
+
+glm::vec3 Affine::transformPoint(const glm::vec3 &p) const
+{
+    glm::vec4 v(p, 1.0f);
+    return glm::vec3(glm::dot(rows[0], v), glm::dot(rows[1], v), glm::dot(rows[2], v));
+}
+
+glm::vec3 Affine::transformVector(const glm::vec3 &v) const
+{
+    return glm::vec3(glm::dot(glm::vec3(rows[0]), v), glm::dot(glm::vec3(rows[1]), v),
+                     glm::dot(glm::vec3(rows[2]), v));
+}
+
+void Affine::transformPoints(const glm::vec3 *points, glm::vec3 *output,
+                             const unsigned int count) const
+{
+    // Use the SIMD batch transform
+    Maths::transformPoints(matrix(), points, output, count);
+}
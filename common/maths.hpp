@@ -5,6 +5,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/io.hpp>
 
+class Quaternion;
+
 // Maths class
 class Maths
 {
@@ -23,19 +25,81 @@ public:
                                   const float near,   const float far);
     static glm::mat4 perspective( const float fov,  const float aspect,
                                   const float near, const float far);
+
+    // Matrix operations. These use SSE or AVX when the CPU has them (see
+    // mathssimd.cpp) and give bit for bit the same results as the scalar code.
+    static glm::mat4 multiply(const glm::mat4 &a, const glm::mat4 &b);
+    static glm::mat4 transpose(const glm::mat4 &m);
+    static glm::mat4 inverse(const glm::mat4 &m);
+    static glm::mat4 affineInverse(const glm::mat4 &m);     // last row 0 0 0 1
+
+    // Transform arrays of points (as m * (p, 1), without a perspective
+    // divide) and normals (by the inverse transpose of the top left 3x3 of
+    // m, then normalised). The output may be the same array as the input.
+    static void transformPoints(const glm::mat4 &m, const glm::vec3 *points,
+                                glm::vec3 *output, const unsigned int count);
+    static void transformNormals(const glm::mat4 &m, const glm::vec3 *normals,
+                                 glm::vec3 *output, const unsigned int count);
+
+    // Rotation matrices of an array of unit quaternions (4 or 8 at a time)
+    static void quaternionMatrices(const Quaternion *quaternions, glm::mat4 *output,
+                                   const unsigned int count);
+
+    // Instruction set used by the matrix operations. This is chosen from the
+    // CPU at start up and can be changed, e.g. to compare against scalar.
+    enum SimdLevel { Scalar, SSE, AVX };
+    static SimdLevel simdLevel();
+    static SimdLevel cpuSimdLevel();                        // best available
+    static void setSimdLevel(const SimdLevel level);
+    static const char *simdName(const SimdLevel level);
 };
 
-// Quaternion class
+// Quaternion class. A unit quaternion w + xi + yj + zk represents a rotation
+// in 16 bytes. q1 * q2 is the rotation q2 followed by q1.
 class Quaternion
 {
 public:
     float w, x, y, z;
     
     // Constructors
-    Quaternion();
+    Quaternion();                                       // no rotation
     Quaternion(const float w, const float x, const float y, const float z);
+    Quaternion(const float angle, const glm::vec3 axis);
     
     // Methods
-    glm::mat4 matrix();
+    glm::mat4 matrix() const;
     void eulerToQuat(const float yaw, const float pitch, const float roll);
+    Quaternion operator*(const Quaternion &q) const;
+    Quaternion conjugate() const;                       // inverse rotation
+    float length() const;
+    Quaternion normalise() const;
+    glm::vec3 rotate(const glm::vec3 &v) const;         // without a matrix
+
+    // Interpolate between two rotations (t = 0 gives q1 and t = 1 gives q2).
+    // nlerp is cheaper but doesn't rotate at a constant speed.
+    static Quaternion nlerp(const Quaternion &q1, const Quaternion &q2, const float t);
+    static Quaternion slerp(const Quaternion &q1, const Quaternion &q2, const float t);
+};
+
+// Affine class. A transform made from translations, rotations and scales
+// stored as the top three rows of its 4x4 matrix (the last row is always
+// 0 0 0 1), 48 bytes rather than a mat4's 64. A shader can read the rows as
+// a mat3x4 M and transform a point with vec4(position, 1.0) * M.
+class Affine
+{
+public:
+    glm::vec4 rows[3];
+    
+    // Constructors
+    Affine();                                           // identity
+    explicit Affine(const glm::mat4 &m);
+    
+    // Methods
+    glm::mat4 matrix() const;
+    Affine operator*(const Affine &a) const;
+    Affine inverse() const;
+    glm::vec3 transformPoint(const glm::vec3 &p) const;
+    glm::vec3 transformVector(const glm::vec3 &v) const;
+    void transformPoints(const glm::vec3 *points, glm::vec3 *output,
+                         const unsigned int count) const;
 };
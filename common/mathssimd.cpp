@@ -0,0 +1,673 @@
+#include <algorithm>
+
+#include <common/maths.hpp>
+
+// SIMD versions of the Maths matrix operations. Each operation is written
+// once as a template over a 4 lane type: Lane4 does the arithmetic one
+// float at a time (the scalar version) and Sse4 uses SSE registers. Both
+// do the same IEEE operations in the same order so their results are
+// identical bit for bit. The AVX versions work on two columns or two
+// vectors at once, again with the same operations per lane. The version
+// used is chosen at run time from the instruction sets the CPU supports.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATHS_SSE
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MATHS_AVX_TARGET
+#else
+#define MATHS_AVX_TARGET __attribute__((target("avx")))
+#endif
+#endif
+
+// Fusing a multiply and add into an FMA would round differently from the
+// scalar code, so contraction is switched off for this file
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+// =============================================================================
+// Lanes
+
+// Four floats, one at a time
+struct Lane4
+{
+    float v[4];
+
+    Lane4() {}
+    Lane4(const float x) { v[0] = v[1] = v[2] = v[3] = x; }
+    Lane4(const float x, const float y, const float z, const float w)
+    {
+        v[0] = x; v[1] = y; v[2] = z; v[3] = w;
+    }
+    static Lane4 load(const float *p) { return Lane4(p[0], p[1], p[2], p[3]); }
+    void store(float *p) const { p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; p[3] = v[3]; }
+    void store3(float *p) const { p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; }
+    float lane(const unsigned int i) const { return v[i]; }
+
+    // Lanes in the order i, j, k, l
+    template <int i, int j, int k, int l>
+    Lane4 permute() const { return Lane4(v[i], v[j], v[k], v[l]); }
+
+    static void transpose(Lane4 &a, Lane4 &b, Lane4 &c, Lane4 &d)
+    {
+        std::swap(a.v[1], b.v[0]); std::swap(a.v[2], c.v[0]); std::swap(a.v[3], d.v[0]);
+        std::swap(b.v[2], c.v[1]); std::swap(b.v[3], d.v[1]); std::swap(c.v[3], d.v[2]);
+    }
+};
+inline Lane4 operator+(const Lane4 &a, const Lane4 &b)
+{
+    return Lane4(a.v[0] + b.v[0], a.v[1] + b.v[1], a.v[2] + b.v[2], a.v[3] + b.v[3]);
+}
+inline Lane4 operator-(const Lane4 &a, const Lane4 &b)
+{
+    return Lane4(a.v[0] - b.v[0], a.v[1] - b.v[1], a.v[2] - b.v[2], a.v[3] - b.v[3]);
+}
+inline Lane4 operator*(const Lane4 &a, const Lane4 &b)
+{
+    return Lane4(a.v[0] * b.v[0], a.v[1] * b.v[1], a.v[2] * b.v[2], a.v[3] * b.v[3]);
+}
+inline Lane4 operator/(const Lane4 &a, const Lane4 &b)
+{
+    return Lane4(a.v[0] / b.v[0], a.v[1] / b.v[1], a.v[2] / b.v[2], a.v[3] / b.v[3]);
+}
+
+#ifdef MATHS_SSE
+// Four floats in an SSE register
+struct Sse4
+{
+    __m128 v;
+
+    Sse4() {}
+    Sse4(const __m128 x) : v(x) {}
+    Sse4(const float x) : v(_mm_set1_ps(x)) {}
+    Sse4(const float x, const float y, const float z, const float w) : v(_mm_setr_ps(x, y, z, w)) {}
+    static Sse4 load(const float *p) { return Sse4(_mm_loadu_ps(p)); }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+    void store3(float *p) const
+    {
+        _mm_storel_pi(reinterpret_cast<__m64 *>(p), v);
+        _mm_store_ss(p + 2, _mm_movehl_ps(v, v));
+    }
+    float lane(const unsigned int i) const
+    {
+        switch (i)
+        {
+            case 0:  return _mm_cvtss_f32(v);
+            case 1:  return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+            case 2:  return _mm_cvtss_f32(_mm_movehl_ps(v, v));
+            default: return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+    }
+
+    template <int i, int j, int k, int l>
+    Sse4 permute() const { return Sse4(_mm_shuffle_ps(v, v, _MM_SHUFFLE(l, k, j, i))); }
+
+    static void transpose(Sse4 &a, Sse4 &b, Sse4 &c, Sse4 &d)
+    {
+        _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+    }
+};
+inline Sse4 operator+(const Sse4 &a, const Sse4 &b) { return _mm_add_ps(a.v, b.v); }
+inline Sse4 operator-(const Sse4 &a, const Sse4 &b) { return _mm_sub_ps(a.v, b.v); }
+inline Sse4 operator*(const Sse4 &a, const Sse4 &b) { return _mm_mul_ps(a.v, b.v); }
+inline Sse4 operator/(const Sse4 &a, const Sse4 &b) { return _mm_div_ps(a.v, b.v); }
+#endif
+
+// =============================================================================
+// Kernels
+
+template <typename V>
+static glm::mat4 multiplyKernel(const glm::mat4 &a, const glm::mat4 &b)
+{
+    // Same order of operations as glm's operator*
+    V a0 = V::load(&a[0][0]), a1 = V::load(&a[1][0]);
+    V a2 = V::load(&a[2][0]), a3 = V::load(&a[3][0]);
+
+    glm::mat4 result;
+    for (unsigned int c = 0; c < 4; c++)
+        (a0 * V(b[c][0]) + a1 * V(b[c][1]) + a2 * V(b[c][2]) + a3 * V(b[c][3])).store(&result[c][0]);
+
+    return result;
+}
+
+template <typename V>
+static glm::mat4 transposeKernel(const glm::mat4 &m)
+{
+    V c0 = V::load(&m[0][0]), c1 = V::load(&m[1][0]);
+    V c2 = V::load(&m[2][0]), c3 = V::load(&m[3][0]);
+    V::transpose(c0, c1, c2, c3);
+
+    glm::mat4 result;
+    c0.store(&result[0][0]); c1.store(&result[1][0]);
+    c2.store(&result[2][0]); c3.store(&result[3][0]);
+    return result;
+}
+
+template <typename V>
+static glm::mat4 inverseKernel(const glm::mat4 &m)
+{
+    // Calculate the 2x2 determinants of the top two and bottom two rows
+    // (Eberly, "The Laplace expansion theorem"). a(i, j) is row i, column j.
+    #define a(i, j) m[j][i]
+    float s0 = a(0, 0) * a(1, 1) - a(1, 0) * a(0, 1);
+    float s1 = a(0, 0) * a(1, 2) - a(1, 0) * a(0, 2);
+    float s2 = a(0, 0) * a(1, 3) - a(1, 0) * a(0, 3);
+    float s3 = a(0, 1) * a(1, 2) - a(1, 1) * a(0, 2);
+    float s4 = a(0, 1) * a(1, 3) - a(1, 1) * a(0, 3);
+    float s5 = a(0, 2) * a(1, 3) - a(1, 2) * a(0, 3);
+    float c5 = a(2, 2) * a(3, 3) - a(3, 2) * a(2, 3);
+    float c4 = a(2, 1) * a(3, 3) - a(3, 1) * a(2, 3);
+    float c3 = a(2, 1) * a(3, 2) - a(3, 1) * a(2, 2);
+    float c2 = a(2, 0) * a(3, 3) - a(3, 0) * a(2, 3);
+    float c1 = a(2, 0) * a(3, 2) - a(3, 0) * a(2, 2);
+    float c0 = a(2, 0) * a(3, 1) - a(3, 0) * a(2, 1);
+    #undef a
+    float det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    V invDet  = V(1.0f / det);
+
+    // Column j rearranged to (a1j, -a0j, a3j, -a2j) and its negative
+    V sign(1.0f, -1.0f, 1.0f, -1.0f), negative(-1.0f);
+    V p0 = V::load(&m[0][0]).template permute<1, 0, 3, 2>() * sign;
+    V p1 = V::load(&m[1][0]).template permute<1, 0, 3, 2>() * sign;
+    V p2 = V::load(&m[2][0]).template permute<1, 0, 3, 2>() * sign;
+    V p3 = V::load(&m[3][0]).template permute<1, 0, 3, 2>() * sign;
+    V n0 = p0 * negative, n1 = p1 * negative, n2 = p2 * negative, n3 = p3 * negative;
+
+    V k0(c0, c0, s0, s0), k1(c1, c1, s1, s1), k2(c2, c2, s2, s2);
+    V k3(c3, c3, s3, s3), k4(c4, c4, s4, s4), k5(c5, c5, s5, s5);
+
+    // Rows of the adjugate divided by the determinant
+    V r0 = (p1 * k5 - p2 * k4 + p3 * k3) * invDet;
+    V r1 = (n0 * k5 - n2 * k2 + n3 * k1) * invDet;
+    V r2 = (p0 * k4 - p1 * k2 + p3 * k0) * invDet;
+    V r3 = (n0 * k3 - n1 * k1 + n2 * k0) * invDet;
+    V::transpose(r0, r1, r2, r3);
+
+    glm::mat4 result;
+    r0.store(&result[0][0]); r1.store(&result[1][0]);
+    r2.store(&result[2][0]); r3.store(&result[3][0]);
+    return result;
+}
+
+// Cross product of the first three lanes (the last lane is 0 for finite
+// inputs)
+template <typename V>
+static V cross(const V &u, const V &v)
+{
+    return u.template permute<1, 2, 0, 3>() * v.template permute<2, 0, 1, 3>() -
+           u.template permute<2, 0, 1, 3>() * v.template permute<1, 2, 0, 3>();
+}
+
+// Inverse transpose of the top left 3x3 of m: columns b x c, c x a and a x b
+// divided by the determinant a . (b x c), where a, b and c are m's columns
+template <typename V>
+static void inverseTranspose3(const glm::mat4 &m, V &n0, V &n1, V &n2)
+{
+    V a = V::load(&m[0][0]), b = V::load(&m[1][0]), c = V::load(&m[2][0]);
+    n0 = cross(b, c);
+    n1 = cross(c, a);
+    n2 = cross(a, b);
+
+    V invDet = V(1.0f / (a.lane(0) * n0.lane(0) + a.lane(1) * n0.lane(1) +
+                         a.lane(2) * n0.lane(2)));
+    n0 = n0 * invDet;
+    n1 = n1 * invDet;
+    n2 = n2 * invDet;
+}
+
+template <typename V>
+static glm::mat4 affineInverseKernel(const glm::mat4 &m)
+{
+    // The inverse of [R t; 0 1] is [R^-1 -R^-1 t; 0 1]
+    V r0, r1, r2, r3(0.0f);
+    inverseTranspose3(m, r0, r1, r2);
+    V::transpose(r0, r1, r2, r3);
+
+    float tx = -m[3][0], ty = -m[3][1], tz = -m[3][2];
+    V t = r0 * V(tx) + r1 * V(ty) + r2 * V(tz) + V(0.0f, 0.0f, 0.0f, 1.0f);
+
+    glm::mat4 result;
+    r0.store(&result[0][0]); r1.store(&result[1][0]);
+    r2.store(&result[2][0]); t.store(&result[3][0]);
+    return result;
+}
+
+// Transform one point, in the same order as glm's m * vec4(p, 1)
+template <typename V>
+static V transformPoint(const V *m, const glm::vec3 &p)
+{
+    return (m[0] * V(p.x) + m[1] * V(p.y)) + (m[2] * V(p.z) + m[3]);
+}
+
+template <typename V>
+static void transformPointsKernel(const glm::mat4 &m, const glm::vec3 *points,
+                                  glm::vec3 *output, const unsigned int count)
+{
+    V columns[4] = { V::load(&m[0][0]), V::load(&m[1][0]),
+                     V::load(&m[2][0]), V::load(&m[3][0]) };
+    for (unsigned int i = 0; i < count; i++)
+        transformPoint(columns, points[i]).store3(&output[i].x);
+}
+
+// Normalise the first three lanes of v (zero vectors are left as they are)
+template <typename V>
+static V normalise(const V &v)
+{
+    float x = v.lane(0), y = v.lane(1), z = v.lane(2);
+    float length = std::sqrt(x * x + y * y + z * z);
+    return length > 0.0f ? v / V(length) : v;
+}
+
+template <typename V>
+static void transformNormalsKernel(const glm::mat4 &m, const glm::vec3 *normals,
+                                   glm::vec3 *output, const unsigned int count)
+{
+    V n0, n1, n2;
+    inverseTranspose3(m, n0, n1, n2);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const glm::vec3 &n = normals[i];
+        normalise(n0 * V(n.x) + n1 * V(n.y) + n2 * V(n.z)).store3(&output[i].x);
+    }
+}
+
+// Rotation part of the matrix of a unit quaternion, as m[3 * column + row].
+// T is float for one quaternion or a lane type for several.
+template <typename T>
+static void rotationMatrix(const T &w, const T &x, const T &y, const T &z, T *m)
+{
+    T x2 = x + x, y2 = y + y, z2 = z + z;
+    T xx = x * x2, xy = x * y2, xz = x * z2, xw = w * x2;
+    T yy = y * y2, yz = y * z2, yw = w * y2;
+    T zz = z * z2, zw = w * z2;
+    T one(1.0f);
+
+    m[0] = one - yy - zz; m[1] = xy + zw;       m[2] = xz - yw;
+    m[3] = xy - zw;       m[4] = one - xx - zz; m[5] = yz + xw;
+    m[6] = xz + yw;       m[7] = yz - xw;       m[8] = one - xx - yy;
+}
+
+glm::mat4 Quaternion::matrix() const
+{
+    float m[9];
+    rotationMatrix(w, x, y, z, m);
+
+    glm::mat4 R(1.0f);
+    for (unsigned int c = 0; c < 3; c++)
+        for (unsigned int r = 0; r < 3; r++)
+            R[c][r] = m[3 * c + r];
+
+    return R;
+}
+
+// Write the rotation matrices of 4 quaternions given by their lanes
+template <typename V>
+static void storeMatrices(const V *m, glm::mat4 *output)
+{
+    V zero(0.0f);
+    for (unsigned int c = 0; c < 3; c++)
+    {
+        V r0 = m[3 * c], r1 = m[3 * c + 1], r2 = m[3 * c + 2], r3 = zero;
+        V::transpose(r0, r1, r2, r3);
+        r0.store(&output[0][c][0]); r1.store(&output[1][c][0]);
+        r2.store(&output[2][c][0]); r3.store(&output[3][c][0]);
+    }
+    for (unsigned int k = 0; k < 4; k++)
+        output[k][3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+template <typename V>
+static void quaternionMatricesKernel(const Quaternion *quaternions, glm::mat4 *output,
+                                     const unsigned int count)
+{
+    // Four quaternions at a time, transposed so each lane holds one
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const float *q = &quaternions[i].w;
+        V w = V::load(q), x = V::load(q + 4), y = V::load(q + 8), z = V::load(q + 12);
+        V::transpose(w, x, y, z);
+
+        V m[9];
+        rotationMatrix(w, x, y, z, m);
+        storeMatrices(m, output + i);
+    }
+
+    for (; i < count; i++)
+        output[i] = quaternions[i].matrix();
+}
+
+// Affine transforms are stored as rows, so a product's rows are sums of the
+// rows of b: row i of a * b = a(i, 0) b0 + a(i, 1) b1 + a(i, 2) b2 + (0, 0, 0, a(i, 3))
+template <typename V>
+static Affine affineMultiplyKernel(const Affine &a, const Affine &b)
+{
+    V b0 = V::load(&b.rows[0].x), b1 = V::load(&b.rows[1].x), b2 = V::load(&b.rows[2].x);
+
+    Affine result;
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const glm::vec4 &row = a.rows[i];
+        (V(row.x) * b0 + V(row.y) * b1 + V(row.z) * b2 +
+         V(0.0f, 0.0f, 0.0f, row.w)).store(&result.rows[i].x);
+    }
+
+    return result;
+}
+
+template <typename V>
+static Affine affineInverseRowsKernel(const Affine &a)
+{
+    // The columns of R^-1 are r1 x r2, r2 x r0 and r0 x r1 divided by the
+    // determinant r0 . (r1 x r2), where r0, r1 and r2 are the rows of R
+    V r0 = V::load(&a.rows[0].x), r1 = V::load(&a.rows[1].x), r2 = V::load(&a.rows[2].x);
+    V c0 = cross(r1, r2), c1 = cross(r2, r0), c2 = cross(r0, r1);
+    V invDet = V(1.0f / (r0.lane(0) * c0.lane(0) + r0.lane(1) * c0.lane(1) +
+                         r0.lane(2) * c0.lane(2)));
+    c0 = c0 * invDet;
+    c1 = c1 * invDet;
+    c2 = c2 * invDet;
+
+    // The translation is -R^-1 t
+    V t = c0 * V(-a.rows[0].w) + c1 * V(-a.rows[1].w) + c2 * V(-a.rows[2].w);
+
+    // Transpose the columns to rows
+    V::transpose(c0, c1, c2, t);
+    Affine result;
+    c0.store(&result.rows[0].x);
+    c1.store(&result.rows[1].x);
+    c2.store(&result.rows[2].x);
+    return result;
+}
+
+#ifdef MATHS_SSE
+// AVX kernels. A 256 bit register holds two columns of a matrix or two
+// vectors, so each lane does the same operations as in the kernels above.
+
+// Copy a 128 bit value to both halves
+MATHS_AVX_TARGET static inline __m256 duplicate(const __m128 x)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(x), x, 1);
+}
+
+// x in the low half and y in the high half
+MATHS_AVX_TARGET static inline __m256 pair(const float x, const float y)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(x)), _mm_set1_ps(y), 1);
+}
+
+MATHS_AVX_TARGET static glm::mat4 multiplyAvx(const glm::mat4 &a, const glm::mat4 &b)
+{
+    __m256 a0 = duplicate(_mm_loadu_ps(&a[0][0])), a1 = duplicate(_mm_loadu_ps(&a[1][0]));
+    __m256 a2 = duplicate(_mm_loadu_ps(&a[2][0])), a3 = duplicate(_mm_loadu_ps(&a[3][0]));
+
+    // Two columns of the result at a time
+    glm::mat4 result;
+    for (unsigned int c = 0; c < 4; c += 2)
+    {
+        __m256 sum = _mm256_add_ps(_mm256_mul_ps(a0, pair(b[c][0], b[c + 1][0])),
+                                   _mm256_mul_ps(a1, pair(b[c][1], b[c + 1][1])));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(a2, pair(b[c][2], b[c + 1][2])));
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(a3, pair(b[c][3], b[c + 1][3])));
+        _mm256_storeu_ps(&result[c][0], sum);
+    }
+
+    return result;
+}
+
+MATHS_AVX_TARGET static void transformPointsAvx(const glm::mat4 &m, const glm::vec3 *points,
+                                                glm::vec3 *output, const unsigned int count)
+{
+    __m256 m0 = duplicate(_mm_loadu_ps(&m[0][0])), m1 = duplicate(_mm_loadu_ps(&m[1][0]));
+    __m256 m2 = duplicate(_mm_loadu_ps(&m[2][0])), m3 = duplicate(_mm_loadu_ps(&m[3][0]));
+
+    // Two points at a time
+    unsigned int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        const glm::vec3 &p = points[i], &q = points[i + 1];
+        __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, pair(p.x, q.x)),
+                                               _mm256_mul_ps(m1, pair(p.y, q.y))),
+                                 _mm256_add_ps(_mm256_mul_ps(m2, pair(p.z, q.z)), m3));
+        Sse4(_mm256_castps256_ps128(r)).store3(&output[i].x);
+        Sse4(_mm256_extractf128_ps(r, 1)).store3(&output[i + 1].x);
+    }
+
+    if (i < count)
+        transformPointsKernel<Sse4>(m, points + i, output + i, count - i);
+}
+
+MATHS_AVX_TARGET static void transformNormalsAvx(const glm::mat4 &m, const glm::vec3 *normals,
+                                                 glm::vec3 *output, const unsigned int count)
+{
+    Sse4 n0, n1, n2;
+    inverseTranspose3(m, n0, n1, n2);
+    __m256 c0 = duplicate(n0.v), c1 = duplicate(n1.v), c2 = duplicate(n2.v);
+
+    // Two normals at a time
+    unsigned int i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        const glm::vec3 &p = normals[i], &q = normals[i + 1];
+        __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c0, pair(p.x, q.x)),
+                                               _mm256_mul_ps(c1, pair(p.y, q.y))),
+                                 _mm256_mul_ps(c2, pair(p.z, q.z)));
+        normalise(Sse4(_mm256_castps256_ps128(r))).store3(&output[i].x);
+        normalise(Sse4(_mm256_extractf128_ps(r, 1))).store3(&output[i + 1].x);
+    }
+
+    if (i < count)
+        transformNormalsKernel<Sse4>(m, normals + i, output + i, count - i);
+}
+
+// Transpose the 4x4 blocks in each half of four registers
+MATHS_AVX_TARGET static inline void transposeHalves(__m256 &a, __m256 &b, __m256 &c, __m256 &d)
+{
+    __m256 t0 = _mm256_unpacklo_ps(a, b), t1 = _mm256_unpacklo_ps(c, d);
+    __m256 t2 = _mm256_unpackhi_ps(a, b), t3 = _mm256_unpackhi_ps(c, d);
+    a = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    b = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    c = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    d = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+MATHS_AVX_TARGET static void quaternionMatricesAvx(const Quaternion *quaternions,
+                                                   glm::mat4 *output, const unsigned int count)
+{
+    // Eight quaternions at a time: i to i + 3 in the low halves and i + 4 to
+    // i + 7 in the high halves
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const float *q = &quaternions[i].w;
+        __m256 w = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(q)), _mm_loadu_ps(q + 16), 1);
+        __m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(q + 4)), _mm_loadu_ps(q + 20), 1);
+        __m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(q + 8)), _mm_loadu_ps(q + 24), 1);
+        __m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(q + 12)), _mm_loadu_ps(q + 28), 1);
+        transposeHalves(w, x, y, z);
+
+        // Same operations as rotationMatrix()
+        __m256 x2 = _mm256_add_ps(x, x), y2 = _mm256_add_ps(y, y), z2 = _mm256_add_ps(z, z);
+        __m256 xx = _mm256_mul_ps(x, x2), xy = _mm256_mul_ps(x, y2);
+        __m256 xz = _mm256_mul_ps(x, z2), xw = _mm256_mul_ps(w, x2);
+        __m256 yy = _mm256_mul_ps(y, y2), yz = _mm256_mul_ps(y, z2), yw = _mm256_mul_ps(w, y2);
+        __m256 zz = _mm256_mul_ps(z, z2), zw = _mm256_mul_ps(w, z2);
+        __m256 one = _mm256_set1_ps(1.0f);
+
+        __m256 m[9];
+        m[0] = _mm256_sub_ps(_mm256_sub_ps(one, yy), zz);
+        m[1] = _mm256_add_ps(xy, zw);
+        m[2] = _mm256_sub_ps(xz, yw);
+        m[3] = _mm256_sub_ps(xy, zw);
+        m[4] = _mm256_sub_ps(_mm256_sub_ps(one, xx), zz);
+        m[5] = _mm256_add_ps(yz, xw);
+        m[6] = _mm256_add_ps(xz, yw);
+        m[7] = _mm256_sub_ps(yz, xw);
+        m[8] = _mm256_sub_ps(_mm256_sub_ps(one, xx), yy);
+
+        // Transpose to the columns of each matrix
+        __m256 zero = _mm256_setzero_ps();
+        for (unsigned int c = 0; c < 3; c++)
+        {
+            __m256 r[4] = { m[3 * c], m[3 * c + 1], m[3 * c + 2], zero };
+            transposeHalves(r[0], r[1], r[2], r[3]);
+            for (unsigned int k = 0; k < 4; k++)
+            {
+                _mm_storeu_ps(&output[i + k][c][0], _mm256_castps256_ps128(r[k]));
+                _mm_storeu_ps(&output[i + k + 4][c][0], _mm256_extractf128_ps(r[k], 1));
+            }
+        }
+        for (unsigned int k = 0; k < 8; k++)
+            output[i + k][3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    quaternionMatricesKernel<Sse4>(quaternions + i, output + i, count - i);
+}
+#endif
+
+// =============================================================================
+// Dispatch
+
+Maths::SimdLevel Maths::cpuSimdLevel()
+{
+#if defined(MATHS_SSE) && defined(_MSC_VER)
+    // AVX needs support from both the CPU and the OS (saving the registers)
+    int info[4];
+    __cpuid(info, 1);
+    bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    return avx ? AVX : SSE;
+#elif defined(MATHS_SSE)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") ? AVX : SSE;
+#else
+    return Scalar;
+#endif
+}
+
+// Zero initialised (Scalar) until the detection has run, so calls made from
+// other files' static initialisers are still correct
+static Maths::SimdLevel currentLevel = Maths::cpuSimdLevel();
+
+Maths::SimdLevel Maths::simdLevel()
+{
+    return currentLevel;
+}
+
+void Maths::setSimdLevel(const SimdLevel level)
+{
+    currentLevel = std::min(level, cpuSimdLevel());
+}
+
+const char *Maths::simdName(const SimdLevel level)
+{
+    switch (level)
+    {
+        case AVX: return "AVX";
+        case SSE: return "SSE";
+        default:  return "scalar";
+    }
+}
+
+glm::mat4 Maths::multiply(const glm::mat4 &a, const glm::mat4 &b)
+{
+    switch (currentLevel)
+    {
+#ifdef MATHS_SSE
+        case AVX: return multiplyAvx(a, b);
+        case SSE: return multiplyKernel<Sse4>(a, b);
+#endif
+        default:  return multiplyKernel<Lane4>(a, b);
+    }
+}
+
+// Transposes and inverses only need four lanes so AVX uses the SSE versions
+glm::mat4 Maths::transpose(const glm::mat4 &m)
+{
+#ifdef MATHS_SSE
+    if (currentLevel != Scalar)
+        return transposeKernel<Sse4>(m);
+#endif
+    return transposeKernel<Lane4>(m);
+}
+
+glm::mat4 Maths::inverse(const glm::mat4 &m)
+{
+#ifdef MATHS_SSE
+    if (currentLevel != Scalar)
+        return inverseKernel<Sse4>(m);
+#endif
+    return inverseKernel<Lane4>(m);
+}
+
+glm::mat4 Maths::affineInverse(const glm::mat4 &m)
+{
+#ifdef MATHS_SSE
+    if (currentLevel != Scalar)
+        return affineInverseKernel<Sse4>(m);
+#endif
+    return affineInverseKernel<Lane4>(m);
+}
+
+void Maths::transformPoints(const glm::mat4 &m, const glm::vec3 *points,
+                            glm::vec3 *output, const unsigned int count)
+{
+    switch (currentLevel)
+    {
+#ifdef MATHS_SSE
+        case AVX: transformPointsAvx(m, points, output, count); break;
+        case SSE: transformPointsKernel<Sse4>(m, points, output, count); break;
+#endif
+        default:  transformPointsKernel<Lane4>(m, points, output, count); break;
+    }
+}
+
+void Maths::transformNormals(const glm::mat4 &m, const glm::vec3 *normals,
+                             glm::vec3 *output, const unsigned int count)
+{
+    switch (currentLevel)
+    {
+#ifdef MATHS_SSE
+        case AVX: transformNormalsAvx(m, normals, output, count); break;
+        case SSE: transformNormalsKernel<Sse4>(m, normals, output, count); break;
+#endif
+        default:  transformNormalsKernel<Lane4>(m, normals, output, count); break;
+    }
+}
+
+void Maths::quaternionMatrices(const Quaternion *quaternions, glm::mat4 *output,
+                               const unsigned int count)
+{
+    switch (currentLevel)
+    {
+#ifdef MATHS_SSE
+        case AVX: quaternionMatricesAvx(quaternions, output, count); break;
+        case SSE: quaternionMatricesKernel<Sse4>(quaternions, output, count); break;
+#endif
+        default:
+            for (unsigned int i = 0; i < count; i++)
+                output[i] = quaternions[i].matrix();
+            break;
+    }
+}
+
+Affine Affine::operator*(const Affine &a) const
+{
+#ifdef MATHS_SSE
+    if (currentLevel != Maths::Scalar)
+        return affineMultiplyKernel<Sse4>(*this, a);
+#endif
+    return affineMultiplyKernel<Lane4>(*this, a);
+}
+
+Affine Affine::inverse() const
+{
+#ifdef MATHS_SSE
+    if (currentLevel != Maths::Scalar)
+        return affineInverseRowsKernel<Sse4>(*this);
+#endif
+    return affineInverseRowsKernel<Lane4>(*this);
+}
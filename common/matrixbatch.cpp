@@ -0,0 +1,384 @@
+#include <stddef.h>
+
+#include <common/matrixbatch.hpp>
+
+// The AVX kernels are compiled for AVX whatever the compiler targets and
+// used when Maths::simdLevel says the CPU supports it. Their entry points
+// are flattened, so the lane operations and templates they call are inlined
+// into code compiled for AVX.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MATRIXBATCH_SSE
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define MATRIXBATCH_AVX_TARGET
+#define MATRIXBATCH_AVX_ENTRY
+#else
+#define MATRIXBATCH_AVX_TARGET __attribute__((target("avx")))
+#define MATRIXBATCH_AVX_ENTRY __attribute__((target("avx"), flatten))
+#endif
+#endif
+
+// Number of floats between the start of consecutive objects' matrices
+static const size_t objectStride = sizeof(ObjectMatrices) / sizeof(float);
+
+// Offsets of the matrices in ObjectMatrices (in floats)
+static const size_t mvpOffset    = offsetof(ObjectMatrices, MVP) / sizeof(float);
+static const size_t mvOffset     = offsetof(ObjectMatrices, MV) / sizeof(float);
+static const size_t normalOffset = offsetof(ObjectMatrices, normalMatrix) / sizeof(float);
+
+void MatrixArray::resize(const unsigned int size)
+{
+    // Copy the matrices into arrays with the new capacity
+    unsigned int newCapacity = (size + 7) & ~7u;
+    std::vector<float> newData(16 * newCapacity, 0.0f);
+    unsigned int keep = size < count ? size : count;
+    for (unsigned int k = 0; k < 16; k++)
+        for (unsigned int i = 0; i < keep; i++)
+            newData[k * newCapacity + i] = data[k * capacity + i];
+
+    data.swap(newData);
+    count    = size;
+    capacity = newCapacity;
+}
+
+void MatrixArray::set(const unsigned int i, const glm::mat4 &matrix)
+{
+    for (unsigned int c = 0; c < 4; c++)
+        for (unsigned int r = 0; r < 4; r++)
+            data[(4 * c + r) * capacity + i] = matrix[c][r];
+}
+
+glm::mat4 MatrixArray::get(const unsigned int i) const
+{
+    glm::mat4 matrix;
+    for (unsigned int c = 0; c < 4; c++)
+        for (unsigned int r = 0; r < 4; r++)
+            matrix[c][r] = data[(4 * c + r) * capacity + i];
+
+    return matrix;
+}
+
+// =============================================================================
+// SIMD lanes. Each type holds one float from each of 4 or 8 objects and
+// provides the operations used by the kernel.
+
+// One object at a time (used for left over objects and without SSE)
+struct Float1
+{
+    static const unsigned int width = 1;
+    float v;
+
+    Float1() {}
+    Float1(const float x) : v(x) {}
+    static Float1 load(const float *p) { return Float1(*p); }
+    void store(float *p) const { *p = v; }
+};
+inline Float1 operator+(const Float1 a, const Float1 b) { return Float1(a.v + b.v); }
+inline Float1 operator-(const Float1 a, const Float1 b) { return Float1(a.v - b.v); }
+inline Float1 operator*(const Float1 a, const Float1 b) { return Float1(a.v * b.v); }
+inline Float1 operator/(const Float1 a, const Float1 b) { return Float1(a.v / b.v); }
+
+#ifdef MATRIXBATCH_SSE
+struct Float4
+{
+    static const unsigned int width = 4;
+    __m128 v;
+
+    Float4() {}
+    Float4(const __m128 x) : v(x) {}
+    Float4(const float x) : v(_mm_set1_ps(x)) {}
+    static Float4 load(const float *p) { return Float4(_mm_loadu_ps(p)); }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+};
+inline Float4 operator+(const Float4 a, const Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(const Float4 a, const Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(const Float4 a, const Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(const Float4 a, const Float4 b) { return _mm_div_ps(a.v, b.v); }
+#endif
+
+#ifdef MATRIXBATCH_SSE
+struct Float8
+{
+    static const unsigned int width = 8;
+    __m256 v;
+
+    MATRIXBATCH_AVX_TARGET Float8() {}
+    MATRIXBATCH_AVX_TARGET Float8(const __m256 x) : v(x) {}
+    MATRIXBATCH_AVX_TARGET Float8(const float x) : v(_mm256_set1_ps(x)) {}
+    MATRIXBATCH_AVX_TARGET static Float8 load(const float *p)
+    {
+        return Float8(_mm256_loadu_ps(p));
+    }
+    MATRIXBATCH_AVX_TARGET void store(float *p) const { _mm256_storeu_ps(p, v); }
+};
+MATRIXBATCH_AVX_TARGET inline Float8 operator+(const Float8 a, const Float8 b)
+{
+    return _mm256_add_ps(a.v, b.v);
+}
+MATRIXBATCH_AVX_TARGET inline Float8 operator-(const Float8 a, const Float8 b)
+{
+    return _mm256_sub_ps(a.v, b.v);
+}
+MATRIXBATCH_AVX_TARGET inline Float8 operator*(const Float8 a, const Float8 b)
+{
+    return _mm256_mul_ps(a.v, b.v);
+}
+MATRIXBATCH_AVX_TARGET inline Float8 operator/(const Float8 a, const Float8 b)
+{
+    return _mm256_div_ps(a.v, b.v);
+}
+#endif
+
+// Write n consecutive elements of each object's matrices, given as one
+// lane value per element, to the objects' output (stride floats apart)
+template <typename F>
+static void scatter(const F *values, const unsigned int n, float *output,
+                    const size_t stride = objectStride)
+{
+    float lanes[F::width];
+    for (unsigned int k = 0; k < n; k++)
+    {
+        values[k].store(lanes);
+        for (unsigned int j = 0; j < F::width; j++)
+            output[j * stride + k] = lanes[j];
+    }
+}
+
+#ifdef MATRIXBATCH_SSE
+// Groups of four elements are transposed so each object's elements are
+// written with one store
+static void scatter(const Float4 *values, const unsigned int n, float *output,
+                    const size_t stride = objectStride)
+{
+    unsigned int k = 0;
+    for (; k + 4 <= n; k += 4)
+    {
+        __m128 r0 = values[k].v,     r1 = values[k + 1].v;
+        __m128 r2 = values[k + 2].v, r3 = values[k + 3].v;
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(output + k, r0);
+        _mm_storeu_ps(output + stride + k, r1);
+        _mm_storeu_ps(output + 2 * stride + k, r2);
+        _mm_storeu_ps(output + 3 * stride + k, r3);
+    }
+
+    float lanes[4];
+    for (; k < n; k++)
+    {
+        values[k].store(lanes);
+        for (unsigned int j = 0; j < 4; j++)
+            output[j * stride + k] = lanes[j];
+    }
+}
+#endif
+
+#ifdef MATRIXBATCH_SSE
+MATRIXBATCH_AVX_TARGET static void scatter(const Float8 *values, const unsigned int n,
+                                           float *output, const size_t stride = objectStride)
+{
+    // Split each value into the lanes of the first and last four objects
+    Float4 low[16], high[16];
+    for (unsigned int k = 0; k < n; k++)
+    {
+        low[k]  = Float4(_mm256_castps256_ps128(values[k].v));
+        high[k] = Float4(_mm256_extractf128_ps(values[k].v, 1));
+    }
+    scatter(low, n, output, stride);
+    scatter(high, n, output + 4 * stride, stride);
+}
+#endif
+
+// Load the top three rows of the model matrices of F::width objects starting
+// at object i (the last row of an affine matrix is 0 0 0 1)
+template <typename F>
+static void loadModels(const MatrixArray &models, const unsigned int i, F *model)
+{
+    for (unsigned int c = 0; c < 4; c++)
+        for (unsigned int r = 0; r < 3; r++)
+            model[3 * c + r] = F::load(models.element(c, r) + i);
+}
+
+// MV = view * model. Both are affine so the last row of MV is 0 0 0 1.
+template <typename F>
+static void modelView(const F *view, const F *model, F *mv)
+{
+    for (unsigned int c = 0; c < 4; c++)
+    {
+        for (unsigned int r = 0; r < 3; r++)
+            mv[4 * c + r] = view[r] * model[3 * c] +
+                            view[4 + r] * model[3 * c + 1] +
+                            view[8 + r] * model[3 * c + 2];
+        mv[4 * c + 3] = F(0.0f);
+    }
+    for (unsigned int r = 0; r < 4; r++)
+        mv[12 + r] = mv[12 + r] + view[12 + r];
+}
+
+// Calculate the matrices of F::width objects starting at object i. The
+// view and projection * view matrix elements are given already copied to
+// every lane.
+template <typename F>
+static void computeLanes(const MatrixArray &models, const F *view,
+                         const F *projectionView, ObjectMatrices *output,
+                         const unsigned int i)
+{
+    F model[12], mv[16];
+    loadModels(models, i, model);
+    modelView(view, model, mv);
+
+    // MVP = (projection * view) * model
+    F mvp[16];
+    for (unsigned int c = 0; c < 4; c++)
+        for (unsigned int r = 0; r < 4; r++)
+            mvp[4 * c + r] = projectionView[r] * model[3 * c] +
+                             projectionView[4 + r] * model[3 * c + 1] +
+                             projectionView[8 + r] * model[3 * c + 2];
+    for (unsigned int r = 0; r < 4; r++)
+        mvp[12 + r] = mvp[12 + r] + projectionView[12 + r];
+
+    // The inverse transpose of a 3x3 matrix with columns a, b and c has
+    // columns b x c, c x a and a x b divided by the determinant a . (b x c)
+    const F *a = &mv[0], *b = &mv[4], *c = &mv[8];
+    F normal[9];
+    normal[0] = b[1] * c[2] - b[2] * c[1];
+    normal[1] = b[2] * c[0] - b[0] * c[2];
+    normal[2] = b[0] * c[1] - b[1] * c[0];
+    normal[3] = c[1] * a[2] - c[2] * a[1];
+    normal[4] = c[2] * a[0] - c[0] * a[2];
+    normal[5] = c[0] * a[1] - c[1] * a[0];
+    normal[6] = a[1] * b[2] - a[2] * b[1];
+    normal[7] = a[2] * b[0] - a[0] * b[2];
+    normal[8] = a[0] * b[1] - a[1] * b[0];
+    F invDet = F(1.0f) / (a[0] * normal[0] + a[1] * normal[1] + a[2] * normal[2]);
+    for (unsigned int k = 0; k < 9; k++)
+        normal[k] = normal[k] * invDet;
+
+    // Write the results to the upload buffer
+    float *first = reinterpret_cast<float *>(output + i);
+    scatter(mvp, 16, first + mvpOffset);
+    scatter(mv, 16, first + mvOffset);
+    scatter(normal, 9, first + normalOffset);
+}
+
+// Calculate the matrices of objects from i up to the last whole group of
+// F::width objects before end
+template <typename F>
+static unsigned int computeGroups(const MatrixArray &models, const glm::mat4 &view,
+                                  const glm::mat4 &projection, ObjectMatrices *output,
+                                  unsigned int i, const unsigned int end)
+{
+    glm::mat4 projectionView = projection * view;
+    F V[16], PV[16];
+    for (unsigned int k = 0; k < 16; k++)
+    {
+        V[k]  = F(view[k / 4][k % 4]);
+        PV[k] = F(projectionView[k / 4][k % 4]);
+    }
+
+    for (; i + F::width <= end; i += F::width)
+        computeLanes<F>(models, V, PV, output, i);
+
+    return i;
+}
+
+#ifdef MATRIXBATCH_SSE
+MATRIXBATCH_AVX_ENTRY static unsigned int computeGroupsAvx(const MatrixArray &models,
+                                                           const glm::mat4 &view,
+                                                           const glm::mat4 &projection,
+                                                           ObjectMatrices *output,
+                                                           const unsigned int i,
+                                                           const unsigned int end)
+{
+    return computeGroups<Float8>(models, view, projection, output, i, end);
+}
+#endif
+
+void computeObjectMatrices(const MatrixArray &models, const glm::mat4 &view,
+                           const glm::mat4 &projection, ObjectMatrices *output,
+                           const unsigned int begin, const unsigned int end)
+{
+    // The kernel needs an affine view matrix (as made by lookAt)
+    if (view[0][3] != 0.0f || view[1][3] != 0.0f || view[2][3] != 0.0f ||
+        view[3][3] != 1.0f)
+    {
+        computeObjectMatricesScalar(models, view, projection, output, begin, end);
+        return;
+    }
+
+    unsigned int i = begin;
+#ifdef MATRIXBATCH_SSE
+    if (Maths::simdLevel() == Maths::AVX)
+        i = computeGroupsAvx(models, view, projection, output, i, end);
+    i = computeGroups<Float4>(models, view, projection, output, i, end);
+#endif
+    computeGroups<Float1>(models, view, projection, output, i, end);
+}
+
+// Calculate the model view matrices of F::width objects starting at object i
+// and write their top three rows
+template <typename F>
+static void computeModelViewLanes(const MatrixArray &models, const F *view,
+                                  Affine *output, const unsigned int i)
+{
+    F model[12], mv[16];
+    loadModels(models, i, model);
+    modelView(view, model, mv);
+
+    F rows[12];
+    for (unsigned int r = 0; r < 3; r++)
+        for (unsigned int c = 0; c < 4; c++)
+            rows[4 * r + c] = mv[4 * c + r];
+
+    scatter(rows, 12, &output[i].rows[0].x, sizeof(Affine) / sizeof(float));
+}
+
+template <typename F>
+static unsigned int computeModelViewGroups(const MatrixArray &models, const glm::mat4 &view,
+                                           Affine *output, unsigned int i,
+                                           const unsigned int end)
+{
+    F V[16];
+    for (unsigned int k = 0; k < 16; k++)
+        V[k] = F(view[k / 4][k % 4]);
+
+    for (; i + F::width <= end; i += F::width)
+        computeModelViewLanes<F>(models, V, output, i);
+
+    return i;
+}
+
+#ifdef MATRIXBATCH_SSE
+MATRIXBATCH_AVX_ENTRY static unsigned int computeModelViewGroupsAvx(const MatrixArray &models,
+                                                                    const glm::mat4 &view,
+                                                                    Affine *output,
+                                                                    const unsigned int i,
+                                                                    const unsigned int end)
+{
+    return computeModelViewGroups<Float8>(models, view, output, i, end);
+}
+#endif
+
+void computeModelViews(const MatrixArray &models, const glm::mat4 &view,
+                       Affine *output, const unsigned int begin,
+                       const unsigned int end)
+{
+    unsigned int i = begin;
+#ifdef MATRIXBATCH_SSE
+    if (Maths::simdLevel() == Maths::AVX)
+        i = computeModelViewGroupsAvx(models, view, output, i, end);
+    i = computeModelViewGroups<Float4>(models, view, output, i, end);
+#endif
+    computeModelViewGroups<Float1>(models, view, output, i, end);
+}
+
+void computeObjectMatricesScalar(const MatrixArray &models, const glm::mat4 &view,
+                                 const glm::mat4 &projection, ObjectMatrices *output,
+                                 const unsigned int begin, const unsigned int end)
+{
+    for (unsigned int i = begin; i < end; i++)
+    {
+        output[i].MV  = view * models.get(i);
+        output[i].MVP = projection * output[i].MV;
+        output[i].normalMatrix = glm::transpose(glm::inverse(glm::mat3(output[i].MV)));
+    }
+}
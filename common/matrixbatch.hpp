@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+
+#include <common/maths.hpp>
+
+// MatrixArray class. Stores 4x4 matrices as a structure of arrays: element
+// (column c, row r) of every matrix is in one contiguous array, so SIMD
+// code can load the same element of 4 or 8 matrices at once.
+class MatrixArray
+{
+public:
+    void resize(const unsigned int size);
+    unsigned int size() const { return count; }
+
+    void set(const unsigned int i, const glm::mat4 &matrix);
+    glm::mat4 get(const unsigned int i) const;
+
+    // Element (column c, row r) of every matrix
+    const float *element(const unsigned int c, const unsigned int r) const
+    {
+        return &data[(4 * c + r) * capacity];
+    }
+
+private:
+    std::vector<float> data;
+    unsigned int count    = 0;
+    unsigned int capacity = 0;      // count rounded up to a multiple of 8
+};
+
+// Matrices sent to the shaders for one object (written into an upload buffer)
+struct ObjectMatrices
+{
+    glm::mat4 MVP;
+    glm::mat4 MV;
+    glm::mat3 normalMatrix;         // inverse transpose of the MV 3x3
+};
+
+// Calculate the MV, MVP and normal matrices of objects [begin, end) from
+// their model matrices, which must be affine (made from translations,
+// rotations and scales). The objects are processed 8 at a time with AVX or
+// 4 at a time with SSE (the best Maths::simdLevel allows) and the results
+// are written straight into the output buffer.
+void computeObjectMatrices(const MatrixArray &models, const glm::mat4 &view,
+                           const glm::mat4 &projection, ObjectMatrices *output,
+                           const unsigned int begin, const unsigned int end);
+
+// The same calculation one object at a time using glm
+void computeObjectMatricesScalar(const MatrixArray &models, const glm::mat4 &view,
+                                 const glm::mat4 &projection, ObjectMatrices *output,
+                                 const unsigned int begin, const unsigned int end);
+
+// Calculate the model view matrices of objects [begin, end) as 48 byte
+// affine transforms (the view matrix must be affine too). This is all the
+// shaders need when they apply the projection matrix themselves.
+void computeModelViews(const MatrixArray &models, const glm::mat4 &view,
+                       Affine *output, const unsigned int begin,
+                       const unsigned int end);
@@ -0,0 +1,404 @@
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <common/mipmaps.hpp>
+#include <common/jobs.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIPMAPS_SSE
+#include <immintrin.h>
+#endif
+
+// =============================================================================
+// Filters
+
+// Half widths of the filters in pixels of the smaller level
+static const float filterRadius[] = { 0.5f, 3.0f, 3.0f };
+
+static float sinc(const float x)
+{
+    if (fabsf(x) < 1e-5f)
+        return 1.0f;
+    float px = 3.14159265f * x;
+    return sinf(px) / px;
+}
+
+// Modified Bessel function of the first kind of order zero
+static float besselI0(const float x)
+{
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 20; k++)
+    {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Weight of a pixel x pixels of the smaller level from a pixel's centre
+static float filterWeight(const Mipmaps::Filter filter, const float x)
+{
+    float radius = filterRadius[filter];
+    if (fabsf(x) > radius)
+        return 0.0f;
+
+    switch (filter)
+    {
+        case Mipmaps::Box:
+            return 1.0f;
+        case Mipmaps::Kaiser:
+        {
+            const float alpha = 4.0f;
+            float t = x / radius;
+            return sinc(x) * besselI0(alpha * sqrtf(1.0f - t * t)) / besselI0(alpha);
+        }
+        case Mipmaps::Lanczos:
+            return sinc(x) * sinc(x / radius);
+    }
+    return 0.0f;
+}
+
+// Pixels of a level and their weights for each pixel of the next along one
+// axis (the texture wraps, so pixels past the edges are on the other side)
+struct Taps
+{
+    std::vector<unsigned int> first;        // first tap of each pixel, plus the end
+    std::vector<unsigned int> index;
+    std::vector<float> weight;
+};
+
+static void calculateTaps(const Mipmaps::Filter filter, const unsigned int size,
+                          const unsigned int newSize, Taps &taps)
+{
+    float scale  = static_cast<float>(size) / newSize;
+    float radius = filterRadius[filter] * scale;
+
+    taps.first.clear();
+    taps.index.clear();
+    taps.weight.clear();
+    for (unsigned int i = 0; i < newSize; i++)
+    {
+        taps.first.push_back(static_cast<unsigned int>(taps.index.size()));
+
+        // Pixels with centres within the filter
+        float centre = (i + 0.5f) * scale;
+        int begin = static_cast<int>(ceilf(centre - radius - 0.5f));
+        int end   = static_cast<int>(floorf(centre + radius - 0.5f));
+        float sum = 0.0f;
+        unsigned int first = static_cast<unsigned int>(taps.weight.size());
+        for (int j = begin; j <= end; j++)
+        {
+            float weight = filterWeight(filter, (j + 0.5f - centre) / scale);
+            if (weight == 0.0f)
+                continue;
+            int wrapped = j % static_cast<int>(size);
+            taps.index.push_back(wrapped < 0 ? wrapped + size : wrapped);
+            taps.weight.push_back(weight);
+            sum += weight;
+        }
+
+        // Normalise the weights
+        for (unsigned int j = first; j < taps.weight.size(); j++)
+            taps.weight[j] /= sum;
+    }
+    taps.first.push_back(static_cast<unsigned int>(taps.index.size()));
+}
+
+// =============================================================================
+// Colour conversions
+
+// sRGB value of each byte in linear light (function statics are initialised
+// once, even with several threads)
+static const float *sRGBToLinear()
+{
+    static const std::vector<float> table = []()
+    {
+        std::vector<float> table(256);
+        for (int i = 0; i < 256; i++)
+        {
+            float c  = i / 255.0f;
+            table[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        return table;
+    }();
+    return &table[0];
+}
+
+// sRGB byte of 4096 linear values from 0 to 1
+static const unsigned char *linearToSRGB()
+{
+    static const std::vector<unsigned char> table = []()
+    {
+        std::vector<unsigned char> table(4096);
+        for (int i = 0; i < 4096; i++)
+        {
+            float c  = i / 4095.0f;
+            float s  = c <= 0.0031308f ? 12.92f * c : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+            table[i] = static_cast<unsigned char>(s * 255.0f + 0.5f);
+        }
+        return table;
+    }();
+    return &table[0];
+}
+
+// Number of colour channels filtered in linear light (R and RG images hold
+// data such as heights, and the alpha channel is always linear)
+static unsigned int numSRGBChannels(const unsigned int components,
+                                    const Mipmaps::Settings &settings)
+{
+    if (!settings.sRGB || settings.normalMap || components < 3)
+        return 0;
+    return 3;
+}
+
+// =============================================================================
+// Mipmaps
+
+std::string Mipmaps::Settings::name() const
+{
+    static const char *filterNames[] = { "box", "kaiser", "lanczos" };
+    std::string name = filterNames[filter];
+    name += normalMap ? "-normal" : sRGB ? "-srgb" : "-linear";
+    return compress ? name + "-bc" : name;
+}
+
+// Level to filter, either as floats (four per pixel) or as the bytes of the
+// first level, which are converted to floats a row at a time as they are
+// needed instead of all at once (they would take 16 bytes a pixel)
+struct Source
+{
+    const float *level          = NULL;
+    const unsigned char *pixels = NULL;
+    const float *toFloat[4];                // value of each byte of each channel
+};
+
+// Filter a level into the next, first down the columns of the rows under
+// each row of the new level and then along that row, and convert the new
+// level to bytes
+static void filterLevel(const Source &source, const unsigned int width, const unsigned int height,
+                        std::vector<float> &newLevel, Mipmaps::Level &mipmap,
+                        const unsigned int components, const unsigned int sRGBChannels,
+                        const Mipmaps::Settings &settings)
+{
+    Taps columns, rows;
+    calculateTaps(settings.filter, width, mipmap.width, columns);
+    calculateTaps(settings.filter, height, mipmap.height, rows);
+    newLevel.resize(4 * static_cast<size_t>(mipmap.width) * mipmap.height);
+    mipmap.pixels.resize(static_cast<size_t>(mipmap.width) * mipmap.height * components);
+    const unsigned char *toSRGB = linearToSRGB();
+
+    // Rows of bytes converted to floats are kept for the next rows of the new
+    // level, whose filters overlap
+    unsigned int maxTaps = 1;
+    for (unsigned int y = 0; y < mipmap.height; y++)
+        maxTaps = std::max(maxTaps, rows.first[y + 1] - rows.first[y]);
+    unsigned int numCachedRows = maxTaps + 2;
+
+    unsigned int grainSize = std::max(1u, 4096 / mipmap.width);
+    Jobs::parallelFor(0, mipmap.height, grainSize, [&](unsigned int begin, unsigned int end)
+    {
+        size_t rowSize = 4 * static_cast<size_t>(width);
+        std::vector<float> row(rowSize);
+        std::vector<const float *> tapRows(maxTaps);
+        std::vector<float> cachedRows;
+        std::vector<int> cachedRow;
+        if (source.pixels != NULL)
+        {
+            cachedRows.resize(numCachedRows * rowSize, 0.0f);
+            cachedRow.resize(numCachedRows, -1);
+        }
+
+        for (unsigned int y = begin; y < end; y++)
+        {
+            // Find the rows under the row (a row of the new level's filter
+            // is two rows on from the row before's, so its slot in the cache
+            // is too)
+            unsigned int numTaps = rows.first[y + 1] - rows.first[y];
+            const float *weights = &rows.weight[rows.first[y]];
+            for (unsigned int k = 0; k < numTaps; k++)
+            {
+                unsigned int r = rows.index[rows.first[y] + k];
+                tapRows[k] = source.level + rowSize * r;
+                if (source.pixels == NULL)
+                    continue;
+
+                unsigned int slot = (2 * y + k) % numCachedRows;
+                float *cached = &cachedRows[rowSize * slot];
+                if (cachedRow[slot] != static_cast<int>(r))
+                {
+                    const unsigned char *pixel = source.pixels +
+                                                 static_cast<size_t>(width) * components * r;
+                    for (unsigned int x = 0; x < width; x++, pixel += components)
+                        for (unsigned int c = 0; c < components; c++)
+                            cached[4 * x + c] = source.toFloat[c][pixel[c]];
+                    cachedRow[slot] = r;
+                }
+                tapRows[k] = cached;
+            }
+
+            // Filter the columns
+            for (unsigned int i = 0; i < rowSize; i += 4)
+            {
+#ifdef MIPMAPS_SSE
+                __m128 sum = _mm_setzero_ps();
+                for (unsigned int k = 0; k < numTaps; k++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]),
+                                                     _mm_loadu_ps(tapRows[k] + i)));
+                _mm_storeu_ps(&row[i], sum);
+#else
+                for (unsigned int c = 0; c < 4; c++)
+                {
+                    float sum = 0.0f;
+                    for (unsigned int k = 0; k < numTaps; k++)
+                        sum += weights[k] * tapRows[k][i + c];
+                    row[i + c] = sum;
+                }
+#endif
+            }
+
+            // Filter along the row
+            size_t first = static_cast<size_t>(mipmap.width) * y;
+            float *pixel = &newLevel[4 * first];
+            unsigned char *byte = &mipmap.pixels[components * first];
+            for (unsigned int x = 0; x < mipmap.width; x++, pixel += 4, byte += components)
+            {
+#ifdef MIPMAPS_SSE
+                __m128 sum = _mm_setzero_ps();
+                for (unsigned int k = columns.first[x]; k < columns.first[x + 1]; k++)
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(columns.weight[k]),
+                                                     _mm_loadu_ps(&row[4 * columns.index[k]])));
+                sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+                _mm_storeu_ps(pixel, sum);
+#else
+                float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                for (unsigned int k = columns.first[x]; k < columns.first[x + 1]; k++)
+                    for (unsigned int c = 0; c < 4; c++)
+                        sum[c] += columns.weight[k] * row[4 * columns.index[k] + c];
+                for (unsigned int c = 0; c < 4; c++)
+                    pixel[c] = std::min(std::max(sum[c], 0.0f), 1.0f);
+#endif
+
+                // Make the normal unit length again
+                if (settings.normalMap)
+                {
+                    float n[3] = { 2.0f * pixel[0] - 1.0f, 2.0f * pixel[1] - 1.0f,
+                                   2.0f * pixel[2] - 1.0f };
+                    float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    if (length > 1e-6f)
+                        for (unsigned int c = 0; c < 3; c++)
+                            pixel[c] = 0.5f * n[c] / length + 0.5f;
+                }
+
+                // Convert to bytes
+                for (unsigned int c = 0; c < components; c++)
+                    byte[c] = c < sRGBChannels
+                        ? toSRGB[static_cast<int>(pixel[c] * 4095.0f + 0.5f)]
+                        : static_cast<unsigned char>(pixel[c] * 255.0f + 0.5f);
+            }
+        }
+    });
+}
+
+void Mipmaps::build(const unsigned char *pixels, const unsigned int width,
+                    const unsigned int height, const unsigned int components,
+                    const Settings &settings)
+{
+    this->components = components;
+    compressed = false;
+    levels.clear();
+    levels.push_back(Level());
+    levels[0].width  = width;
+    levels[0].height = height;
+    levels[0].pixels.assign(pixels, pixels + static_cast<size_t>(width) * height * components);
+
+    // Filter the first level from its bytes
+    unsigned int sRGBChannels = numSRGBChannels(components, settings);
+    float toUnit[256];
+    for (int i = 0; i < 256; i++)
+        toUnit[i] = i / 255.0f;
+    Source source;
+    source.pixels = pixels;
+    for (unsigned int c = 0; c < 4; c++)
+        source.toFloat[c] = c < sRGBChannels ? sRGBToLinear() : toUnit;
+
+    // And each level after from the floats of the one before
+    std::vector<float> level, newLevel;
+    while (levels.back().width > 1 || levels.back().height > 1)
+    {
+        unsigned int w = levels.back().width, h = levels.back().height;
+        levels.push_back(Level());
+        Level &mipmap = levels.back();
+        mipmap.width  = std::max(1u, w / 2);
+        mipmap.height = std::max(1u, h / 2);
+        filterLevel(source, w, h, newLevel, mipmap, components, sRGBChannels, settings);
+
+        level.swap(newLevel);
+        source.level  = &level[0];
+        source.pixels = NULL;
+    }
+
+    if (settings.compress)
+        compress(BlockCompression::format(components, settings.normalMap));
+}
+
+void Mipmaps::compress(const BlockCompression::Format format)
+{
+    if (compressed)
+        return;
+
+    for (Level &level : levels)
+    {
+        std::vector<unsigned char> blocks(BlockCompression::size(format, level.width,
+                                                                 level.height));
+        BlockCompression::encode(&level.pixels[0], level.width, level.height, components, format,
+                                 &blocks[0]);
+        level.pixels.swap(blocks);
+    }
+    compressed   = true;
+    this->format = format;
+}
+
+size_t Mipmaps::size() const
+{
+    size_t size = 0;
+    for (const Level &level : levels)
+        size += level.pixels.size();
+    return size;
+}
+
+void Mipmaps::upload() const
+{
+    // Deal with different number of colour channels
+    GLenum pixelFormat = Mipmaps::pixelFormat(components);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (unsigned int i = 0; i < levels.size(); i++)
+    {
+        if (compressed)
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, BlockCompression::internalFormat(format),
+                                   levels[i].width, levels[i].height, 0,
+                                   static_cast<GLsizei>(levels[i].pixels.size()),
+                                   &levels[i].pixels[0]);
+        else
+            glTexImage2D(GL_TEXTURE_2D, i, pixelFormat, levels[i].width, levels[i].height, 0,
+                         pixelFormat, GL_UNSIGNED_BYTE, &levels[i].pixels[0]);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<int>(levels.size()) - 1);
+}
+
+GLenum Mipmaps::pixelFormat(const unsigned int components)
+{
+    if (components == 1)
+        return GL_RED;
+    if (components == 2)
+        return GL_RG;
+    if (components == 3)
+        return GL_RGB;
+    return GL_RGBA;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <string>
+
+#include <GL/glew.h>
+
+#include <common/blockcompression.hpp>
+
+// Mipmaps class. Builds the mipmap chain of an 8 bit image (R, RG, RGB or
+// RGBA) on the CPU instead of with glGenerateMipmap, whose filter and speed
+// depend on the driver (llvmpipe runs it on the OpenGL thread). Each level
+// is filtered from the one before with a box, Kaiser or Lanczos filter:
+//
+//     Mipmaps mipmaps;
+//     Mipmaps::Settings settings;
+//     settings.normalMap = true;
+//     mipmaps.build(pixels, width, height, 3, settings);
+//     KTX::write("diamond_normal.ktx", mipmaps);  // read it back next time
+//     glBindTexture(GL_TEXTURE_2D, texture);
+//     mipmaps.upload();
+//
+// The filtering is done in floating point with SSE, with the rows of each
+// level shared between the threads of the job system. Colour images are
+// stored in sRGB, so by default they are filtered in linear light (averaging
+// the sRGB values would darken them). The texels of normal maps are
+// renormalised after filtering so the normals of small levels stay unit
+// length. Filters with negative lobes are clamped to [0, 1]. The levels can
+// then be block compressed with BlockCompression (normal maps as BC5).
+class Mipmaps
+{
+public:
+    enum Filter { Box, Kaiser, Lanczos };
+
+    // How to filter the levels
+    struct Settings
+    {
+        Filter filter  = Kaiser;
+        bool sRGB      = true;              // filter the colours in linear light
+        bool normalMap = false;             // renormalise the texels (not sRGB)
+        bool compress  = false;             // block compress the levels
+
+        // Name of the settings for file names, e.g. kaiser-srgb
+        std::string name() const;
+    };
+
+    // Level of the chain (rows from the first in memory, or blocks once
+    // compressed)
+    struct Level
+    {
+        unsigned int width  = 0;
+        unsigned int height = 0;
+        std::vector<unsigned char> pixels;
+    };
+
+    std::vector<Level> levels;
+    unsigned int components = 0;
+    bool compressed = false;
+    BlockCompression::Format format = BlockCompression::BC1;
+
+    // Build the chain down to 1x1 from the first level's pixels
+    void build(const unsigned char *pixels, const unsigned int width, const unsigned int height,
+               const unsigned int components, const Settings &settings);
+
+    // Replace the levels' pixels with compressed blocks
+    void compress(const BlockCompression::Format format);
+
+    // Bytes in the levels
+    size_t size() const;
+
+    // Upload the levels into the bound GL_TEXTURE_2D
+    void upload() const;
+
+    // OpenGL format of the pixels of an image with a number of components
+    static GLenum pixelFormat(const unsigned int components);
+};
@@ -1,36 +1,56 @@
 #include <vector>
 #include <stdio.h>
+#include <stdint.h>
+#include <math.h>
 #include <string>
 #include <cstring>
 #include <iostream>
+#include <algorithm>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
 #include "model.hpp"
-#include "stb_image.hpp"
+#include "profiler.hpp"
+#include "jobs.hpp"
+#include "texture.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MODEL_SSE
+#include <immintrin.h>
+#endif
 
 Model::Model(const char *path)
 {
     // Load object
     bool res = loadObj(path, vertices, uvs, normals);
     
-    // Calculate tangent and bitangent vectors
-    calculateTangents();
+    // Record the streams the model has (the tangents are calculated when
+    // they are first needed)
+    if (!vertices.empty())
+        streams |= 1u << POSITIONS | 1u << TANGENTS;
+    if (!vertices.empty() && uvs.size() == vertices.size())
+        streams |= 1u << UVS;
+    if (!vertices.empty() && normals.size() == vertices.size())
+        streams |= 1u << NORMALS;
+    built = streams & (1u << POSITIONS | 1u << UVS | 1u << NORMALS);
     
     // Setup buffers
     setupBuffers();
 }
 
-void Model::draw(unsigned int &shaderID)
+void Model::draw(unsigned int &shaderID, const unsigned int instances)
 {
+    PROFILE_SCOPE("Model::draw");
+    
     // Send material properties to the shader
     glUniform1f(glGetUniformLocation(shaderID, "ka"), ka);
     glUniform1f(glGetUniformLocation(shaderID, "kd"), kd);
     glUniform1f(glGetUniformLocation(shaderID, "ks"), ks);
     glUniform1f(glGetUniformLocation(shaderID, "Ns"), Ns);
     
-    // Bind the textures
+    // Bind the textures (uploading any that are still being decoded)
+    Textures::finish();
     unsigned int diffuseNum = 0;
     unsigned int normalNum = 0;
     for (unsigned int i = 0; i < textures.size(); i++)
@@ -40,85 +60,131 @@ void Model::draw(unsigned int &shaderID)
         glActiveTexture(GL_TEXTURE0 + i);
         glUniform1i(glGetUniformLocation(shaderID, (name + "Map").c_str()), i);
         glBindTexture(GL_TEXTURE_2D, textures[i].id);
+
+        // Two channel (BC5) normal maps only hold x and y
+        if (name == "normal")
+            glUniform1i(glGetUniformLocation(shaderID, "normalMapXY"),
+                        Textures::components(textures[i].id) == 2);
+    }
+    
+    // Upload the streams the shader reads that haven't been
+    unsigned int missing = findProgramStreams(shaderID) & streams & ~uploaded;
+    if (missing != 0)
+    {
+        buildStreams(missing);
+        uploadStreams(missing);
     }
     
     // Draw the triangles
     glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, static_cast<unsigned int>(vertices.size()));
+    if (instances > 1)
+        glDrawArraysInstanced(GL_TRIANGLES, 0, static_cast<unsigned int>(vertices.size()), instances);
+    else
+        glDrawArrays(GL_TRIANGLES, 0, static_cast<unsigned int>(vertices.size()));
     glBindVertexArray(0);
 }
 
-void Model::setupBuffers()
+void Model::setInstanceBuffer(const unsigned int buffer, const unsigned int location)
 {
-    // Create and bind the Vertex Array Object (VAO)
-    glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
     
-    // Create Vertex Buffer Object
-    unsigned int vertexBuffer;
-    glGenBuffers(1, &vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), &vertices[0], GL_STATIC_DRAW);
-    
-    // Create uv buffer
-    unsigned int uvBuffer;
-    glGenBuffers(1, &uvBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-    glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2), &uvs[0], GL_STATIC_DRAW);
-    
-    // Create normal buffer
-    unsigned int normalBuffer;
-    glGenBuffers(1, &normalBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), &normals[0], GL_STATIC_DRAW);
-    
-    // Bind the vertex buffer
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    
-    // Bind the uv buffer
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-    
-    // Bind the normal buffer
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    // One row per attribute, advancing once per instance
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        glEnableVertexAttribArray(location + i);
+        glVertexAttribPointer(location + i, 4, GL_FLOAT, GL_FALSE, 3 * sizeof(glm::vec4),
+                              (void*)(i * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location + i, 1);
+    }
     
-    // Create tangent buffer
-    unsigned int tangentBuffer;
-    glGenBuffers(1, &tangentBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-    glBufferData(GL_ARRAY_BUFFER, tangents.size() * sizeof(glm::vec3), &tangents[0], GL_STATIC_DRAW);
+    glBindVertexArray(0);
+}
 
-    // Create bitangent buffer
-    unsigned int bitangentBuffer;
-    glGenBuffers(1, &bitangentBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, bitangentBuffer);
-    glBufferData(GL_ARRAY_BUFFER, bitangents.size() * sizeof(glm::vec3), &bitangents[0], GL_STATIC_DRAW);
+void Model::setupBuffers()
+{
+    // Create the Vertex Array Object (VAO). The streams' buffers are added
+    // to it as they are uploaded.
+    glGenVertexArrays(1, &VAO);
+}
 
-    // Bind the tangent buffer
-    glEnableVertexAttribArray(3);
-    glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+void Model::buildStreams(const unsigned int mask)
+{
+    // Calculate tangent vectors
+    if ((mask & streams & ~built & 1u << TANGENTS) != 0)
+    {
+        calculateTangents();
+        built |= 1u << TANGENTS;
+    }
+}
 
-    // Bind the bitangent buffer
-    glEnableVertexAttribArray(4);
-    glBindBuffer(GL_ARRAY_BUFFER, bitangentBuffer);
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+void Model::uploadStreams(const unsigned int mask)
+{
+    // Data and components per vertex of each stream (the tangents have the
+    // handedness in w)
+    const void *data[NUM_STREAMS] = { vertices.data(), uvs.data(), normals.data(),
+                                      tangents.data() };
+    const int components[NUM_STREAMS] = { 3, 2, 3, 4 };
+    
+    glBindVertexArray(VAO);
+    for (unsigned int stream = 0; stream < NUM_STREAMS; stream++)
+    {
+        if ((mask & (1u << stream)) == 0)
+            continue;
+        
+        // Create the stream's buffer and bind it to the stream's location
+        glGenBuffers(1, &buffers[stream]);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[stream]);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * components[stream] * sizeof(float),
+                     data[stream], GL_STATIC_DRAW);
+        glEnableVertexAttribArray(stream);
+        glVertexAttribPointer(stream, components[stream], GL_FLOAT, GL_FALSE, 0, (void*)0);
+        uploaded |= 1u << stream;
+    }
     
-     // Unbind the VAO
+    // Unbind the VAO
     glBindVertexArray(0);
 }
 
+unsigned int Model::findProgramStreams(const unsigned int shaderID)
+{
+    std::map<unsigned int, unsigned int>::iterator it = programStreams.find(shaderID);
+    if (it != programStreams.end())
+        return it->second;
+    
+    // Locations of the program's active attributes
+    int numAttributes = 0, maxLength = 0;
+    glGetProgramiv(shaderID, GL_ACTIVE_ATTRIBUTES, &numAttributes);
+    glGetProgramiv(shaderID, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+    std::vector<char> name(std::max(maxLength, 1));
+    unsigned int mask = 0;
+    for (int i = 0; i < numAttributes; i++)
+    {
+        int size;
+        GLenum type;
+        glGetActiveAttrib(shaderID, i, static_cast<int>(name.size()), NULL, &size, &type,
+                          &name[0]);
+        int location = glGetAttribLocation(shaderID, &name[0]);
+        if (location >= 0 && location < NUM_STREAMS)
+            mask |= 1u << location;
+    }
+    
+    programStreams[shaderID] = mask;
+    return mask;
+}
+
 void Model::deleteBuffers()
 {
-    glDeleteBuffers(1, &vertexBuffer);
-    glDeleteBuffers(1, &uvBuffer);
-    glDeleteBuffers(1, &normalBuffer);
+    for (unsigned int stream = 0; stream < NUM_STREAMS; stream++)
+    {
+        if (buffers[stream] != 0)
+            glDeleteBuffers(1, &buffers[stream]);
+        buffers[stream] = 0;
+    }
     glDeleteVertexArrays(1, &VAO);
+    VAO = 0;
+    uploaded = 0;
+    programStreams.clear();
 }
 
 bool Model::loadObj(const char *path,
@@ -237,71 +303,312 @@ bool Model::loadObj(const char *path,
 void Model::addTexture(const char *path, const std::string type)
 {
     Texture texture;
-    texture.id = loadTexture(path);
+    // Normal maps aren't colours, their mipmaps hold unit normals
+    Mipmaps::Settings settings;
+    settings.normalMap = type == "normal";
+    texture.id = Textures::request(path, false, settings);
     texture.type = type;
+    texture.path = path;
     textures.push_back(texture);
 }
 
-unsigned int Model::loadTexture(const char *path)
+// =============================================================================
+// Tangents
+
+// Tangent and bitangent of triangle t scaled by its area, or zero when its
+// uvs don't span an area (their directions would be infinite)
+static void faceTangent(const glm::vec3 *vertices, const glm::vec2 *uvs, const unsigned int t,
+                        glm::vec3 &tangent, glm::vec3 &bitangent)
 {
+    unsigned int i = 3 * t;
+    glm::vec3 E1  = vertices[i+1] - vertices[i];
+    glm::vec3 E2  = vertices[i+2] - vertices[i+1];
+    float deltaU1 = uvs[i+1].x - uvs[i].x;
+    float deltaV1 = uvs[i+1].y - uvs[i].y;
+    float deltaU2 = uvs[i+2].x - uvs[i+1].x;
+    float deltaV2 = uvs[i+2].y - uvs[i+1].y;
+    float det     = deltaU1 * deltaV2 - deltaU2 * deltaV1;
+    
+    tangent   = glm::vec3(0.0f);
+    bitangent = glm::vec3(0.0f);
+    if (det == 0.0f)
+        return;
+    tangent   = (deltaV2 * E1 - deltaV1 * E2) / det;
+    bitangent = (deltaU1 * E2 - deltaU2 * E1) / det;
+    
+    float area = 0.5f * glm::length(glm::cross(E1, E2));
+    float tangentLength   = glm::length(tangent);
+    float bitangentLength = glm::length(bitangent);
+    tangent   = tangentLength > 0.0f ? tangent * (area / tangentLength) : glm::vec3(0.0f);
+    bitangent = bitangentLength > 0.0f ? bitangent * (area / bitangentLength) : glm::vec3(0.0f);
+}
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+#ifdef MODEL_SSE
 
-    int width, height, numComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &numComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (numComponents == 1)
-            format = GL_RED;
-        else if (numComponents == 3)
-            format = GL_RGB;
-        else if (numComponents == 4)
-            format = GL_RGBA;
+// Length of 4 vectors
+static inline __m128 length4(const __m128 x, const __m128 y, const __m128 z)
+{
+    return _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+                                  _mm_mul_ps(z, z)));
+}
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+// Scale of 4 vectors to give them the length area (zero for zero vectors)
+static inline __m128 rescale4(const __m128 x, const __m128 y, const __m128 z, const __m128 area)
+{
+    __m128 length = length4(x, y, z);
+    __m128 valid  = _mm_cmpgt_ps(length, _mm_setzero_ps());
+    return _mm_and_ps(valid, _mm_div_ps(area, _mm_or_ps(length, _mm_andnot_ps(valid,
+                                                                  _mm_set1_ps(1.0f)))));
+}
 
-        stbi_image_free(data);
+// faceTangent of triangles t to t + 3 at once
+static void faceTangents4(const glm::vec3 *vertices, const glm::vec2 *uvs, const unsigned int t,
+                          glm::vec3 *tangents, glm::vec3 *bitangents)
+{
+    // Gather the vertex co-ordinates of the 4 triangles into one register
+    // per co-ordinate
+    const glm::vec3 *v = &vertices[3 * t];
+    const glm::vec2 *w = &uvs[3 * t];
+    __m128 p[3][3], uv[3][2];
+    for (unsigned int k = 0; k < 3; k++)
+    {
+        for (unsigned int axis = 0; axis < 3; axis++)
+            p[k][axis] = _mm_setr_ps(v[k][axis], v[3 + k][axis], v[6 + k][axis],
+                                     v[9 + k][axis]);
+        for (unsigned int axis = 0; axis < 2; axis++)
+            uv[k][axis] = _mm_setr_ps(w[k][axis], w[3 + k][axis], w[6 + k][axis],
+                                      w[9 + k][axis]);
     }
-    else
+    
+    __m128 E1[3], E2[3];
+    for (unsigned int axis = 0; axis < 3; axis++)
+    {
+        E1[axis] = _mm_sub_ps(p[1][axis], p[0][axis]);
+        E2[axis] = _mm_sub_ps(p[2][axis], p[1][axis]);
+    }
+    __m128 deltaU1 = _mm_sub_ps(uv[1][0], uv[0][0]);
+    __m128 deltaV1 = _mm_sub_ps(uv[1][1], uv[0][1]);
+    __m128 deltaU2 = _mm_sub_ps(uv[2][0], uv[1][0]);
+    __m128 deltaV2 = _mm_sub_ps(uv[2][1], uv[1][1]);
+    __m128 det     = _mm_sub_ps(_mm_mul_ps(deltaU1, deltaV2), _mm_mul_ps(deltaU2, deltaV1));
+    
+    // Triangles whose uvs don't span an area get zero vectors
+    __m128 valid  = _mm_cmpneq_ps(det, _mm_setzero_ps());
+    __m128 invDet = _mm_and_ps(valid, _mm_div_ps(_mm_set1_ps(1.0f),
+                                                 _mm_or_ps(det, _mm_andnot_ps(valid,
+                                                                  _mm_set1_ps(1.0f)))));
+    __m128 T[3], B[3];
+    for (unsigned int axis = 0; axis < 3; axis++)
+    {
+        T[axis] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(deltaV2, E1[axis]),
+                                        _mm_mul_ps(deltaV1, E2[axis])), invDet);
+        B[axis] = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(deltaU1, E2[axis]),
+                                        _mm_mul_ps(deltaU2, E1[axis])), invDet);
+    }
+    
+    // Scale the vectors by the triangles' areas
+    __m128 nx = _mm_sub_ps(_mm_mul_ps(E1[1], E2[2]), _mm_mul_ps(E1[2], E2[1]));
+    __m128 ny = _mm_sub_ps(_mm_mul_ps(E1[2], E2[0]), _mm_mul_ps(E1[0], E2[2]));
+    __m128 nz = _mm_sub_ps(_mm_mul_ps(E1[0], E2[1]), _mm_mul_ps(E1[1], E2[0]));
+    __m128 area = _mm_mul_ps(_mm_set1_ps(0.5f), length4(nx, ny, nz));
+    __m128 tangentScale   = rescale4(T[0], T[1], T[2], area);
+    __m128 bitangentScale = rescale4(B[0], B[1], B[2], area);
+    
+    float out[6][4];
+    for (unsigned int axis = 0; axis < 3; axis++)
+    {
+        _mm_storeu_ps(out[axis], _mm_mul_ps(T[axis], tangentScale));
+        _mm_storeu_ps(out[3 + axis], _mm_mul_ps(B[axis], bitangentScale));
+    }
+    for (unsigned int lane = 0; lane < 4; lane++)
     {
-        std::cout << "Texture " << path << " failed to load." << std::endl;
-        stbi_image_free(data);
+        tangents[t + lane]   = glm::vec3(out[0][lane], out[1][lane], out[2][lane]);
+        bitangents[t + lane] = glm::vec3(out[3][lane], out[4][lane], out[5][lane]);
     }
+}
+
+#endif
 
-    return textureID;
+// 64 bit hash of a vertex's attributes (the top bits are well mixed)
+static uint64_t hashVertex(const glm::vec3 &position, const glm::vec2 &uv,
+                           const glm::vec3 &normal)
+{
+    float key[8] = { position.x, position.y, position.z, uv.x, uv.y,
+                     normal.x, normal.y, normal.z };
+    uint64_t words[4];
+    memcpy(words, key, sizeof(key));
+    uint64_t a = (words[0] ^ 0x243f6a8885a308d3ull) * 0x9e3779b97f4a7c15ull;
+    uint64_t b = (words[1] ^ 0x13198a2e03707344ull) * 0xc2b2ae3d27d4eb4full;
+    a = (a ^ words[2] ^ (a >> 31)) * 0x9e3779b97f4a7c15ull;
+    b = (b ^ words[3] ^ (b >> 31)) * 0xc2b2ae3d27d4eb4full;
+    uint64_t hash = (a ^ (b >> 29) ^ (b << 35)) * 0x9e3779b97f4a7c15ull;
+    return hash ^ (hash >> 29);
 }
 
+// Vertex with the hash of its attributes
+struct HashedVertex
+{
+    uint64_t hash;
+    unsigned int vertex;
+};
+
+// Welded vertex: the sum of the tangents and bitangents of the triangles
+// sharing it
+struct WeldedVertex
+{
+    uint64_t hash;
+    unsigned int first;                 // first copy of the vertex
+    glm::vec3 tangent;
+    glm::vec3 bitangent;
+    float handedness;
+};
+
 void Model::calculateTangents()
 {
-    for (unsigned int i = 0; i < vertices.size(); i += 3)
+    PROFILE_SCOPE("Model::calculateTangents");
+    
+    unsigned int numVertices  = static_cast<unsigned int>(vertices.size()) / 3 * 3;
+    unsigned int numTriangles = numVertices / 3;
+    tangents.assign(numVertices, glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+    if (numVertices == 0)
+        return;
+    
+    // Models without uvs or normals get the tangents of zero uvs or of
+    // their face normals
+    bool hasUVs     = uvs.size() >= numVertices;
+    bool hasNormals = normals.size() >= numVertices;
+    std::vector<glm::vec2> noUVs;
+    if (!hasUVs)
+        noUVs.assign(numVertices, glm::vec2(0.0f));
+    const glm::vec2 *vertexUVs = hasUVs ? &uvs[0] : &noUVs[0];
+    
+    // Area weighted tangent and bitangent of each triangle, 4 at a time
+    std::vector<glm::vec3> faceTangents(numTriangles), faceBitangents(numTriangles);
+    Jobs::parallelFor(0, (numTriangles + 3) / 4, 1024, [&](unsigned int begin, unsigned int end)
     {
-        // Calculate edge vectors and deltas
-        glm::vec3 E1  = vertices[i+1] - vertices[i];
-        glm::vec3 E2  = vertices[i+2] - vertices[i+1];
-        float deltaU1 = uvs[i+1].x - uvs[i].x;
-        float deltaV1 = uvs[i+1].y - uvs[i].y;
-        float deltaU2 = uvs[i+2].x - uvs[i+1].x;
-        float deltaV2 = uvs[i+2].y - uvs[i+1].y;
-        
-        // Calculate tangents
-        float denom         = 1.0f / (deltaU1 * deltaV2 - deltaU2 * deltaV1);
-        glm::vec3 tangent   = (deltaV2 * E1 - deltaV1 * E2) * denom;
-        glm::vec3 bitangent = (deltaU1 * E2 - deltaU2 * E1) * denom;
-        
-        // Set the same tangents for the three vertices of the triangle
-        tangents.push_back(tangent);
-        tangents.push_back(tangent);
-        tangents.push_back(tangent);
-        bitangents.push_back(bitangent);
-        bitangents.push_back(bitangent);
-        bitangents.push_back(bitangent);
+        for (unsigned int t = 4 * begin; t < std::min(4 * end, numTriangles); )
+        {
+#ifdef MODEL_SSE
+            if (t + 4 <= numTriangles)
+            {
+                faceTangents4(&vertices[0], vertexUVs, t, &faceTangents[0], &faceBitangents[0]);
+                t += 4;
+                continue;
+            }
+#endif
+            faceTangent(&vertices[0], vertexUVs, t, faceTangents[t], faceBitangents[t]);
+            t++;
+        }
+    });
+    
+    // Hash the vertices and sort them into buckets by the top bits of their
+    // hashes, so the copies of a vertex shared by several triangles (which
+    // have the same position, uv and normal) are in the same bucket
+    std::vector<uint64_t> hashes(numVertices);
+    Jobs::parallelFor(0, numVertices, 4096, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+            hashes[i] = hashVertex(vertices[i], vertexUVs[i],
+                                   hasNormals ? normals[i] : glm::vec3(0.0f));
+    });
+    
+    static const unsigned int numBuckets = 64;
+    std::vector<unsigned int> bucketStart(numBuckets + 1, 0);
+    for (unsigned int i = 0; i < numVertices; i++)
+        bucketStart[(hashes[i] >> 58) + 1]++;
+    for (unsigned int b = 0; b < numBuckets; b++)
+        bucketStart[b + 1] += bucketStart[b];
+    std::vector<HashedVertex> order(numVertices);
+    std::vector<unsigned int> next(bucketStart.begin(), bucketStart.end() - 1);
+    for (unsigned int i = 0; i < numVertices; i++)
+    {
+        HashedVertex &vertex = order[next[hashes[i] >> 58]++];
+        vertex.hash   = hashes[i];
+        vertex.vertex = i;
     }
+    
+    // Weld the vertices of each bucket with a hash table, then give them
+    // the sum of their triangles' tangents made orthogonal to their normal
+    // (Gram-Schmidt) with the handedness of the uvs in w
+    Jobs::parallelFor(0, numBuckets, 1, [&](unsigned int begin, unsigned int end)
+    {
+        std::vector<unsigned int> table, welded;
+        std::vector<WeldedVertex> weldedVertices;
+        for (unsigned int b = begin; b < end; b++)
+        {
+            unsigned int first = bucketStart[b];
+            unsigned int count = bucketStart[b + 1] - first;
+            unsigned int size  = 16;
+            while (size < 2 * count)
+                size *= 2;
+            table.assign(size, 0xffffffff);
+            welded.resize(count);
+            weldedVertices.clear();
+            
+            for (unsigned int k = 0; k < count; k++)
+            {
+                // Find the vertex in the table or add it
+                unsigned int i    = order[first + k].vertex;
+                uint64_t hash     = order[first + k].hash;
+                unsigned int slot = static_cast<unsigned int>(hash) & (size - 1);
+                while (table[slot] != 0xffffffff)
+                {
+                    const WeldedVertex &w = weldedVertices[table[slot]];
+                    if (w.hash == hash && vertices[w.first] == vertices[i] &&
+                        vertexUVs[w.first] == vertexUVs[i] &&
+                        (!hasNormals || normals[w.first] == normals[i]))
+                        break;
+                    slot = (slot + 1) & (size - 1);
+                }
+                if (table[slot] == 0xffffffff)
+                {
+                    WeldedVertex w;
+                    w.hash      = hash;
+                    w.first     = i;
+                    w.tangent   = glm::vec3(0.0f);
+                    w.bitangent = glm::vec3(0.0f);
+                    table[slot] = static_cast<unsigned int>(weldedVertices.size());
+                    weldedVertices.push_back(w);
+                }
+                WeldedVertex &w = weldedVertices[table[slot]];
+                w.tangent   += faceTangents[i / 3];
+                w.bitangent += faceBitangents[i / 3];
+                welded[k] = table[slot];
+            }
+            
+            // Frame of each welded vertex
+            for (WeldedVertex &w : weldedVertices)
+            {
+                unsigned int t   = w.first / 3;
+                glm::vec3 normal = hasNormals ? normals[w.first]
+                                              : glm::cross(vertices[3 * t + 1] - vertices[3 * t],
+                                                           vertices[3 * t + 2] - vertices[3 * t]);
+                float normalLength = glm::length(normal);
+                normal = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f, 0.0f, 1.0f);
+                
+                glm::vec3 tangent = w.tangent - glm::dot(w.tangent, normal) * normal;
+                float tangentLength = glm::length(tangent);
+                if (tangentLength > 1.0e-20f)
+                    tangent /= tangentLength;
+                else
+                {
+                    // Any direction in the tangent plane will do
+                    glm::vec3 axis = fabsf(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                                            : glm::vec3(0.0f, 1.0f, 0.0f);
+                    tangent = glm::normalize(axis - glm::dot(axis, normal) * normal);
+                }
+                float handedness = glm::dot(glm::cross(normal, tangent), w.bitangent) < 0.0f
+                                   ? -1.0f : 1.0f;
+                w.tangent    = tangent;
+                w.handedness = handedness;
+            }
+            
+            for (unsigned int k = 0; k < count; k++)
+            {
+                const WeldedVertex &w = weldedVertices[welded[k]];
+                unsigned int i = order[first + k].vertex;
+                tangents[i] = glm::vec4(w.tangent, w.handedness);
+            }
+        }
+    });
 }
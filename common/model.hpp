@@ -1,28 +1,40 @@
 #pragma once
 
 #include <vector>
+#include <map>
 #include <stdio.h>
 #include <string>
 
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
+#include <common/glstats.hpp>
+
 // Texture struct
 struct Texture
 {
     unsigned int id;
     std::string type;
+    std::string path;
 };
 
+// Model class. The vertex attributes are streams that are only built and
+// uploaded when something needs them: draw asks the shader program which
+// attributes it reads (the first time it sees the program) and uploads just
+// those streams, so a model drawn without a normal map never calculates its
+// tangents or uses memory for them.
 class Model
 {
 public:
+    // Vertex attribute streams, numbered by their locations in the shaders
+    enum Stream { POSITIONS, UVS, NORMALS, TANGENTS, NUM_STREAMS };
+    
     // Model attributes
     std::vector<glm::vec3> vertices;
     std::vector<glm::vec2> uvs;
     std::vector<glm::vec3> normals;
-    std::vector<glm::vec3> tangents;
-    std::vector<glm::vec3> bitangents;
+    std::vector<glm::vec4> tangents;      // handedness of the uvs (1 or -1) in w, the
+                                          // bitangent is w * cross(normal, tangent)
     std::vector<Texture>   textures;
     unsigned int textureID;
     float ka, kd, ks, Ns;
@@ -30,8 +42,18 @@ public:
     // Constructor
     Model(const char *path);
     
-    // Draw model
-    void draw(unsigned int &shaderID);
+    // Draw model (or several instances of it in one draw call)
+    void draw(unsigned int &shaderID, const unsigned int instances = 1);
+    
+    // Whether the model has a stream (tangents can always be calculated),
+    // and build the streams in a mask of 1 << Stream bits on the CPU if they
+    // haven't been already
+    bool hasStream(const Stream stream) const { return (streams & (1u << stream)) != 0; }
+    void buildStreams(const unsigned int mask);
+    
+    // Read per instance affine matrices (three vec4 rows each) from a buffer
+    // into the vertex attributes at location, location + 1 and location + 2
+    void setInstanceBuffer(const unsigned int buffer, const unsigned int location);
     
     // Add textures
     void addTexture(const char *path, const std::string type);
@@ -39,28 +61,35 @@ public:
     // Cleanup
     void deleteBuffers();
     
-private:
-    
-    // Array buffers
-    unsigned int VAO;
-    unsigned int vertexBuffer;
-    unsigned int uvBuffer;
-    unsigned int normalBuffer;
-    unsigned int tangentBuffer;
-    unsigned int bitangentBuffer;
-    
     // Load .obj file method
     bool loadObj(const char *path,
                  std::vector<glm::vec3> &inVertices,
                  std::vector<glm::vec2> &inUVs,
                  std::vector<glm::vec3> &inNormals);
     
-    // Setup buffers
-    void setupBuffers();
+    // Calculate smooth tangents (replacing the tangents). The copies of a
+    // vertex shared by several triangles are welded and given the sum of
+    // their triangles' tangents, made orthogonal to the vertex normal. The
+    // triangles are worked on in parallel on the job system, 4 at a time
+    // with SSE.
+    void calculateTangents();
+    
+private:
     
-    // Load texture
-    unsigned int loadTexture(const char *path);
+    // Streams the model has, and those built on the CPU and uploaded
+    unsigned int streams  = 0;
+    unsigned int built    = 0;
+    unsigned int uploaded = 0;
     
-    // Calculate tangents and bitangents
-    void calculateTangents();
+    // Streams read by each shader program the model has been drawn with
+    std::map<unsigned int, unsigned int> programStreams;
+    
+    // Array buffers (one per stream)
+    unsigned int VAO = 0;
+    unsigned int buffers[NUM_STREAMS] = {};
+    
+    // Setup buffers
+    void setupBuffers();
+    void uploadStreams(const unsigned int mask);
+    unsigned int findProgramStreams(const unsigned int shaderID);
 };
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <map>
+
+#include <common/options.hpp>
+
+// Options given on the command line
+static std::map<std::string, std::string> options;
+
+// Environment variable for an option, e.g. frames -> LABS_FRAMES
+static const char *environmentValue(const std::string &name)
+{
+    std::string variable = "LABS_";
+    for (unsigned int i = 0; i < name.size(); i++)
+        variable += name[i] == '-' ? '_' : static_cast<char>(toupper(name[i]));
+    
+    return getenv(variable.c_str());
+}
+
+void Options::parse(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0)
+            continue;
+        
+        // An option is followed by its value unless it is a flag
+        std::string name = arg.substr(2);
+        if (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0)
+            options[name] = argv[++i];
+        else
+            options[name] = "1";
+    }
+}
+
+bool Options::has(const std::string &name)
+{
+    if (options.count(name) > 0)
+        return true;
+    
+    const char *value = environmentValue(name);
+    return value != NULL && std::string(value) != "0";
+}
+
+std::string Options::get(const std::string &name,
+                         const std::string &defaultValue)
+{
+    std::map<std::string, std::string>::iterator it = options.find(name);
+    if (it != options.end())
+        return it->second;
+    
+    const char *value = environmentValue(name);
+    return value != NULL ? value : defaultValue;
+}
+
+int Options::getInt(const std::string &name, int defaultValue)
+{
+    std::string value = get(name);
+    return value.empty() ? defaultValue : atoi(value.c_str());
+}
+
+float Options::getFloat(const std::string &name, float defaultValue)
+{
+    std::string value = get(name);
+    return value.empty() ? defaultValue : static_cast<float>(atof(value.c_str()));
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+// Options class. Command line options are given as --name value (or just
+// --name for a flag) and can also be set with LABS_NAME environment
+// variables, e.g. --frames 500 or LABS_FRAMES=500.
+class Options
+{
+public:
+    // Read the command line
+    static void parse(int argc, char *argv[]);
+    
+    // Get option values
+    static bool        has(const std::string &name);
+    static std::string get(const std::string &name,
+                           const std::string &defaultValue = "");
+    static int         getInt(const std::string &name, int defaultValue);
+    static float       getFloat(const std::string &name, float defaultValue);
+};
@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+#include <common/pathtracer.hpp>
+#include <common/window.hpp>
+#include <common/jobs.hpp>
+#include <common/profiler.hpp>
+
+// Images are rendered in 16x16 pixel tiles
+static const unsigned int tileSize = 16;
+
+// Paths end at random after this many bounces (Russian roulette)
+static const unsigned int minBounces = 2;
+
+static const float pi = 3.14159265f;
+
+// Wall clock time in milliseconds
+static double now()
+{
+    std::chrono::duration<double, std::milli> time =
+        std::chrono::steady_clock::now().time_since_epoch();
+    return time.count();
+}
+
+// =============================================================================
+// Random numbers
+
+// PCG hash of an integer
+static inline uint32_t hash(const uint32_t value)
+{
+    uint32_t state = value * 747796405u + 2891336453u;
+    uint32_t word  = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Random number in [0, 1)
+static inline float random(uint32_t &seed)
+{
+    seed = hash(seed);
+    return (seed >> 8) * (1.0f / 16777216.0f);
+}
+
+// Random direction about a normal with a probability proportional to the
+// cosine of its angle to the normal
+static glm::vec3 cosineDirection(const glm::vec3 &normal, uint32_t &seed)
+{
+    float r   = sqrtf(random(seed));
+    float phi = 2.0f * pi * random(seed);
+    glm::vec3 tangent = fabsf(normal.x) > 0.5f ? glm::vec3(0.0f, 1.0f, 0.0f)
+                                               : glm::vec3(1.0f, 0.0f, 0.0f);
+    tangent = glm::normalize(glm::cross(tangent, normal));
+    glm::vec3 bitangent = glm::cross(normal, tangent);
+    return r * cosf(phi) * tangent + r * sinf(phi) * bitangent +
+           sqrtf(std::max(1.0f - r * r, 0.0f)) * normal;
+}
+
+// Distance to move a ray's origin off a surface at a point
+static inline float surfaceOffset(const glm::vec3 &point)
+{
+    float size = std::max(std::max(fabsf(point.x), fabsf(point.y)), fabsf(point.z));
+    return 1.0e-4f * std::max(size, 1.0f);
+}
+
+// =============================================================================
+// Scene
+
+PathTracer::PathTracer(const unsigned int width, const unsigned int height)
+{
+    resize(width, height);
+}
+
+void PathTracer::resize(const unsigned int width, const unsigned int height)
+{
+    this->width  = width;
+    this->height = height;
+    colour.assign(4 * width * height, 0);
+    reset();
+}
+
+void PathTracer::clear()
+{
+    meshes.clear();
+    instances.clear();
+    positions.clear();
+    bvh.clear();
+    reset();
+}
+
+void PathTracer::add(Model &model, const glm::mat4 *modelMatrices, const unsigned int instances)
+{
+    unsigned int numVertices = static_cast<unsigned int>(model.vertices.size()) / 3 * 3;
+    if (instances == 0 || numVertices == 0)
+        return;
+
+    Mesh mesh;
+    mesh.model = &model;
+    mesh.material.ka = model.ka;
+    mesh.material.kd = model.kd;
+    mesh.material.ks = model.ks;
+    mesh.material.Ns = model.Ns;
+    mesh.material.diffuseMap = findTexture(model, "diffuse");
+    mesh.material.normalMap  = findTexture(model, "normal");
+    if (mesh.material.normalMap != NULL)
+        model.buildStreams(1u << Model::TANGENTS);
+    meshes.push_back(mesh);
+
+    // Copy the triangles of each instance in world space
+    for (unsigned int i = 0; i < instances; i++)
+    {
+        Instance instance;
+        instance.mesh          = static_cast<unsigned int>(meshes.size() - 1);
+        instance.firstTriangle = static_cast<unsigned int>(positions.size() / 3);
+        instance.model         = modelMatrices[i];
+        instance.normalMatrix  = glm::transpose(glm::inverse(glm::mat3(modelMatrices[i])));
+        this->instances.push_back(instance);
+
+        positions.resize(positions.size() + numVertices);
+        Maths::transformPoints(modelMatrices[i], &model.vertices[0],
+                               &positions[positions.size() - numVertices], numVertices);
+    }
+}
+
+void PathTracer::setLights(const Light &lights)
+{
+    this->lights = lights.lightSources;
+    reset();
+}
+
+void PathTracer::build()
+{
+    bvh.build(positions.empty() ? NULL : &positions[0],
+              static_cast<unsigned int>(positions.size() / 3));
+    stats.triangles = bvh.numTriangles;
+    stats.nodes     = static_cast<unsigned int>(bvh.nodes.size());
+    stats.buildTime = bvh.buildTime;
+    reset();
+}
+
+const RasterTexture *PathTracer::findTexture(const Model &model, const std::string &type)
+{
+    for (const Texture &texture : model.textures)
+    {
+        if (texture.type != type)
+            continue;
+
+        // Load the image the first time it is used
+        std::map<std::string, RasterTexture>::iterator it = textureCache.find(texture.path);
+        if (it == textureCache.end())
+        {
+            it = textureCache.insert(std::make_pair(texture.path, RasterTexture())).first;
+            it->second.load(texture.path.c_str());
+        }
+        return it->second.levels.empty() ? NULL : &it->second;
+    }
+    return NULL;
+}
+
+// =============================================================================
+// Rendering
+
+void PathTracer::setCamera(const glm::mat4 &view, const glm::mat4 &projection)
+{
+    if (view == this->view && projection == this->projection)
+        return;
+
+    this->view       = view;
+    this->projection = projection;
+    inverseViewProjection = Maths::inverse(projection * view);
+    reset();
+}
+
+void PathTracer::reset()
+{
+    accumulation.assign(width * height, glm::vec3(0.0f));
+    stats.rays       = 0;
+    stats.samples    = 0;
+    stats.renderTime = 0.0;
+}
+
+void PathTracer::render(const unsigned int samples)
+{
+    PROFILE_SCOPE("PathTracer::render");
+    if (width == 0 || height == 0 || samples == 0)
+        return;
+
+    // Render the tiles in parallel
+    double start = now();
+    unsigned int tilesX = (width + tileSize - 1) / tileSize;
+    unsigned int tilesY = (height + tileSize - 1) / tileSize;
+    std::atomic<uint64_t> rays(0);
+    Jobs::parallelFor(0, tilesX * tilesY, 1, [&](unsigned int begin, unsigned int end)
+    {
+        uint64_t tileRays = 0;
+        for (unsigned int i = begin; i < end; i++)
+            renderTile(i, samples, tileRays);
+        rays += tileRays;
+    });
+
+    stats.samples    += samples;
+    stats.rays       += rays;
+    stats.renderTime += now() - start;
+}
+
+void PathTracer::renderTile(const unsigned int tile, const unsigned int samples, uint64_t &rays)
+{
+    unsigned int tilesX = (width + tileSize - 1) / tileSize;
+    unsigned int x0 = (tile % tilesX) * tileSize;
+    unsigned int y0 = (tile / tilesX) * tileSize;
+    unsigned int x1 = std::min(x0 + tileSize, width);
+    unsigned int y1 = std::min(y0 + tileSize, height);
+    float scale = 1.0f / (stats.samples + samples);
+
+    for (unsigned int y = y0; y < y1; y++)
+    {
+        for (unsigned int x = x0; x < x1; x++)
+        {
+            unsigned int pixel = y * width + x;
+            glm::vec3 &sum = accumulation[pixel];
+            for (unsigned int s = 0; s < samples; s++)
+            {
+                // Ray through a random point in the pixel from the near
+                // plane to the far plane
+                uint32_t seed = hash(pixel ^ hash(stats.samples + s));
+                float ndcX = 2.0f * (x + random(seed)) / width - 1.0f;
+                float ndcY = 1.0f - 2.0f * (y + random(seed)) / height;
+                glm::vec4 near = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+                glm::vec4 far  = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+                glm::vec3 nearPoint = glm::vec3(near) / near.w;
+                glm::vec3 farPoint  = glm::vec3(far) / far.w;
+
+                Ray ray;
+                ray.origin    = nearPoint;
+                ray.direction = glm::normalize(farPoint - nearPoint);
+                ray.tMax      = glm::length(farPoint - nearPoint);
+                sum += trace(ray, seed, rays);
+            }
+
+            // Average of the samples so far
+            glm::vec3 c = glm::clamp(sum * scale, 0.0f, 1.0f);
+            unsigned char *output = &colour[4 * pixel];
+            output[0] = static_cast<unsigned char>(c.r * 255.0f + 0.5f);
+            output[1] = static_cast<unsigned char>(c.g * 255.0f + 0.5f);
+            output[2] = static_cast<unsigned char>(c.b * 255.0f + 0.5f);
+            output[3] = 255;
+        }
+    }
+}
+
+glm::vec3 PathTracer::trace(const Ray &cameraRay, uint32_t &seed, uint64_t &rays) const
+{
+    glm::vec3 radiance(0.0f);
+    glm::vec3 throughput(1.0f);
+    Ray ray = cameraRay;
+    for (unsigned int bounce = 0; ; bounce++)
+    {
+        RayHit hit;
+        rays++;
+        if (!bvh.intersect(ray, hit))
+        {
+            radiance += throughput * background;
+            break;
+        }
+
+        // Instance and model triangle that were hit
+        std::vector<Instance>::const_iterator it =
+            std::upper_bound(instances.begin(), instances.end(), hit.triangle,
+                             [](const uint32_t triangle, const Instance &instance)
+        {
+            return triangle < instance.firstTriangle;
+        }) - 1;
+        const Instance &instance = *it;
+        const Mesh &mesh = meshes[instance.mesh];
+        const Model &model = *mesh.model;
+        const Material &material = mesh.material;
+        unsigned int i0 = 3 * (hit.triangle - instance.firstTriangle);
+        glm::vec3 w(1.0f - hit.u - hit.v, hit.u, hit.v);
+
+        // Geometric normal facing the ray
+        glm::vec3 position = ray.origin + hit.t * ray.direction;
+        const glm::vec3 *p = &positions[3 * hit.triangle];
+        glm::vec3 geometricNormal = glm::normalize(glm::cross(p[1] - p[0], p[2] - p[0]));
+        glm::vec3 toEye = -ray.direction;
+        float side = glm::dot(geometricNormal, toEye) < 0.0f ? -1.0f : 1.0f;
+        geometricNormal *= side;
+
+        // Interpolate the attributes
+        glm::vec3 normal = geometricNormal;
+        if (model.normals.size() == model.vertices.size())
+            normal = side * (instance.normalMatrix * (w[0] * model.normals[i0] +
+                                                      w[1] * model.normals[i0 + 1] +
+                                                      w[2] * model.normals[i0 + 2]));
+        glm::vec2 uv(0.0f);
+        if (model.uvs.size() == model.vertices.size())
+            uv = w[0] * model.uvs[i0] + w[1] * model.uvs[i0 + 1] + w[2] * model.uvs[i0 + 2];
+
+        // Object colour and the normal vector from the normal map (the
+        // samples of each pixel filter the textures so no mipmaps are used)
+        glm::vec3 objectColour(1.0f);
+        if (material.diffuseMap)
+            objectColour = material.diffuseMap->sample(uv);
+        if (material.normalMap)
+        {
+            // The bitangent follows from the normal, the tangent and its
+            // handedness, which mirrored instances flip
+            glm::mat3 model3(instance.model);
+            glm::vec4 objectTangent = w[0] * model.tangents[i0] + w[1] * model.tangents[i0 + 1] +
+                                      w[2] * model.tangents[i0 + 2];
+            glm::vec3 tangent = model3 * glm::vec3(objectTangent);
+            float handedness  = (objectTangent.w < 0.0f) != (glm::determinant(model3) < 0.0f)
+                                ? -1.0f : 1.0f;
+            glm::vec3 bitangent = handedness * glm::cross(glm::normalize(side * normal), tangent);
+            glm::vec3 mapNormal = material.normalMap->normal(material.normalMap->sample(uv));
+            normal = side * tangent * mapNormal.x + side * bitangent * mapNormal.y +
+                     normal * mapNormal.z;
+        }
+        normal = glm::normalize(normal);
+
+        // Light arriving straight from the light sources
+        radiance += throughput * directLight(position, normal, geometricNormal, toEye,
+                                             objectColour, material, rays);
+        if (bounce == maxBounces)
+            break;
+
+        // Diffuse bounce, ending paths that carry little light at random
+        throughput *= material.kd * objectColour;
+        if (bounce >= minBounces)
+        {
+            float survive = glm::clamp(std::max(std::max(throughput.r, throughput.g),
+                                                throughput.b), 0.05f, 0.95f);
+            if (random(seed) >= survive)
+                break;
+            throughput /= survive;
+        }
+        ray.direction = cosineDirection(normal, seed);
+        if (glm::dot(ray.direction, geometricNormal) <= 0.0f)
+            break;
+        ray.origin = position + surfaceOffset(position) * geometricNormal;
+        ray.tMin   = 0.0f;
+        ray.tMax   = 1.0e30f;
+    }
+    return radiance;
+}
+
+glm::vec3 PathTracer::directLight(const glm::vec3 &position, const glm::vec3 &normal,
+                                  const glm::vec3 &geometricNormal, const glm::vec3 &toEye,
+                                  const glm::vec3 &objectColour, const Material &material,
+                                  uint64_t &rays) const
+{
+    glm::vec3 origin = position + surfaceOffset(position) * geometricNormal;
+    glm::vec3 total(0.0f);
+    for (const LightSource &light : lights)
+    {
+        // Direction and distance to the light, its attenuation and the
+        // spotlight's intensity (as in lightingFragmentShader.glsl)
+        glm::vec3 lightVector;
+        float distance = 1.0e30f;
+        float intensity = 1.0f;
+        if (light.type == 3)
+            lightVector = glm::normalize(-light.direction);
+        else
+        {
+            lightVector = light.position - position;
+            distance    = glm::length(lightVector);
+            lightVector /= distance;
+            intensity   = 1.0f / (light.constant + light.linear * distance +
+                                  light.quadratic * distance * distance);
+            if (light.type == 2)
+            {
+                float cosTheta = glm::dot(-lightVector, glm::normalize(light.direction));
+                intensity *= glm::clamp((cosTheta - light.cosPhi) / Maths::radians(2.0f),
+                                        0.0f, 1.0f);
+            }
+        }
+        if (intensity <= 0.0f)
+            continue;
+
+        // Ambient reflection (which isn't shadowed, as in the shader)
+        total += intensity * material.ka * objectColour;
+        if (glm::dot(geometricNormal, lightVector) <= 0.0f)
+            continue;
+
+        // Diffuse and specular reflection
+        float cosTheta       = std::max(glm::dot(normal, lightVector), 0.0f);
+        glm::vec3 reflection = -lightVector + 2.0f * glm::dot(lightVector, normal) * normal;
+        float cosAlpha       = std::max(glm::dot(toEye, reflection), 0.0f);
+        glm::vec3 reflected  = light.colour * intensity *
+                               (material.kd * objectColour * cosTheta +
+                                material.ks * powf(cosAlpha, material.Ns));
+        if (reflected == glm::vec3(0.0f))
+            continue;
+
+        // Shadow ray
+        Ray shadow;
+        shadow.origin    = origin;
+        shadow.direction = lightVector;
+        shadow.tMax      = distance - surfaceOffset(position);
+        rays++;
+        if (!bvh.occluded(shadow))
+            total += reflected;
+    }
+    return total;
+}
+
+// =============================================================================
+// Output
+
+bool PathTracer::writePNG(const char *path) const
+{
+    if (colour.empty())
+        return false;
+    return ::writePNG(path, &colour[0], width, height, 4);
+}
+
+void PathTracer::present()
+{
+    if (colour.empty())
+        return;
+
+    // Remember the bound framebuffers
+    int drawFramebuffer, readFramebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+
+    // Texture holding the image, attached to a framebuffer to copy from
+    if (framebuffer == 0)
+    {
+        glGenTextures(1, &texture);
+        glGenFramebuffers(1, &framebuffer);
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (textureWidth != width || textureHeight != height)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, &colour[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               texture, 0);
+        textureWidth  = width;
+        textureHeight = height;
+    }
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                        &colour[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Copy the image upside down (OpenGL's first row is the bottom of the
+    // image) and bind the framebuffers again
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBlitFramebuffer(0, 0, width, height, 0, height, width, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+}
+
+void PathTracer::deleteBuffers()
+{
+    if (framebuffer != 0)
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &texture);
+    }
+    framebuffer   = 0;
+    texture       = 0;
+    textureWidth  = 0;
+    textureHeight = 0;
+}
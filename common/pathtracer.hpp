@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <stdint.h>
+
+#include <common/maths.hpp>
+#include <common/model.hpp>
+#include <common/light.hpp>
+#include <common/bvh.hpp>
+#include <common/rasterizer.hpp>
+
+// PathTracer class. Renders reference images of Models lit by a Light on the
+// CPU by path tracing. The triangles of every instance are put in world
+// space into one BVH. Each call to render adds samples to every pixel, so
+// the image converges the longer the camera stays still:
+//
+//     pathTracer.add(teapot, &models[0], models.size());
+//     pathTracer.setLights(lightSources);
+//     pathTracer.build();
+//     pathTracer.setCamera(camera.view, camera.projection);
+//     pathTracer.render();                    // one more sample per pixel
+//     pathTracer.present();                   // copy into the OpenGL framebuffer
+//
+// The image is split into 16x16 pixel tiles rendered in parallel on the job
+// system. Paths start with a jittered ray through each pixel. At each hit
+// the point, spot and directional lights are sampled with shadow rays and
+// give the light of the Phong model in lightingFragmentShader.glsl (so the
+// images are as bright as the labs'), then the path bounces in a cosine
+// weighted random direction to add light reflected off other objects. Paths
+// that leave the scene pick up the background colour.
+class PathTracer
+{
+public:
+    // Statistics of the last build and render
+    struct Stats
+    {
+        unsigned int triangles = 0;
+        unsigned int nodes     = 0;
+        double buildTime = 0.0;         // milliseconds
+        uint64_t rays    = 0;           // camera, bounce and shadow rays traced
+        unsigned int samples = 0;       // samples per pixel so far
+        double renderTime = 0.0;        // milliseconds
+    };
+    Stats stats;
+
+    glm::vec3 background = glm::vec3(0.0f);
+    unsigned int maxBounces = 4;
+
+    // Constructor
+    PathTracer(const unsigned int width = 0, const unsigned int height = 0);
+
+    void resize(const unsigned int width, const unsigned int height);
+    unsigned int getWidth() const  { return width; }
+    unsigned int getHeight() const { return height; }
+
+    // Scene (the models must stay alive while the path tracer uses them)
+    void clear();
+    void add(Model &model, const glm::mat4 *modelMatrices, const unsigned int instances);
+    void setLights(const Light &lights);
+    void build();
+    const BVH &getBVH() const { return bvh; }
+
+    // Set the camera, starting the image again if it has moved
+    void setCamera(const glm::mat4 &view, const glm::mat4 &projection);
+
+    // Start the image again, or add samples to every pixel
+    void reset();
+    void render(const unsigned int samples = 1);
+
+    // Trace one ray and return the colour along it
+    glm::vec3 trace(const Ray &ray, uint32_t &seed, uint64_t &rays) const;
+
+    // Rendered image as RGBA rows starting with the top of the image
+    const unsigned char *pixels() const { return colour.empty() ? NULL : &colour[0]; }
+    bool writePNG(const char *path) const;
+
+    // Copy the image into the bound OpenGL framebuffer
+    void present();
+    void deleteBuffers();
+
+private:
+    // Surface properties of a model
+    struct Material
+    {
+        float ka = 0.0f, kd = 0.0f, ks = 0.0f, Ns = 1.0f;
+        const RasterTexture *diffuseMap = NULL;
+        const RasterTexture *normalMap  = NULL;
+    };
+
+    struct Mesh
+    {
+        const Model *model;
+        Material material;
+    };
+
+    // Instance of a mesh whose triangles start at firstTriangle in the BVH
+    struct Instance
+    {
+        unsigned int mesh;
+        unsigned int firstTriangle;
+        glm::mat4 model;
+        glm::mat3 normalMatrix;
+    };
+
+    unsigned int width  = 0;
+    unsigned int height = 0;
+
+    // Scene
+    std::vector<Mesh> meshes;
+    std::vector<Instance> instances;
+    std::vector<LightSource> lights;
+    std::vector<glm::vec3> positions;       // world space, 3 per triangle
+    BVH bvh;
+
+    // Camera
+    glm::mat4 view = glm::mat4(0.0f);
+    glm::mat4 projection = glm::mat4(0.0f);
+    glm::mat4 inverseViewProjection;
+
+    // Sum of the samples of each pixel, and the image
+    std::vector<glm::vec3> accumulation;
+    std::vector<unsigned char> colour;
+
+    // Images of the models' textures
+    std::map<std::string, RasterTexture> textureCache;
+
+    // OpenGL texture and framebuffer used by present
+    unsigned int texture = 0;
+    unsigned int framebuffer = 0;
+    unsigned int textureWidth = 0;
+    unsigned int textureHeight = 0;
+
+    const RasterTexture *findTexture(const Model &model, const std::string &type);
+    void renderTile(const unsigned int tile, const unsigned int samples, uint64_t &rays);
+    glm::vec3 directLight(const glm::vec3 &position, const glm::vec3 &normal,
+                          const glm::vec3 &geometricNormal, const glm::vec3 &toEye,
+                          const glm::vec3 &objectColour, const Material &material,
+                          uint64_t &rays) const;
+};
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+
+#include <common/profiler.hpp>
+
+// Number of frames kept for the rolling statistics
+static const unsigned int historyLength = 300;
+
+// Maximum number of events kept for the trace (about 40 MB)
+static const size_t maxEvents = 1000000;
+
+// Track used for GPU events in the trace
+static const unsigned int gpuThread = 1000;
+
+bool Profiler::isEnabled = false;
+std::string Profiler::tracePath;
+unsigned int Profiler::summaryInterval = 0;
+unsigned int Profiler::frame = 0;
+double Profiler::frameStart = 0.0;
+std::vector<Profiler::Event> Profiler::events;
+std::map<std::string, Profiler::ScopeHistory> Profiler::history;
+std::map<std::string, double> Profiler::frameTotals;
+std::vector<Profiler::GpuQuery> Profiler::gpuQueries[2];
+std::vector<unsigned int> Profiler::freeQueries;
+bool Profiler::gpuScopeActive = false;
+
+static std::mutex profilerMutex;
+static std::atomic<unsigned int> threadCount(0);
+static std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+// Open CPU scopes of the calling thread
+struct OpenScope
+{
+    const char *name;
+    double start;
+};
+static thread_local std::vector<OpenScope> openScopes;
+
+// Index of the calling thread (the thread that starts the profiler is 0)
+static unsigned int threadIndex()
+{
+    static thread_local unsigned int index = threadCount++;
+    return index;
+}
+
+double Profiler::now()
+{
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - startTime;
+    return elapsed.count();
+}
+
+void Profiler::start(const char *path, unsigned int interval)
+{
+    if (path == NULL)
+        return;
+
+    threadIndex();
+    tracePath       = path;
+    summaryInterval = interval;
+    isEnabled       = true;
+    events.reserve(65536);
+    printf("Profiling to %s\n", path);
+}
+
+void Profiler::stop()
+{
+    if (!isEnabled)
+        return;
+
+    // Wait for the outstanding GPU queries
+    glFinish();
+    collectGpuQueries(gpuQueries[0]);
+    collectGpuQueries(gpuQueries[1]);
+    for (unsigned int i = 0; i < freeQueries.size(); i++)
+        glDeleteQueries(1, &freeQueries[i]);
+    freeQueries.clear();
+
+    isEnabled = false;
+    printSummary();
+    writeTrace(tracePath.c_str());
+}
+
+void Profiler::record(const char *name, double start, double duration,
+                      unsigned int thread, unsigned int depth)
+{
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    if (events.size() < maxEvents)
+    {
+        Event event = { name, start, duration, thread, depth };
+        events.push_back(event);
+    }
+    frameTotals[name] += duration;
+}
+
+void Profiler::beginFrame()
+{
+    if (!isEnabled)
+        return;
+
+    frameStart = now();
+
+    // Read back the queries issued in the previous use of this buffer
+    collectGpuQueries(gpuQueries[frame % 2]);
+}
+
+void Profiler::endFrame()
+{
+    if (!isEnabled)
+        return;
+
+    double end = now();
+    record("Frame", frameStart, end - frameStart, threadIndex(), 0);
+
+    // Add this frame's per-scope totals to the rolling history. Scopes seen
+    // in earlier frames that did not run in this one take no time.
+    {
+        std::lock_guard<std::mutex> lock(profilerMutex);
+        std::map<std::string, double>::iterator total;
+        for (total = frameTotals.begin(); total != frameTotals.end(); total++)
+            history[total->first];
+
+        std::map<std::string, ScopeHistory>::iterator it;
+        for (it = history.begin(); it != history.end(); it++)
+        {
+            total = frameTotals.find(it->first);
+            double duration = total != frameTotals.end() ? total->second : 0.0;
+
+            ScopeHistory &scope = it->second;
+            if (scope.samples.size() < historyLength)
+                scope.samples.push_back(duration);
+            else
+                scope.samples[scope.next] = duration;
+            scope.next = (scope.next + 1) % historyLength;
+        }
+        frameTotals.clear();
+    }
+
+    frame++;
+    if (summaryInterval > 0 && frame % summaryInterval == 0)
+        printSummary();
+}
+
+void Profiler::beginScope(const char *name)
+{
+    OpenScope scope = { name, now() };
+    openScopes.push_back(scope);
+}
+
+void Profiler::endScope()
+{
+    if (openScopes.empty())
+        return;
+
+    OpenScope scope = openScopes.back();
+    openScopes.pop_back();
+    record(scope.name, scope.start, now() - scope.start, threadIndex(),
+           static_cast<unsigned int>(openScopes.size()) + 1);
+}
+
+void Profiler::beginGpuScope(const char *name)
+{
+    // GL_TIME_ELAPSED queries cannot be nested
+    if (gpuScopeActive)
+        return;
+
+    GpuQuery query;
+    if (freeQueries.empty())
+    {
+        glGenQueries(1, &query.id);
+    }
+    else
+    {
+        query.id = freeQueries.back();
+        freeQueries.pop_back();
+    }
+    query.name  = name;
+    query.start = now();
+
+    glBeginQuery(GL_TIME_ELAPSED, query.id);
+    gpuQueries[frame % 2].push_back(query);
+    gpuScopeActive = true;
+}
+
+void Profiler::endGpuScope()
+{
+    if (!gpuScopeActive)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    gpuScopeActive = false;
+}
+
+void Profiler::collectGpuQueries(std::vector<GpuQuery> &queries)
+{
+    for (unsigned int i = 0; i < queries.size(); i++)
+    {
+        // Results that are not ready yet are dropped rather than waited for
+        GLint available = 0;
+        glGetQueryObjectiv(queries[i].id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(queries[i].id, GL_QUERY_RESULT, &elapsed);
+            record(queries[i].name, queries[i].start, elapsed / 1000.0,
+                   gpuThread, 1);
+        }
+        freeQueries.push_back(queries[i].id);
+    }
+    queries.clear();
+}
+
+// Return the p-th percentile of a set of samples
+static double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty())
+        return 0.0;
+
+    size_t index = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+void Profiler::printSummary()
+{
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    printf("\n%-32s %10s %10s %10s %10s\n", "Scope (ms per frame)", "mean",
+           "p50", "p95", "p99");
+
+    std::map<std::string, ScopeHistory>::iterator it;
+    for (it = history.begin(); it != history.end(); it++)
+    {
+        std::vector<double> &samples = it->second.samples;
+        double sum = 0.0;
+        for (unsigned int i = 0; i < samples.size(); i++)
+            sum += samples[i];
+
+        printf("%-32s %10.3f %10.3f %10.3f %10.3f\n", it->first.c_str(),
+               sum / samples.size() / 1000.0,
+               percentile(samples, 0.50) / 1000.0,
+               percentile(samples, 0.95) / 1000.0,
+               percentile(samples, 0.99) / 1000.0);
+    }
+}
+
+bool Profiler::writeTrace(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf("Impossible to open %s for writing.\n", path);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(profilerMutex);
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,"
+                  "\"args\":{\"name\":\"GPU\"}}", gpuThread);
+    for (unsigned int i = 0; i < events.size(); i++)
+    {
+        const Event &event = events[i];
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+                      "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"depth\":%u}}",
+                event.name, event.thread, event.start, event.duration,
+                event.depth);
+    }
+    fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(file);
+
+    printf("Wrote %u profiler events to %s\n",
+           static_cast<unsigned int>(events.size()), path);
+    return true;
+}
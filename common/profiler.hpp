@@ -0,0 +1,137 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+
+#include <GL/glew.h>
+
+// Profiler class. Records nested CPU scopes and GPU timer queries for each
+// frame, writes them as a Chrome/Perfetto trace (load the file in
+// chrome://tracing or ui.perfetto.dev) and keeps rolling per-scope statistics.
+// When the profiler is not started each scope costs a single branch, and
+// defining DISABLE_PROFILER removes the scope macros altogether.
+class Profiler
+{
+public:
+    // Start recording; the trace is written to tracePath when the profiler
+    // is stopped. Passing NULL leaves the profiler disabled.
+    static void start(const char *tracePath, unsigned int summaryInterval = 0);
+    static void stop();
+    static bool enabled() { return isEnabled; }
+
+    // Frame markers
+    static void beginFrame();
+    static void endFrame();
+
+    // CPU scopes (may be nested and used from any thread)
+    static void beginScope(const char *name);
+    static void endScope();
+
+    // GPU scopes using GL_TIME_ELAPSED queries (cannot be nested)
+    static void beginGpuScope(const char *name);
+    static void endGpuScope();
+
+    // Output
+    static bool writeTrace(const char *path);
+    static void printSummary();
+
+private:
+    struct Event
+    {
+        const char *name;
+        double start;           // microseconds since the profiler started
+        double duration;        // microseconds
+        unsigned int thread;    // 0 = main thread, GPU events use their own track
+        unsigned int depth;
+    };
+
+    struct GpuQuery
+    {
+        unsigned int id;
+        const char *name;
+        double start;
+    };
+
+    static bool isEnabled;
+    static std::string tracePath;
+    static unsigned int summaryInterval;
+    static unsigned int frame;
+    static double frameStart;
+    static std::vector<Event> events;
+
+    // Per-scope time for each of the most recent frames, written in a ring
+    // from next onwards
+    struct ScopeHistory
+    {
+        std::vector<double> samples;
+        unsigned int next = 0;
+    };
+
+    static std::map<std::string, ScopeHistory> history;
+    static std::map<std::string, double> frameTotals;
+
+    // GPU queries are double buffered: queries issued in one frame are read
+    // back in the next so the CPU never waits for the GPU
+    static std::vector<GpuQuery> gpuQueries[2];
+    static std::vector<unsigned int> freeQueries;
+    static bool gpuScopeActive;
+
+    static double now();
+    static void record(const char *name, double start, double duration,
+                       unsigned int thread, unsigned int depth);
+    static void collectGpuQueries(std::vector<GpuQuery> &queries);
+};
+
+// Times a CPU scope from construction to destruction
+class ProfileScope
+{
+public:
+    ProfileScope(const char *name)
+    {
+        if (Profiler::enabled())
+            Profiler::beginScope(name);
+        active = Profiler::enabled();
+    }
+
+    ~ProfileScope()
+    {
+        if (active)
+            Profiler::endScope();
+    }
+
+private:
+    bool active;
+};
+
+// Times a GPU scope from construction to destruction
+class GpuProfileScope
+{
+public:
+    GpuProfileScope(const char *name)
+    {
+        if (Profiler::enabled())
+            Profiler::beginGpuScope(name);
+        active = Profiler::enabled();
+    }
+
+    ~GpuProfileScope()
+    {
+        if (active)
+            Profiler::endGpuScope();
+    }
+
+private:
+    bool active;
+};
+
+#define PROFILER_CONCAT2(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT2(a, b)
+
+#ifndef DISABLE_PROFILER
+#define PROFILE_SCOPE(name) ProfileScope PROFILER_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) GpuProfileScope PROFILER_CONCAT(gpuProfileScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#endif
@@ -0,0 +1,1027 @@
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+#include <common/rasterizer.hpp>
+#include <common/window.hpp>
+#include <common/jobs.hpp>
+#include <common/profiler.hpp>
+
+#include "stb_image.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RASTERIZER_SSE
+#include <immintrin.h>
+#endif
+
+// Tiles are 64x64 pixels made of 8x8 pixel blocks
+static const int tileSize      = 64;
+static const int tilePixels    = tileSize * tileSize;
+static const int blockSize     = 8;
+static const int blocksPerRow  = tileSize / blockSize;
+
+// Vertices are snapped to 1/16 of a pixel
+static const int subpixelBits = 4;
+static const int subpixels    = 1 << subpixelBits;
+
+// Triangles are clipped to a guard band 2000 pixels across centred on the
+// screen, so the edge functions (at most twice the square of the width in
+// subpixels) fit in 32 bits
+static const float guardBand = 2000.0f;
+static const unsigned int maxSize = 1920;
+
+// Chunks have at least 1024 triangles and there are about 1024 chunks at most
+static const unsigned int minChunkSize = 1024;
+static const unsigned int maxChunks    = 1024;
+
+// Visible triangle of pixels nothing is drawn on
+static const uint32_t emptyPixel = 0xffffffff;
+
+// Wall clock time in milliseconds
+static double now()
+{
+    std::chrono::duration<double, std::milli> time =
+        std::chrono::steady_clock::now().time_since_epoch();
+    return time.count();
+}
+
+// =============================================================================
+// Textures
+
+bool RasterTexture::load(const char *path)
+{
+    int w, h, numComponents;
+    unsigned char *data = stbi_load(path, &w, &h, &numComponents, 0);
+    if (!data)
+    {
+        printf("Rasterizer could not load texture %s\n", path);
+        return false;
+    }
+
+    // Two channel images are red and green, as OpenGL uploads them, and
+    // grey ones grey
+    components = numComponents;
+    levels.assign(1, Level());
+    levels[0].width  = w;
+    levels[0].height = h;
+    levels[0].texels.resize(w * h);
+    for (int i = 0; i < w * h; i++)
+    {
+        const unsigned char *texel = data + i * numComponents;
+        if (numComponents >= 3)
+            levels[0].texels[i] = glm::vec3(texel[0], texel[1], texel[2]) / 255.0f;
+        else if (numComponents == 2)
+            levels[0].texels[i] = glm::vec3(texel[0], texel[1], 0.0f) / 255.0f;
+        else
+            levels[0].texels[i] = glm::vec3(texel[0]) / 255.0f;
+    }
+    stbi_image_free(data);
+
+    // Each mipmap level averages 2x2 texels of the level before
+    while (levels.back().width > 1 || levels.back().height > 1)
+    {
+        const Level &previous = levels.back();
+        Level level;
+        level.width  = std::max(previous.width / 2, 1u);
+        level.height = std::max(previous.height / 2, 1u);
+        level.texels.resize(level.width * level.height);
+        for (unsigned int y = 0; y < level.height; y++)
+        {
+            unsigned int y0 = std::min(2 * y, previous.height - 1);
+            unsigned int y1 = std::min(2 * y + 1, previous.height - 1);
+            for (unsigned int x = 0; x < level.width; x++)
+            {
+                unsigned int x0 = std::min(2 * x, previous.width - 1);
+                unsigned int x1 = std::min(2 * x + 1, previous.width - 1);
+                level.texels[y * level.width + x] =
+                    0.25f * (previous.texels[y0 * previous.width + x0] +
+                             previous.texels[y0 * previous.width + x1] +
+                             previous.texels[y1 * previous.width + x0] +
+                             previous.texels[y1 * previous.width + x1]);
+            }
+        }
+        levels.push_back(level);
+    }
+    return true;
+}
+
+float RasterTexture::lod(const glm::vec2 &dx, const glm::vec2 &dy) const
+{
+    // Log2 of the most texels crossed moving one pixel
+    glm::vec2 size(levels[0].width, levels[0].height);
+    float rho = std::max(glm::length(dx * size), glm::length(dy * size));
+    return rho > 1.0f ? log2f(rho) : 0.0f;
+}
+
+glm::vec3 RasterTexture::sample(const glm::vec2 &uv, const float lod) const
+{
+    if (levels.empty())
+        return glm::vec3(1.0f);
+
+    // Blend the two nearest mipmap levels
+    float level = std::min(lod, static_cast<float>(levels.size() - 1));
+    unsigned int level0 = static_cast<unsigned int>(level);
+    float t = level - level0;
+    glm::vec3 colour = bilinear(levels[level0], uv);
+    if (t > 0.0f)
+        colour = (1.0f - t) * colour + t * bilinear(levels[level0 + 1], uv);
+    return colour;
+}
+
+glm::vec3 RasterTexture::normal(const glm::vec3 &colour) const
+{
+    glm::vec3 normal = 2.0f * colour - 1.0f;
+    if (components == 2)
+        normal.z = sqrtf(std::max(1.0f - normal.x * normal.x - normal.y * normal.y, 0.0f));
+    return glm::normalize(normal);
+}
+
+glm::vec3 RasterTexture::bilinear(const Level &level, const glm::vec2 &uv) const
+{
+    // Texel co-ordinates with the texel centres on whole numbers
+    unsigned int width  = level.width;
+    unsigned int height = level.height;
+    const std::vector<glm::vec3> &texels = level.texels;
+    float x  = uv.x * width - 0.5f;
+    float y  = uv.y * height - 0.5f;
+    float fx = floorf(x);
+    float fy = floorf(y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    // Wrap the four nearest texels
+    int w  = static_cast<int>(width);
+    int h  = static_cast<int>(height);
+    int x0 = static_cast<int>(fx) % w;
+    int y0 = static_cast<int>(fy) % h;
+    x0 += x0 < 0 ? w : 0;
+    y0 += y0 < 0 ? h : 0;
+    int x1 = x0 + 1 < w ? x0 + 1 : 0;
+    int y1 = y0 + 1 < h ? y0 + 1 : 0;
+
+    const glm::vec3 *row0 = &texels[y0 * width];
+    const glm::vec3 *row1 = &texels[y1 * width];
+    return (1.0f - ty) * ((1.0f - tx) * row0[x0] + tx * row0[x1]) +
+           ty * ((1.0f - tx) * row1[x0] + tx * row1[x1]);
+}
+
+// =============================================================================
+// Lighting (a port of lightingFragmentShader.glsl; all vectors are in view
+// space so the camera is at the origin)
+
+// Calculate point light
+static glm::vec3 pointLight(const LightSource &light, const float ka, const float kd,
+                            const float ks, const float Ns, const glm::vec3 &objectColour,
+                            const glm::vec3 &normal, const glm::vec3 &fragmentPosition)
+{
+    // Ambient reflection
+    glm::vec3 ambient = ka * objectColour;
+
+    // Diffuse reflection
+    glm::vec3 lightVector = glm::normalize(light.position - fragmentPosition);
+    float cosTheta        = std::max(glm::dot(normal, lightVector), 0.0f);
+    glm::vec3 diffuse     = kd * light.colour * objectColour * cosTheta;
+
+    // Specular reflection
+    glm::vec3 reflection = -lightVector + 2.0f * glm::dot(lightVector, normal) * normal;
+    glm::vec3 camera     = glm::normalize(-fragmentPosition);
+    float cosAlpha       = std::max(glm::dot(camera, reflection), 0.0f);
+    glm::vec3 specular   = ks * light.colour * powf(cosAlpha, Ns);
+
+    // Attenuation
+    float distance    = glm::length(light.position - fragmentPosition);
+    float attenuation = 1.0f / (light.constant + light.linear * distance +
+                                light.quadratic * distance * distance);
+
+    // Fragment colour
+    return (ambient + diffuse + specular) * attenuation;
+}
+
+// Calculate spotlight
+static glm::vec3 spotLight(const LightSource &light, const float ka, const float kd,
+                           const float ks, const float Ns, const glm::vec3 &objectColour,
+                           const glm::vec3 &normal, const glm::vec3 &fragmentPosition)
+{
+    // Directional light intensity
+    glm::vec3 lightVector = glm::normalize(light.position - fragmentPosition);
+    glm::vec3 direction   = glm::normalize(light.direction);
+    float cosTheta        = glm::dot(-lightVector, direction);
+    float delta           = Maths::radians(2.0f);
+    float intensity       = glm::clamp((cosTheta - light.cosPhi) / delta, 0.0f, 1.0f);
+
+    // The rest is the same as a point light
+    return pointLight(light, ka, kd, ks, Ns, objectColour, normal, fragmentPosition) * intensity;
+}
+
+// Calculate directional light
+static glm::vec3 directionalLight(const LightSource &light, const float ka, const float kd,
+                                  const float ks, const float Ns,
+                                  const glm::vec3 &objectColour, const glm::vec3 &normal,
+                                  const glm::vec3 &fragmentPosition)
+{
+    // Ambient reflection
+    glm::vec3 ambient = ka * objectColour;
+
+    // Diffuse reflection
+    glm::vec3 lightVector = glm::normalize(-light.direction);
+    float cosTheta        = std::max(glm::dot(normal, lightVector), 0.0f);
+    glm::vec3 diffuse     = kd * light.colour * objectColour * cosTheta;
+
+    // Specular reflection
+    glm::vec3 reflection = -lightVector + 2.0f * glm::dot(lightVector, normal) * normal;
+    glm::vec3 camera     = glm::normalize(-fragmentPosition);
+    float cosAlpha       = std::max(glm::dot(camera, reflection), 0.0f);
+    glm::vec3 specular   = ks * light.colour * powf(cosAlpha, Ns);
+
+    // Fragment colour
+    return ambient + diffuse + specular;
+}
+
+// =============================================================================
+// Rasterizer
+
+Rasterizer::Rasterizer(const unsigned int width, const unsigned int height)
+{
+    resize(width, height);
+}
+
+void Rasterizer::resize(const unsigned int width, const unsigned int height)
+{
+    if (width > maxSize || height > maxSize)
+        printf("Rasterizer frames can be at most %u pixels across, not %u x %u\n",
+               maxSize, width, height);
+
+    this->width  = std::min(width, maxSize);
+    this->height = std::min(height, maxSize);
+    tilesX = (this->width + tileSize - 1) / tileSize;
+    tilesY = (this->height + tileSize - 1) / tileSize;
+
+    colour.assign(4 * this->width * this->height, 0);
+    depth.assign(tilesX * tilesY * tilePixels, 1.0f);
+    visible.assign(tilesX * tilesY * tilePixels, emptyPixel);
+    tiles.resize(tilesX * tilesY);
+    for (Chunk &chunk : chunks)
+        chunk.bins.clear();
+}
+
+void Rasterizer::begin(const glm::mat4 &view, const glm::mat4 &projection,
+                       const Light &lights)
+{
+    this->view       = view;
+    this->projection = projection;
+    draws.clear();
+
+    // Light positions and directions in view space
+    unsigned int numLights = std::min(static_cast<unsigned int>(lights.lightSources.size()),
+                                      maxShaderLights);
+    viewLights.assign(lights.lightSources.begin(), lights.lightSources.begin() + numLights);
+    for (LightSource &light : viewLights)
+    {
+        light.position  = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        light.direction = glm::vec3(view * glm::vec4(light.direction, 0.0f));
+    }
+}
+
+void Rasterizer::draw(Model &model, const Affine *modelViews, const unsigned int instances)
+{
+    if (instances == 0 || model.vertices.size() < 3)
+        return;
+
+    Draw draw;
+    draw.model = &model;
+    draw.modelViews.assign(modelViews, modelViews + instances);
+    draw.material.ka = model.ka;
+    draw.material.kd = model.kd;
+    draw.material.ks = model.ks;
+    draw.material.Ns = model.Ns;
+    draw.material.diffuseMap = findTexture(model, "diffuse");
+    draw.material.normalMap  = findTexture(model, "normal");
+    if (draw.material.normalMap != NULL)
+        model.buildStreams(1u << Model::TANGENTS);
+    draws.push_back(draw);
+}
+
+void Rasterizer::drawLights(const Light &lights, const Model &lightModel)
+{
+    if (lights.lightSources.empty() || lightModel.vertices.size() < 3)
+        return;
+
+    // Light sources are drawn as small spheres in their own colour (as
+    // Light::draw does)
+    Draw draw;
+    draw.model = &lightModel;
+    draw.material.lit = false;
+    for (const LightSource &light : lights.lightSources)
+    {
+        glm::mat4 model = Maths::translate(light.position) * Maths::scale(glm::vec3(0.1f));
+        draw.modelViews.push_back(Affine(view * model));
+        draw.colours.push_back(light.colour);
+    }
+    draws.push_back(draw);
+}
+
+void Rasterizer::end()
+{
+    PROFILE_SCOPE("Rasterizer::end");
+    stats = Stats();
+    double start = now();
+
+    // Split the draws into chunks of about the same number of triangles
+    for (const Draw &draw : draws)
+        stats.triangles += static_cast<unsigned int>(draw.modelViews.size() *
+                                                     (draw.model->vertices.size() / 3));
+    unsigned int chunkSize = std::max(minChunkSize, (stats.triangles + maxChunks - 1) / maxChunks);
+    numChunks = 0;
+    for (unsigned int d = 0; d < draws.size(); d++)
+    {
+        unsigned int count = static_cast<unsigned int>(draws[d].modelViews.size() *
+                                                       (draws[d].model->vertices.size() / 3));
+        for (unsigned int first = 0; first < count; first += chunkSize)
+        {
+            if (numChunks == chunks.size())
+                chunks.push_back(Chunk());
+            Chunk &chunk = chunks[numChunks++];
+            chunk.draw  = d;
+            chunk.first = first;
+            chunk.last  = std::min(count, first + chunkSize);
+        }
+    }
+
+    // Set up and bin the triangles of each chunk in parallel
+    Jobs::parallelFor(0, numChunks, 1, [this](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+            setupChunk(chunks[i]);
+    });
+
+    // Number the triangles of the frame
+    triangles.clear();
+    for (unsigned int i = 0; i < numChunks; i++)
+    {
+        Chunk &chunk = chunks[i];
+        chunk.base = static_cast<unsigned int>(triangles.size());
+        for (const Triangle &triangle : chunk.triangles)
+            triangles.push_back(&triangle);
+        for (const std::vector<uint32_t> &bin : chunk.bins)
+            stats.binned += static_cast<unsigned int>(bin.size());
+    }
+    stats.setup = static_cast<unsigned int>(triangles.size());
+    double setupEnd = now();
+
+    // Rasterize and shade each tile in parallel
+    Jobs::parallelFor(0, static_cast<unsigned int>(tiles.size()), 1,
+                      [this](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            rasterizeTile(i);
+            shadeTile(i);
+        }
+    });
+
+    for (const Tile &tile : tiles)
+    {
+        stats.hizCulled += tile.hizCulled;
+        stats.fragments += tile.fragments;
+    }
+    stats.setupTime  = setupEnd - start;
+    stats.rasterTime = now() - setupEnd;
+}
+
+const RasterTexture *Rasterizer::findTexture(const Model &model, const std::string &type)
+{
+    for (const Texture &texture : model.textures)
+    {
+        if (texture.type != type)
+            continue;
+
+        // Load the image the first time it is used
+        std::map<std::string, RasterTexture>::iterator it = textureCache.find(texture.path);
+        if (it == textureCache.end())
+        {
+            it = textureCache.insert(std::make_pair(texture.path, RasterTexture())).first;
+            it->second.load(texture.path.c_str());
+        }
+        return it->second.levels.empty() ? NULL : &it->second;
+    }
+    return NULL;
+}
+
+// =============================================================================
+// Set up
+
+void Rasterizer::setupChunk(Chunk &chunk)
+{
+    chunk.triangles.clear();
+    chunk.bins.resize(tiles.size());
+    for (std::vector<uint32_t> &bin : chunk.bins)
+        bin.clear();
+
+    const Draw &draw   = draws[chunk.draw];
+    const Model &model = *draw.model;
+    unsigned int numTriangles = static_cast<unsigned int>(model.vertices.size() / 3);
+    bool hasUVs      = model.uvs.size() == model.vertices.size();
+    bool hasNormals  = model.normals.size() == model.vertices.size();
+    bool hasTangents = hasNormals && model.tangents.size() == model.vertices.size();
+
+    unsigned int instance = chunk.first / numTriangles;
+    const Affine *modelView = NULL;
+    glm::mat3 normalMatrix;
+    for (unsigned int t = chunk.first; t < chunk.last; t++)
+    {
+        // Normal matrix of the instance (the columns b x c, c x a and a x b
+        // of the model view 3x3 with columns a, b and c, as the shaders use)
+        if (modelView == NULL || t / numTriangles != instance)
+        {
+            instance  = t / numTriangles;
+            modelView = &draw.modelViews[instance];
+            glm::mat3 A = glm::mat3(modelView->matrix());
+            normalMatrix = glm::mat3(glm::cross(A[1], A[2]), glm::cross(A[2], A[0]),
+                                     glm::cross(A[0], A[1]));
+        }
+
+        // Transform the positions
+        ClipVertex vertices[3];
+        unsigned int first = 3 * (t % numTriangles);
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            vertices[k].position = modelView->transformPoint(model.vertices[first + k]);
+            vertices[k].clip     = projection * glm::vec4(vertices[k].position, 1.0f);
+        }
+
+        // Skip triangles outside the frustum, and triangles in front of the
+        // camera facing away from it, before working out their other
+        // attributes
+        const glm::vec4 &c0 = vertices[0].clip, &c1 = vertices[1].clip, &c2 = vertices[2].clip;
+        if ((c0.x >  c0.w && c1.x >  c1.w && c2.x >  c2.w) ||
+            (c0.x < -c0.w && c1.x < -c1.w && c2.x < -c2.w) ||
+            (c0.y >  c0.w && c1.y >  c1.w && c2.y >  c2.w) ||
+            (c0.y < -c0.w && c1.y < -c1.w && c2.y < -c2.w) ||
+            (c0.z >  c0.w && c1.z >  c1.w && c2.z >  c2.w) ||
+            (c0.z < -c0.w && c1.z < -c1.w && c2.z < -c2.w))
+            continue;
+        if (cullBackFaces && c0.w > 0.0f && c1.w > 0.0f && c2.w > 0.0f)
+        {
+            glm::vec2 p0 = glm::vec2(c0) / c0.w, p1 = glm::vec2(c1) / c1.w, p2 = glm::vec2(c2) / c2.w;
+            if ((p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y) < 0.0f)
+                continue;
+        }
+
+        // Transform the other attributes (as tbnVertexShader.glsl does)
+        for (unsigned int k = 0; k < 3; k++)
+        {
+            ClipVertex &v = vertices[k];
+            v.uv       = hasUVs ? model.uvs[first + k] : glm::vec2(0.0f);
+            v.normal   = glm::vec3(0.0f, 0.0f, 1.0f);
+            v.tangent  = glm::vec4(1.0f, 0.0f, 0.0f, 1.0f);
+            if (hasNormals)
+                v.normal = glm::normalize(normalMatrix * model.normals[first + k]);
+            if (hasTangents)
+            {
+                const glm::vec4 &tangent = model.tangents[first + k];
+                glm::vec3 t = glm::normalize(normalMatrix * glm::vec3(tangent));
+                t = glm::normalize(t - glm::dot(t, v.normal) * v.normal);
+                v.tangent = glm::vec4(t, tangent.w);
+            }
+        }
+        clipTriangle(chunk, vertices, instance);
+    }
+}
+
+// Signed distance of a clip space position inside a clipping plane: the
+// guard band's left, right, bottom and top planes, then the near and far
+// planes
+static float planeDistance(const glm::vec4 &v, const unsigned int plane,
+                           const float gx, const float gy)
+{
+    switch (plane)
+    {
+        case 0:  return gx * v.w + v.x;
+        case 1:  return gx * v.w - v.x;
+        case 2:  return gy * v.w + v.y;
+        case 3:  return gy * v.w - v.y;
+        case 4:  return v.w + v.z;
+        default: return v.w - v.z;
+    }
+}
+
+void Rasterizer::clipTriangle(Chunk &chunk, const ClipVertex *vertices,
+                              const unsigned int instance)
+{
+    // Cull triangles outside one of the frustum planes
+    unsigned int outside = 0x3f, clip = 0;
+    float gx = guardBand / width;
+    float gy = guardBand / height;
+    for (unsigned int k = 0; k < 3; k++)
+    {
+        unsigned int vertexOutside = 0;
+        for (unsigned int p = 0; p < 6; p++)
+        {
+            if (planeDistance(vertices[k].clip, p, 1.0f, 1.0f) < 0.0f)
+                vertexOutside |= 1 << p;
+            if (planeDistance(vertices[k].clip, p, gx, gy) < 0.0f)
+                clip |= 1 << p;
+        }
+        outside &= vertexOutside;
+    }
+    if (outside != 0)
+        return;
+
+    if (clip == 0)
+    {
+        setupTriangle(chunk, vertices[0], vertices[1], vertices[2], instance);
+        return;
+    }
+
+    // Clip the triangle to the planes it crosses (Sutherland-Hodgman)
+    ClipVertex polygons[2][9];
+    unsigned int count = 3, current = 0;
+    std::copy(vertices, vertices + 3, polygons[0]);
+    for (unsigned int p = 0; p < 6 && count >= 3; p++)
+    {
+        if (!(clip & (1 << p)))
+            continue;
+
+        const ClipVertex *input = polygons[current];
+        ClipVertex *output      = polygons[1 - current];
+        unsigned int outputCount = 0;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            const ClipVertex &a = input[i];
+            const ClipVertex &b = input[(i + 1) % count];
+            float da = planeDistance(a.clip, p, gx, gy);
+            float db = planeDistance(b.clip, p, gx, gy);
+            if (da >= 0.0f)
+                output[outputCount++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                // Vertex where the edge crosses the plane
+                float t = da / (da - db);
+                ClipVertex &v = output[outputCount++];
+                v.clip      = a.clip + t * (b.clip - a.clip);
+                v.position  = a.position + t * (b.position - a.position);
+                v.normal    = a.normal + t * (b.normal - a.normal);
+                v.tangent   = a.tangent + t * (b.tangent - a.tangent);
+                v.uv        = a.uv + t * (b.uv - a.uv);
+            }
+        }
+        count   = outputCount;
+        current = 1 - current;
+    }
+
+    // Split the polygon into a fan of triangles
+    for (unsigned int i = 1; i + 1 < count; i++)
+        setupTriangle(chunk, polygons[current][0], polygons[current][i],
+                      polygons[current][i + 1], instance);
+}
+
+void Rasterizer::setupTriangle(Chunk &chunk, const ClipVertex &a, const ClipVertex &b,
+                               const ClipVertex &c, const unsigned int instance)
+{
+    // Snap the screen positions to subpixels (the first row of pixels is at
+    // the top of the screen so y points down)
+    const ClipVertex *v[3] = { &a, &b, &c };
+    int32_t X[3], Y[3];
+    float invW[3], z[3];
+    for (unsigned int k = 0; k < 3; k++)
+    {
+        invW[k] = 1.0f / v[k]->clip.w;
+        glm::vec3 ndc = glm::vec3(v[k]->clip) * invW[k];
+        X[k] = static_cast<int32_t>(floorf((0.5f + 0.5f * ndc.x) * width * subpixels + 0.5f));
+        Y[k] = static_cast<int32_t>(floorf((0.5f - 0.5f * ndc.y) * height * subpixels + 0.5f));
+        z[k] = 0.5f + 0.5f * ndc.z;
+    }
+
+    // Twice the signed area, which is negative for triangles that are
+    // anticlockwise (front facing) in OpenGL since y points down
+    int64_t area = static_cast<int64_t>(X[1] - X[0]) * (Y[2] - Y[0]) -
+                   static_cast<int64_t>(X[2] - X[0]) * (Y[1] - Y[0]);
+    if (area == 0 || (area > 0 && cullBackFaces))
+        return;
+
+    // Make the area positive by swapping two vertices
+    if (area < 0)
+    {
+        std::swap(v[1], v[2]);
+        std::swap(X[1], X[2]);
+        std::swap(Y[1], Y[2]);
+        std::swap(invW[1], invW[2]);
+        std::swap(z[1], z[2]);
+        area = -area;
+    }
+
+    // Pixels whose centres are inside the bounding box
+    int minX = std::min(X[0], std::min(X[1], X[2]));
+    int maxX = std::max(X[0], std::max(X[1], X[2]));
+    int minY = std::min(Y[0], std::min(Y[1], Y[2]));
+    int maxY = std::max(Y[0], std::max(Y[1], Y[2]));
+    Triangle triangle;
+    triangle.minX = std::max((minX - subpixels / 2 + subpixels - 1) >> subpixelBits, 0);
+    triangle.minY = std::max((minY - subpixels / 2 + subpixels - 1) >> subpixelBits, 0);
+    triangle.maxX = std::min((maxX - subpixels / 2) >> subpixelBits, static_cast<int>(width) - 1);
+    triangle.maxY = std::min((maxY - subpixels / 2) >> subpixelBits, static_cast<int>(height) - 1);
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+        return;
+
+    // Edge function k is zero on the edge opposite vertex k and area at
+    // vertex k. Pixels on an edge are only drawn if it is a top or left edge
+    // so pixels on an edge shared by two triangles are drawn once.
+    double barycentric[3][3];
+    for (unsigned int k = 0; k < 3; k++)
+    {
+        unsigned int i = (k + 1) % 3, j = (k + 2) % 3;
+        int32_t A = Y[i] - Y[j];
+        int32_t B = X[j] - X[i];
+        int64_t C = static_cast<int64_t>(Y[j] - Y[i]) * X[i] -
+                    static_cast<int64_t>(X[j] - X[i]) * Y[i];
+
+        // Edge function at the centre of pixel (x, y)
+        int64_t C0 = C + (A + B) * (subpixels / 2);
+        bool topLeft = A > 0 || (A == 0 && B > 0);
+        triangle.edgeA[k] = A * subpixels;
+        triangle.edgeB[k] = B * subpixels;
+        triangle.edgeC[k] = static_cast<int32_t>(C0 - (topLeft ? 0 : 1));
+
+        // Barycentric co-ordinate k at the centre of pixel (x, y)
+        barycentric[k][0] = static_cast<double>(A) * subpixels / area;
+        barycentric[k][1] = static_cast<double>(B) * subpixels / area;
+        barycentric[k][2] = static_cast<double>(C0) / area;
+    }
+
+    // Planes of the barycentric co-ordinates of vertices 1 and 2 and the
+    // depth (which are linear in screen space)
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        triangle.b1[i] = static_cast<float>(barycentric[1][i]);
+        triangle.b2[i] = static_cast<float>(barycentric[2][i]);
+        triangle.z[i]  = static_cast<float>((i == 2 ? z[0] : 0.0) +
+                                            (z[1] - z[0]) * barycentric[1][i] +
+                                            (z[2] - z[0]) * barycentric[2][i]);
+    }
+    triangle.zMin = std::min(z[0], std::min(z[1], z[2]));
+
+    // Attributes
+    for (unsigned int k = 0; k < 3; k++)
+    {
+        triangle.invW[k]      = invW[k];
+        triangle.position[k]  = v[k]->position;
+        triangle.normal[k]    = v[k]->normal;
+        triangle.tangent[k]   = v[k]->tangent;
+        triangle.uv[k]        = v[k]->uv;
+    }
+    triangle.draw     = chunk.draw;
+    triangle.instance = instance;
+
+    // Add the triangle to the bins of the tiles it overlaps
+    uint32_t index = static_cast<uint32_t>(chunk.triangles.size());
+    chunk.triangles.push_back(triangle);
+    for (int ty = triangle.minY / tileSize; ty <= triangle.maxY / tileSize; ty++)
+        for (int tx = triangle.minX / tileSize; tx <= triangle.maxX / tileSize; tx++)
+            chunk.bins[ty * tilesX + tx].push_back(index);
+}
+
+// =============================================================================
+// Rasterize
+
+void Rasterizer::rasterizeTile(const unsigned int index)
+{
+    Tile &tile = tiles[index];
+    int tileX = (index % tilesX) * tileSize;
+    int tileY = (index / tilesX) * tileSize;
+    float *tileDepth       = &depth[index * tilePixels];
+    uint32_t *tileVisible  = &visible[index * tilePixels];
+
+    // Clear the tile
+    std::fill(tileDepth, tileDepth + tilePixels, 1.0f);
+    std::fill(tileVisible, tileVisible + tilePixels, emptyPixel);
+    std::fill(tile.blockZMax, tile.blockZMax + blocksPerRow * blocksPerRow, 1.0f);
+    tile.zMax      = 1.0f;
+    tile.hizCulled = 0;
+
+    // Rasterize the triangles in the order they were drawn
+    for (unsigned int c = 0; c < numChunks; c++)
+    {
+        const Chunk &chunk = chunks[c];
+        for (uint32_t i : chunk.bins[index])
+        {
+            const Triangle &triangle = chunk.triangles[i];
+
+            // Skip triangles behind everything in the tile
+            if (triangle.zMin >= tile.zMax)
+            {
+                tile.hizCulled++;
+                continue;
+            }
+
+            if (rasterizeTriangle(triangle, chunk.base + i, tileX, tileY, tile,
+                                  tileDepth, tileVisible))
+            {
+                tile.zMax = *std::max_element(tile.blockZMax,
+                                              tile.blockZMax + blocksPerRow * blocksPerRow);
+            }
+        }
+    }
+}
+
+bool Rasterizer::rasterizeTriangle(const Triangle &triangle, const uint32_t id,
+                                   const int tileX, const int tileY, Tile &tile,
+                                   float *tileDepth, uint32_t *tileVisible)
+{
+    // Blocks of the tile the bounding box overlaps
+    int bx0 = (std::max(triangle.minX, tileX) - tileX) / blockSize;
+    int by0 = (std::max(triangle.minY, tileY) - tileY) / blockSize;
+    int bx1 = (std::min(triangle.maxX, tileX + tileSize - 1) - tileX) / blockSize;
+    int by1 = (std::min(triangle.maxY, tileY + tileSize - 1) - tileY) / blockSize;
+
+    bool written = false;
+    for (int by = by0; by <= by1; by++)
+    {
+        for (int bx = bx0; bx <= bx1; bx++)
+        {
+            // Skip blocks where the triangle is behind everything
+            float &blockZMax = tile.blockZMax[by * blocksPerRow + bx];
+            if (triangle.zMin >= blockZMax)
+            {
+                tile.hizCulled++;
+                continue;
+            }
+
+            // Edge functions at the top left pixel of the block, and skip
+            // blocks outside an edge (where it is negative at the corner
+            // where it is largest)
+            int x = tileX + bx * blockSize;
+            int y = tileY + by * blockSize;
+            int32_t e[3];
+            bool outside = false;
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                int64_t A = triangle.edgeA[k], B = triangle.edgeB[k];
+                int64_t corner = A * x + B * y + triangle.edgeC[k];
+                e[k] = static_cast<int32_t>(corner);
+                corner += (A > 0 ? A : 0) * (blockSize - 1) + (B > 0 ? B : 0) * (blockSize - 1);
+                outside = outside || corner < 0;
+            }
+            if (outside)
+                continue;
+
+            // Test each row of the block against the edges and depths
+            float *blockDepth      = tileDepth + (by * tileSize + bx) * blockSize;
+            uint32_t *blockVisible = tileVisible + (by * tileSize + bx) * blockSize;
+            bool blockWritten = false;
+#ifdef RASTERIZER_SSE
+            __m128i rowEdge[3], stepEdge[3];
+            for (unsigned int k = 0; k < 3; k++)
+            {
+                int32_t A = triangle.edgeA[k];
+                rowEdge[k]  = _mm_setr_epi32(e[k], e[k] + A, e[k] + 2 * A, e[k] + 3 * A);
+                stepEdge[k] = _mm_set1_epi32(4 * A);
+            }
+            __m128 zStep = _mm_setr_ps(0.0f, triangle.z[0], 2.0f * triangle.z[0],
+                                       3.0f * triangle.z[0]);
+            __m128i newId = _mm_set1_epi32(static_cast<int>(id));
+
+            for (int row = 0; row < blockSize; row++)
+            {
+                __m128i e0 = rowEdge[0], e1 = rowEdge[1], e2 = rowEdge[2];
+                float zRow = triangle.z[0] * x + triangle.z[1] * (y + row) + triangle.z[2];
+                for (int column = 0; column < blockSize; column += 4)
+                {
+                    // Inside all three edges (no sign bits set) and nearer
+                    __m128i outsideEdges = _mm_srai_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), 31);
+                    __m128 z     = _mm_add_ps(_mm_set1_ps(zRow + triangle.z[0] * column), zStep);
+                    __m128 old   = _mm_loadu_ps(blockDepth + column);
+                    __m128 write = _mm_andnot_ps(_mm_castsi128_ps(outsideEdges), _mm_cmplt_ps(z, old));
+                    if (_mm_movemask_ps(write) != 0)
+                    {
+                        __m128i writeId = _mm_castps_si128(write);
+                        __m128i oldId   = _mm_loadu_si128(reinterpret_cast<__m128i *>(blockVisible + column));
+                        _mm_storeu_ps(blockDepth + column,
+                                      _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, old)));
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(blockVisible + column),
+                                         _mm_or_si128(_mm_and_si128(writeId, newId),
+                                                      _mm_andnot_si128(writeId, oldId)));
+                        blockWritten = true;
+                    }
+                    e0 = _mm_add_epi32(e0, stepEdge[0]);
+                    e1 = _mm_add_epi32(e1, stepEdge[1]);
+                    e2 = _mm_add_epi32(e2, stepEdge[2]);
+                }
+
+                // Move down a row
+                for (unsigned int k = 0; k < 3; k++)
+                    rowEdge[k] = _mm_add_epi32(rowEdge[k], _mm_set1_epi32(triangle.edgeB[k]));
+                blockDepth   += tileSize;
+                blockVisible += tileSize;
+            }
+#else
+            for (int row = 0; row < blockSize; row++)
+            {
+                for (int column = 0; column < blockSize; column++)
+                {
+                    int32_t e0 = e[0] + column * triangle.edgeA[0];
+                    int32_t e1 = e[1] + column * triangle.edgeA[1];
+                    int32_t e2 = e[2] + column * triangle.edgeA[2];
+                    float z = triangle.z[0] * (x + column) + triangle.z[1] * (y + row) +
+                              triangle.z[2];
+                    if ((e0 | e1 | e2) >= 0 && z < blockDepth[column])
+                    {
+                        blockDepth[column]   = z;
+                        blockVisible[column] = id;
+                        blockWritten = true;
+                    }
+                }
+                for (unsigned int k = 0; k < 3; k++)
+                    e[k] += triangle.edgeB[k];
+                blockDepth   += tileSize;
+                blockVisible += tileSize;
+            }
+#endif
+
+            // Update the farthest depth in the block
+            if (blockWritten)
+            {
+                blockDepth -= blockSize * tileSize;
+                float zMax = 0.0f;
+                for (int row = 0; row < blockSize; row++)
+                    for (int column = 0; column < blockSize; column++)
+                        zMax = std::max(zMax, blockDepth[row * tileSize + column]);
+                blockZMax = zMax;
+                written = true;
+            }
+        }
+    }
+    return written;
+}
+
+// =============================================================================
+// Shade
+
+void Rasterizer::shadeTile(const unsigned int index)
+{
+    Tile &tile = tiles[index];
+    int tileX = (index % tilesX) * tileSize;
+    int tileY = (index / tilesX) * tileSize;
+    const uint32_t *tileVisible = &visible[index * tilePixels];
+
+    // Colour bytes as OpenGL writes them to an 8-bit framebuffer
+    unsigned char background[4];
+    for (unsigned int i = 0; i < 4; i++)
+        background[i] = static_cast<unsigned char>(glm::clamp(clearColour[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+
+    tile.fragments = 0;
+    int rows    = std::min(tileSize, static_cast<int>(height) - tileY);
+    int columns = std::min(tileSize, static_cast<int>(width) - tileX);
+    for (int y = 0; y < rows; y++)
+    {
+        unsigned char *output = &colour[4 * ((tileY + y) * width + tileX)];
+        for (int x = 0; x < columns; x++, output += 4)
+        {
+            uint32_t id = tileVisible[y * tileSize + x];
+            if (id == emptyPixel)
+            {
+                std::copy(background, background + 4, output);
+                continue;
+            }
+
+            glm::vec3 c = glm::clamp(shade(*triangles[id], tileX + x, tileY + y), 0.0f, 1.0f);
+            output[0] = static_cast<unsigned char>(c.r * 255.0f + 0.5f);
+            output[1] = static_cast<unsigned char>(c.g * 255.0f + 0.5f);
+            output[2] = static_cast<unsigned char>(c.b * 255.0f + 0.5f);
+            output[3] = 255;
+            tile.fragments++;
+        }
+    }
+}
+
+glm::vec3 Rasterizer::shade(const Triangle &triangle, const int x, const int y) const
+{
+    const Draw &draw = draws[triangle.draw];
+    const Material &material = draw.material;
+    if (!material.lit)
+        return draw.colours[triangle.instance];
+
+    // Interpolate the attributes
+    glm::vec3 w = weights(triangle, static_cast<float>(x), static_cast<float>(y));
+    glm::vec2 uv       = w[0] * triangle.uv[0] + w[1] * triangle.uv[1] + w[2] * triangle.uv[2];
+    glm::vec3 position = w[0] * triangle.position[0] + w[1] * triangle.position[1] +
+                         w[2] * triangle.position[2];
+    glm::vec3 normal   = w[0] * triangle.normal[0] + w[1] * triangle.normal[1] +
+                         w[2] * triangle.normal[2];
+
+    // Texture co-ordinates of the next pixels across and down, which give
+    // the mipmap level as a GPU's derivatives do
+    glm::vec3 wx = weights(triangle, x + 1.0f, static_cast<float>(y));
+    glm::vec3 wy = weights(triangle, static_cast<float>(x), y + 1.0f);
+    glm::vec2 dx = wx[0] * triangle.uv[0] + wx[1] * triangle.uv[1] + wx[2] * triangle.uv[2] - uv;
+    glm::vec2 dy = wy[0] * triangle.uv[0] + wy[1] * triangle.uv[1] + wy[2] * triangle.uv[2] - uv;
+
+    // Object colour and the view space normal vector from the normal map
+    glm::vec3 objectColour(1.0f);
+    if (material.diffuseMap)
+        objectColour = material.diffuseMap->sample(uv, material.diffuseMap->lod(dx, dy));
+    if (material.normalMap)
+    {
+        // The bitangent follows from the normal, the tangent and its handedness
+        glm::vec4 tangent   = w[0] * triangle.tangent[0] + w[1] * triangle.tangent[1] +
+                              w[2] * triangle.tangent[2];
+        glm::vec3 bitangent = (tangent.w < 0.0f ? -1.0f : 1.0f) *
+                              glm::cross(normal, glm::vec3(tangent));
+        glm::vec3 mapColour = material.normalMap->sample(uv, material.normalMap->lod(dx, dy));
+        glm::vec3 mapNormal = material.normalMap->normal(mapColour);
+        normal = glm::vec3(tangent) * mapNormal.x + bitangent * mapNormal.y +
+                 normal * mapNormal.z;
+    }
+    normal = glm::normalize(normal);
+
+    // Calculate lighting in view space
+    glm::vec3 fragmentColour(0.0f);
+    for (const LightSource &light : viewLights)
+    {
+        if (light.type == 1)
+            fragmentColour += pointLight(light, material.ka, material.kd, material.ks,
+                                         material.Ns, objectColour, normal, position);
+        else if (light.type == 2)
+            fragmentColour += spotLight(light, material.ka, material.kd, material.ks,
+                                        material.Ns, objectColour, normal, position);
+        else if (light.type == 3)
+            fragmentColour += directionalLight(light, material.ka, material.kd, material.ks,
+                                               material.Ns, objectColour, normal, position);
+    }
+    return fragmentColour;
+}
+
+// Perspective correct barycentric co-ordinates at a point in the pixel grid
+glm::vec3 Rasterizer::weights(const Triangle &triangle, const float x, const float y)
+{
+    float b1 = triangle.b1[0] * x + triangle.b1[1] * y + triangle.b1[2];
+    float b2 = triangle.b2[0] * x + triangle.b2[1] * y + triangle.b2[2];
+    glm::vec3 w((1.0f - b1 - b2) * triangle.invW[0], b1 * triangle.invW[1],
+                b2 * triangle.invW[2]);
+    return w / (w[0] + w[1] + w[2]);
+}
+
+// =============================================================================
+// Output
+
+bool Rasterizer::writePNG(const char *path) const
+{
+    if (colour.empty())
+        return false;
+    return ::writePNG(path, &colour[0], width, height, 4);
+}
+
+void Rasterizer::present()
+{
+    if (colour.empty())
+        return;
+
+    // Remember the bound framebuffers
+    int drawFramebuffer, readFramebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+
+    // Texture holding the frame, attached to a framebuffer to copy from
+    if (framebuffer == 0)
+    {
+        glGenTextures(1, &texture);
+        glGenFramebuffers(1, &framebuffer);
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    if (textureWidth != width || textureHeight != height)
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, &colour[0]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               texture, 0);
+        textureWidth  = width;
+        textureHeight = height;
+    }
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                        &colour[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Copy the frame upside down (OpenGL's first row is the bottom of the
+    // image) and bind the framebuffers again
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBlitFramebuffer(0, 0, width, height, 0, height, width, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+}
+
+void Rasterizer::deleteBuffers()
+{
+    if (framebuffer != 0)
+    {
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &texture);
+    }
+    framebuffer   = 0;
+    texture       = 0;
+    textureWidth  = 0;
+    textureHeight = 0;
+}
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <stdint.h>
+
+#include <common/maths.hpp>
+#include <common/model.hpp>
+#include <common/light.hpp>
+
+// Texture image kept in memory for the CPU rasterizer, with mipmaps made
+// the way glGenerateMipmap makes them
+struct RasterTexture
+{
+    // Mipmap level (each level is half the size of the one before)
+    struct Level
+    {
+        unsigned int width  = 0;
+        unsigned int height = 0;
+        std::vector<glm::vec3> texels;  // colours from 0 to 1
+    };
+    std::vector<Level> levels;
+    unsigned int components = 0;        // in the image file
+
+    bool load(const char *path);
+
+    // Mipmap level for the change in texture co-ordinates between a pixel
+    // and the next pixels across and down
+    float lod(const glm::vec2 &dx, const glm::vec2 &dy) const;
+
+    // Trilinear filtered colour with repeat wrapping
+    glm::vec3 sample(const glm::vec2 &uv, const float lod = 0.0f) const;
+
+    // Normal vector from a normal map's colour (two channel maps only hold
+    // x and y, so z is calculated from them)
+    glm::vec3 normal(const glm::vec3 &colour) const;
+
+private:
+    glm::vec3 bilinear(const Level &level, const glm::vec2 &uv) const;
+};
+
+// Rasterizer class. Renders Models lit by a Light on the CPU, for machines
+// without a GPU where OpenGL falls back to a generic software renderer such
+// as llvmpipe. A frame is drawn in three steps:
+//
+// 1. Set up: the triangles are transformed, culled, clipped (to the near and
+//    far planes and a guard band around the screen) and snapped to 1/16 of
+//    a pixel in chunks on the job system's threads. Each chunk bins its
+//    triangles into lists for the 64x64 pixel tiles they overlap.
+// 2. Rasterize: each tile is rasterized by one thread, which goes through
+//    the bins of every chunk in the order the triangles were drawn. The edge
+//    functions and depths of 4 pixels are tested at once with SSE2. The
+//    farthest depth in the tile and in each 8x8 block of it is kept, so
+//    triangles behind everything already drawn there are skipped without
+//    testing their pixels. Only the depth and the triangle covering each
+//    pixel are written.
+// 3. Shade: each covered pixel is shaded once with a C++ port of the Phong
+//    model in lightingFragmentShader.glsl and the per-fragment TBN normal
+//    mapping in tbnFragmentShader.glsl.
+//
+//     rasterizer.begin(camera.view, camera.projection, lightSources);
+//     rasterizer.draw(teapot, &modelViews[0], modelViews.size());
+//     rasterizer.drawLights(lightSources, sphere);
+//     rasterizer.end();
+//     rasterizer.present();               // copy into the OpenGL framebuffer
+//
+// Frames can be at most 1920 pixels wide and high (the guard band keeps the
+// fixed point edge functions within 32 bits).
+class Rasterizer
+{
+public:
+    // Statistics of the last frame
+    struct Stats
+    {
+        unsigned int triangles = 0;     // triangles drawn
+        unsigned int setup     = 0;     // triangles left after culling and clipping
+        unsigned int binned    = 0;     // triangle and tile pairs
+        unsigned int hizCulled = 0;     // tiles and blocks skipped by the depth test
+        unsigned int fragments = 0;     // pixels shaded
+        double setupTime  = 0.0;        // milliseconds
+        double rasterTime = 0.0;        // rasterizing and shading the tiles
+    };
+    Stats stats;
+
+    glm::vec4 clearColour = glm::vec4(0.0f);
+    bool cullBackFaces = true;
+
+    // Constructor
+    Rasterizer(const unsigned int width = 0, const unsigned int height = 0);
+
+    void resize(const unsigned int width, const unsigned int height);
+    unsigned int getWidth() const  { return width; }
+    unsigned int getHeight() const { return height; }
+
+    // Draw a frame. The lights are used as Light::toShader sends them (the
+    // first 10); draw and drawLights keep pointers to the models until end.
+    void begin(const glm::mat4 &view, const glm::mat4 &projection, const Light &lights);
+    void draw(Model &model, const Affine *modelViews, const unsigned int instances);
+    void drawLights(const Light &lights, const Model &lightModel);
+    void end();
+
+    // Rendered frame as RGBA rows starting with the top of the image
+    const unsigned char *pixels() const { return colour.empty() ? NULL : &colour[0]; }
+    bool writePNG(const char *path) const;
+
+    // Copy the frame into the bound OpenGL framebuffer
+    void present();
+    void deleteBuffers();
+
+private:
+    // Surface properties of a draw
+    struct Material
+    {
+        float ka = 0.0f, kd = 0.0f, ks = 0.0f, Ns = 1.0f;
+        const RasterTexture *diffuseMap = NULL;
+        const RasterTexture *normalMap  = NULL;
+        bool lit = true;                // unlit draws use one colour per instance
+    };
+
+    struct Draw
+    {
+        const Model *model;
+        std::vector<Affine> modelViews;
+        std::vector<glm::vec3> colours;
+        Material material;
+    };
+
+    // Vertex in clip space with its view space attributes
+    struct ClipVertex
+    {
+        glm::vec4 clip;
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec4 tangent;      // handedness in w
+        glm::vec2 uv;
+    };
+
+    // Triangle ready to rasterize
+    struct Triangle
+    {
+        int32_t edgeA[3], edgeB[3], edgeC[3];   // edge functions at pixel centres
+        float b1[3], b2[3];                     // barycentric planes of vertices 1 and 2
+        float z[3];                             // depth plane
+        float zMin;
+        int minX, minY, maxX, maxY;             // pixel bounding box
+        float invW[3];
+        glm::vec3 position[3];
+        glm::vec3 normal[3];
+        glm::vec4 tangent[3];
+        glm::vec2 uv[3];
+        unsigned int draw;
+        unsigned int instance;
+    };
+
+    // Triangles [first, last) of a draw's instances (numbered instance by
+    // instance), set up and binned by one job
+    struct Chunk
+    {
+        unsigned int draw, first, last;
+        unsigned int base;                      // index of the first triangle in the frame
+        std::vector<Triangle> triangles;
+        std::vector<std::vector<uint32_t> > bins;
+    };
+
+    // Farthest depth in a tile and each of its blocks
+    struct Tile
+    {
+        float zMax;
+        float blockZMax[64];
+        unsigned int hizCulled;
+        unsigned int fragments;
+    };
+
+    unsigned int width  = 0;
+    unsigned int height = 0;
+    unsigned int tilesX = 0;
+    unsigned int tilesY = 0;
+
+    // Frame buffers (depth and visible triangles are stored tile by tile)
+    std::vector<unsigned char> colour;
+    std::vector<float> depth;
+    std::vector<uint32_t> visible;
+    std::vector<Tile> tiles;
+
+    // Current frame
+    glm::mat4 view;
+    glm::mat4 projection;
+    std::vector<LightSource> viewLights;
+    std::vector<Draw> draws;
+    std::vector<Chunk> chunks;
+    unsigned int numChunks = 0;
+    std::vector<const Triangle *> triangles;
+
+    // Images of the models' textures
+    std::map<std::string, RasterTexture> textureCache;
+
+    // OpenGL texture and framebuffer used by present
+    unsigned int texture = 0;
+    unsigned int framebuffer = 0;
+    unsigned int textureWidth = 0;
+    unsigned int textureHeight = 0;
+
+    const RasterTexture *findTexture(const Model &model, const std::string &type);
+    void setupChunk(Chunk &chunk);
+    void clipTriangle(Chunk &chunk, const ClipVertex *vertices, const unsigned int instance);
+    void setupTriangle(Chunk &chunk, const ClipVertex &a, const ClipVertex &b,
+                       const ClipVertex &c, const unsigned int instance);
+    void rasterizeTile(const unsigned int index);
+    bool rasterizeTriangle(const Triangle &triangle, const uint32_t id, const int tileX,
+                           const int tileY, Tile &tile, float *tileDepth,
+                           uint32_t *tileVisible);
+    void shadeTile(const unsigned int index);
+    glm::vec3 shade(const Triangle &triangle, const int x, const int y) const;
+    static glm::vec3 weights(const Triangle &triangle, const float x, const float y);
+};
@@ -0,0 +1,188 @@
+#include <common/rayquery.hpp>
+#include <common/jobs.hpp>
+
+unsigned int RayQuery::addMesh(const glm::vec3 *positions, const unsigned int numTriangles)
+{
+    meshes.push_back(Mesh());
+    Mesh &mesh = meshes.back();
+    mesh.bvh.build(positions, numTriangles);
+
+    // Face normals
+    mesh.normals.resize(numTriangles);
+    for (unsigned int i = 0; i < numTriangles; i++)
+    {
+        glm::vec3 normal = glm::cross(positions[3 * i + 1] - positions[3 * i],
+                                      positions[3 * i + 2] - positions[3 * i]);
+        float length = glm::length(normal);
+        mesh.normals[i] = length > 0.0f ? normal / length : glm::vec3(0.0f);
+    }
+    return static_cast<unsigned int>(meshes.size() - 1);
+}
+
+unsigned int RayQuery::addMesh(const Model &model)
+{
+    std::map<const Model *, unsigned int>::iterator it = modelMeshes.find(&model);
+    if (it != modelMeshes.end())
+        return it->second;
+
+    unsigned int numTriangles = static_cast<unsigned int>(model.vertices.size() / 3);
+    unsigned int mesh = addMesh(numTriangles > 0 ? &model.vertices[0] : NULL, numTriangles);
+    modelMeshes[&model] = mesh;
+    return mesh;
+}
+
+unsigned int RayQuery::addInstance(const unsigned int mesh, const glm::mat4 &model)
+{
+    instances.push_back(Instance());
+    instances.back().mesh = mesh;
+    setInstance(static_cast<unsigned int>(instances.size() - 1), model);
+    return static_cast<unsigned int>(instances.size() - 1);
+}
+
+void RayQuery::setInstance(const unsigned int instance, const glm::mat4 &model)
+{
+    Instance &i    = instances[instance];
+    i.toWorld      = Affine(model);
+    i.toObject     = i.toWorld.inverse();
+    i.normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+}
+
+void RayQuery::build()
+{
+    // World space box of each instance from the corners of its mesh's box
+    std::vector<glm::vec3> boxMin(instances.size()), boxMax(instances.size());
+    for (unsigned int i = 0; i < instances.size(); i++)
+    {
+        const Instance &instance = instances[i];
+        const BVH &bvh = meshes[instance.mesh].bvh;
+        glm::vec3 min = bvh.boundsMin(), max = bvh.boundsMax();
+        boxMin[i] = glm::vec3(1.0e30f);
+        boxMax[i] = glm::vec3(-1.0e30f);
+        for (unsigned int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 point(corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y,
+                            corner & 4 ? max.z : min.z);
+            point     = instance.toWorld.transformPoint(point);
+            boxMin[i] = glm::min(boxMin[i], point);
+            boxMax[i] = glm::max(boxMax[i], point);
+        }
+    }
+
+    if (instances.empty())
+        topLevel.clear();
+    else
+        topLevel.buildBoxes(&boxMin[0], &boxMax[0], static_cast<unsigned int>(instances.size()));
+}
+
+void RayQuery::clear()
+{
+    meshes.clear();
+    instances.clear();
+    modelMeshes.clear();
+    topLevel.clear();
+}
+
+unsigned int RayQuery::numTriangles() const
+{
+    unsigned int count = 0;
+    for (const Instance &instance : instances)
+        count += meshes[instance.mesh].bvh.numTriangles;
+    return count;
+}
+
+Ray RayQuery::objectRay(const Instance &instance, const Ray &ray, const float tMax) const
+{
+    Ray objectRay;
+    objectRay.origin    = instance.toObject.transformPoint(ray.origin);
+    objectRay.direction = instance.toObject.transformVector(ray.direction);
+    objectRay.tMin      = ray.tMin;
+    objectRay.tMax      = tMax;
+    return objectRay;
+}
+
+// =============================================================================
+// Queries
+
+bool RayQuery::intersect(const Ray &ray, Hit &hit) const
+{
+    bool found = false;
+    topLevel.traverse(ray, [&](uint32_t i, float &tMax)
+    {
+        // Closest hit in the instance's mesh nearer than any found so far
+        const Instance &instance = instances[i];
+        RayHit meshHit;
+        if (meshes[instance.mesh].bvh.intersect(objectRay(instance, ray, tMax), meshHit))
+        {
+            tMax         = meshHit.t;
+            hit.t        = meshHit.t;
+            hit.u        = meshHit.u;
+            hit.v        = meshHit.v;
+            hit.instance = i;
+            hit.triangle = meshHit.triangle;
+            found        = true;
+        }
+        return false;
+    });
+
+    if (found)
+    {
+        const Instance &instance = instances[hit.instance];
+        glm::vec3 normal = meshes[instance.mesh].normals[hit.triangle];
+        hit.position = ray.origin + hit.t * ray.direction;
+        hit.normal   = glm::normalize(instance.normalMatrix * normal);
+    }
+    return found;
+}
+
+bool RayQuery::occluded(const Ray &ray) const
+{
+    bool found = false;
+    topLevel.traverse(ray, [&](uint32_t i, float &tMax)
+    {
+        const Instance &instance = instances[i];
+        found = meshes[instance.mesh].bvh.occluded(objectRay(instance, ray, tMax));
+        return found;
+    });
+    return found;
+}
+
+void RayQuery::intersect(const Ray *rays, Hit *hits, const unsigned int count) const
+{
+    Jobs::parallelFor(0, count, 64, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            hits[i] = Hit();
+            intersect(rays[i], hits[i]);
+        }
+    });
+}
+
+void RayQuery::occluded(const Ray *rays, unsigned char *results, const unsigned int count) const
+{
+    Jobs::parallelFor(0, count, 64, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+            results[i] = occluded(rays[i]) ? 1 : 0;
+    });
+}
+
+Ray RayQuery::cursorRay(const double x, const double y, const unsigned int width,
+                        const unsigned int height, const glm::mat4 &view,
+                        const glm::mat4 &projection)
+{
+    // Points on the near and far planes under the pixel
+    glm::mat4 inverseViewProjection = Maths::inverse(projection * view);
+    float ndcX = 2.0f * static_cast<float>(x) / width - 1.0f;
+    float ndcY = 1.0f - 2.0f * static_cast<float>(y) / height;
+    glm::vec4 near = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 far  = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    glm::vec3 nearPoint = glm::vec3(near) / near.w;
+    glm::vec3 farPoint  = glm::vec3(far) / far.w;
+
+    Ray ray;
+    ray.origin    = nearPoint;
+    ray.direction = glm::normalize(farPoint - nearPoint);
+    ray.tMax      = glm::length(farPoint - nearPoint);
+    return ray;
+}
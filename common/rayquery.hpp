@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+#include <common/maths.hpp>
+#include <common/model.hpp>
+#include <common/bvh.hpp>
+
+// RayQuery class. Answers ray queries against the instances of a scene on
+// the CPU, e.g. to pick the object under the mouse or to test for
+// collisions. Each mesh has its own BVH of triangles in object space, built
+// once however many instances of it there are, and a second BVH over the
+// world space bounding boxes of the instances sits on top of them. A ray
+// walks down the top level, is moved into the object space of each
+// instance it reaches and walks down that instance's mesh:
+//
+//     RayQuery query;
+//     unsigned int mesh = query.addMesh(teapot);
+//     for (unsigned int i = 0; i < scene.instances.size(); i++)
+//         query.addInstance(mesh, scene.modelMatrix(i));
+//     query.build();
+//
+//     Ray ray = RayQuery::cursorRay(xpos, ypos, width, height, camera.view,
+//                                   camera.projection);
+//     RayQuery::Hit hit;
+//     if (query.intersect(ray, hit))
+//         ...                             // hit.instance, hit.t, hit.position
+//
+// Moving instances with setInstance only needs build to be called again,
+// which rebuilds the top level but not the meshes.
+class RayQuery
+{
+public:
+    // Closest intersection of a ray with the instances
+    struct Hit
+    {
+        float t = 1.0e30f;                  // distance in units of the ray's direction
+        float u = 0.0f, v = 0.0f;           // barycentric co-ordinates of vertices 1 and 2
+        unsigned int instance = 0xffffffff;
+        uint32_t triangle = 0xffffffff;     // index of the triangle in its mesh
+        glm::vec3 position;                 // world space
+        glm::vec3 normal;                   // world space face normal
+    };
+
+    // Add a mesh of triangles (3 vertices each) and return its index. A
+    // model's mesh is only added once however often it is passed in.
+    unsigned int addMesh(const glm::vec3 *positions, const unsigned int numTriangles);
+    unsigned int addMesh(const Model &model);
+
+    // Add an instance of a mesh and return its index, or move one
+    unsigned int addInstance(const unsigned int mesh, const glm::mat4 &model);
+    void setInstance(const unsigned int instance, const glm::mat4 &model);
+
+    // Build the top level over the instances (after adding or moving any)
+    void build();
+    void clear();
+
+    // Closest hit along a ray (true if there is one)
+    bool intersect(const Ray &ray, Hit &hit) const;
+
+    // Whether anything is hit along a ray (stops at the first hit found)
+    bool occluded(const Ray &ray) const;
+
+    // Batches of rays shared between the threads of the job system
+    void intersect(const Ray *rays, Hit *hits, const unsigned int count) const;
+    void occluded(const Ray *rays, unsigned char *results, const unsigned int count) const;
+
+    // Ray from the camera through a point of the window in pixels from the
+    // top left corner, e.g. the cursor position
+    static Ray cursorRay(const double x, const double y, const unsigned int width,
+                         const unsigned int height, const glm::mat4 &view,
+                         const glm::mat4 &projection);
+
+    unsigned int numMeshes() const    { return static_cast<unsigned int>(meshes.size()); }
+    unsigned int numInstances() const { return static_cast<unsigned int>(instances.size()); }
+    unsigned int numTriangles() const;  // of every instance
+    const BVH &getTopLevel() const    { return topLevel; }
+
+private:
+    // Triangles of a mesh in object space and their normals
+    struct Mesh
+    {
+        BVH bvh;
+        std::vector<glm::vec3> normals;
+    };
+
+    // Instance of a mesh with its transforms to and from object space
+    struct Instance
+    {
+        unsigned int mesh;
+        Affine toWorld;
+        Affine toObject;
+        glm::mat3 normalMatrix;
+    };
+
+    std::vector<Mesh> meshes;
+    std::vector<Instance> instances;
+    std::map<const Model *, unsigned int> modelMeshes;
+    BVH topLevel;
+
+    // Ray in the object space of an instance (the direction isn't
+    // normalised, so distances along it are the same as in world space)
+    Ray objectRay(const Instance &instance, const Ray &ray, const float tMax) const;
+};
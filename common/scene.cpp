@@ -0,0 +1,167 @@
+#include <algorithm>
+
+#include <common/scene.hpp>
+
+static const float pi = 3.14159265358979f;
+
+// PCG32 constants
+static const uint64_t multiplier = 6364136223846793005ULL;
+static const uint64_t increment  = 1442695040888963407ULL;
+
+Scene::Scene(const uint32_t seed)
+{
+    state = 0;
+    random();
+    state += seed;
+    random();
+}
+
+uint32_t Scene::random()
+{
+    uint64_t old = state;
+    state = old * multiplier + increment;
+    uint32_t xorShifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+    uint32_t rotation   = static_cast<uint32_t>(old >> 59);
+    return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+}
+
+float Scene::uniform(const float min, const float max)
+{
+    // 24 random bits give every float in [0, 1) the same chance
+    float t = (random() >> 8) * (1.0f / 16777216.0f);
+    return min + t * (max - min);
+}
+
+float Scene::normal()
+{
+    // Box-Muller transform
+    float u1 = 1.0f - uniform(0.0f, 1.0f);
+    float u2 = uniform(0.0f, 1.0f);
+    return std::sqrt(-2.0f * std::log(u1)) * std::cos(2.0f * pi * u2);
+}
+
+glm::vec3 Scene::randomDirection()
+{
+    // Uniformly distributed point on the unit sphere
+    float z   = uniform(-1.0f, 1.0f);
+    float phi = uniform(0.0f, 2.0f * pi);
+    float r   = std::sqrt(1.0f - z * z);
+    return glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+void Scene::addInstance(const glm::vec3 position, const glm::vec3 axis,
+                        const float angle, const float scale,
+                        const unsigned int model)
+{
+    Instance instance;
+    instance.position = position;
+    instance.axis     = axis;
+    instance.angle    = angle;
+    instance.scale    = scale;
+    instance.model    = model;
+    instances.push_back(instance);
+
+    radius = std::max(radius, glm::length(position) + scale);
+}
+
+void Scene::addInstances(const unsigned int count, const Layout layout,
+                         const unsigned int numModels, const float spacing)
+{
+    // Use a cube whose size keeps the same number of instances per unit
+    // volume however many there are
+    unsigned int side = static_cast<unsigned int>(std::ceil(std::cbrt(float(count))));
+    float halfWidth   = 0.5f * spacing * side;
+
+    // Cluster centres and spread for the clustered layout
+    std::vector<glm::vec3> centres;
+    float spread = 0.0f;
+    if (layout == Clustered)
+    {
+        unsigned int numClusters = std::max(1u, static_cast<unsigned int>(std::sqrt(float(count)) + 0.5f));
+        for (unsigned int i = 0; i < numClusters; i++)
+            centres.push_back(glm::vec3(uniform(-halfWidth, halfWidth),
+                                        uniform(-halfWidth, halfWidth),
+                                        uniform(-halfWidth, halfWidth)));
+        spread = 0.5f * spacing * std::cbrt(float(count) / numClusters);
+    }
+
+    instances.reserve(instances.size() + count);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        glm::vec3 position;
+        if (layout == Grid)
+        {
+            glm::vec3 cell(i % side, (i / side) % side, i / (side * side));
+            position = spacing * (cell - 0.5f * float(side - 1));
+        }
+        else if (layout == Random)
+        {
+            position = glm::vec3(uniform(-halfWidth, halfWidth),
+                                 uniform(-halfWidth, halfWidth),
+                                 uniform(-halfWidth, halfWidth));
+        }
+        else
+        {
+            glm::vec3 offset(normal(), normal(), normal());
+            position = centres[i % centres.size()] + spread * offset;
+        }
+
+        glm::vec3 axis = randomDirection();
+        float angle    = uniform(0.0f, 2.0f * pi);
+        float scale    = uniform(0.5f, 1.0f);
+        addInstance(position, axis, angle, scale, random() % std::max(numModels, 1u));
+    }
+}
+
+void Scene::addLights(Light &lights, const unsigned int count)
+{
+    float halfWidth = std::max(radius, 5.0f);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        glm::vec3 position(uniform(-halfWidth, halfWidth),
+                           uniform(-halfWidth, halfWidth),
+                           uniform(-halfWidth, halfWidth));
+        glm::vec3 colour(uniform(0.5f, 1.0f), uniform(0.5f, 1.0f),
+                         uniform(0.5f, 1.0f));
+
+        // 60% point lights, 30% spotlights and 10% directional lights
+        unsigned int type = i % 10;
+        if (type < 6)
+        {
+            lights.addPointLight(position, colour, 1.0f, 0.1f, 0.02f);
+        }
+        else if (type < 9)
+        {
+            glm::vec3 direction(uniform(-0.5f, 0.5f), -1.0f, uniform(-0.5f, 0.5f));
+            float cosPhi = std::cos(Maths::radians(uniform(20.0f, 45.0f)));
+            lights.addSpotLight(position, glm::normalize(direction), colour,
+                                1.0f, 0.1f, 0.02f, cosPhi);
+        }
+        else
+        {
+            glm::vec3 direction = randomDirection();
+            direction.y = -std::abs(direction.y);
+            lights.addDirectionalLight(direction, 0.3f * colour);
+        }
+    }
+}
+
+glm::mat4 Scene::modelMatrix(const unsigned int i) const
+{
+    const Instance &instance = instances[i];
+    glm::mat4 translate = Maths::translate(instance.position);
+    glm::mat4 scale     = Maths::scale(glm::vec3(instance.scale));
+    glm::mat4 rotate    = Maths::rotate(instance.angle, instance.axis);
+    return translate * rotate * scale;
+}
+
+Scene::Layout Scene::layoutFromName(const std::string &name)
+{
+    if (name == "random")
+        return Random;
+
+    if (name == "clustered")
+        return Clustered;
+
+    return Grid;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include <common/maths.hpp>
+#include <common/light.hpp>
+
+// Scene class. Generates scenes of any size for scaling benchmarks. Object
+// instances are placed on a grid, at random or in clusters, and lights of
+// mixed types are scattered through the scene. Generation only uses the
+// scene's own random number generator so the same seed always gives the
+// same scene on every machine.
+//
+// Lab options:
+//     --instances N   number of object instances
+//     --layout NAME   grid, random or clustered (default grid)
+//     --lights M      number of light sources
+//     --seed S        random number seed (default 1)
+class Scene
+{
+public:
+    enum Layout { Grid, Random, Clustered };
+
+    // Object instance
+    struct Instance
+    {
+        glm::vec3 position;
+        glm::vec3 axis;             // rotation axis
+        float angle;                // rotation angle in radians
+        float scale;
+        unsigned int model;         // index of the model to draw
+    };
+
+    std::vector<Instance> instances;
+    float radius = 0.0f;            // radius of a sphere at the origin
+                                    // containing all instances
+
+    // Constructor
+    Scene(const uint32_t seed = 1);
+
+    // Add instances of numModels different models
+    void addInstance(const glm::vec3 position, const glm::vec3 axis,
+                     const float angle, const float scale,
+                     const unsigned int model = 0);
+    void addInstances(const unsigned int count, const Layout layout,
+                      const unsigned int numModels = 1,
+                      const float spacing = 3.0f);
+
+    // Add point, spot and directional lights
+    void addLights(Light &lights, const unsigned int count);
+
+    // Model matrix of an instance
+    glm::mat4 modelMatrix(const unsigned int i) const;
+
+    // Layout from its name (grid, random or clustered)
+    static Layout layoutFromName(const std::string &name);
+
+private:
+    uint64_t state;
+
+    // Random numbers (PCG32)
+    uint32_t random();
+    float uniform(const float min, const float max);
+    float normal();
+    glm::vec3 randomDirection();
+};
@@ -1,104 +1,260 @@
 #include <stdio.h>
 #include <string>
 #include <vector>
-#include <iostream>
+#include <map>
 #include <fstream>
-#include <algorithm>
 #include <sstream>
-using namespace std;
-
-#include <stdlib.h>
-#include <string.h>
 
 #include <GL/glew.h>
 
-#include "shader.hpp"
-
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
-
-    // Create the shaders
-    GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-    GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Read the Vertex Shader code from the file
-    std::string VertexShaderCode;
-    std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-    if(VertexShaderStream.is_open()){
-        std::stringstream sstr;
-        sstr << VertexShaderStream.rdbuf();
-        VertexShaderCode = sstr.str();
-        VertexShaderStream.close();
-    }else{
-        printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-        getchar();
-        return 0;
+#include <common/shader.hpp>
+
+// Compiled shader objects indexed by shader type and preprocessed source
+static std::map<std::string, unsigned int> shaderCache;
+
+// Remove "." and "dir/.." components so the same file is always referred to
+// by the same path
+static std::string normalisePath(const std::string &path)
+{
+    std::vector<std::string> parts;
+    std::stringstream stream(path);
+    std::string part;
+    while (std::getline(stream, part, '/'))
+    {
+        if (part.empty() || part == ".")
+            continue;
+        if (part == ".." && !parts.empty() && parts.back() != "..")
+            parts.pop_back();
+        else
+            parts.push_back(part);
+    }
+
+    std::string normalised = (!path.empty() && path[0] == '/') ? "/" : "";
+    for (unsigned int i = 0; i < parts.size(); i++)
+        normalised += (i > 0 ? "/" : "") + parts[i];
+
+    return normalised;
+}
+
+// Append a file to the source, recursively expanding #include directives
+static bool expandFile(const std::string &path, std::string &source,
+                       std::vector<std::string> &files)
+{
+    std::ifstream stream(path.c_str(), std::ios::in);
+    if (!stream.is_open())
+    {
+        printf("Impossible to open %s. Are you in the right directory?\n",
+               path.c_str());
+        return false;
+    }
+
+    // The source number used in #line directives is the index of the file
+    unsigned int sourceNumber = static_cast<unsigned int>(files.size());
+    files.push_back(path);
+
+    // Included files are found relative to the directory of this file
+    std::string directory;
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos)
+        directory = path.substr(0, slash + 1);
+
+    std::string line;
+    unsigned int lineNumber = 0;
+    while (std::getline(stream, line))
+    {
+        lineNumber++;
+        size_t start = line.find_first_not_of(" \t");
+        std::string directive = start == std::string::npos ? "" : line.substr(start);
+
+        // Only the first file may declare the GLSL version
+        if (directive.compare(0, 8, "#version") == 0)
+        {
+            if (sourceNumber == 0)
+                source += line + "\n#line " + std::to_string(lineNumber + 1) + " 0\n";
+            else
+                source += "\n";
+            continue;
+        }
+
+        if (directive.compare(0, 8, "#include") != 0)
+        {
+            source += line + "\n";
+            continue;
+        }
+
+        // Get the name of the included file
+        size_t open  = directive.find('"');
+        size_t close = directive.find('"', open + 1);
+        if (open == std::string::npos || close == std::string::npos)
+        {
+            printf("%s:%u: malformed #include\n", path.c_str(), lineNumber);
+            return false;
+        }
+        std::string include = normalisePath(directory + directive.substr(open + 1, close - open - 1));
+
+        // Each file is only included once
+        bool included = false;
+        for (unsigned int i = 0; i < files.size(); i++)
+            if (files[i] == include)
+                included = true;
+
+        if (included)
+        {
+            source += "\n";
+            continue;
+        }
+
+        source += "#line 1 " + std::to_string(files.size()) + "\n";
+        if (!expandFile(include, source, files))
+            return false;
+        source += "#line " + std::to_string(lineNumber + 1) + " " +
+                  std::to_string(sourceNumber) + "\n";
     }
 
-    // Read the Fragment Shader code from the file
-    std::string FragmentShaderCode;
-    std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-    if(FragmentShaderStream.is_open()){
-        std::stringstream sstr;
-        sstr << FragmentShaderStream.rdbuf();
-        FragmentShaderCode = sstr.str();
-        FragmentShaderStream.close();
+    return true;
+}
+
+bool PreprocessShader(const char *path, std::string &source,
+                      std::vector<std::string> &files)
+{
+    source.clear();
+    files.clear();
+    return expandFile(normalisePath(path), source, files);
+}
+
+// Replace the source numbers at the start of compiler messages with the names
+// of the files. This handles the "0:12(3)", "0(12)" and "ERROR: 0:12" formats.
+static std::string mapShaderLog(const std::string &log,
+                                const std::vector<std::string> &files)
+{
+    std::stringstream stream(log);
+    std::string line, mapped;
+    while (std::getline(stream, line))
+    {
+        size_t start = 0;
+        if (line.compare(0, 7, "ERROR: ") == 0)
+            start = 7;
+        else if (line.compare(0, 9, "WARNING: ") == 0)
+            start = 9;
+
+        size_t end = line.find_first_not_of("0123456789", start);
+        if (end != std::string::npos && end > start &&
+            (line[end] == ':' || line[end] == '('))
+        {
+            unsigned int number = std::stoi(line.substr(start, end - start));
+            if (number < files.size())
+                line = line.substr(0, start) + files[number] + line.substr(end);
+        }
+        mapped += line + "\n";
     }
 
+    return mapped;
+}
+
+unsigned int CompileShader(const char *path, GLenum type)
+{
+    // Read the shader code and expand includes
+    std::string ShaderCode;
+    std::vector<std::string> files;
+    if (!PreprocessShader(path, ShaderCode, files))
+        return 0;
+
+    // Return the cached shader object if this code has already been compiled
+    std::string key = std::to_string(type) + ":" + ShaderCode;
+    std::map<std::string, unsigned int>::iterator cached = shaderCache.find(key);
+    if (cached != shaderCache.end())
+        return cached->second;
+
+    // Compile shader
+    printf("Compiling shader : %s\n", path);
+    unsigned int ShaderID = glCreateShader(type);
+    char const * SourcePointer = ShaderCode.c_str();
+    glShaderSource(ShaderID, 1, &SourcePointer, NULL);
+    glCompileShader(ShaderID);
+
+    // Check shader
     GLint Result = GL_FALSE;
     int InfoLogLength;
+    glGetShaderiv(ShaderID, GL_COMPILE_STATUS, &Result);
+    glGetShaderiv(ShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+    if ( InfoLogLength > 0 )
+    {
+        std::vector<char> ShaderErrorMessage(InfoLogLength+1);
+        glGetShaderInfoLog(ShaderID, InfoLogLength, NULL,
+                           &ShaderErrorMessage[0]);
+        printf("%s\n", mapShaderLog(&ShaderErrorMessage[0], files).c_str());
+    }
 
-    // Compile Vertex Shader
-    printf("Compiling shader : %s\n", vertex_file_path);
-    char const * VertexSourcePointer = VertexShaderCode.c_str();
-    glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-    glCompileShader(VertexShaderID);
-
-    // Check Vertex Shader
-    glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if ( InfoLogLength > 0 ){
-        std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-        glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-        printf("%s\n", &VertexShaderErrorMessage[0]);
+    // Don't keep a shader that failed to compile
+    if (Result == GL_FALSE)
+    {
+        glDeleteShader(ShaderID);
+        return 0;
     }
 
-    // Compile Fragment Shader
-    printf("Compiling shader : %s\n", fragment_file_path);
-    char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-    glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-    glCompileShader(FragmentShaderID);
-
-    // Check Fragment Shader
-    glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-    glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if ( InfoLogLength > 0 ){
-        std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-        glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-        printf("%s\n", &FragmentShaderErrorMessage[0]);
+    shaderCache[key] = ShaderID;
+    return ShaderID;
+}
+
+unsigned int LoadShaders(const char *vertex_file_path,
+                         const char *fragment_file_path)
+{
+    return LoadShaders(vertex_file_path, fragment_file_path,
+                       std::vector<std::string>());
+}
+
+unsigned int LoadShaders(const char *vertex_file_path,
+                         const char *fragment_file_path,
+                         const std::vector<std::string> &fragment_modules)
+{
+    // Compile the shaders (or fetch them from the cache)
+    std::vector<unsigned int> ShaderIDs;
+    ShaderIDs.push_back(CompileShader(vertex_file_path, GL_VERTEX_SHADER));
+    ShaderIDs.push_back(CompileShader(fragment_file_path, GL_FRAGMENT_SHADER));
+    for (unsigned int i = 0; i < fragment_modules.size(); i++)
+        ShaderIDs.push_back(CompileShader(fragment_modules[i].c_str(),
+                                          GL_FRAGMENT_SHADER));
+
+    for (unsigned int i = 0; i < ShaderIDs.size(); i++)
+    {
+        if (ShaderIDs[i] == 0)
+        {
+            getchar();
+            return 0;
+        }
     }
 
     // Link the program
     printf("Linking program\n");
-    GLuint ProgramID = glCreateProgram();
-    glAttachShader(ProgramID, VertexShaderID);
-    glAttachShader(ProgramID, FragmentShaderID);
+    unsigned int ProgramID = glCreateProgram();
+    for (unsigned int i = 0; i < ShaderIDs.size(); i++)
+        glAttachShader(ProgramID, ShaderIDs[i]);
     glLinkProgram(ProgramID);
 
     // Check the program
+    GLint Result = GL_FALSE;
+    int InfoLogLength;
     glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
     glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-    if ( InfoLogLength > 0 ){
+    if ( InfoLogLength > 0 )
+    {
         std::vector<char> ProgramErrorMessage(InfoLogLength+1);
-        glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+        glGetProgramInfoLog(ProgramID, InfoLogLength, NULL,
+                            &ProgramErrorMessage[0]);
         printf("%s\n", &ProgramErrorMessage[0]);
     }
 
-    glDetachShader(ProgramID, VertexShaderID);
-    glDetachShader(ProgramID, FragmentShaderID);
-    
-    glDeleteShader(VertexShaderID);
-    glDeleteShader(FragmentShaderID);
+    // The shader objects stay in the cache so other programs can reuse them
+    for (unsigned int i = 0; i < ShaderIDs.size(); i++)
+        glDetachShader(ProgramID, ShaderIDs[i]);
 
     return ProgramID;
 }
 
+void DeleteShaderCache()
+{
+    std::map<std::string, unsigned int>::iterator it;
+    for (it = shaderCache.begin(); it != shaderCache.end(); it++)
+        glDeleteShader(it->second);
+    shaderCache.clear();
+}
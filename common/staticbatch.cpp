@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+#include <common/staticbatch.hpp>
+#include <common/texture.hpp>
+#include <common/jobs.hpp>
+#include <common/profiler.hpp>
+
+// Floats per vertex without and with tangents (position, uv, normal, then
+// tangent with its handedness in w)
+static const unsigned int baseFloats    = 8;
+static const unsigned int tangentFloats = 12;
+
+// Wall clock time in milliseconds
+static double now()
+{
+    std::chrono::duration<double, std::milli> time =
+        std::chrono::steady_clock::now().time_since_epoch();
+    return time.count();
+}
+
+bool StaticBatch::Material::operator==(const Material &material) const
+{
+    if (ka != material.ka || kd != material.kd || ks != material.ks || Ns != material.Ns ||
+        textures.size() != material.textures.size())
+        return false;
+    for (unsigned int i = 0; i < textures.size(); i++)
+    {
+        if (textures[i].id != material.textures[i].id ||
+            textures[i].type != material.textures[i].type)
+            return false;
+    }
+    return true;
+}
+
+StaticBatch::StaticBatch(const float chunkSize) : chunkSize(chunkSize) {}
+
+StaticBatch::Material StaticBatch::material(const Model &model)
+{
+    Material material;
+    material.ka = model.ka;
+    material.kd = model.kd;
+    material.ks = model.ks;
+    material.Ns = model.Ns;
+    material.textures = model.textures;
+    return material;
+}
+
+void StaticBatch::add(Model &model, const glm::mat4 &world)
+{
+    add(model, material(model), world);
+}
+
+void StaticBatch::add(Model &model, const Material &material, const glm::mat4 &world)
+{
+    if (model.vertices.size() < 3)
+        return;
+
+    Object object;
+    object.model = &model;
+    object.world = world;
+
+    // Batch of the object's material
+    object.batch = static_cast<unsigned int>(batches.size());
+    for (unsigned int i = 0; i < batches.size(); i++)
+    {
+        if (batches[i].material == material)
+            object.batch = i;
+    }
+    if (object.batch == batches.size())
+    {
+        batches.push_back(Batch());
+        batches.back().material = material;
+        for (const Texture &texture : material.textures)
+            batches.back().tangents |= texture.type == "normal";
+    }
+
+    // Mesh of the object's model
+    object.mesh = static_cast<unsigned int>(meshes.size());
+    for (unsigned int i = 0; i < meshes.size(); i++)
+    {
+        if (meshes[i].model == &model)
+            object.mesh = i;
+    }
+    if (object.mesh == meshes.size())
+    {
+        meshes.push_back(Mesh());
+        meshes.back().model = &model;
+    }
+    objects.push_back(object);
+}
+
+// =============================================================================
+// Build
+
+void StaticBatch::weld(Mesh &mesh)
+{
+    // Position, uv and normal of each vertex (the tangents of the copies of
+    // a vertex are the same, as Model::calculateTangents welds them too)
+    const Model &model = *mesh.model;
+    unsigned int numVertices = static_cast<unsigned int>(model.vertices.size()) / 3 * 3;
+    bool hasUVs     = model.hasStream(Model::UVS);
+    bool hasNormals = model.hasStream(Model::NORMALS);
+    std::vector<float> keys(baseFloats * numVertices, 0.0f);
+    for (unsigned int i = 0; i < numVertices; i++)
+    {
+        float *key = &keys[baseFloats * i];
+        memcpy(key, &model.vertices[i], sizeof(glm::vec3));
+        if (hasUVs)
+            memcpy(key + 3, &model.uvs[i], sizeof(glm::vec2));
+        if (hasNormals)
+            memcpy(key + 5, &model.normals[i], sizeof(glm::vec3));
+    }
+
+    // Sort the vertices so the copies of a vertex are next to each other
+    std::vector<unsigned int> order(numVertices);
+    for (unsigned int i = 0; i < numVertices; i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+    {
+        int compare = memcmp(&keys[baseFloats * a], &keys[baseFloats * b],
+                             baseFloats * sizeof(float));
+        return compare < 0 || (compare == 0 && a < b);
+    });
+
+    // Give each copy the first copy of its vertex
+    std::vector<unsigned int> first(numVertices);
+    for (unsigned int k = 0; k < numVertices; k++)
+    {
+        bool copy = k > 0 && memcmp(&keys[baseFloats * order[k]], &keys[baseFloats * order[k - 1]],
+                                    baseFloats * sizeof(float)) == 0;
+        first[order[k]] = copy ? first[order[k - 1]] : order[k];
+    }
+
+    // Number the vertices in the order the triangles first use them, so
+    // vertices used together are close together in the buffers
+    std::vector<unsigned int> number(numVertices, 0xffffffff);
+    mesh.vertices.clear();
+    mesh.indices.resize(numVertices);
+    for (unsigned int i = 0; i < numVertices; i++)
+    {
+        if (number[first[i]] == 0xffffffff)
+        {
+            number[first[i]] = static_cast<unsigned int>(mesh.vertices.size());
+            mesh.vertices.push_back(first[i]);
+        }
+        mesh.indices[i] = number[first[i]];
+    }
+
+    // Bounding box
+    mesh.boxMin = glm::vec3(1.0e30f);
+    mesh.boxMax = glm::vec3(-1.0e30f);
+    for (unsigned int i = 0; i < numVertices; i++)
+    {
+        mesh.boxMin = glm::min(mesh.boxMin, model.vertices[i]);
+        mesh.boxMax = glm::max(mesh.boxMax, model.vertices[i]);
+    }
+}
+
+void StaticBatch::build()
+{
+    PROFILE_SCOPE("StaticBatch::build");
+    double start = now();
+    deleteBuffers();
+
+    // Materials with normal maps need the models' tangents
+    for (const Object &object : objects)
+    {
+        if (batches[object.batch].tangents)
+            object.model->buildStreams(1u << Model::TANGENTS);
+    }
+
+    // Weld the models' vertices
+    Jobs::parallelFor(0, static_cast<unsigned int>(meshes.size()), 1,
+                      [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+            weld(meshes[i]);
+    });
+
+    // Cell of the grid the centre of each object's bounding box is in
+    for (Object &object : objects)
+    {
+        const Mesh &mesh = meshes[object.mesh];
+        glm::vec3 centre = glm::vec3(object.world * glm::vec4(0.5f * (mesh.boxMin + mesh.boxMax),
+                                                              1.0f));
+        object.cell = glm::ivec3(glm::floor(centre / chunkSize));
+    }
+
+    // Sort the objects by batch and cell, and make each run of objects in
+    // the same cell a chunk
+    std::vector<unsigned int> order(objects.size());
+    for (unsigned int i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+    {
+        const Object &A = objects[a], &B = objects[b];
+        if (A.batch != B.batch)
+            return A.batch < B.batch;
+        if (A.cell.x != B.cell.x)
+            return A.cell.x < B.cell.x;
+        if (A.cell.y != B.cell.y)
+            return A.cell.y < B.cell.y;
+        if (A.cell.z != B.cell.z)
+            return A.cell.z < B.cell.z;
+        return a < b;
+    });
+
+    for (unsigned int k = 0; k < order.size(); k++)
+    {
+        Object &object = objects[order[k]];
+        const Mesh &mesh = meshes[object.mesh];
+        Batch &batch = batches[object.batch];
+        const Object *previous = k > 0 ? &objects[order[k - 1]] : NULL;
+        if (previous == NULL || previous->batch != object.batch || previous->cell != object.cell)
+        {
+            Chunk chunk;
+            chunk.boxMin     = glm::vec3(1.0e30f);
+            chunk.boxMax     = glm::vec3(-1.0e30f);
+            chunk.firstIndex = batch.numIndices;
+            chunk.numIndices = 0;
+            batch.chunks.push_back(chunk);
+        }
+
+        // Grow the chunk's box by the object's world space box
+        Chunk &chunk = batch.chunks.back();
+        for (unsigned int corner = 0; corner < 8; corner++)
+        {
+            glm::vec4 point(corner & 1 ? mesh.boxMax.x : mesh.boxMin.x,
+                            corner & 2 ? mesh.boxMax.y : mesh.boxMin.y,
+                            corner & 4 ? mesh.boxMax.z : mesh.boxMin.z, 1.0f);
+            glm::vec3 worldPoint = glm::vec3(object.world * point);
+            chunk.boxMin = glm::min(chunk.boxMin, worldPoint);
+            chunk.boxMax = glm::max(chunk.boxMax, worldPoint);
+        }
+
+        object.firstVertex = batch.numVertices;
+        object.firstIndex  = batch.numIndices;
+        batch.numVertices += static_cast<unsigned int>(mesh.vertices.size());
+        batch.numIndices  += static_cast<unsigned int>(mesh.indices.size());
+        chunk.numIndices  += static_cast<unsigned int>(mesh.indices.size());
+    }
+
+    // Transform each object's vertices into its batch's arrays
+    std::vector<std::vector<float> > vertexData(batches.size());
+    std::vector<std::vector<uint32_t> > indexData(batches.size());
+    for (unsigned int i = 0; i < batches.size(); i++)
+    {
+        vertexData[i].resize(batches[i].numVertices * (batches[i].tangents ? tangentFloats :
+                                                                             baseFloats));
+        indexData[i].resize(batches[i].numIndices);
+    }
+
+    Jobs::parallelFor(0, static_cast<unsigned int>(objects.size()), 1,
+                      [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            const Object &object = objects[i];
+            const Mesh &mesh     = meshes[object.mesh];
+            const Model &model   = *object.model;
+            bool tangents = batches[object.batch].tangents;
+            bool hasUVs     = model.hasStream(Model::UVS);
+            bool hasNormals = model.hasStream(Model::NORMALS);
+            unsigned int stride = tangents ? tangentFloats : baseFloats;
+
+            // Normals are transformed by the inverse transpose, and mirrored
+            // objects have their tangent spaces and triangles flipped
+            glm::mat3 model3       = glm::mat3(object.world);
+            glm::mat3 normalMatrix = glm::transpose(glm::inverse(model3));
+            float handedness = glm::determinant(model3) < 0.0f ? -1.0f : 1.0f;
+
+            float *vertex = &vertexData[object.batch][stride * object.firstVertex];
+            for (unsigned int source : mesh.vertices)
+            {
+                glm::vec4 position = object.world * glm::vec4(model.vertices[source], 1.0f);
+                glm::vec2 uv       = hasUVs ? model.uvs[source] : glm::vec2(0.0f);
+                glm::vec3 normal   = hasNormals ? model.normals[source] : glm::vec3(0.0f);
+                if (hasNormals && glm::dot(normal, normal) > 0.0f)
+                    normal = glm::normalize(normalMatrix * normal);
+                memcpy(vertex, &position, sizeof(glm::vec3));
+                memcpy(vertex + 3, &uv, sizeof(glm::vec2));
+                memcpy(vertex + 5, &normal, sizeof(glm::vec3));
+                if (tangents)
+                {
+                    glm::vec3 tangent = model3 * glm::vec3(model.tangents[source]);
+                    if (glm::dot(tangent, tangent) > 0.0f)
+                        tangent = glm::normalize(tangent);
+                    glm::vec4 tangent4(tangent, handedness * model.tangents[source].w);
+                    memcpy(vertex + 8, &tangent4, sizeof(glm::vec4));
+                }
+                vertex += stride;
+            }
+
+            uint32_t *index = &indexData[object.batch][object.firstIndex];
+            for (unsigned int k = 0; k < mesh.indices.size(); k += 3)
+            {
+                index[k]     = object.firstVertex + mesh.indices[k];
+                index[k + 1] = object.firstVertex + mesh.indices[handedness > 0.0f ? k + 1 : k + 2];
+                index[k + 2] = object.firstVertex + mesh.indices[handedness > 0.0f ? k + 2 : k + 1];
+            }
+        }
+    });
+
+    // Upload each batch's buffers
+    stats = Stats();
+    for (unsigned int i = 0; i < batches.size(); i++)
+    {
+        Batch &batch = batches[i];
+        unsigned int stride = (batch.tangents ? tangentFloats : baseFloats) * sizeof(float);
+        glGenVertexArrays(1, &batch.VAO);
+        glBindVertexArray(batch.VAO);
+
+        glGenBuffers(1, &batch.vertexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, batch.vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, vertexData[i].size() * sizeof(float), vertexData[i].data(),
+                     GL_STATIC_DRAW);
+        glGenBuffers(1, &batch.indexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch.indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData[i].size() * sizeof(uint32_t),
+                     indexData[i].data(), GL_STATIC_DRAW);
+
+        // Interleaved streams at the locations Model uses
+        const int components[Model::NUM_STREAMS] = { 3, 2, 3, 4 };
+        unsigned int numStreams = batch.tangents ? Model::NUM_STREAMS : Model::TANGENTS;
+        unsigned int offset = 0;
+        for (unsigned int stream = 0; stream < numStreams; stream++)
+        {
+            glEnableVertexAttribArray(stream);
+            glVertexAttribPointer(stream, components[stream], GL_FLOAT, GL_FALSE, stride,
+                                  (void*)(offset * sizeof(float)));
+            offset += components[stream];
+        }
+        if (instanceBuffer != 0)
+            bindInstanceBuffer();
+        glBindVertexArray(0);
+
+        stats.chunks    += static_cast<unsigned int>(batch.chunks.size());
+        stats.vertices  += batch.numVertices;
+        stats.triangles += batch.numIndices / 3;
+        stats.bytes     += vertexData[i].size() * sizeof(float) +
+                           indexData[i].size() * sizeof(uint32_t);
+    }
+    stats.objects   = static_cast<unsigned int>(objects.size());
+    stats.batches   = static_cast<unsigned int>(batches.size());
+    stats.buildTime = now() - start;
+}
+
+// =============================================================================
+// Draw
+
+void StaticBatch::setInstanceBuffer(const unsigned int buffer, const unsigned int location)
+{
+    instanceBuffer   = buffer;
+    instanceLocation = location;
+    for (const Batch &batch : batches)
+    {
+        if (batch.VAO == 0)
+            continue;
+        glBindVertexArray(batch.VAO);
+        bindInstanceBuffer();
+        glBindVertexArray(0);
+    }
+}
+
+void StaticBatch::bindInstanceBuffer()
+{
+    // One row per attribute of the bound VAO, advancing once per instance
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        glEnableVertexAttribArray(instanceLocation + i);
+        glVertexAttribPointer(instanceLocation + i, 4, GL_FLOAT, GL_FALSE, 3 * sizeof(glm::vec4),
+                              (void*)(i * sizeof(glm::vec4)));
+        glVertexAttribDivisor(instanceLocation + i, 1);
+    }
+}
+
+void StaticBatch::draw(unsigned int &shaderID, const glm::mat4 &viewProjection)
+{
+    PROFILE_SCOPE("StaticBatch::draw");
+    stats.visibleChunks = 0;
+    stats.drawCalls     = 0;
+
+    // Planes of the view frustum pointing inwards, from the rows of the view
+    // projection matrix
+    glm::vec4 planes[6];
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        glm::vec4 row(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i],
+                      viewProjection[3][i]);
+        glm::vec4 w(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3],
+                    viewProjection[3][3]);
+        planes[2 * i]     = w + row;
+        planes[2 * i + 1] = w - row;
+    }
+
+    for (const Batch &batch : batches)
+    {
+        // Index ranges of the chunks inside the frustum, joining chunks that
+        // are next to each other in the index buffer
+        drawCounts.clear();
+        drawOffsets.clear();
+        unsigned int end = 0xffffffff;
+        for (const Chunk &chunk : batch.chunks)
+        {
+            // A box is outside if its corner furthest along a plane's normal
+            // is behind the plane
+            bool inside = true;
+            for (unsigned int p = 0; p < 6 && inside; p++)
+            {
+                glm::vec3 corner(planes[p].x >= 0.0f ? chunk.boxMax.x : chunk.boxMin.x,
+                                 planes[p].y >= 0.0f ? chunk.boxMax.y : chunk.boxMin.y,
+                                 planes[p].z >= 0.0f ? chunk.boxMax.z : chunk.boxMin.z);
+                inside = glm::dot(glm::vec3(planes[p]), corner) + planes[p].w >= 0.0f;
+            }
+            if (!inside)
+                continue;
+
+            stats.visibleChunks++;
+            if (chunk.firstIndex == end)
+                drawCounts.back() += chunk.numIndices;
+            else
+            {
+                drawCounts.push_back(chunk.numIndices);
+                drawOffsets.push_back((const void *)(chunk.firstIndex * sizeof(uint32_t)));
+            }
+            end = chunk.firstIndex + chunk.numIndices;
+        }
+        if (drawCounts.empty())
+            continue;
+
+        // Send material properties to the shader
+        const Material &material = batch.material;
+        glUniform1f(glGetUniformLocation(shaderID, "ka"), material.ka);
+        glUniform1f(glGetUniformLocation(shaderID, "kd"), material.kd);
+        glUniform1f(glGetUniformLocation(shaderID, "ks"), material.ks);
+        glUniform1f(glGetUniformLocation(shaderID, "Ns"), material.Ns);
+
+        // Bind the textures (uploading any that are still being decoded)
+        Textures::finish();
+        for (unsigned int i = 0; i < material.textures.size(); i++)
+        {
+            std::string name = material.textures[i].type;
+            glActiveTexture(GL_TEXTURE0 + i);
+            glUniform1i(glGetUniformLocation(shaderID, (name + "Map").c_str()), i);
+            glBindTexture(GL_TEXTURE_2D, material.textures[i].id);
+            if (name == "normal")
+                glUniform1i(glGetUniformLocation(shaderID, "normalMapXY"),
+                            Textures::components(material.textures[i].id) == 2);
+        }
+
+        // Draw the visible chunks
+        glBindVertexArray(batch.VAO);
+        glMultiDrawElements(GL_TRIANGLES, &drawCounts[0], GL_UNSIGNED_INT, &drawOffsets[0],
+                            static_cast<int>(drawCounts.size()));
+        glBindVertexArray(0);
+        stats.drawCalls++;
+    }
+}
+
+void StaticBatch::deleteBuffers()
+{
+    for (Batch &batch : batches)
+    {
+        if (batch.VAO != 0)
+        {
+            glDeleteBuffers(1, &batch.vertexBuffer);
+            glDeleteBuffers(1, &batch.indexBuffer);
+            glDeleteVertexArrays(1, &batch.VAO);
+        }
+        batch.VAO = batch.vertexBuffer = batch.indexBuffer = 0;
+        batch.chunks.clear();
+        batch.numVertices = 0;
+        batch.numIndices  = 0;
+    }
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+#include <common/maths.hpp>
+#include <common/model.hpp>
+
+// StaticBatch class. Bakes objects that never move into merged vertex and
+// index buffers, so they are drawn with one draw call per material instead
+// of one per object. Each object is a Model at a world matrix with a
+// material (the model's own unless one is given):
+//
+//     StaticBatch batch;
+//     for (unsigned int i = 0; i < 10; i++)
+//         batch.add(teapot, modelMatrices[i]);
+//     batch.build();
+//
+//     // The vertices are in world space, so MVP = P * V and MV = V
+//     batch.draw(shaderID, camera.projection * camera.view);
+//
+// build welds the copies of each model's vertices into an indexed mesh
+// once, then transforms every object's copy of its mesh into world space in
+// parallel on the job system. The objects of a material are split into
+// chunks by the cell of a grid their centres are in, and each chunk keeps
+// its bounding box, so draw skips the chunks outside the view frustum and
+// draws the rest with one glMultiDrawElements call per material.
+//
+// The vertices have the locations of Model's streams. Only materials with a
+// normal map have tangents.
+class StaticBatch
+{
+public:
+    // Surface properties shared by the objects of a batch
+    struct Material
+    {
+        float ka = 0.0f, kd = 0.0f, ks = 0.0f, Ns = 1.0f;
+        std::vector<Texture> textures;
+
+        bool operator==(const Material &material) const;
+    };
+
+    // Statistics of the last build and draw
+    struct Stats
+    {
+        unsigned int objects   = 0;
+        unsigned int batches   = 0;         // one per material
+        unsigned int chunks    = 0;
+        unsigned int vertices  = 0;
+        unsigned int triangles = 0;
+        size_t bytes = 0;                   // vertex and index buffers
+        double buildTime = 0.0;             // milliseconds
+        unsigned int visibleChunks = 0;
+        unsigned int drawCalls     = 0;
+    };
+    Stats stats;
+
+    // Constructor (chunkSize is the width of the grid's cells)
+    StaticBatch(const float chunkSize = 16.0f);
+
+    // Add an object (the model must stay alive until build) and bake the
+    // objects into the buffers
+    void add(Model &model, const glm::mat4 &world);
+    void add(Model &model, const Material &material, const glm::mat4 &world);
+    void build();
+    unsigned int numObjects() const { return static_cast<unsigned int>(objects.size()); }
+
+    // Material of a model
+    static Material material(const Model &model);
+
+    // Read per instance affine matrices from a buffer into the attributes
+    // at location, location + 1 and location + 2 (as Model does), e.g. the
+    // view matrix as the model view matrix for shaders with an MV attribute
+    void setInstanceBuffer(const unsigned int buffer, const unsigned int location);
+
+    // Draw the chunks inside the frustum of a view projection matrix
+    void draw(unsigned int &shaderID, const glm::mat4 &viewProjection);
+
+    // Cleanup
+    void deleteBuffers();
+
+private:
+    // Object added to the batch
+    struct Object
+    {
+        Model *model;
+        unsigned int mesh;
+        unsigned int batch;
+        glm::mat4 world;
+        glm::ivec3 cell;                    // cell of the grid its centre is in
+        unsigned int firstVertex = 0;       // in its batch's buffers
+        unsigned int firstIndex  = 0;
+    };
+
+    // Model's vertices welded into an indexed mesh
+    struct Mesh
+    {
+        Model *model;
+        std::vector<unsigned int> vertices;  // first copy of each vertex
+        std::vector<unsigned int> indices;
+        glm::vec3 boxMin, boxMax;
+    };
+
+    // Objects close together in a batch, drawn or skipped together
+    struct Chunk
+    {
+        glm::vec3 boxMin, boxMax;
+        unsigned int firstIndex;
+        unsigned int numIndices;
+    };
+
+    // Objects with the same material and their buffers
+    struct Batch
+    {
+        Material material;
+        bool tangents = false;              // whether there is a normal map
+        std::vector<Chunk> chunks;
+        unsigned int numVertices = 0;
+        unsigned int numIndices  = 0;
+        unsigned int VAO = 0;
+        unsigned int vertexBuffer = 0;
+        unsigned int indexBuffer  = 0;
+    };
+
+    float chunkSize;
+    std::vector<Object> objects;
+    std::vector<Mesh> meshes;
+    std::vector<Batch> batches;
+    unsigned int instanceBuffer   = 0;
+    unsigned int instanceLocation = 0;
+
+    // Index ranges of the visible chunks of a batch
+    std::vector<int> drawCounts;
+    std::vector<const void *> drawOffsets;
+
+    static void weld(Mesh &mesh);
+    void bindInstanceBuffer();
+};
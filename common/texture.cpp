@@ -0,0 +1,716 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <algorithm>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <common/stb_image.hpp>
+
+#include <common/texture.hpp>
+#include <common/ktx.hpp>
+#include <common/jobs.hpp>
+#include <common/options.hpp>
+#include <common/window.hpp>
+
+// Level of a texture being streamed, in rows of pixels or of 4x4 blocks
+struct StreamLevel
+{
+    const unsigned char *data;
+    unsigned int width, height;
+    unsigned int numRows;
+    unsigned int rowHeight;                 // pixels in a row (4 for blocks)
+    size_t rowSize;                         // bytes in a row
+};
+
+// Texture asked for, with its mipmaps until they are uploaded
+struct TextureEntry
+{
+    std::string path;
+    bool flip;
+    Mipmaps::Settings settings;
+    unsigned int id;
+    std::string cachePath;                  // KTX file of the mipmaps (empty for none)
+    Mipmaps mipmaps;
+    KTX ktx;                                // mapped file, if there was one
+    JobHandle decode;
+    bool copy = false;                      // of a file decoded before
+
+    // Levels of a texture being streamed, the next band of rows to copy
+    // (from the smallest level up) and their OpenGL formats
+    std::vector<StreamLevel> streamLevels;
+    int streamLevel = -1;
+    unsigned int streamRow = 0;
+    GLenum type = 0, format = 0, internalFormat = 0;
+    int alignment = 1;
+};
+
+// Pixel buffer object the worker threads copy bands of rows into
+struct StreamBuffer
+{
+    unsigned int id = 0;
+    size_t size = 0;
+    GLsync fence = 0;                       // signalled when the GPU has read it
+    bool mapped = false;
+};
+
+// Band of rows being copied into a buffer on a worker thread
+struct StreamCopy
+{
+    TextureEntry *entry;
+    unsigned int level, firstRow, numRows;
+    unsigned int buffer;
+    JobHandle job;
+};
+
+static std::deque<TextureEntry> entries;
+static std::vector<TextureEntry *> pending;
+static std::map<std::string, unsigned int> pathTextures;
+
+// Decode of the first file with each contents, flip and settings (the
+// decodes of copies of it map its KTX file instead of decoding them again)
+struct ContentDecode
+{
+    JobHandle decode;
+    std::string cachePath;
+};
+static std::map<std::string, ContentDecode> contentDecodes;
+static std::mutex contentMutex;     // also guards textureStats.textures
+static std::map<unsigned int, unsigned int> textureComponents;
+static Textures::Stats textureStats;
+static bool defaultMipmapCache = true;
+static std::string mipmapCacheDirectory;
+
+// Streaming (on with --stream-textures) through a pool of buffers of 1 MB.
+// Levels of up to 64 KB are uploaded straight away.
+static bool streamingRead = false;
+static bool streamingOn = false;
+static size_t streamBudget = 2 << 20;
+static std::vector<TextureEntry *> streaming;
+static std::vector<TextureEntry *> streamed;
+static std::vector<StreamBuffer> streamBuffers;
+static std::vector<StreamCopy> streamCopies;
+static const unsigned int maxStreamBuffers = 16;
+static const size_t streamBufferSize = 1 << 20;
+static const size_t streamTailSize = 64 << 10;
+
+// Absolute path with the links and . and .. removed (or the path as it is
+// if the file doesn't exist)
+static std::string canonicalPath(const char *path)
+{
+#ifdef _WIN32
+    char canonical[_MAX_PATH];
+    if (_fullpath(canonical, path, _MAX_PATH) != NULL)
+        return canonical;
+#else
+    char canonical[PATH_MAX];
+    if (realpath(path, canonical) != NULL)
+        return canonical;
+#endif
+    return path;
+}
+
+// Read a whole file
+static bool readFile(const char *path, std::vector<unsigned char> &data)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data.resize(size > 0 ? size : 0);
+    bool read = size > 0 && fread(&data[0], 1, data.size(), file) == data.size();
+    fclose(file);
+    return read;
+}
+
+// 64 bit hash of the contents of a file
+static uint64_t contentHash(const unsigned char *data, const size_t size)
+{
+    uint64_t hash = 0x243f6a8885a308d3ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, &data[i], 8);
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+// File of the mipmaps of an image, named by the hash of the image's path,
+// size and modification time and how they are made (in a .mipcache
+// directory next to the image by default), so finding it doesn't need the
+// image to be read
+static std::string mipmapPath(const std::string &path, const struct stat &status,
+                              const bool flip, const Mipmaps::Settings &settings)
+{
+    std::string directory = mipmapCacheDirectory;
+    if (defaultMipmapCache)
+    {
+        size_t slash = path.find_last_of("/\\");
+        directory = (slash == std::string::npos ? std::string(".") : path.substr(0, slash)) +
+                    "/.mipcache";
+    }
+    if (directory.empty())
+        return "";
+
+    char file[64];
+    snprintf(file, sizeof(file), ":%lld:%lld", static_cast<long long>(status.st_size),
+             static_cast<long long>(status.st_mtime));
+    std::string key = path + file;
+    uint64_t hash = contentHash(reinterpret_cast<const unsigned char *>(key.c_str()), key.size());
+
+    char name[64];
+    snprintf(name, sizeof(name), "/%016llx%s-", static_cast<unsigned long long>(hash),
+             flip ? "-flip" : "");
+    return directory + name + settings.name() + ".ktx";
+}
+
+// Make the directory of a file in the mipmap cache
+static void makeCacheDirectory(const std::string &cachePath)
+{
+    std::string directory = cachePath.substr(0, cachePath.find_last_of('/'));
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+}
+
+// Decode an image and make its mipmaps, or map them from the last time
+// (on a worker thread)
+static void decode(TextureEntry &entry)
+{
+    if (!entry.cachePath.empty() && entry.ktx.open(entry.cachePath))
+    {
+        entry.ktx.prefetch();
+        return;
+    }
+
+    std::vector<unsigned char> file;
+    if (!readFile(entry.path.c_str(), file))
+        return;
+
+    // Map the mipmaps of a copy of the file decoded before, and keep them
+    // for this file's next time too
+    char key[64];
+    snprintf(key, sizeof(key), "%016llx:%zu:%d:",
+             static_cast<unsigned long long>(contentHash(&file[0], file.size())),
+             file.size(), entry.flip ? 1 : 0);
+    ContentDecode earlier;
+    {
+        std::lock_guard<std::mutex> lock(contentMutex);
+        std::map<std::string, ContentDecode>::iterator it =
+            contentDecodes.find(key + entry.settings.name());
+        if (it != contentDecodes.end())
+            earlier = it->second;
+        else
+            contentDecodes[key + entry.settings.name()] = { entry.decode, entry.cachePath };
+    }
+    if (earlier.decode)
+    {
+        entry.copy = true;
+        Jobs::wait(earlier.decode);
+        if (!earlier.cachePath.empty() && entry.ktx.open(earlier.cachePath))
+        {
+            if (!entry.cachePath.empty())
+            {
+                makeCacheDirectory(entry.cachePath);
+                entry.ktx.copy(entry.cachePath);
+            }
+            entry.ktx.prefetch();
+            return;
+        }
+    }
+
+    int width, height, numComponents;
+    unsigned char *pixels = stbi_load_from_memory(&file[0], static_cast<int>(file.size()),
+                                                  &width, &height, &numComponents, 0);
+    if (pixels == NULL)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(contentMutex);
+        textureStats.textures++;
+    }
+
+    // Swap the rows top to bottom
+    if (entry.flip)
+    {
+        size_t rowSize = static_cast<size_t>(width) * numComponents;
+        std::vector<unsigned char> row(rowSize);
+        for (int y = 0; y < height / 2; y++)
+        {
+            unsigned char *top    = pixels + y * rowSize;
+            unsigned char *bottom = pixels + (height - 1 - y) * rowSize;
+            memcpy(&row[0], top, rowSize);
+            memcpy(top, bottom, rowSize);
+            memcpy(bottom, &row[0], rowSize);
+        }
+    }
+
+    entry.mipmaps.build(pixels, width, height, numComponents, entry.settings);
+    stbi_image_free(pixels);
+
+    // Keep the mipmaps for next time
+    if (!entry.cachePath.empty())
+    {
+        makeCacheDirectory(entry.cachePath);
+        KTX::write(entry.cachePath, entry.mipmaps);
+    }
+}
+
+// Components in the pixels of an image's levels (2 for BC5)
+static unsigned int levelComponents(const TextureEntry &entry)
+{
+    if (entry.ktx.isOpen())
+        return entry.ktx.components();
+    if (entry.mipmaps.compressed)
+        return BlockCompression::components(entry.mipmaps.format);
+    return entry.mipmaps.components;
+}
+
+// Set a texture's wrapping and filtering options
+static void setParameters()
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+// Free an image's file and mipmaps once they are uploaded
+static void release(TextureEntry &entry)
+{
+    entry.mipmaps = Mipmaps();
+    entry.ktx.close();
+    entry.decode.reset();
+    std::vector<StreamLevel>().swap(entry.streamLevels);
+}
+
+// Upload an image's mipmaps (on the OpenGL thread)
+static void upload(TextureEntry &entry)
+{
+    if (entry.mipmaps.levels.empty() && !entry.ktx.isOpen())
+    {
+        printf("Texture %s failed to load.\n", entry.path.c_str());
+        return;
+    }
+
+    // Upload the levels from the mapped file, or the ones just made
+    textureComponents[entry.id] = levelComponents(entry);
+    textureStats.contentHits += entry.copy ? 1 : 0;
+    glBindTexture(GL_TEXTURE_2D, entry.id);
+    if (entry.ktx.isOpen())
+    {
+        entry.ktx.upload();
+        textureStats.bytes += entry.ktx.size();
+        textureStats.cachedMipmaps++;
+    }
+    else
+    {
+        entry.mipmaps.upload();
+        textureStats.bytes += entry.mipmaps.size();
+    }
+    setParameters();
+}
+
+// Whether textures are streamed (read from the options the first time)
+static bool streamTextures()
+{
+    if (!streamingRead)
+    {
+        streamingRead = true;
+        streamingOn   = Options::has("stream-textures");
+        streamBudget  = static_cast<size_t>(Options::getFloat("stream-budget", 2.0f) * (1 << 20));
+    }
+    return streamingOn;
+}
+
+// Add a level of an image to stream
+static void addStreamLevel(TextureEntry &entry, const unsigned char *data,
+                           const unsigned int width, const unsigned int height, const size_t size)
+{
+    StreamLevel level;
+    level.data      = data;
+    level.width     = width;
+    level.height    = height;
+    level.rowHeight = entry.type == 0 ? 4 : 1;
+    level.numRows   = (height + level.rowHeight - 1) / level.rowHeight;
+    level.rowSize   = size / level.numRows;
+    entry.streamLevels.push_back(level);
+}
+
+// Allocate a texture's levels and upload the small ones, so it has a blurry
+// image while the rest are streamed in (false if its image failed to load)
+static bool startStream(TextureEntry &entry)
+{
+    textureComponents[entry.id] = levelComponents(entry);
+    textureStats.contentHits += entry.copy ? 1 : 0;
+    if (entry.ktx.isOpen())
+    {
+        entry.type           = entry.ktx.type;
+        entry.format         = entry.ktx.format;
+        entry.internalFormat = entry.ktx.internalFormat;
+        entry.alignment      = 4;
+        for (const KTX::Level &level : entry.ktx.levels)
+            addStreamLevel(entry, level.data, level.width, level.height, level.size);
+        textureStats.cachedMipmaps++;
+    }
+    else if (!entry.mipmaps.levels.empty())
+    {
+        const Mipmaps &mipmaps = entry.mipmaps;
+        entry.type           = mipmaps.compressed ? 0 : GL_UNSIGNED_BYTE;
+        entry.format         = mipmaps.compressed ? 0 : Mipmaps::pixelFormat(mipmaps.components);
+        entry.internalFormat = mipmaps.compressed
+                               ? BlockCompression::internalFormat(mipmaps.format) : entry.format;
+        entry.alignment      = 1;
+        for (const Mipmaps::Level &level : mipmaps.levels)
+            addStreamLevel(entry, &level.pixels[0], level.width, level.height,
+                           level.pixels.size());
+    }
+    else
+    {
+        printf("Texture %s failed to load.\n", entry.path.c_str());
+        return false;
+    }
+
+    // Stream the levels from the smallest one too big to upload now (with
+    // no buffer bound, so the pointers aren't taken as offsets into one)
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, entry.id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, entry.alignment);
+    int numLevels = static_cast<int>(entry.streamLevels.size());
+    for (int i = 0; i < numLevels; i++)
+    {
+        const StreamLevel &level = entry.streamLevels[i];
+        size_t size = level.rowSize * level.numRows;
+        const unsigned char *data = size <= streamTailSize ? level.data : NULL;
+        if (entry.type == 0)
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, entry.internalFormat, level.width,
+                                   level.height, 0, static_cast<GLsizei>(size), data);
+        else
+            glTexImage2D(GL_TEXTURE_2D, i, entry.internalFormat, level.width, level.height, 0,
+                         entry.format, entry.type, data);
+        if (data != NULL)
+            textureStats.bytes += size;
+        else
+            entry.streamLevel = i;
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.streamLevel + 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    setParameters();
+    return true;
+}
+
+// Buffer that isn't being copied into or read by the GPU (-1 if they all are)
+static int freeStreamBuffer()
+{
+    for (unsigned int i = 0; i < streamBuffers.size(); i++)
+    {
+        StreamBuffer &buffer = streamBuffers[i];
+        if (buffer.mapped)
+            continue;
+        if (buffer.fence != 0)
+        {
+            if (glClientWaitSync(buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                continue;
+            glDeleteSync(buffer.fence);
+            buffer.fence = 0;
+        }
+        return i;
+    }
+
+    // Add a buffer to the pool
+    if (streamBuffers.size() == maxStreamBuffers)
+        return -1;
+    StreamBuffer buffer;
+    glGenBuffers(1, &buffer.id);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, streamBufferSize, NULL, GL_STREAM_DRAW);
+    buffer.size = streamBufferSize;
+    streamBuffers.push_back(buffer);
+    return static_cast<int>(streamBuffers.size()) - 1;
+}
+
+// Wait for the copies and decodes, and delete the buffers
+static void stopStreaming()
+{
+    for (StreamCopy &copy : streamCopies)
+        Jobs::wait(copy.job);
+    for (TextureEntry *entry : streaming)
+        if (entry->decode)
+            Jobs::wait(entry->decode);
+
+    for (StreamBuffer &buffer : streamBuffers)
+    {
+        if (buffer.mapped)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        if (buffer.fence != 0)
+            glDeleteSync(buffer.fence);
+        glDeleteBuffers(1, &buffer.id);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    streamBuffers.clear();
+    streamCopies.clear();
+    streaming.clear();
+    streamed.clear();
+}
+
+unsigned int Textures::request(const char *path, const bool flip,
+                               const Mipmaps::Settings &settings)
+{
+    textureStats.requests++;
+
+    // Block compress the textures with --compress-textures
+    static const bool compress = Options::has("compress-textures") &&
+                                 BlockCompression::supported();
+    Mipmaps::Settings textureSettings = settings;
+    textureSettings.compress = textureSettings.compress || compress;
+
+    // Texture of a file already asked for
+    std::string canonical = canonicalPath(path);
+    std::string pathKey = canonical + (flip ? ":1:" : ":0:") + textureSettings.name();
+    std::map<std::string, unsigned int>::iterator it = pathTextures.find(pathKey);
+    if (it != pathTextures.end())
+    {
+        textureStats.pathHits++;
+        return it->second;
+    }
+
+    // Create the texture and read and decode its image on the job system
+    // (the job is set before it is submitted, as without worker threads it
+    // runs straight away)
+    entries.emplace_back();
+    TextureEntry &entry = entries.back();
+    entry.path = path;
+    entry.flip = flip;
+    entry.settings = textureSettings;
+    glGenTextures(1, &entry.id);
+    struct stat status;
+    if (stat(path, &status) == 0)
+    {
+        entry.cachePath = mipmapPath(canonical, status, flip, textureSettings);
+        entry.decode = Jobs::create([&entry]() { decode(entry); });
+        Jobs::submit(entry.decode);
+    }
+    pending.push_back(&entry);
+
+    pathTextures[pathKey] = entry.id;
+    return entry.id;
+}
+
+void Textures::finish()
+{
+    // Hand the images to stream, which Window::swapBuffers calls after
+    // each frame
+    if (streamTextures())
+    {
+        static bool registered = false;
+        if (!registered)
+            Window::addFrameCallback([]() { Textures::stream(); });
+        registered = true;
+        streaming.insert(streaming.end(), pending.begin(), pending.end());
+        pending.clear();
+        return;
+    }
+
+    // Upload the images in the order they were asked for
+    for (TextureEntry *entry : pending)
+    {
+        if (entry->decode)
+            Jobs::wait(entry->decode);
+        upload(*entry);
+        release(*entry);
+    }
+    pending.clear();
+}
+
+bool Textures::stream()
+{
+    // Upload the bands copied into buffers since the last frame, with a
+    // fence after each so the buffer isn't written again until the GPU has
+    // read it
+    for (StreamCopy &copy : streamCopies)
+    {
+        Jobs::wait(copy.job);
+        StreamBuffer &buffer = streamBuffers[copy.buffer];
+        TextureEntry &entry = *copy.entry;
+        const StreamLevel &level = entry.streamLevels[copy.level];
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        buffer.mapped = false;
+
+        glBindTexture(GL_TEXTURE_2D, entry.id);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, entry.alignment);
+        unsigned int y = copy.firstRow * level.rowHeight;
+        unsigned int height = std::min(copy.numRows * level.rowHeight, level.height - y);
+        size_t size = copy.numRows * level.rowSize;
+        if (entry.type == 0)
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, y, level.width, height,
+                                      entry.internalFormat, static_cast<GLsizei>(size), NULL);
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, y, level.width, height,
+                            entry.format, entry.type, NULL);
+        buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        textureStats.bytes += size;
+
+        // Sample the level once all of its rows are there
+        if (copy.firstRow + copy.numRows == level.numRows)
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, copy.level);
+    }
+    streamCopies.clear();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (TextureEntry *entry : streamed)
+        release(*entry);
+    streamed.clear();
+
+    // Copy the next bands into free buffers on the worker threads, up to a
+    // frame's budget
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < streaming.size() && bytes < streamBudget;)
+    {
+        TextureEntry &entry = *streaming[i];
+
+        // Start on a texture once its image is decoded (waiting for it if
+        // there are no other threads to decode it)
+        if (entry.streamLevels.empty())
+        {
+            if (entry.decode && !Jobs::done(entry.decode) && Jobs::numThreads() > 1)
+            {
+                i++;
+                continue;
+            }
+            if (entry.decode)
+                Jobs::wait(entry.decode);
+            startStream(entry);
+        }
+
+        // Or finish with it once its last band is being copied (or its image
+        // failed to load)
+        if (entry.streamLevel < 0)
+        {
+            streamed.push_back(&entry);
+            streaming.erase(streaming.begin() + i);
+            continue;
+        }
+
+        // Map a buffer for as many rows as fit in it
+        int index = freeStreamBuffer();
+        if (index < 0)
+            break;
+        StreamBuffer &buffer = streamBuffers[index];
+        const StreamLevel &level = entry.streamLevels[entry.streamLevel];
+        unsigned int numRows = std::max(1u, static_cast<unsigned int>(buffer.size / level.rowSize));
+        numRows = std::min(numRows, level.numRows - entry.streamRow);
+        size_t size = numRows * level.rowSize;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+        if (size > buffer.size)
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            buffer.size = size;
+        }
+        void *pointer = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+                                         GL_MAP_UNSYNCHRONIZED_BIT);
+        if (pointer == NULL)
+            break;
+        buffer.mapped = true;
+
+        // Copy the rows on a worker thread
+        StreamCopy copy;
+        copy.entry    = &entry;
+        copy.level    = entry.streamLevel;
+        copy.firstRow = entry.streamRow;
+        copy.numRows  = numRows;
+        copy.buffer   = index;
+        const unsigned char *source = level.data + entry.streamRow * level.rowSize;
+        copy.job = Jobs::run([=]() { memcpy(pointer, source, size); });
+        streamCopies.push_back(copy);
+        bytes += size;
+
+        // Move on to the next level up
+        entry.streamRow += numRows;
+        if (entry.streamRow == level.numRows)
+        {
+            entry.streamLevel--;
+            entry.streamRow = 0;
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    return !streaming.empty() || !streamCopies.empty() || !streamed.empty();
+}
+
+void Textures::setStreaming(const bool on, const size_t budget)
+{
+    // Finish streaming the textures before turning it off
+    streamTextures();
+    if (!on)
+        while (stream())
+            ;
+    streamingOn  = on;
+    streamBudget = budget;
+}
+
+unsigned int Textures::load(const char *path, const bool flip,
+                            const Mipmaps::Settings &settings)
+{
+    unsigned int id = request(path, flip, settings);
+    finish();
+    return id;
+}
+
+unsigned int Textures::components(const unsigned int id)
+{
+    std::map<unsigned int, unsigned int>::const_iterator it = textureComponents.find(id);
+    return it != textureComponents.end() ? it->second : 0;
+}
+
+void Textures::clear()
+{
+    finish();
+    stopStreaming();
+    for (TextureEntry &entry : entries)
+        glDeleteTextures(1, &entry.id);
+    entries.clear();
+    pathTextures.clear();
+    contentDecodes.clear();
+    textureComponents.clear();
+    textureStats = Stats();
+}
+
+void Textures::setMipmapCache(const char *directory)
+{
+    defaultMipmapCache = directory == NULL;
+    mipmapCacheDirectory = directory == NULL ? "" : directory;
+}
+
+const Textures::Stats &Textures::stats()
+{
+    return textureStats;
+}
+
+unsigned int loadTexture(const char *path)
+{
+    return Textures::load(path, true);
+}
@@ -1,48 +1,92 @@
-#define STB_IMAGE_IMPLEMENTATION
-#include <common/stb_image.hpp>
-
-unsigned int loadTexture(const char *path)
-{
-    // Create and bind texture
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    
-    // Load texture image from file
-    int width, height, nChannels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char *data = stbi_load(path, &width, &height, &nChannels, 0);
-    
-    if (data)
-    {
-        // Deal with different number of colour channels
-        GLenum format;
-        if (nChannels == 1)
-            format = GL_RED;
-        else if (nChannels == 3)
-            format = GL_RGB;
-        else if (nChannels == 4)
-            format = GL_RGBA;
-        
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                     GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        // Set texture wrapping options
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, 
-                        GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-    }
-    else
-    {
-        printf("Texture %s failed to load.\n", path);
-    }
-
-    // Free the image from the memory
-    stbi_image_free(data);
-    
-    return textureID;
-}
+#pragma once
+
+#include <GL/glew.h>
+
+#include <common/mipmaps.hpp>
+
+// Textures class. Loads each image into an OpenGL texture only once: asking
+// for a file that has already been asked for, by its canonical path, gives
+// the same texture, and a copy of a file under another name is only decoded
+// once. Images are read and decoded on the job system's worker threads as
+// soon as they are asked for and uploaded on the OpenGL thread, in the order
+// they were asked for, by finish:
+//
+//     unsigned int diffuse = Textures::request("../assets/blue.bmp");
+//     unsigned int normal  = Textures::request("../assets/diamond_normal.png");
+//     ...                                     // carry on while they decode
+//     Textures::finish();                     // upload them
+//
+// Model::draw calls finish, so the textures added to a model only need to be
+// requested. Before the job system is started the images are decoded as
+// they are asked for.
+//
+// The mipmaps are made with the Mipmaps class as the image is decoded (a
+// Kaiser filter in linear light unless other settings are asked for) and
+// kept in a .mipcache directory next to the image, in a KTX file named by
+// a hash of the image's path, size and modification time and the settings.
+// The next time the texture is asked for, the KTX file is mapped into memory
+// and its levels uploaded from there instead of the image being read and
+// decoded.
+// With --compress-textures (where the GPU supports S3TC) they are block
+// compressed, as BC5 for normal maps. BC5 only holds x and y, so shaders
+// calculate the z of normals from them when components gives 2.
+//
+// With --stream-textures the textures are streamed in over several frames
+// instead of uploaded by finish, at most --stream-budget MB (default 2) a
+// frame. The worker threads copy bands of rows into mapped pixel buffer
+// objects and the OpenGL thread uploads them with glTexSubImage2D from the
+// buffers, the smallest levels first, so the textures start blurry and
+// sharpen as their larger levels arrive. Fences stop a buffer being written
+// again before the GPU has read it.
+class Textures
+{
+public:
+    // Statistics since the last clear
+    struct Stats
+    {
+        unsigned int requests = 0;
+        unsigned int textures = 0;          // files decoded (by the decodes finished so far)
+        unsigned int pathHits    = 0;       // requests for a file already asked for
+        unsigned int contentHits = 0;       // copies of a file decoded before
+        unsigned int cachedMipmaps = 0;     // textures read from the mipmap cache
+        size_t bytes = 0;                   // uploaded
+    };
+
+    // Ask for a texture and return its name (it has no image until finish
+    // is called). Flipped images start with the bottom row, the first row
+    // of an OpenGL texture.
+    static unsigned int request(const char *path, const bool flip = false,
+                                const Mipmaps::Settings &settings = Mipmaps::Settings());
+
+    // Upload the requested textures, waiting for their images to be decoded
+    // (or when streaming, start streaming them)
+    static void finish();
+
+    // Upload the next frame's budget of the textures being streamed and
+    // return whether any are left (Window::swapBuffers calls this after
+    // each frame)
+    static bool stream();
+
+    // Turn streaming on or off with a budget in bytes a frame (turning it
+    // off finishes streaming the textures)
+    static void setStreaming(const bool on, const size_t budget = 2 << 20);
+
+    // Request a texture and upload it (or start streaming it)
+    static unsigned int load(const char *path, const bool flip = false,
+                             const Mipmaps::Settings &settings = Mipmaps::Settings());
+
+    // Components in a texture's pixels once it is uploaded or streaming
+    // (0 before then)
+    static unsigned int components(const unsigned int id);
+
+    // Delete the textures and forget them
+    static void clear();
+
+    // Keep the mipmaps in a directory instead of next to the images (NULL
+    // for next to the images, "" for nowhere)
+    static void setMipmapCache(const char *directory);
+    static const Stats &stats();
+};
+
+// Load a texture the right way up for the labs' uv co-ordinates
+unsigned int loadTexture(const char *path);
@@ -0,0 +1,183 @@
+#include <algorithm>
+
+#include <common/transform.hpp>
+
+unsigned int TransformHierarchy::add(const glm::vec3 position,
+                                     const glm::vec3 axis, const float angle,
+                                     const glm::vec3 scale, const int parent)
+{
+    unsigned int handle = static_cast<unsigned int>(indices.size());
+    unsigned int index  = static_cast<unsigned int>(parents.size());
+    int parentIndex     = parent == noParent ? noParent : static_cast<int>(indices[parent]);
+    unsigned int depth  = parent == noParent ? 0 : depths[parentIndex] + 1;
+
+    // Nodes are added at the end, which only breaks the depth order when
+    // the new node is less deep than the last one
+    if (!depths.empty() && depth < depths.back())
+        needsSort = true;
+
+    parents.push_back(parentIndex);
+    depths.push_back(depth);
+    positions.push_back(position);
+    rotations.push_back(Quaternion(angle, axis));
+    scales.push_back(scale);
+    worlds.push_back(glm::mat4(1.0f));
+    dirty.push_back(0);
+    handles.push_back(handle);
+    indices.push_back(index);
+
+    markDirty(index);
+    return handle;
+}
+
+void TransformHierarchy::setPosition(const unsigned int node, const glm::vec3 position)
+{
+    positions[indices[node]] = position;
+    markDirty(indices[node]);
+}
+
+void TransformHierarchy::setRotation(const unsigned int node, const float angle,
+                                     const glm::vec3 axis)
+{
+    rotations[indices[node]] = Quaternion(angle, axis);
+    markDirty(indices[node]);
+}
+
+void TransformHierarchy::setRotation(const unsigned int node, const Quaternion &rotation)
+{
+    rotations[indices[node]] = rotation;
+    markDirty(indices[node]);
+}
+
+void TransformHierarchy::setScale(const unsigned int node, const glm::vec3 scale)
+{
+    scales[indices[node]] = scale;
+    markDirty(indices[node]);
+}
+
+void TransformHierarchy::setParent(const unsigned int node, const int parent)
+{
+    parents[indices[node]] = parent == noParent ? noParent : static_cast<int>(indices[parent]);
+    needsSort = true;
+}
+
+glm::vec3 TransformHierarchy::position(const unsigned int node) const
+{
+    return positions[indices[node]];
+}
+
+Quaternion TransformHierarchy::rotation(const unsigned int node) const
+{
+    return rotations[indices[node]];
+}
+
+glm::vec3 TransformHierarchy::scale(const unsigned int node) const
+{
+    return scales[indices[node]];
+}
+
+const glm::mat4 &TransformHierarchy::world(const unsigned int node) const
+{
+    return worlds[indices[node]];
+}
+
+unsigned int TransformHierarchy::size() const
+{
+    return static_cast<unsigned int>(parents.size());
+}
+
+void TransformHierarchy::markDirty(const unsigned int index)
+{
+    dirty[index] = 1;
+    firstDirty   = std::min(firstDirty, index);
+}
+
+unsigned int TransformHierarchy::update()
+{
+    if (needsSort)
+        sortByDepth();
+
+    unsigned int n = size();
+    if (firstDirty >= n)
+        return 0;
+
+    // Nodes before the first dirty node can't have changed, and a node needs
+    // updating if it or its parent is dirty (parents come first so they have
+    // already been updated)
+    unsigned int count = 0;
+    for (unsigned int i = firstDirty; i < n; i++)
+    {
+        int parent = parents[i];
+        if (!dirty[i] && (parent == noParent || !dirty[parent]))
+            continue;
+
+        // Calculate the local matrix translate * rotate * scale directly
+        glm::mat4 local = rotations[i].matrix();
+        local[0] *= scales[i].x;
+        local[1] *= scales[i].y;
+        local[2] *= scales[i].z;
+        local[3]  = glm::vec4(positions[i], 1.0f);
+
+        worlds[i] = parent == noParent ? local : worlds[parent] * local;
+        dirty[i]  = 1;
+        count++;
+    }
+
+    std::fill(dirty.begin() + firstDirty, dirty.end(), 0);
+    firstDirty = n;
+    return count;
+}
+
+void TransformHierarchy::sortByDepth()
+{
+    unsigned int n = size();
+
+    // Calculate the depth of each node from its parents
+    for (unsigned int i = 0; i < n; i++)
+    {
+        unsigned int depth = 0;
+        for (int parent = parents[i]; parent != noParent; parent = parents[parent])
+            depth++;
+        depths[i] = depth;
+    }
+
+    // Order the nodes by depth
+    std::vector<unsigned int> order(n);
+    for (unsigned int i = 0; i < n; i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [this](unsigned int a, unsigned int b) { return depths[a] < depths[b]; });
+
+    std::vector<unsigned int> newIndex(n);
+    for (unsigned int i = 0; i < n; i++)
+        newIndex[order[i]] = i;
+
+    // Move the node data into the new order
+    std::vector<int> newParents(n);
+    std::vector<unsigned int> newDepths(n), newHandles(n);
+    std::vector<glm::vec3> newPositions(n), newScales(n);
+    std::vector<Quaternion> newRotations(n);
+    for (unsigned int i = 0; i < n; i++)
+    {
+        unsigned int old = order[i];
+        newParents[i]   = parents[old] == noParent ? noParent
+                                                   : static_cast<int>(newIndex[parents[old]]);
+        newDepths[i]    = depths[old];
+        newHandles[i]   = handles[old];
+        newPositions[i] = positions[old];
+        newScales[i]    = scales[old];
+        newRotations[i] = rotations[old];
+        indices[handles[old]] = i;
+    }
+    parents.swap(newParents);
+    depths.swap(newDepths);
+    handles.swap(newHandles);
+    positions.swap(newPositions);
+    scales.swap(newScales);
+    rotations.swap(newRotations);
+
+    // Every world matrix is recalculated
+    std::fill(dirty.begin(), dirty.end(), 1);
+    firstDirty = 0;
+    needsSort  = false;
+}
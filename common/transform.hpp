@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+
+#include <common/maths.hpp>
+
+// TransformHierarchy class. A scene graph of transform nodes, each with a
+// parent (or none), a local translation, rotation and scale and a cached
+// world matrix. Changing a node's local transform marks it dirty and
+// update() recalculates the world matrices of dirty nodes and their
+// descendants only. Nodes are kept in flat arrays sorted by depth, so
+// parents always come before their children and the update is a single
+// linear pass. When nothing has changed update() does no work at all.
+//
+//     TransformHierarchy transforms;
+//     unsigned int body  = transforms.add(glm::vec3(0.0f, 1.0f, 0.0f));
+//     unsigned int wheel = transforms.add(glm::vec3(1.0f, 0.0f, 0.0f),
+//                                         glm::vec3(0.0f, 0.0f, 1.0f),
+//                                         0.0f, glm::vec3(1.0f), body);
+//     transforms.setRotation(wheel, angle, glm::vec3(0.0f, 0.0f, 1.0f));
+//     transforms.update();
+//     glm::mat4 model = transforms.world(wheel);
+class TransformHierarchy
+{
+public:
+    static const int noParent = -1;
+
+    // Add a node and return its handle
+    unsigned int add(const glm::vec3 position,
+                     const glm::vec3 axis  = glm::vec3(0.0f, 1.0f, 0.0f),
+                     const float angle     = 0.0f,
+                     const glm::vec3 scale = glm::vec3(1.0f),
+                     const int parent      = noParent);
+
+    // Change a node's local transform or parent
+    void setPosition(const unsigned int node, const glm::vec3 position);
+    void setRotation(const unsigned int node, const float angle, const glm::vec3 axis);
+    void setRotation(const unsigned int node, const Quaternion &rotation);
+    void setScale(const unsigned int node, const glm::vec3 scale);
+    void setParent(const unsigned int node, const int parent);
+
+    // Local transform
+    glm::vec3 position(const unsigned int node) const;
+    Quaternion rotation(const unsigned int node) const;
+    glm::vec3 scale(const unsigned int node) const;
+
+    // Recalculate the world matrices of the nodes that have changed and
+    // return the number of matrices calculated
+    unsigned int update();
+
+    // World matrix of a node (as of the last update)
+    const glm::mat4 &world(const unsigned int node) const;
+
+    unsigned int size() const;
+
+private:
+    // Node data in depth order
+    std::vector<int> parents;               // index of the parent or -1
+    std::vector<unsigned int> depths;
+    std::vector<glm::vec3> positions;
+    std::vector<Quaternion> rotations;      // 16 bytes rather than a mat3's 36
+    std::vector<glm::vec3> scales;
+    std::vector<glm::mat4> worlds;
+    std::vector<unsigned char> dirty;
+    std::vector<unsigned int> handles;      // handle of each node
+
+    // Position of each node in the arrays
+    std::vector<unsigned int> indices;
+
+    // Index of the first dirty node (size() when none are dirty)
+    unsigned int firstDirty = 0;
+    bool needsSort = false;
+
+    void markDirty(const unsigned int index);
+    void sortByDepth();
+};
@@ -0,0 +1,576 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include <common/window.hpp>
+#include <common/options.hpp>
+
+#ifdef LABS_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// Fixed time step used for animation when rendering headless
+static const double headlessTimeStep = 1.0 / 60.0;
+
+// Functions called after each frame
+static std::vector<std::function<void()> > frameCallbacks;
+
+// Wall clock time in seconds
+static double wallTime()
+{
+    std::chrono::duration<double> time =
+        std::chrono::steady_clock::now().time_since_epoch();
+    return time.count();
+}
+
+Window::Window(int argc, char *argv[], const char *title,
+               const unsigned int Width, const unsigned int Height)
+{
+    width  = Width;
+    height = Height;
+
+    // Read the headless options
+    Options::parse(argc, argv);
+    headless  = Options::has("headless");
+    frames    = Options::getInt("frames", 300);
+    dumpPath  = Options::get("dump");
+    dumpEvery = std::max(Options::getInt("dump-every", 1), 1);
+    statsPath = Options::get("stats");
+
+    if (!headless)
+    {
+        open = createGLFWContext(title, true);
+    }
+    else
+    {
+        // Try an EGL context first, then a hidden GLFW window
+        useEGL = createEGLContext();
+        open   = useEGL || createGLFWContext(title, false);
+        if (open)
+            open = createFramebuffer();
+        if (open)
+            printf("Rendering %u frames headless (%s): %s\n", frames,
+                   useEGL ? "EGL" : "hidden GLFW window",
+                   glGetString(GL_RENDERER));
+    }
+
+    startTime  = wallTime();
+    frameStart = startTime;
+
+    // Start counting the GL calls and GPU time of the first frame
+    if (headless && open)
+    {
+        GLStats::reset();
+        glQueryCounter(timeQueries[0], GL_TIMESTAMP);
+    }
+}
+
+Window::~Window()
+{
+    close();
+}
+
+bool Window::createGLFWContext(const char *title, const bool visible)
+{
+    // Initialise GLFW
+    if( !glfwInit() )
+    {
+        fprintf( stderr, "Failed to initialize GLFW\n" );
+        return false;
+    }
+
+    glfwWindowHint(GLFW_SAMPLES, 4);
+    glfwWindowHint(GLFW_RESIZABLE,GL_FALSE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GL_TRUE : GL_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    // Open a window and create its OpenGL context
+    window = glfwCreateWindow(width, height, title, NULL, NULL);
+    if( window == NULL ){
+        fprintf(stderr, "Failed to open GLFW window.\n");
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(window);
+
+    // Initialize GLEW
+    glewExperimental = true; // Needed for core profile
+    if (glewInit() != GLEW_OK) {
+        fprintf(stderr, "Failed to initialize GLEW\n");
+        glfwTerminate();
+        window = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+bool Window::createEGLContext()
+{
+#ifdef LABS_USE_EGL
+    // Use a surfaceless display if available as it doesn't need an X server
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLint major, minor;
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+    if (getPlatformDisplay != NULL && extensions != NULL &&
+        strstr(extensions, "EGL_MESA_platform_surfaceless") != NULL)
+    {
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                     EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY && !eglInitialize(display, &major, &minor))
+            display = EGL_NO_DISPLAY;
+    }
+#endif
+
+    if (display == EGL_NO_DISPLAY)
+    {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+            return false;
+    }
+
+    // Choose a configuration, with a pbuffer if possible
+    EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &numConfigs) ||
+        numConfigs == 0)
+    {
+        configAttributes[1] = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &numConfigs) ||
+            numConfigs == 0)
+        {
+            eglTerminate(display);
+            return false;
+        }
+    }
+
+    // Create an OpenGL 3.3 core profile context
+    eglBindAPI(EGL_OPENGL_API);
+    EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+                                          contextAttributes);
+    if (context == EGL_NO_CONTEXT)
+    {
+        eglTerminate(display);
+        return false;
+    }
+
+    // Rendering goes to a framebuffer object so the pbuffer can be tiny, and
+    // without one the context is made current with no surface at all
+    EGLint surfaceAttributes[] = { EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE };
+    EGLSurface surface = EGL_NO_SURFACE;
+    if (configAttributes[1] == EGL_PBUFFER_BIT)
+        surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+
+    if (!eglMakeCurrent(display, surface, surface, context))
+    {
+        eglDestroyContext(display, context);
+        eglTerminate(display);
+        return false;
+    }
+
+    // Initialize GLEW (the GLX part of GLEW fails without an X display,
+    // which doesn't matter here)
+    glewExperimental = true;
+    GLenum result = glewInit();
+    if (result != GLEW_OK && result != GLEW_ERROR_GLX_VERSION_11_ONLY)
+    {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+        eglTerminate(display);
+        return false;
+    }
+
+    eglDisplay = display;
+    eglSurface = surface;
+    eglContext = context;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Window::createFramebuffer()
+{
+    // Colour buffer
+    glGenRenderbuffers(1, &colourBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colourBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    // Depth buffer
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+    // Framebuffer object that replaces the default framebuffer
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, colourBuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depthBuffer);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "Failed to create the offscreen framebuffer.\n");
+        return false;
+    }
+
+    glViewport(0, 0, width, height);
+
+    // Queries for the GPU time of each frame
+    glGenQueries(2, timeQueries);
+    return true;
+}
+
+bool Window::isOpen()
+{
+    return open;
+}
+
+bool Window::shouldClose()
+{
+    if (headless)
+        return frameCount >= frames;
+
+    return glfwWindowShouldClose(window);
+}
+
+void Window::swapBuffers()
+{
+    if (headless)
+    {
+        // Wait for the frame to finish so the frame time includes GPU work
+        glQueryCounter(timeQueries[1], GL_TIMESTAMP);
+        glFinish();
+
+        // The GPU has finished so the timestamps can be read straight away
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(timeQueries[0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(timeQueries[1], GL_QUERY_RESULT, &end);
+        gpuTimes.push_back(end > start ? (end - start) / 1.0e6 : 0.0);
+        frameCalls.push_back(GLStats::reset());
+
+        if (!dumpPath.empty() && frameCount % dumpEvery == 0)
+            dumpFrame();
+        glQueryCounter(timeQueries[0], GL_TIMESTAMP);
+    }
+    else
+    {
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+    }
+
+    // Work between frames counts towards the frame time
+    for (const std::function<void()> &callback : frameCallbacks)
+        callback();
+
+    double time = wallTime();
+    frameTimes.push_back(1000.0 * (time - frameStart));
+    frameStart = time;
+    frameCount++;
+}
+
+void Window::addFrameCallback(const std::function<void()> &callback)
+{
+    frameCallbacks.push_back(callback);
+}
+
+void Window::setFrames(const unsigned int Frames)
+{
+    frames = Frames;
+}
+
+double Window::getTime()
+{
+    // Headless animation uses a fixed time step so runs are repeatable
+    if (headless)
+        return frameCount * headlessTimeStep;
+
+    return glfwGetTime();
+}
+
+void Window::dumpFrame()
+{
+    // Read the frame and flip it so the first row is the top of the image
+    std::vector<unsigned char> pixels(4 * width * height);
+    std::vector<unsigned char> flipped(4 * width * height);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    for (unsigned int y = 0; y < height; y++)
+        memcpy(&flipped[4 * width * y], &pixels[4 * width * (height - 1 - y)],
+               4 * width);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/frame_%04u.png", dumpPath.c_str(),
+             frameCount);
+    if (!writePNG(path, &flipped[0], width, height, 4))
+        printf("Failed to write %s\n", path);
+}
+
+// Return the p-th percentile of a sorted set of samples
+static double percentile(const std::vector<double> &sorted, const double p)
+{
+    return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5)];
+}
+
+// Mean GL calls per frame (draw, uniform, other and total), leaving out the
+// first frame as it also counts the calls made setting up the lab
+static void meanCalls(const std::vector<GLStats::Counts> &frameCalls, double calls[4])
+{
+    size_t first = frameCalls.size() > 1 ? 1 : 0;
+    double n = static_cast<double>(std::max(frameCalls.size() - first, size_t(1)));
+    calls[0] = calls[1] = calls[2] = calls[3] = 0.0;
+    for (size_t i = first; i < frameCalls.size(); i++)
+    {
+        calls[0] += frameCalls[i].draws / n;
+        calls[1] += frameCalls[i].uniforms / n;
+        calls[2] += frameCalls[i].others / n;
+        calls[3] += frameCalls[i].total() / n;
+    }
+}
+
+void Window::printReport()
+{
+    if (frameTimes.empty())
+        return;
+
+    std::vector<double> sorted(frameTimes);
+    std::sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (unsigned int i = 0; i < sorted.size(); i++)
+        total += sorted[i];
+
+    printf("\nFrames: %u, total %.1f ms (%.1f fps)\n",
+           static_cast<unsigned int>(sorted.size()), total,
+           1000.0 * sorted.size() / total);
+    printf("Frame time (ms): mean %.3f, min %.3f, p50 %.3f, p95 %.3f, "
+           "p99 %.3f, max %.3f\n", total / sorted.size(), sorted.front(),
+           percentile(sorted, 0.50), percentile(sorted, 0.95),
+           percentile(sorted, 0.99), sorted.back());
+
+    if (gpuTimes.empty())
+        return;
+
+    std::vector<double> gpuSorted(gpuTimes);
+    std::sort(gpuSorted.begin(), gpuSorted.end());
+    double gpuTotal = 0.0;
+    for (unsigned int i = 0; i < gpuSorted.size(); i++)
+        gpuTotal += gpuSorted[i];
+    double calls[4];
+    meanCalls(frameCalls, calls);
+
+    printf("GPU time (ms): mean %.3f, p95 %.3f, p99 %.3f\n", gpuTotal / gpuSorted.size(),
+           percentile(gpuSorted, 0.95), percentile(gpuSorted, 0.99));
+    printf("GL calls per frame: %.1f draw, %.1f uniform, %.1f other, %.1f total\n",
+           calls[0], calls[1], calls[2], calls[3]);
+}
+
+bool Window::writeStats(const char *path)
+{
+    if (frameTimes.empty())
+        return false;
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL)
+    {
+        printf("Impossible to open %s for writing.\n", path);
+        return false;
+    }
+
+    // Frame and GPU time statistics, leaving out the first frame (which also
+    // times loading the lab) like the GL calls
+    size_t first = frameTimes.size() > 1 ? 1 : 0;
+    std::vector<double> sorted(frameTimes.begin() + first, frameTimes.end());
+    std::vector<double> gpuSorted(gpuTimes.begin() + first, gpuTimes.end());
+    std::sort(sorted.begin(), sorted.end());
+    std::sort(gpuSorted.begin(), gpuSorted.end());
+    double n = static_cast<double>(sorted.size());
+    double total = 0.0, gpuTotal = 0.0;
+    for (unsigned int i = 0; i < sorted.size(); i++)
+    {
+        total    += sorted[i];
+        gpuTotal += gpuSorted[i];
+    }
+    double calls[4];
+    meanCalls(frameCalls, calls);
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"renderer\": \"%s\",\n", glGetString(GL_RENDERER));
+    fprintf(file, "  \"frames\": %u,\n", static_cast<unsigned int>(frameTimes.size()));
+    fprintf(file, "  \"mean_ms\": %.4f,\n", total / n);
+    fprintf(file, "  \"p50_ms\": %.4f,\n", percentile(sorted, 0.50));
+    fprintf(file, "  \"p95_ms\": %.4f,\n", percentile(sorted, 0.95));
+    fprintf(file, "  \"p99_ms\": %.4f,\n", percentile(sorted, 0.99));
+    fprintf(file, "  \"gpu_mean_ms\": %.4f,\n", gpuTotal / n);
+    fprintf(file, "  \"gpu_p95_ms\": %.4f,\n", percentile(gpuSorted, 0.95));
+    fprintf(file, "  \"draw_calls\": %.2f,\n", calls[0]);
+    fprintf(file, "  \"uniform_calls\": %.2f,\n", calls[1]);
+    fprintf(file, "  \"other_calls\": %.2f,\n", calls[2]);
+    fprintf(file, "  \"gl_calls\": %.2f\n", calls[3]);
+    fprintf(file, "}\n");
+    fclose(file);
+    return true;
+}
+
+void Window::close()
+{
+    if (!open)
+        return;
+
+    if (headless)
+    {
+        printReport();
+        if (!statsPath.empty())
+            writeStats(statsPath.c_str());
+        glDeleteQueries(2, timeQueries);
+        glDeleteFramebuffers(1, &framebuffer);
+        glDeleteRenderbuffers(1, &colourBuffer);
+        glDeleteRenderbuffers(1, &depthBuffer);
+    }
+
+#ifdef LABS_USE_EGL
+    if (useEGL)
+    {
+        EGLDisplay display = (EGLDisplay)eglDisplay;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if ((EGLSurface)eglSurface != EGL_NO_SURFACE)
+            eglDestroySurface(display, (EGLSurface)eglSurface);
+        eglDestroyContext(display, (EGLContext)eglContext);
+        eglTerminate(display);
+    }
+#endif
+
+    // Close OpenGL window and terminate GLFW
+    if (window != NULL)
+        glfwTerminate();
+
+    window = NULL;
+    open   = false;
+}
+
+// =============================================================================
+// PNG output
+
+// CRC-32 of a block of bytes (as used by PNG chunks)
+static unsigned int crc32(const unsigned char *data, const size_t length,
+                          unsigned int crc = 0xffffffffu)
+{
+    static unsigned int table[256];
+    static bool tableReady = false;
+    if (!tableReady)
+    {
+        for (unsigned int n = 0; n < 256; n++)
+        {
+            unsigned int c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        tableReady = true;
+    }
+
+    for (size_t i = 0; i < length; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+static void putBigEndian(std::vector<unsigned char> &out, const unsigned int value)
+{
+    out.push_back((value >> 24) & 0xff);
+    out.push_back((value >> 16) & 0xff);
+    out.push_back((value >> 8) & 0xff);
+    out.push_back(value & 0xff);
+}
+
+static void writeChunk(FILE *file, const char *type,
+                       const std::vector<unsigned char> &data)
+{
+    std::vector<unsigned char> chunk;
+    putBigEndian(chunk, static_cast<unsigned int>(data.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    unsigned int crc = crc32(&chunk[4], chunk.size() - 4) ^ 0xffffffffu;
+    putBigEndian(chunk, crc);
+    fwrite(&chunk[0], 1, chunk.size(), file);
+}
+
+bool writePNG(const char *path, const unsigned char *pixels,
+              const unsigned int width, const unsigned int height,
+              const unsigned int channels)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+
+    // Signature
+    const unsigned char signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    fwrite(signature, 1, 8, file);
+
+    // Header: size, 8 bits per channel, RGB or RGBA
+    std::vector<unsigned char> header;
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    header.push_back(8);
+    header.push_back(channels == 4 ? 6 : 2);
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+    writeChunk(file, "IHDR", header);
+
+    // Rows prefixed with filter type 0 (none)
+    size_t rowSize = static_cast<size_t>(width) * channels;
+    std::vector<unsigned char> raw;
+    raw.reserve((rowSize + 1) * height);
+    for (unsigned int y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels + y * rowSize, pixels + (y + 1) * rowSize);
+    }
+
+    // zlib stream using uncompressed deflate blocks, which keeps the writer
+    // small and fast at the cost of file size
+    std::vector<unsigned char> data;
+    data.push_back(0x78);
+    data.push_back(0x01);
+    unsigned int a = 1, b = 0;
+    for (size_t i = 0; i < raw.size(); i += 65535)
+    {
+        size_t length = std::min<size_t>(65535, raw.size() - i);
+        data.push_back(i + length == raw.size() ? 1 : 0);
+        data.push_back(length & 0xff);
+        data.push_back((length >> 8) & 0xff);
+        data.push_back(~length & 0xff);
+        data.push_back((~length >> 8) & 0xff);
+        data.insert(data.end(), raw.begin() + i, raw.begin() + i + length);
+        for (size_t j = i; j < i + length; j++)
+        {
+            a = (a + raw[j]) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    putBigEndian(data, (b << 16) | a);
+    writeChunk(file, "IDAT", data);
+
+    writeChunk(file, "IEND", std::vector<unsigned char>());
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <functional>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <common/glstats.hpp>
+
+// Window class. Opens a GLFW window and creates its OpenGL context, or when
+// run with --headless (or LABS_HEADLESS=1) creates an offscreen context and
+// renders a fixed number of frames into a framebuffer object. Headless
+// contexts use EGL (surfaceless or pbuffer, e.g. Mesa llvmpipe on machines
+// without a display or GPU) and fall back to a hidden GLFW window.
+//
+// Headless options:
+//     --frames N      number of frames to render (default 300)
+//     --dump DIR      write every frame to DIR/frame_NNNN.png
+//     --dump-every N  only write every Nth frame
+//     --stats FILE    write the frame time, GPU time and GL call statistics
+//                     to FILE as JSON
+class Window
+{
+public:
+    GLFWwindow *window = NULL;      // NULL when using an EGL context
+    unsigned int width;
+    unsigned int height;
+    bool headless = false;
+
+    // Constructor
+    Window(int argc, char *argv[], const char *title,
+           const unsigned int width = 1024, const unsigned int height = 768);
+    ~Window();
+
+    // Methods
+    bool isOpen();
+    bool shouldClose();
+    void swapBuffers();
+    double getTime();
+    void close();
+    void setFrames(const unsigned int frames);
+
+    // Call a function after each frame is swapped (e.g. Textures::stream)
+    static void addFrameCallback(const std::function<void()> &callback);
+
+    // Frame times (in milliseconds) of the frames rendered so far
+    std::vector<double> frameTimes;
+
+    // GPU time (in milliseconds, from timestamp queries) and GL calls of each
+    // frame rendered headless. Software renderers such as llvmpipe draw when
+    // the frame is finished, so their GPU times leave most of the work out.
+    std::vector<double> gpuTimes;
+    std::vector<GLStats::Counts> frameCalls;
+
+private:
+    bool open = false;
+    bool useEGL = false;
+    unsigned int frames = 0;
+    unsigned int frameCount = 0;
+    std::string dumpPath;
+    unsigned int dumpEvery = 1;
+    std::string statsPath;
+    double startTime = 0.0;
+    double frameStart = 0.0;
+
+    // Offscreen framebuffer
+    unsigned int framebuffer = 0;
+    unsigned int colourBuffer = 0;
+    unsigned int depthBuffer = 0;
+
+    // Timestamp queries at the start and end of the frame
+    unsigned int timeQueries[2] = { 0, 0 };
+
+    // EGL handles (stored as pointers so EGL headers are not needed here)
+    void *eglDisplay = NULL;
+    void *eglSurface = NULL;
+    void *eglContext = NULL;
+
+    // Context creation
+    bool createGLFWContext(const char *title, const bool visible);
+    bool createEGLContext();
+    bool createFramebuffer();
+
+    // Headless frame output
+    void dumpFrame();
+    void printReport();
+    bool writeStats(const char *path);
+};
+
+// Write an 8-bit RGB or RGBA image to a PNG file
+bool writePNG(const char *path, const unsigned char *pixels,
+              const unsigned int width, const unsigned int height,
+              const unsigned int channels);